@@ -0,0 +1,323 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Servers under test and blocking clients shared by sockets-bench and load-gen.
+//
+// Clients work in rounds: a round writes one message, or one batch of pipelined
+// requests, to every connection and then reads all the replies, so that the server
+// has as many requests in flight as there are connections. The latency of a
+// request counts from the start of its round until its reply is read.
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "sockets.hpp"
+
+namespace bench
+{
+    using namespace SOCKETSHPP_NS::http::server;
+    using SOCKETSHPP_NS::net::common::SocketServer;
+    using SOCKETSHPP_NS::net::utils::LatencyHistogram;
+
+    using Clock = std::chrono::steady_clock;
+
+    static inline uint64_t elapsedNs(Clock::time_point start)
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+        return static_cast<uint64_t>(elapsed.count());
+    }
+
+    static inline std::string tempPath(char const* name)
+    {
+        char const* dir = std::getenv("TMPDIR");
+        return std::string((dir != nullptr) ? dir : "/tmp") + "/" + name;
+    }
+
+    /// <summary>
+    /// Echo server on an ephemeral port or a Unix domain socket.
+    /// </summary>
+    struct EchoServer
+    {
+        SocketServer server;
+
+        EchoServer(SocketAddr addr, SocketParams params, size_t numWorkers) : server(addr, params, 10, numWorkers)
+        {
+            server.onRequest = [](SocketServer::Connection& conn) {
+                conn.response_buffer.append(conn.request_data.data(), conn.request_data.size());
+                conn.state.insert(SocketServer::Connection::Responding);
+            };
+            server.Start();
+        }
+
+        ~EchoServer() { server.Stop(); }
+
+        SocketAddr const& address() const { return server.address(); }
+    };
+
+    /// <summary>
+    /// HTTP server with a small "/hello" response, serving other paths as files
+    /// relative to the working directory.
+    /// </summary>
+    class BenchHttpServer : public HttpFileServer
+    {
+    public:
+        HttpRequestCallback hello{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "Hello, world!";
+            return 200;
+        } };
+
+        explicit BenchHttpServer(size_t numWorkers) : HttpFileServer("127.0.0.1", 0)
+        {
+            // Reactor #0 accepts, connections are spread over the others
+            m_reactors.resize(numWorkers);
+            (*this)["/hello"] = hello;
+            InitializeFileEndpoint(*this);
+            start();
+        }
+
+        ~BenchHttpServer() { stop(); }
+
+        SocketAddr address()
+        {
+            SocketAddr addr;
+            m_listeningSockets.front().getsockname(addr);
+            return SocketAddr(SocketAddr::Loopback, addr.port());
+        }
+    };
+
+    /// <summary>
+    /// File of the given size in the working directory, removed with the object.
+    /// </summary>
+    struct BenchFile
+    {
+        std::string name;
+
+        BenchFile(char const* fileName, size_t size) : name(fileName)
+        {
+            std::string block(64 * 1024, 0);
+            for (size_t i = 0; i < block.size(); i++)
+            {
+                block[i] = static_cast<char>('a' + i % 26);
+            }
+            FILE* file = fopen(name.c_str(), "wb");
+            for (size_t written = 0; (file != nullptr) && (written < size); written += block.size())
+            {
+                fwrite(block.data(), 1, std::min(block.size(), size - written), file);
+            }
+            if (file != nullptr)
+            {
+                fclose(file);
+            }
+        }
+
+        ~BenchFile() { std::remove(name.c_str()); }
+    };
+
+    /// <summary>
+    /// Connected client sockets, closed with the object.
+    /// </summary>
+    struct Clients
+    {
+        std::vector<Socket> sockets;
+        std::vector<std::string> buffers;  // Received past the last reply, per socket
+
+        Clients(SocketAddr const& addr, SocketParams params, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                Socket socket(params);
+                if (!socket.connect(addr))
+                {
+                    socket.close();
+                    break;
+                }
+                if (params.type == SOCK_STREAM)
+                {
+                    socket.setNoDelay();
+                }
+                else
+                {
+                    // Lost datagrams fail the round instead of blocking it
+                    timeval timeout{ 1, 0 };
+                    ::setsockopt(socket.m_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                }
+                sockets.push_back(socket);
+            }
+            buffers.resize(sockets.size());
+        }
+
+        ~Clients()
+        {
+            for (auto& socket : sockets)
+            {
+                socket.close();
+            }
+        }
+
+        bool connected(size_t count) const { return sockets.size() == count; }
+    };
+
+    /// <summary>
+    /// Send the message on every connection, then read the echo of each.
+    /// </summary>
+    static inline bool echoRound(Clients& clients, std::string const& message, LatencyHistogram& latency)
+    {
+        auto start = Clock::now();
+        for (auto& socket : clients.sockets)
+        {
+            if (socket.writeall(message) != message.size())
+            {
+                return false;
+            }
+        }
+        std::string reply(message.size(), 0);
+        for (auto& socket : clients.sockets)
+        {
+            if (socket.readall(reply) != message.size())
+            {
+                return false;
+            }
+            latency.record(elapsedNs(start));
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Send one datagram from every socket, then receive the echo of each.
+    /// </summary>
+    static inline bool datagramRound(Clients& clients, std::string const& message, LatencyHistogram& latency)
+    {
+        auto start = Clock::now();
+        for (auto& socket : clients.sockets)
+        {
+            if (socket.send(message.data(), message.size()) != static_cast<int>(message.size()))
+            {
+                return false;
+            }
+        }
+        std::string reply(message.size() + 1, 0);
+        for (auto& socket : clients.sockets)
+        {
+            if (socket.recv(&reply[0], reply.size()) != static_cast<int>(message.size()))
+            {
+                return false;
+            }
+            latency.record(elapsedNs(start));
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Read one response with Content-Length and drop it.
+    /// </summary>
+    /// <param name="buffer">Received past the previous response, keeps what follows this one</param>
+    /// <returns>Body size, -1 if the connection failed</returns>
+    static inline int64_t readHttpResponse(Socket& socket, std::string& buffer)
+    {
+        char chunk[65536];
+        size_t total = std::string::npos;
+        size_t bodySize = 0;
+        for (;;)
+        {
+            if (total == std::string::npos)
+            {
+                size_t headEnd = buffer.find("\r\n\r\n");
+                if (headEnd != std::string::npos)
+                {
+                    size_t length = buffer.find("Content-Length: ");
+                    if ((length == std::string::npos) || (length > headEnd))
+                    {
+                        return -1;
+                    }
+                    bodySize = static_cast<size_t>(std::strtoull(buffer.c_str() + length + 16, nullptr, 10));
+                    total = headEnd + 4 + bodySize;
+                }
+            }
+            if (buffer.size() >= total)
+            {
+                buffer.erase(0, total);
+                return static_cast<int64_t>(bodySize);
+            }
+            // Large bodies are consumed as they arrive, only the head is kept
+            if ((total != std::string::npos) && (buffer.size() > sizeof(chunk)))
+            {
+                size_t drop = buffer.size() - sizeof(chunk);
+                buffer.erase(0, drop);
+                total -= drop;
+            }
+            int received = socket.recv(chunk, sizeof(chunk));
+            if (received <= 0)
+            {
+                return -1;
+            }
+            buffer.append(chunk, static_cast<size_t>(received));
+        }
+    }
+
+    /// <summary>
+    /// Send the pipelined requests on every connection, then read all the responses of each.
+    /// </summary>
+    /// <param name="requests">One or more requests</param>
+    /// <param name="depth">Number of requests in the batch</param>
+    /// <returns>Body bytes received, -1 if a connection failed</returns>
+    static inline int64_t httpRound(Clients& clients, std::string const& requests, size_t depth,
+        LatencyHistogram& latency)
+    {
+        auto start = Clock::now();
+        for (auto& socket : clients.sockets)
+        {
+            if (socket.writeall(requests) != requests.size())
+            {
+                return -1;
+            }
+        }
+        int64_t received = 0;
+        for (size_t i = 0; i < clients.sockets.size(); i++)
+        {
+            for (size_t j = 0; j < depth; j++)
+            {
+                int64_t body = readHttpResponse(clients.sockets[i], clients.buffers[i]);
+                if (body < 0)
+                {
+                    return -1;
+                }
+                received += body;
+                latency.record(elapsedNs(start));
+            }
+        }
+        return received;
+    }
+
+    static inline std::string httpGet(std::string const& path, size_t depth = 1)
+    {
+        std::string requests;
+        for (size_t i = 0; i < depth; i++)
+        {
+            requests += "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        }
+        return requests;
+    }
+
+    /// <summary>
+    /// Request head with the given number of headers, each with a value of the given size.
+    /// </summary>
+    static inline std::string requestHead(size_t numHeaders, size_t valueSize)
+    {
+        std::string head = "GET /index.html?query=value HTTP/1.1\r\nHost: localhost\r\n";
+        for (size_t i = 0; i < numHeaders; i++)
+        {
+            head += "X-Header-" + std::to_string(i) + ": " + std::string(valueSize, 'v') + "\r\n";
+        }
+        return head + "\r\n";
+    }
+
+}  // namespace bench
@@ -0,0 +1,225 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Load generator: drives a server with many connections from several threads for a
+// fixed time and reports the request rate, the throughput and latency percentiles.
+// Without --target it starts the server under test in the same process.
+//
+// Usage: load-gen <tcp|unix|udp|http|pipeline|file> [options]
+//   --connections N   Connections, spread over the threads (default 64)
+//   --threads N       Client threads (default 4)
+//   --workers N       Reactor threads of the in-process server (default 2)
+//   --seconds N       Duration (default 5)
+//   --size N          Message size of echo modes, file size of file mode (default 64, 16 MiB)
+//   --depth N         Pipelined requests per connection and round (default 16)
+//   --target ADDR     Server to load, host:port or Unix domain socket path
+//   --path PATH       Request path of HTTP modes against --target (default /hello)
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "bench_utils.h"
+
+using namespace bench;
+
+struct Options
+{
+    std::string mode;
+    size_t connections{ 64 };
+    size_t threads{ 4 };
+    size_t workers{ 2 };
+    size_t seconds{ 5 };
+    size_t size{ 0 };
+    size_t depth{ 16 };
+    std::string target;
+    std::string path{ "/hello" };
+};
+
+struct Totals
+{
+    std::mutex mutex;
+    LatencyHistogram latency;
+    uint64_t requests{ 0 };
+    uint64_t bytes{ 0 };
+    size_t failed{ 0 };  // Threads that lost a connection
+};
+
+static int usage()
+{
+    printf("Usage: load-gen <tcp|unix|udp|http|pipeline|file> [--connections N] [--threads N] [--workers N]\n"
+           "                [--seconds N] [--size N] [--depth N] [--target ADDR] [--path PATH]\n");
+    return 1;
+}
+
+static bool parseOptions(int argc, const char* argv[], Options& options)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+    options.mode = argv[1];
+    std::map<std::string, size_t*> numbers = { { "--connections", &options.connections },
+        { "--threads", &options.threads }, { "--workers", &options.workers }, { "--seconds", &options.seconds },
+        { "--size", &options.size }, { "--depth", &options.depth } };
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        auto number = numbers.find(argv[i]);
+        if (number != numbers.end())
+        {
+            *number->second = static_cast<size_t>(atol(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "--target") == 0)
+        {
+            options.target = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--path") == 0)
+        {
+            options.path = argv[i + 1];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (options.size == 0)
+    {
+        options.size = (options.mode == "file") ? 16 * 1024 * 1024 : 64;
+    }
+    if (options.mode != "pipeline")
+    {
+        options.depth = 1;
+    }
+    options.threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+    return (options.connections != 0) && (options.seconds != 0) && (options.depth != 0);
+}
+
+static void runClient(Options const& options, SocketAddr const& addr, SocketParams params, size_t numConnections,
+    Clock::time_point deadline, Totals& totals)
+{
+    Clients clients(addr, params, numConnections);
+    LatencyHistogram latency;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    bool ok = clients.connected(numConnections);
+    bool http = (options.mode == "http") || (options.mode == "pipeline") || (options.mode == "file");
+    std::string message = http ? httpGet(options.path, options.depth) : std::string(options.size, 'x');
+    while (ok && (Clock::now() < deadline))
+    {
+        if (http)
+        {
+            int64_t received = httpRound(clients, message, options.depth, latency);
+            ok = (received >= 0);
+            bytes += ok ? static_cast<uint64_t>(received) : 0;
+        }
+        else
+        {
+            ok = (params.type == SOCK_STREAM) ? echoRound(clients, message, latency)
+                                              : datagramRound(clients, message, latency);
+            bytes += ok ? numConnections * message.size() : 0;
+        }
+        requests += ok ? numConnections * options.depth : 0;
+    }
+    std::lock_guard<std::mutex> lock(totals.mutex);
+    totals.latency.add(latency);
+    totals.requests += requests;
+    totals.bytes += bytes;
+    totals.failed += ok ? 0 : 1;
+}
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        return usage();
+    }
+
+    SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+    if (options.mode == "unix")
+    {
+        params.af = AF_UNIX;
+    }
+    else if (options.mode == "udp")
+    {
+        params.type = SOCK_DGRAM;
+    }
+    else if ((options.mode != "tcp") && (options.mode != "http") && (options.mode != "pipeline") &&
+        (options.mode != "file"))
+    {
+        return usage();
+    }
+
+    // Server under test, unless there is a target
+    std::unique_ptr<EchoServer> echoServer;
+    std::unique_ptr<BenchHttpServer> httpServer;
+    std::unique_ptr<BenchFile> file;
+    std::string socketPath = tempPath("socketshpp_load.sock");
+    SocketAddr addr;
+    if (!options.target.empty())
+    {
+        addr = (params.af == AF_UNIX) ? SocketAddr(options.target.c_str(), true) : SocketAddr(options.target.c_str());
+    }
+    else if (options.mode == "tcp" || options.mode == "udp")
+    {
+        echoServer.reset(new EchoServer(SocketAddr("127.0.0.1:0"), params, options.workers));
+        addr = echoServer->address();
+    }
+    else if (options.mode == "unix")
+    {
+        std::remove(socketPath.c_str());
+        echoServer.reset(new EchoServer(SocketAddr(socketPath.c_str(), true), params, options.workers));
+        addr = echoServer->address();
+    }
+    else
+    {
+        if (options.mode == "file")
+        {
+            file.reset(new BenchFile("socketshpp_load.bin", options.size));
+            options.path = "/" + file->name;
+        }
+        httpServer.reset(new BenchHttpServer(options.workers));
+        addr = httpServer->address();
+    }
+
+    printf("%s: %zu connections, %zu threads, %zu seconds, size=%zu, depth=%zu, target=%s\n", options.mode.c_str(),
+        options.connections, options.threads, options.seconds, options.size, options.depth,
+        options.target.empty() ? "in-process" : options.target.c_str());
+    Totals totals;
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::seconds(options.seconds);
+    for (size_t i = 0; i < options.threads; i++)
+    {
+        size_t numConnections =
+            options.connections / options.threads + ((i < options.connections % options.threads) ? 1 : 0);
+        threads.emplace_back(
+            [&, numConnections]() { runClient(options, addr, params, numConnections, deadline, totals); });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    httpServer.reset();
+    echoServer.reset();
+    if (options.mode == "unix")
+    {
+        std::remove(socketPath.c_str());
+    }
+
+    LatencyHistogram const& latency = totals.latency;
+    printf("requests: %llu, %.0f/s, %.1f MiB/s\n", static_cast<unsigned long long>(totals.requests),
+        totals.requests / seconds, totals.bytes / seconds / (1024 * 1024));
+    printf("latency us: p50=%.1f p99=%.1f p999=%.1f max=%.1f\n", latency.percentile(0.5) / 1e3,
+        latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3, latency.max() / 1e3);
+    if (totals.failed != 0)
+    {
+        printf("failed: %zu of %zu threads lost a connection\n", totals.failed, options.threads);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Reactor bookkeeping benchmark: cost of addSocket, event dispatch and removeSocket
+// while the reactor holds a varying number of idle sockets.
+//
+// Usage: reactor-bench [numIdle ...]     (default: 1000 10000 50000)
+//
+// The number of idle sockets is capped by RLIMIT_NOFILE.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "sockets.hpp"
+
+using namespace SOCKETSHPP_NS::net::utils;
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t kActivePairs = 64;
+static const size_t kRounds = 2000;
+
+struct CountingCallback : public Reactor::SocketCallback
+{
+    std::atomic<size_t> events{ 0 };
+
+    virtual void onSocketReadable(Socket sock) override
+    {
+        char buffer[64];
+        sock.recv(buffer, sizeof(buffer));
+        events++;
+    }
+
+    virtual void onSocketWritable(Socket) override {}
+
+    virtual void onSocketAcceptable(Socket) override {}
+
+    virtual void onSocketClosed(Socket) override {}
+};
+
+static double nsPerOp(Clock::duration elapsed, size_t count)
+{
+    return (count == 0) ? 0.0 : std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+static size_t raiseFileLimit()
+{
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return static_cast<size_t>(limit.rlim_cur);
+}
+
+static void runIdleSockets(size_t numIdle)
+{
+    CountingCallback callback;
+    Reactor reactor(callback);
+
+    std::vector<Socket> idle;
+    idle.reserve(numIdle);
+    auto start = Clock::now();
+    for (size_t i = 0; i < numIdle; i++)
+    {
+        Socket socket(AF_INET, SOCK_DGRAM, 0);
+        if (socket.invalid())
+        {
+            break;
+        }
+        idle.push_back(socket);
+        reactor.addSocket(socket, Reactor::Readable | Reactor::Closed);
+    }
+    auto addTime = Clock::now() - start;
+
+    // Active socket pairs are registered last, like the most recent connections.
+    std::vector<Socket> writers;
+    std::vector<Socket> readers;
+    for (size_t i = 0; i < kActivePairs; i++)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            printf("socketpair failed, errno=%d\n", errno);
+            return;
+        }
+        readers.push_back(Socket(fds[0]));
+        writers.push_back(Socket(fds[1]));
+        reactor.addSocket(readers.back(), Reactor::Readable | Reactor::Closed);
+    }
+
+    reactor.start();
+    start = Clock::now();
+    for (size_t round = 1; round <= kRounds; round++)
+    {
+        for (auto& writer : writers)
+        {
+            writer.send("x", 1);
+        }
+        while (callback.events < round * kActivePairs)
+        {
+            std::this_thread::yield();
+        }
+    }
+    auto dispatchTime = Clock::now() - start;
+
+    start = Clock::now();
+    for (auto& socket : idle)
+    {
+        reactor.removeSocket(socket);
+    }
+    auto removeTime = Clock::now() - start;
+
+    reactor.stop();
+    for (auto& socket : idle)
+    {
+        socket.close();
+    }
+    for (size_t i = 0; i < kActivePairs; i++)
+    {
+        writers[i].close();
+        readers[i].close();
+    }
+
+    printf("%10zu %14.1f %18.1f %14.1f%s\n", idle.size(), nsPerOp(addTime, idle.size()),
+        nsPerOp(dispatchTime, kRounds * kActivePairs), nsPerOp(removeTime, idle.size()),
+        (idle.size() < numIdle) ? "  (capped by RLIMIT_NOFILE)" : "");
+}
+
+int main(int argc, const char* argv[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+    {
+        sizes.push_back(static_cast<size_t>(atol(argv[i])));
+    }
+    if (sizes.empty())
+    {
+        sizes = { 1000, 10000, 50000 };
+    }
+
+    size_t maxFiles = raiseFileLimit();
+    printf("RLIMIT_NOFILE=%zu, active pairs=%zu, rounds=%zu\n", maxFiles, kActivePairs, kRounds);
+    printf("%10s %14s %18s %14s\n", "idle", "add ns/op", "dispatch ns/event", "remove ns/op");
+    for (size_t numIdle : sizes)
+    {
+        size_t reserved = 2 * kActivePairs + 64;
+        runIdleSockets((maxFiles > numIdle + reserved) ? numIdle : maxFiles - reserved);
+    }
+    return 0;
+}
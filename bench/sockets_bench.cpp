@@ -0,0 +1,142 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Google Benchmark suite of the server hot paths: TCP, Unix domain and UDP echo,
+// HTTP keep-alive and pipelined GET, request head parsing and file transfer, at
+// varying numbers of connections. Every benchmark reports the request latency
+// percentiles p50_us, p99_us and p999_us next to the rates.
+//
+// Usage: sockets-bench [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>]
+
+#include <benchmark/benchmark.h>
+
+#include "bench_utils.h"
+
+using namespace bench;
+
+static const size_t kNumWorkers = 2;
+
+static void reportLatency(benchmark::State& state, LatencyHistogram const& latency)
+{
+    state.counters["p50_us"] = static_cast<double>(latency.percentile(0.5)) / 1e3;
+    state.counters["p99_us"] = static_cast<double>(latency.percentile(0.99)) / 1e3;
+    state.counters["p999_us"] = static_cast<double>(latency.percentile(0.999)) / 1e3;
+}
+
+static void runEcho(benchmark::State& state, SocketAddr const& addr, SocketParams params)
+{
+    size_t numConnections = static_cast<size_t>(state.range(0));
+    std::string message(static_cast<size_t>(state.range(1)), 'x');
+    EchoServer server(addr, params, kNumWorkers);
+    Clients clients(server.address(), params, numConnections);
+    if (!clients.connected(numConnections))
+    {
+        state.SkipWithError("connect failed");
+        return;
+    }
+    LatencyHistogram latency;
+    for (auto _ : state)
+    {
+        bool echoed = (params.type == SOCK_STREAM) ? echoRound(clients, message, latency)
+                                                   : datagramRound(clients, message, latency);
+        if (!echoed)
+        {
+            state.SkipWithError("echo failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * numConnections));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * numConnections * message.size()));
+    reportLatency(state, latency);
+}
+
+static void BM_TcpEcho(benchmark::State& state)
+{
+    runEcho(state, SocketAddr("127.0.0.1:0"), SocketParams{ AF_INET, SOCK_STREAM, 0 });
+}
+BENCHMARK(BM_TcpEcho)->ArgsProduct({ { 1, 8, 64 }, { 64, 16384 } })->UseRealTime();
+
+static void BM_UnixEcho(benchmark::State& state)
+{
+    std::string path = tempPath("socketshpp_bench.sock");
+    std::remove(path.c_str());
+    runEcho(state, SocketAddr(path.c_str(), true), SocketParams{ AF_UNIX, SOCK_STREAM, 0 });
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_UnixEcho)->ArgsProduct({ { 1, 8, 64 }, { 64, 16384 } })->UseRealTime();
+
+static void BM_UdpEcho(benchmark::State& state)
+{
+    runEcho(state, SocketAddr("127.0.0.1:0"), SocketParams{ AF_INET, SOCK_DGRAM, 0 });
+}
+BENCHMARK(BM_UdpEcho)->ArgsProduct({ { 1, 8, 64 }, { 64, 1400 } })->UseRealTime();
+
+static void runHttp(benchmark::State& state, BenchHttpServer& server, std::string const& path, size_t depth)
+{
+    size_t numConnections = static_cast<size_t>(state.range(0));
+    Clients clients(server.address(), SocketParams{ AF_INET, SOCK_STREAM, 0 }, numConnections);
+    if (!clients.connected(numConnections))
+    {
+        state.SkipWithError("connect failed");
+        return;
+    }
+    std::string requests = httpGet(path, depth);
+    LatencyHistogram latency;
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        int64_t received = httpRound(clients, requests, depth, latency);
+        if (received < 0)
+        {
+            state.SkipWithError("request failed");
+            break;
+        }
+        bytes += received;
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * numConnections * depth));
+    state.SetBytesProcessed(bytes);
+    reportLatency(state, latency);
+}
+
+static void BM_HttpKeepalive(benchmark::State& state)
+{
+    BenchHttpServer server(kNumWorkers);
+    runHttp(state, server, "/hello", 1);
+}
+BENCHMARK(BM_HttpKeepalive)->Arg(1)->Arg(8)->Arg(64)->UseRealTime();
+
+static void BM_HttpPipelined(benchmark::State& state)
+{
+    BenchHttpServer server(kNumWorkers);
+    runHttp(state, server, "/hello", static_cast<size_t>(state.range(1)));
+}
+BENCHMARK(BM_HttpPipelined)->ArgsProduct({ { 1, 8, 64 }, { 4, 16 } })->UseRealTime();
+
+static void BM_HttpFileTransfer(benchmark::State& state)
+{
+    BenchFile file("socketshpp_bench.bin", static_cast<size_t>(state.range(1)) * 1024 * 1024);
+    BenchHttpServer server(kNumWorkers);
+    runHttp(state, server, "/" + file.name, 1);
+}
+BENCHMARK(BM_HttpFileTransfer)->ArgsProduct({ { 1, 8 }, { 1, 16 } })->UseRealTime();
+
+static void BM_ParseHeaders(benchmark::State& state)
+{
+    std::string head = requestHead(static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)));
+    HttpHeadScanner scanner;
+    HttpRequestHead request;
+    for (auto _ : state)
+    {
+        // What HttpServer does once the head is received: find the line ends, then split
+        scanner.reset();
+        size_t length = scanner.scan(head);
+        bool parsed = request.parse(std::string_view(head.data(), length), scanner.lineEnds());
+        benchmark::DoNotOptimize(parsed);
+        benchmark::DoNotOptimize(request.headers.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * head.size()));
+}
+BENCHMARK(BM_ParseHeaders)->ArgsProduct({ { 4, 16, 64 }, { 16, 256 } });
+
+BENCHMARK_MAIN();
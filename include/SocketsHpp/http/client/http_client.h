@@ -0,0 +1,871 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../common/url_parser.h"
+#include "../server/http_request_parser.h"
+#include "../../net/common/connection_pool.h"
+#include "../../net/common/socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace http
+{
+    namespace client
+    {
+
+        using BufferPool = net::utils::BufferPool;
+        using ConnectionPool = net::utils::ConnectionPool;
+        using HttpChunkedDecoder = http::server::HttpChunkedDecoder;
+        using HttpHeadScanner = http::server::HttpHeadScanner;
+        using HttpRequestHead = http::server::HttpRequestHead;
+        using Reactor = net::utils::Reactor;
+        using Socket = net::utils::Socket;
+        using SocketAddr = net::utils::SocketAddr;
+        using SocketWaiter = net::utils::SocketWaiter;
+        using UrlParser = http::common::UrlParser;
+
+        struct HttpClientRequest
+        {
+            std::string method{ "GET" };
+            std::string url;                             // http://host:port/path?query
+            std::map<std::string, std::string> headers;  // Host and Content-Length are added by the client
+            std::string content;
+        };
+
+        struct HttpClientResponse
+        {
+            int result{ 0 };  // HttpClient::Result
+            int code{ 0 };
+            std::string protocol;
+            std::string reason;
+            std::map<std::string, std::string> headers;
+            std::string content;  // Not filled if the body is streamed
+        };
+
+        /// <summary>
+        /// HTTP/1.1 client on a reactor: requests of many callers are in flight at once on one
+        /// thread, next to the servers of the reactor. Connections are taken from a ConnectionPool
+        /// per host and go back to it once their responses are complete, so that keepalive
+        /// connections are reused. A request goes to an idle connection of its host first, to a
+        /// new one while the host is below its limit, then it is pipelined behind the requests of
+        /// the least busy connection, up to the pipeline depth. Requests that the server closed
+        /// the connection on before answering are sent again once if they are idempotent.
+        ///
+        /// Sockets are awaited with Reactor::addWaiter, the reactor callback is not involved.
+        /// Host names are resolved with getaddrinfo once per host, which blocks on the first
+        /// request. Must be used by the reactor thread, callbacks run on it.
+        /// </summary>
+        class HttpClient
+        {
+        public:
+            enum Result
+            {
+                Ok,
+                ConnectFailed,
+                ConnectionClosed,  // Server closed the connection before the response was complete
+                InvalidResponse,
+                TimedOut,
+                Aborted  // Body callback returned false
+            };
+
+            /// <summary>
+            /// Response complete or failed, see HttpClientResponse::result.
+            /// </summary>
+            using ResponseCallback = std::function<void(HttpClientResponse& response)>;
+
+            /// <summary>
+            /// Piece of a streamed body, in place and only valid during the call, the response head
+            /// is filled. Chunked bodies are handed over without their framing. Returns false to
+            /// abort the response, then its connection is closed.
+            /// </summary>
+            using BodyCallback = std::function<bool(HttpClientResponse const& response, std::string_view data)>;
+
+            static constexpr size_t const DefaultMaxConnectionsPerHost = ConnectionPool::DefaultMaxPerHost;
+            static constexpr size_t const MaxResponseHeadSize = 64 * 1024;
+
+            explicit HttpClient(Reactor& reactor) : m_reactor(reactor), m_pool(reactor) {}
+
+            HttpClient(const HttpClient&) = delete;
+            HttpClient& operator=(const HttpClient&) = delete;
+
+            /// <summary>
+            /// Close connections. Requests still in flight are dropped without a callback.
+            /// </summary>
+            ~HttpClient()
+            {
+                for (auto& entry : m_hosts)
+                {
+                    m_reactor.cancelTimer(entry.second->dispatchTimer);
+                    for (auto& conn : entry.second->connections)
+                    {
+                        m_reactor.cancelTimer(conn->timer);
+                        m_reactor.removeSocket(conn->socket);
+                        m_pool.release(entry.second->address, conn->socket, false);
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Limit connections to every host, including idle ones. Must be set before requests are sent.
+            /// </summary>
+            /// <param name="max">Connections at once, 0 - no limit</param>
+            void setMaxConnectionsPerHost(size_t max)
+            {
+                m_maxPerHost = max;
+                m_pool.setMaxPerHost(max);
+            }
+
+            /// <summary>
+            /// Requests in flight on one connection, 1 - no pipelining (default).
+            /// </summary>
+            void setPipelineDepth(size_t depth) { m_pipelineDepth = std::max<size_t>(depth, 1); }
+
+            /// <summary>
+            /// Close keepalive connections idle for so long, 0 - keep them until the server closes them.
+            /// </summary>
+            void setIdleTimeout(std::chrono::milliseconds timeout) { m_pool.setIdleTimeout(timeout); }
+
+            /// <summary>
+            /// Deadline of new connections, 0 - none.
+            /// </summary>
+            void setConnectTimeout(std::chrono::milliseconds timeout) { m_pool.setConnectTimeout(timeout); }
+
+            /// <summary>
+            /// Close connections that receive nothing for so long while responses are due, and fail
+            /// their requests with TimedOut. 0 - no limit (default).
+            /// </summary>
+            void setResponseTimeout(std::chrono::milliseconds timeout) { m_responseTimeout = timeout; }
+
+            /// <summary>
+            /// Requests sent or queued, which have not completed yet.
+            /// </summary>
+            size_t pending() const { return m_pending; }
+
+            ConnectionPool& pool() { return m_pool; }
+
+            /// <summary>
+            /// Send request. The callback runs once the response is complete or the request failed,
+            /// never before send() returns.
+            /// </summary>
+            /// <param name="onBody">Streams the response body instead of collecting it, optional</param>
+            /// <returns>false if the URL is not a valid http URL or the host can't be resolved,
+            /// then no callback runs</returns>
+            bool send(HttpClientRequest const& request, ResponseCallback onResponse, BodyCallback onBody = nullptr)
+            {
+                UrlParser url(request.url);
+                if (!url.success_ || (url.scheme_ != "http") || url.host_.empty())
+                {
+                    LOG_ERROR("HttpClient: unsupported URL %s", request.url.c_str());
+                    return false;
+                }
+                Host* host = findHost(url.host_, url.port_);
+                if (host == nullptr)
+                {
+                    return false;
+                }
+
+                std::unique_ptr<Exchange> exchange(new Exchange());
+                exchange->head = (request.method == "HEAD");
+                exchange->idempotent = (request.method == "GET") || exchange->head || (request.method == "PUT") ||
+                    (request.method == "DELETE") || (request.method == "OPTIONS") || (request.method == "TRACE");
+                exchange->onResponse = std::move(onResponse);
+                exchange->onBody = std::move(onBody);
+                std::string& wire = exchange->wire;
+                std::string_view query = url.query_;
+                if (!query.empty() && (query[0] == '?'))
+                {
+                    query.remove_prefix(1);
+                }
+                wire.reserve(128 + request.content.size());
+                wire.append(request.method).append(" ").append(url.path_);
+                if (!query.empty())
+                {
+                    wire.append("?").append(query);
+                }
+                wire.append(" HTTP/1.1\r\nHost: ").append(host->name).append("\r\n");
+                for (auto const& header : request.headers)
+                {
+                    wire.append(header.first).append(": ").append(header.second).append("\r\n");
+                }
+                if (!request.content.empty() || (request.method == "POST") || (request.method == "PUT"))
+                {
+                    wire.append("Content-Length: ").append(std::to_string(request.content.size())).append("\r\n");
+                }
+                wire.append("\r\n").append(request.content);
+
+                host->queued.push_back(std::move(exchange));
+                m_pending++;
+                // Callbacks only ever run on later reactor events
+                if (host->dispatchTimer == 0)
+                {
+                    host->dispatchTimer = m_reactor.addTimer(std::chrono::milliseconds(0), [this, host]() {
+                        host->dispatchTimer = 0;
+                        dispatch(*host);
+                    });
+                }
+                return true;
+            }
+
+            bool get(std::string const& url, ResponseCallback onResponse, BodyCallback onBody = nullptr)
+            {
+                HttpClientRequest request;
+                request.url = url;
+                return send(request, std::move(onResponse), std::move(onBody));
+            }
+
+        private:
+            struct Exchange
+            {
+                std::string wire;  // Request as it is sent
+                bool head{ false };
+                bool idempotent{ false };
+                bool retried{ false };
+                bool started{ false };  // Response bytes received
+                ResponseCallback onResponse;
+                BodyCallback onBody;
+                HttpClientResponse response;
+            };
+
+            struct Host;
+
+            struct Connection : public SocketWaiter
+            {
+                enum Phase
+                {
+                    ResponseHead,
+                    LengthBody,
+                    ChunkedBody,
+                    BodyUntilClose
+                };
+
+                HttpClient& client;
+                Host& host;
+                Socket socket;
+                std::deque<std::unique_ptr<Exchange>> inflight;  // Sent or being sent, in order
+                std::string sendBuffer;
+                size_t sendOffset{ 0 };
+                std::string receiveBuffer;
+                HttpHeadScanner headScanner;
+                HttpChunkedDecoder chunkedDecoder;
+                Phase phase{ ResponseHead };
+                uint64_t remaining{ 0 };  // Bytes of the body with Content-Length
+                bool reusable{ true };    // Keepalive, until the server or a failure says otherwise
+                Reactor::TimerId timer{ 0 };
+
+                Connection(HttpClient& client, Host& host, Socket socket) : client(client), host(host), socket(socket)
+                {
+                }
+
+                void onSocketReady(Socket sock, int state) override
+                {
+                    (void)sock;
+                    client.onReady(*this, state);
+                }
+            };
+
+            struct Host
+            {
+                std::string name;  // Host header
+                SocketAddr address;
+                std::deque<std::unique_ptr<Exchange>> queued;
+                std::vector<std::unique_ptr<Connection>> connections;
+                size_t connecting{ 0 };
+                Reactor::TimerId dispatchTimer{ 0 };  // Dispatch of requests sent meanwhile
+            };
+
+            /// <summary>
+            /// Host entry of the name and port, resolved once. Entries are never erased.
+            /// </summary>
+            Host* findHost(std::string const& name, uint16_t port)
+            {
+                std::string key = name + ":" + std::to_string(port);
+                auto it = m_hosts.find(key);
+                if (it != m_hosts.end())
+                {
+                    return it->second.get();
+                }
+                std::unique_ptr<Host> host(new Host());
+                if (!resolve(name, port, host->address))
+                {
+                    LOG_ERROR("HttpClient: can't resolve %s", name.c_str());
+                    return nullptr;
+                }
+                host->name = (port == 80) ? name : key;
+                Host* result = host.get();
+                m_hosts[key] = std::move(host);
+                return result;
+            }
+
+            static bool resolve(std::string const& name, uint16_t port, SocketAddr& addr)
+            {
+                std::string hostName = name;
+                if ((hostName.size() > 2) && (hostName.front() == '[') && (hostName.back() == ']'))
+                {
+                    hostName = hostName.substr(1, hostName.size() - 2);
+                }
+                addrinfo hints = {};
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                addrinfo* list = nullptr;
+                if ((::getaddrinfo(hostName.c_str(), nullptr, &hints, &list) != 0) || (list == nullptr))
+                {
+                    return false;
+                }
+                // IPv4 first: servers often listen on the IPv4 loopback only
+                addrinfo* found = list;
+                for (addrinfo* info = list; info != nullptr; info = info->ai_next)
+                {
+                    if (info->ai_family == AF_INET)
+                    {
+                        found = info;
+                        break;
+                    }
+                }
+                bool result = (found->ai_family == AF_INET) || (found->ai_family == AF_INET6);
+                if (result)
+                {
+                    memcpy(&addr.m_data, found->ai_addr, std::min<size_t>(found->ai_addrlen, sizeof(addr.m_data_in6)));
+                    if (found->ai_family == AF_INET)
+                    {
+                        addr.m_data_in.sin_port = htons(port);
+                    }
+                    else
+                    {
+                        addr.m_data_in6.sin6_port = htons(port);
+                    }
+                }
+                ::freeaddrinfo(list);
+                return result;
+            }
+
+            /// <summary>
+            /// Hand queued requests of the host to connections: idle ones first, then new ones
+            /// while the host is below its limit, then pipelined behind the least busy one.
+            /// </summary>
+            void dispatch(Host& host)
+            {
+                while (!host.queued.empty())
+                {
+                    Connection* idle = nullptr;
+                    Connection* busy = nullptr;
+                    for (auto& conn : host.connections)
+                    {
+                        if (!conn->reusable)
+                        {
+                            continue;
+                        }
+                        if (conn->inflight.empty())
+                        {
+                            idle = conn.get();
+                            break;
+                        }
+                        if ((conn->inflight.size() < m_pipelineDepth) &&
+                            ((busy == nullptr) || (conn->inflight.size() < busy->inflight.size())))
+                        {
+                            busy = conn.get();
+                        }
+                    }
+                    size_t open = host.connections.size() + host.connecting;
+                    if ((idle == nullptr) && ((m_maxPerHost == 0) || (open < m_maxPerHost)) &&
+                        (host.connecting < host.queued.size()))
+                    {
+                        connect(host);
+                        continue;
+                    }
+                    Connection* conn = (idle != nullptr) ? idle : busy;
+                    if (conn == nullptr)
+                    {
+                        return;
+                    }
+                    std::unique_ptr<Exchange> exchange = std::move(host.queued.front());
+                    host.queued.pop_front();
+                    if (conn->sendOffset == conn->sendBuffer.size())
+                    {
+                        conn->sendBuffer.clear();
+                        conn->sendOffset = 0;
+                    }
+                    conn->sendBuffer.append(exchange->wire);
+                    conn->inflight.push_back(std::move(exchange));
+                    // A failed send is reported by the reactor, connections are only closed there
+                    flush(*conn);
+                    arm(*conn);
+                }
+            }
+
+            void connect(Host& host)
+            {
+                host.connecting++;
+                m_pool.acquire(host.address, [this, &host](Socket socket, int error) {
+                    host.connecting--;
+                    if (error != 0)
+                    {
+                        LOG_WARN("HttpClient: connect to %s failed, error=%d", host.name.c_str(), error);
+                        // Every failed connect fails one request, the others try again
+                        std::unique_ptr<Exchange> exchange;
+                        if (!host.queued.empty())
+                        {
+                            exchange = std::move(host.queued.front());
+                            host.queued.pop_front();
+                        }
+                        dispatch(host);
+                        if (exchange)
+                        {
+                            finish(*exchange, ConnectFailed);
+                        }
+                        return;
+                    }
+                    host.connections.emplace_back(new Connection(*this, host, socket));
+                    Connection& conn = *host.connections.back();
+                    dispatch(host);
+                    if (conn.inflight.empty())
+                    {
+                        release(conn);
+                    }
+                });
+            }
+
+            /// <summary>
+            /// Send as much of the send buffer as the socket takes.
+            /// </summary>
+            /// <returns>false if the connection failed</returns>
+            bool flush(Connection& conn)
+            {
+                while (conn.sendOffset < conn.sendBuffer.size())
+                {
+                    int sent = conn.socket.send(conn.sendBuffer.data() + conn.sendOffset,
+                        conn.sendBuffer.size() - conn.sendOffset);
+                    if (sent > 0)
+                    {
+                        conn.sendOffset += static_cast<size_t>(sent);
+                        continue;
+                    }
+                    return (sent < 0) && (conn.socket.error() == Socket::ErrorWouldBlock);
+                }
+                conn.sendBuffer.clear();
+                conn.sendOffset = 0;
+                return true;
+            }
+
+            /// <summary>
+            /// Wait for the response, and for the socket to take the rest of the requests. The response
+            /// timeout restarts every time.
+            /// </summary>
+            void arm(Connection& conn)
+            {
+                int flags = Reactor::Readable | Reactor::Closed;
+                if (conn.sendOffset < conn.sendBuffer.size())
+                {
+                    flags |= Reactor::Writable;
+                }
+                m_reactor.addWaiter(conn.socket, flags, &conn);
+                m_reactor.cancelTimer(conn.timer);
+                conn.timer = 0;
+                if (m_responseTimeout.count() > 0)
+                {
+                    Connection* target = &conn;
+                    conn.timer = m_reactor.addTimer(m_responseTimeout, [this, target]() {
+                        target->timer = 0;
+                        close(*target, TimedOut);
+                    });
+                }
+            }
+
+            void onReady(Connection& conn, int state)
+            {
+                if ((state & Reactor::Writable) && !flush(conn))
+                {
+                    close(conn, ConnectionClosed);
+                    return;
+                }
+                if ((state & (Reactor::Readable | Reactor::Closed)) && !receive(conn))
+                {
+                    return;
+                }
+                if (!conn.host.queued.empty())
+                {
+                    // Room for requests that wait, on this connection first if it has none left
+                    dispatch(conn.host);
+                }
+                if (conn.inflight.empty())
+                {
+                    release(conn);
+                    return;
+                }
+                arm(conn);
+            }
+
+            /// <summary>
+            /// Read what the socket has and complete the responses it holds.
+            /// </summary>
+            /// <returns>false if the connection is gone</returns>
+            bool receive(Connection& conn)
+            {
+                bool closed = false;
+                {
+                    BufferPool::Chunk chunk = m_reactor.buffers().acquire();
+                    for (;;)
+                    {
+                        int received = conn.socket.recv(chunk.data(), chunk.size());
+                        if (received <= 0)
+                        {
+                            closed = (received == 0) || (conn.socket.error() != Socket::ErrorWouldBlock);
+                            break;
+                        }
+                        conn.receiveBuffer.append(chunk.data(), static_cast<size_t>(received));
+                        if (static_cast<size_t>(received) < chunk.size())
+                        {
+                            break;
+                        }
+                    }
+                }
+                if (!parse(conn))
+                {
+                    return false;
+                }
+                if (!closed)
+                {
+                    return true;
+                }
+                if ((conn.phase == Connection::BodyUntilClose) && !conn.inflight.empty())
+                {
+                    complete(conn);
+                }
+                close(conn, ConnectionClosed);
+                return false;
+            }
+
+            /// <summary>
+            /// Parse received responses in order of the requests.
+            /// </summary>
+            /// <returns>false if the connection is gone</returns>
+            bool parse(Connection& conn)
+            {
+                while (!conn.receiveBuffer.empty())
+                {
+                    if (conn.inflight.empty())
+                    {
+                        // Nothing was asked for
+                        close(conn, InvalidResponse);
+                        return false;
+                    }
+                    Exchange& exchange = *conn.inflight.front();
+                    exchange.started = true;
+                    std::string_view data = conn.receiveBuffer;
+                    switch (conn.phase)
+                    {
+                    case Connection::ResponseHead:
+                    {
+                        size_t length = conn.headScanner.scan(data);
+                        if (length == 0)
+                        {
+                            if (data.size() > MaxResponseHeadSize)
+                            {
+                                close(conn, InvalidResponse);
+                                return false;
+                            }
+                            return true;
+                        }
+                        if (!parseHead(conn, exchange, data.substr(0, length)))
+                        {
+                            close(conn, InvalidResponse);
+                            return false;
+                        }
+                        conn.receiveBuffer.erase(0, length);
+                        conn.headScanner.reset();
+                        break;
+                    }
+                    case Connection::LengthBody:
+                    {
+                        size_t size = static_cast<size_t>(std::min<uint64_t>(conn.remaining, data.size()));
+                        if (!deliver(exchange, data.substr(0, size)))
+                        {
+                            close(conn, Aborted);
+                            return false;
+                        }
+                        conn.receiveBuffer.erase(0, size);
+                        conn.remaining -= size;
+                        if (conn.remaining == 0)
+                        {
+                            complete(conn);
+                        }
+                        break;
+                    }
+                    case Connection::ChunkedBody:
+                    {
+                        size_t consumed = 0;
+                        bool aborted = false;
+                        auto result = conn.chunkedDecoder.decode(data, consumed, [&](std::string_view piece) {
+                            aborted = !deliver(exchange, piece);
+                            return !aborted;
+                        });
+                        if (result == HttpChunkedDecoder::Error)
+                        {
+                            close(conn, aborted ? Aborted : InvalidResponse);
+                            return false;
+                        }
+                        conn.receiveBuffer.erase(0, consumed);
+                        if (result == HttpChunkedDecoder::Done)
+                        {
+                            complete(conn);
+                        }
+                        break;
+                    }
+                    case Connection::BodyUntilClose:
+                        if (!deliver(exchange, data))
+                        {
+                            close(conn, Aborted);
+                            return false;
+                        }
+                        conn.receiveBuffer.clear();
+                        break;
+                    }
+                }
+                return true;
+            }
+
+            /// <summary>
+            /// Parse status line and headers, and tell how the body is framed.
+            /// </summary>
+            /// <returns>false if the head is malformed</returns>
+            bool parseHead(Connection& conn, Exchange& exchange, std::string_view head)
+            {
+                HttpClientResponse& response = exchange.response;
+                response.headers.clear();
+                std::vector<uint32_t> const& lineEnds = conn.headScanner.lineEnds();
+                bool chunked = false;
+                bool hasLength = false;
+                uint64_t contentLength = 0;
+                bool keepAlive = false;
+                bool close = false;
+                for (size_t i = 0; i + 1 < lineEnds.size(); i++)
+                {
+                    size_t begin = (i == 0) ? 0 : (lineEnds[i - 1] + 1);
+                    size_t end = lineEnds[i];
+                    if ((end > begin) && (head[end - 1] == '\r'))
+                    {
+                        end--;
+                    }
+                    std::string_view line = head.substr(begin, end - begin);
+                    if (i == 0)
+                    {
+                        // HTTP/1.1 200 OK
+                        size_t space = line.find(' ');
+                        if ((space == std::string_view::npos) || (line.substr(0, 5) != "HTTP/") ||
+                            (line.size() < space + 4))
+                        {
+                            return false;
+                        }
+                        response.protocol = std::string(line.substr(0, space));
+                        std::string_view code = line.substr(space + 1, 3);
+                        int value = 0;
+                        auto parsed = std::from_chars(code.data(), code.data() + code.size(), value);
+                        if ((parsed.ptr != code.data() + code.size()) || (value < 100))
+                        {
+                            return false;
+                        }
+                        response.code = value;
+                        response.reason = std::string(line.substr(std::min(space + 5, line.size())));
+                        continue;
+                    }
+                    size_t colon = line.find(':');
+                    if ((colon == 0) || (colon == std::string_view::npos))
+                    {
+                        return false;
+                    }
+                    std::string_view name = line.substr(0, colon);
+                    std::string_view value = line.substr(colon + 1);
+                    while (!value.empty() && ((value.front() == ' ') || (value.front() == '\t')))
+                    {
+                        value.remove_prefix(1);
+                    }
+                    while (!value.empty() && ((value.back() == ' ') || (value.back() == '\t')))
+                    {
+                        value.remove_suffix(1);
+                    }
+                    if (HttpRequestHead::equalsIgnoreCase(name, "Content-Length"))
+                    {
+                        auto parsed = std::from_chars(value.data(), value.data() + value.size(), contentLength);
+                        if (value.empty() || (parsed.ptr != value.data() + value.size()))
+                        {
+                            return false;
+                        }
+                        hasLength = true;
+                    }
+                    else if (HttpRequestHead::equalsIgnoreCase(name, "Transfer-Encoding"))
+                    {
+                        size_t comma = value.rfind(',');
+                        std::string_view coding = (comma == std::string_view::npos) ? value : value.substr(comma + 1);
+                        while (!coding.empty() && (coding.front() == ' '))
+                        {
+                            coding.remove_prefix(1);
+                        }
+                        chunked = HttpRequestHead::equalsIgnoreCase(coding, "chunked");
+                    }
+                    else if (HttpRequestHead::equalsIgnoreCase(name, "Connection"))
+                    {
+                        keepAlive = HttpRequestHead::equalsIgnoreCase(value, "keep-alive");
+                        close = HttpRequestHead::equalsIgnoreCase(value, "close");
+                    }
+                    response.headers[std::string(name)] = std::string(value);
+                }
+
+                if ((response.code < 200) && (response.code != 101))
+                {
+                    // Interim response, the final one follows
+                    return true;
+                }
+                if (close || ((response.protocol == "HTTP/1.0") && !keepAlive))
+                {
+                    conn.reusable = false;
+                }
+                if (exchange.head || (response.code == 204) || (response.code == 304) || (response.code == 101))
+                {
+                    complete(conn);
+                }
+                else if (chunked)
+                {
+                    conn.chunkedDecoder.reset();
+                    conn.phase = Connection::ChunkedBody;
+                }
+                else if (hasLength)
+                {
+                    conn.remaining = contentLength;
+                    conn.phase = Connection::LengthBody;
+                    if (contentLength == 0)
+                    {
+                        complete(conn);
+                    }
+                }
+                else
+                {
+                    conn.reusable = false;
+                    conn.phase = Connection::BodyUntilClose;
+                }
+                return true;
+            }
+
+            static bool deliver(Exchange& exchange, std::string_view data)
+            {
+                if (data.empty())
+                {
+                    return true;
+                }
+                if (exchange.onBody)
+                {
+                    return exchange.onBody(exchange.response, data);
+                }
+                exchange.response.content.append(data);
+                return true;
+            }
+
+            /// <summary>
+            /// Response at the front of the connection is complete.
+            /// </summary>
+            void complete(Connection& conn)
+            {
+                std::unique_ptr<Exchange> exchange = std::move(conn.inflight.front());
+                conn.inflight.pop_front();
+                conn.phase = Connection::ResponseHead;
+                finish(*exchange, Ok);
+            }
+
+            void finish(Exchange& exchange, Result result)
+            {
+                m_pending--;
+                exchange.response.result = result;
+                if (exchange.onResponse)
+                {
+                    exchange.onResponse(exchange.response);
+                }
+            }
+
+            /// <summary>
+            /// Connection has no requests left: back to the pool if it may be reused, closed otherwise.
+            /// </summary>
+            void release(Connection& conn)
+            {
+                Host& host = conn.host;
+                m_reactor.cancelTimer(conn.timer);
+                m_reactor.removeSocket(conn.socket);
+                m_pool.release(host.address, conn.socket, conn.reusable && conn.receiveBuffer.empty());
+                erase(conn);
+                dispatch(host);
+            }
+
+            /// <summary>
+            /// Close connection that failed or that the server closed. The response being received
+            /// fails with the result, requests after it are sent again if they are idempotent.
+            /// </summary>
+            void close(Connection& conn, Result result)
+            {
+                Host& host = conn.host;
+                m_reactor.cancelTimer(conn.timer);
+                m_reactor.removeSocket(conn.socket);
+                m_pool.release(host.address, conn.socket, false);
+                std::deque<std::unique_ptr<Exchange>> inflight = std::move(conn.inflight);
+                erase(conn);
+
+                // Requeued in their order, ahead of requests that were not sent yet
+                std::vector<std::unique_ptr<Exchange>> failed;
+                for (size_t i = inflight.size(); i-- > 0;)
+                {
+                    Exchange& exchange = *inflight[i];
+                    bool retry = (result == ConnectionClosed) && !exchange.started && exchange.idempotent &&
+                        !exchange.retried;
+                    if (retry)
+                    {
+                        exchange.retried = true;
+                        host.queued.push_front(std::move(inflight[i]));
+                    }
+                    else
+                    {
+                        failed.push_back(std::move(inflight[i]));
+                    }
+                }
+                dispatch(host);
+                for (size_t i = failed.size(); i-- > 0;)
+                {
+                    finish(*failed[i], result);
+                }
+            }
+
+            void erase(Connection& conn)
+            {
+                auto& connections = conn.host.connections;
+                auto it = std::find_if(connections.begin(), connections.end(),
+                    [&conn](std::unique_ptr<Connection> const& entry) { return entry.get() == &conn; });
+                if (it != connections.end())
+                {
+                    connections.erase(it);
+                }
+            }
+
+            Reactor& m_reactor;
+            ConnectionPool m_pool;
+            std::unordered_map<std::string, std::unique_ptr<Host>> m_hosts;
+            size_t m_maxPerHost{ DefaultMaxConnectionsPerHost };
+            size_t m_pipelineDepth{ 1 };
+            std::chrono::milliseconds m_responseTimeout{ 0 };
+            size_t m_pending{ 0 };
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
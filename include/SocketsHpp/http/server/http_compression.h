@@ -0,0 +1,427 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+// Content codings of response bodies: gzip and deflate on zlib, br on the brotli encoder.
+// The backends need their libraries, so they are opt-in: define HAVE_ZLIB and link ZLIB::ZLIB,
+// define HAVE_BROTLI and link brotlienc. Codings that are not compiled in are never negotiated.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#  include <brotli/encode.h>
+#endif
+
+SOCKETSHPP_NS_BEGIN
+namespace http
+{
+    namespace server
+    {
+
+        /// <summary>
+        /// Streaming encoder of one body in one content coding. Its state is fixed when the stream
+        /// starts and doesn't grow with the body: about 128 KiB for gzip and deflate, a 64 KiB
+        /// window for br at the Fast effort. Every part written is flushed, so that what the
+        /// producer generated goes out without waiting for more.
+        /// </summary>
+        class HttpEncoder
+        {
+        public:
+            /// <summary>
+            /// Content codings, as flags for the sets a server offers.
+            /// </summary>
+            enum Coding : unsigned
+            {
+                Identity = 0,
+                Gzip = 1,
+                Deflate = 2,  // zlib format, as RFC 9110 defines it
+                Brotli = 4
+            };
+
+            enum Effort
+            {
+                Fast,  // Bodies compressed while they are sent
+                Best   // Bodies compressed once and sent many times, e.g. cached files
+            };
+
+            HttpEncoder() = default;
+
+            HttpEncoder(const HttpEncoder&) = delete;
+            HttpEncoder& operator=(const HttpEncoder&) = delete;
+
+            ~HttpEncoder() { reset(); }
+
+            /// <summary>
+            /// Codings compiled in.
+            /// </summary>
+            static unsigned available()
+            {
+                unsigned codings = Identity;
+#ifdef HAVE_ZLIB
+                codings |= Gzip | Deflate;
+#endif
+#ifdef HAVE_BROTLI
+                codings |= Brotli;
+#endif
+                return codings;
+            }
+
+            /// <summary>
+            /// Name of the coding in Accept-Encoding and Content-Encoding.
+            /// </summary>
+            static char const* name(Coding coding)
+            {
+                switch (coding)
+                {
+                case Gzip:
+                    return "gzip";
+                case Deflate:
+                    return "deflate";
+                case Brotli:
+                    return "br";
+                default:
+                    return "identity";
+                }
+            }
+
+            /// <summary>
+            /// Pick the coding with the highest quality in Accept-Encoding among the offered ones.
+            /// Ties go to br, then gzip, then deflate. "*" covers the codings that are not listed,
+            /// q=0 refuses a coding.
+            /// </summary>
+            /// <param name="acceptEncoding">Value of the request header</param>
+            /// <param name="codings">Coding flags the server offers</param>
+            /// <returns>Identity if the client accepts none of them</returns>
+            static Coding negotiate(std::string_view acceptEncoding, unsigned codings)
+            {
+                static Coding const preference[] = { Brotli, Gzip, Deflate };
+                int quality[3] = { -1, -1, -1 };  // In thousandths, -1 while not listed
+                int other = -1;
+                while (!acceptEncoding.empty())
+                {
+                    size_t end = acceptEncoding.find(',');
+                    std::string_view element = acceptEncoding.substr(0, end);
+                    acceptEncoding = (end == std::string_view::npos) ? std::string_view() :
+                        acceptEncoding.substr(end + 1);
+
+                    size_t params = element.find(';');
+                    std::string_view token = trim(element.substr(0, params));
+                    int q = (params == std::string_view::npos) ? 1000 : parseQuality(element.substr(params + 1));
+                    if (token == "*")
+                    {
+                        other = q;
+                    }
+                    else if (equalsIgnoreCase(token, "br"))
+                    {
+                        quality[0] = q;
+                    }
+                    else if (equalsIgnoreCase(token, "gzip") || equalsIgnoreCase(token, "x-gzip"))
+                    {
+                        quality[1] = q;
+                    }
+                    else if (equalsIgnoreCase(token, "deflate"))
+                    {
+                        quality[2] = q;
+                    }
+                }
+
+                Coding best = Identity;
+                int bestQuality = 0;
+                for (size_t i = 0; i < 3; i++)
+                {
+                    int q = (quality[i] >= 0) ? quality[i] : other;
+                    if ((codings & preference[i]) && (q > bestQuality))
+                    {
+                        best = preference[i];
+                        bestQuality = q;
+                    }
+                }
+                return best;
+            }
+
+            /// <summary>
+            /// Whether bodies of the media type are worth compressing: text, JSON, JavaScript, XML
+            /// and SVG. Images, archives and other binary formats are compressed already.
+            /// </summary>
+            static bool compressible(std::string_view contentType)
+            {
+                contentType = trim(contentType.substr(0, contentType.find(';')));
+                if (startsWithIgnoreCase(contentType, "text/"))
+                {
+                    return true;
+                }
+                for (std::string_view suffix : { "/json", "+json", "/javascript", "/xml", "+xml" })
+                {
+                    if ((contentType.size() > suffix.size()) &&
+                        equalsIgnoreCase(contentType.substr(contentType.size() - suffix.size()), suffix))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /// <summary>
+            /// Compress the whole input at once.
+            /// </summary>
+            /// <returns>false if the coding is not available or the encoder failed</returns>
+            static bool compress(Coding coding, std::string_view input, std::string& output, Effort effort = Best)
+            {
+                output.clear();
+                HttpEncoder encoder;
+                return encoder.start(coding, effort, input.size()) && encoder.write(input, output, true);
+            }
+
+            /// <summary>
+            /// Start a new stream, dropping the previous one.
+            /// </summary>
+            /// <param name="sizeHint">Expected input size, 0 if unknown</param>
+            /// <returns>false if the coding is not available</returns>
+            bool start(Coding coding, Effort effort = Fast, size_t sizeHint = 0)
+            {
+                reset();
+#ifdef HAVE_ZLIB
+                if ((coding == Gzip) || (coding == Deflate))
+                {
+                    std::memset(&m_zlib, 0, sizeof(m_zlib));
+                    // 2^(windowBits + 2) + 2^(memLevel + 9) bytes of state, gzip framing adds 16
+                    int windowBits = (effort == Best) ? 15 : 14;
+                    int memLevel = (effort == Best) ? 8 : 7;
+                    if (deflateInit2(&m_zlib, (effort == Best) ? 9 : 6, Z_DEFLATED,
+                            (coding == Gzip) ? windowBits + 16 : windowBits, memLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+                    {
+                        return false;
+                    }
+                    m_coding = coding;
+                    return true;
+                }
+#endif
+#ifdef HAVE_BROTLI
+                if (coding == Brotli)
+                {
+                    m_brotli = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+                    if (m_brotli == nullptr)
+                    {
+                        return false;
+                    }
+                    // Quality 11 is an order of magnitude slower than 9, for little gain on text
+                    BrotliEncoderSetParameter(m_brotli, BROTLI_PARAM_QUALITY, (effort == Best) ? 9 : 4);
+                    BrotliEncoderSetParameter(m_brotli, BROTLI_PARAM_LGWIN, (effort == Best) ? 22 : 16);
+                    if (sizeHint != 0)
+                    {
+                        BrotliEncoderSetParameter(m_brotli, BROTLI_PARAM_SIZE_HINT,
+                            static_cast<uint32_t>(std::min<size_t>(sizeHint, 1u << 30)));
+                    }
+                    m_coding = coding;
+                    return true;
+                }
+#endif
+                (void)coding;
+                (void)effort;
+                (void)sizeHint;
+                return false;
+            }
+
+            /// <summary>
+            /// Compress the next part of the body and append what is ready to the output.
+            /// Without last the stream is flushed, so that the output decodes to all the input
+            /// written so far.
+            /// </summary>
+            /// <param name="last">Whether this is the end of the body, the stream ends with it</param>
+            /// <returns>false if there is no stream or the encoder failed</returns>
+            bool write(std::string_view input, std::string& output, bool last)
+            {
+#if defined(HAVE_ZLIB) || defined(HAVE_BROTLI)
+                static size_t const MinOutput = 16 * 1024;
+#endif
+#ifdef HAVE_ZLIB
+                if ((m_coding == Gzip) || (m_coding == Deflate))
+                {
+                    m_zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+                    m_zlib.avail_in = static_cast<uInt>(input.size());
+                    for (;;)
+                    {
+                        size_t offset = output.size();
+                        size_t room = std::max(MinOutput, static_cast<size_t>(m_zlib.avail_in) / 2);
+                        output.resize(offset + room);
+                        m_zlib.next_out = reinterpret_cast<Bytef*>(&output[offset]);
+                        m_zlib.avail_out = static_cast<uInt>(room);
+                        int result = deflate(&m_zlib, last ? Z_FINISH : Z_SYNC_FLUSH);
+                        output.resize(offset + room - m_zlib.avail_out);
+                        if ((result == Z_STREAM_ERROR) || (last && (result == Z_BUF_ERROR)))
+                        {
+                            return false;
+                        }
+                        // Z_BUF_ERROR: the flush before filled the output exactly, there is nothing left
+                        if (last ? (result == Z_STREAM_END) : ((m_zlib.avail_out != 0) || (result == Z_BUF_ERROR)))
+                        {
+                            break;
+                        }
+                    }
+                    if (last)
+                    {
+                        reset();
+                    }
+                    return true;
+                }
+#endif
+#ifdef HAVE_BROTLI
+                if (m_coding == Brotli)
+                {
+                    uint8_t const* nextIn = reinterpret_cast<uint8_t const*>(input.data());
+                    size_t availIn = input.size();
+                    BrotliEncoderOperation operation = last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+                    for (;;)
+                    {
+                        size_t offset = output.size();
+                        size_t room = std::max(MinOutput, availIn / 2);
+                        output.resize(offset + room);
+                        uint8_t* nextOut = reinterpret_cast<uint8_t*>(&output[offset]);
+                        size_t availOut = room;
+                        bool ok = BrotliEncoderCompressStream(
+                            m_brotli, operation, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+                        output.resize(offset + room - availOut);
+                        if (!ok)
+                        {
+                            return false;
+                        }
+                        if ((availIn == 0) && !BrotliEncoderHasMoreOutput(m_brotli) &&
+                            (!last || BrotliEncoderIsFinished(m_brotli)))
+                        {
+                            break;
+                        }
+                    }
+                    if (last)
+                    {
+                        reset();
+                    }
+                    return true;
+                }
+#endif
+                (void)input;
+                (void)output;
+                (void)last;
+                return false;
+            }
+
+            /// <summary>
+            /// Drop the stream and free its state.
+            /// </summary>
+            void reset()
+            {
+#ifdef HAVE_ZLIB
+                if ((m_coding == Gzip) || (m_coding == Deflate))
+                {
+                    deflateEnd(&m_zlib);
+                }
+#endif
+#ifdef HAVE_BROTLI
+                if (m_brotli != nullptr)
+                {
+                    BrotliEncoderDestroyInstance(m_brotli);
+                    m_brotli = nullptr;
+                }
+#endif
+                m_coding = Identity;
+            }
+
+            /// <summary>
+            /// Coding of the current stream, Identity if there is none.
+            /// </summary>
+            Coding coding() const { return m_coding; }
+
+        private:
+            static std::string_view trim(std::string_view value)
+            {
+                while (!value.empty() && ((value.front() == ' ') || (value.front() == '\t')))
+                {
+                    value.remove_prefix(1);
+                }
+                while (!value.empty() && ((value.back() == ' ') || (value.back() == '\t')))
+                {
+                    value.remove_suffix(1);
+                }
+                return value;
+            }
+
+            static bool equalsIgnoreCase(std::string_view a, std::string_view b)
+            {
+                if (a.size() != b.size())
+                {
+                    return false;
+                }
+                for (size_t i = 0; i < a.size(); i++)
+                {
+                    if (::tolower(static_cast<unsigned char>(a[i])) != ::tolower(static_cast<unsigned char>(b[i])))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            static bool startsWithIgnoreCase(std::string_view value, std::string_view prefix)
+            {
+                return (value.size() >= prefix.size()) && equalsIgnoreCase(value.substr(0, prefix.size()), prefix);
+            }
+
+            /// <summary>
+            /// Quality of "q=0.5" type parameters, in thousandths. Malformed values count as 0.
+            /// </summary>
+            static int parseQuality(std::string_view params)
+            {
+                int q = 1000;
+                while (!params.empty())
+                {
+                    size_t end = params.find(';');
+                    std::string_view param = trim(params.substr(0, end));
+                    params = (end == std::string_view::npos) ? std::string_view() : params.substr(end + 1);
+                    if ((param.size() < 3) || ((param[0] != 'q') && (param[0] != 'Q')) || (param[1] != '='))
+                    {
+                        continue;
+                    }
+                    std::string_view value = param.substr(2);
+                    if ((value[0] != '0') && (value[0] != '1'))
+                    {
+                        return 0;
+                    }
+                    q = (value[0] - '0') * 1000;
+                    if ((value.size() > 1) && (value[1] == '.'))
+                    {
+                        int scale = 100;
+                        for (size_t i = 2; (i < value.size()) && (i < 5); i++, scale /= 10)
+                        {
+                            if ((value[i] < '0') || (value[i] > '9'))
+                            {
+                                return 0;
+                            }
+                            q += (value[i] - '0') * scale;
+                        }
+                    }
+                    q = std::min(q, 1000);
+                }
+                return q;
+            }
+
+            Coding m_coding{ Identity };
+#ifdef HAVE_ZLIB
+            z_stream m_zlib;
+#endif
+#ifdef HAVE_BROTLI
+            BrotliEncoderState* m_brotli{ nullptr };
+#endif
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
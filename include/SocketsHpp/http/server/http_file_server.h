@@ -4,8 +4,13 @@
 
 #include <SocketsHpp/config.h>
 
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -44,40 +49,274 @@ namespace http
              */
             void InitializeFileEndpoint(HttpFileServer& server) { server[root_endpt_] = ServeFile; }
 
+            /**
+             * Keep small files in memory, together with their pre-serialized headers,
+             * so that hot files are served without any file I/O. Entries are evicted
+             * least recently used first, and are checked against the file size and
+             * modification time at most once per revalidation interval. With compression
+             * enabled (see setCompression) compressible files are cached with their
+             * .br and .gz siblings, or compressed once when they are cached.
+             * @param budget total size of cached files in bytes, 0 disables the cache
+             * @param maxFileSize larger files are always streamed from disk
+             * @param revalidateSeconds how long a cached file is trusted without stat
+             */
+            void SetFileCache(size_t budget, size_t maxFileSize = 1024 * 1024, int revalidateSeconds = 1)
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                cache_budget_ = budget;
+                cache_max_file_size_ = maxFileSize;
+                cache_revalidate_ = std::chrono::seconds(revalidateSeconds);
+                while (cache_size_ > cache_budget_)
+                {
+                    EvictCachedFile(std::prev(cache_lru_.end()));
+                }
+            }
+
         private:
+            /**
+             * Representation of a cached file in one content coding.
+             */
+            struct Variant
+            {
+                HttpEncoder::Coding coding;
+                std::shared_ptr<HttpFile> file;  // Loaded in memory
+                std::string headers;             // Content-Type, ETag, Last-Modified and the coding
+                std::string etag;                // Differs between codings
+                std::string notModified;         // Headers of a 304: ETag, Last-Modified and Vary
+            };
+
+            struct CachedFile
+            {
+                std::string name;
+                std::shared_ptr<HttpFile> file;  // Loaded in memory
+                std::vector<Variant> variants;   // Identity first, then compressed ones
+                unsigned codings = HttpEncoder::Identity;  // Flags of the compressed variants
+                std::chrono::steady_clock::time_point checked;
+
+                size_t size() const
+                {
+                    size_t total = 0;
+                    for (auto const& variant : variants)
+                    {
+                        total += static_cast<size_t>(variant.file->size());
+                    }
+                    return total;
+                }
+            };
+
+            /**
+             * Respond with a cached file in the best coding the client accepts, or with
+             * 304 Not Modified if the client has it.
+             */
+            int SendCachedFile(CachedFile const& entry, HttpRequest const& req, HttpResponse& resp)
+            {
+                HttpEncoder::Coding coding = acceptedCoding(req, entry.codings);
+                Variant const* variant = &entry.variants.front();
+                for (auto const& other : entry.variants)
+                {
+                    if (other.coding == coding)
+                    {
+                        variant = &other;
+                    }
+                }
+                auto const ifNoneMatch = req.head.find("If-None-Match");
+                if ((ifNoneMatch != nullptr) && (ifNoneMatch->value == variant->etag))
+                {
+                    resp.rawHeaders = variant->notModified;
+                    resp.code = 304;
+                }
+                else
+                {
+                    resp.rawHeaders = variant->headers;
+                    resp.file = variant->file;
+                    resp.code = 200;
+                }
+                resp.message = HttpServer::getDefaultResponseMessage(resp.code);
+                return resp.code;
+            }
+
+            /**
+             * Look the file up in the cache and drop it if it changed on disk.
+             * @returns whether the response was set from the cache
+             */
+            bool FindCachedFile(const std::string& name, HttpRequest const& req, HttpResponse& resp)
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                auto it = cache_index_.find(name);
+                if (it == cache_index_.end())
+                {
+                    return false;
+                }
+                auto entry = it->second;
+                auto now = std::chrono::steady_clock::now();
+                if (now - entry->checked >= cache_revalidate_)
+                {
+                    uint64_t size;
+                    time_t lastModified;
+                    if (!HttpFile::stat(entry->name, size, lastModified) || (size != entry->file->size()) ||
+                        (lastModified != entry->file->lastModified()))
+                    {
+                        EvictCachedFile(entry);
+                        return false;
+                    }
+                    entry->checked = now;
+                }
+                cache_lru_.splice(cache_lru_.begin(), cache_lru_, entry);
+                SendCachedFile(*entry, req, resp);
+                return true;
+            }
+
+            /**
+             * Load the file and add it to the cache, evicting older entries to fit the budget.
+             * @returns whether the response was set from the new entry
+             */
+            bool CacheFile(const std::string& name, std::shared_ptr<HttpFile> const& file, HttpRequest const& req,
+                HttpResponse& resp)
+            {
+                if ((file->size() > cache_max_file_size_) || (file->size() > cache_budget_) || !file->load())
+                {
+                    return false;
+                }
+
+                CachedFile entry;
+                entry.name = name;
+                entry.file = file;
+                std::string type = GetMimeContentType(name);
+                std::string headers = std::string(CONTENT_TYPE) + ": " + type + "\r\n" +
+                    "Last-Modified: " + formatTimestamp(file->lastModified()) + "\r\n";
+                bool encode = (m_compression != HttpEncoder::Identity) && HttpEncoder::compressible(type);
+                if (encode)
+                {
+                    headers += "Vary: Accept-Encoding\r\n";
+                }
+                AddVariant(entry, HttpEncoder::Identity, file, headers);
+                for (HttpEncoder::Coding coding : { HttpEncoder::Brotli, HttpEncoder::Gzip })
+                {
+                    if (!encode || !(m_compression & coding) || (file->size() < m_compressionMinSize))
+                    {
+                        continue;
+                    }
+                    // Precompressed sibling, e.g. by the build at the highest level, or compressed once now
+                    std::shared_ptr<HttpFile> encoded;
+                    if (!FileGetSuccess(name + PrecompressedExtension(coding), encoded) || !encoded->load())
+                    {
+                        std::string contents;
+                        std::string_view data(file->data(), static_cast<size_t>(file->size()));
+                        if (!HttpEncoder::compress(coding, data, contents))
+                        {
+                            continue;
+                        }
+                        encoded = HttpFile::fromMemory(std::move(contents), file->lastModified());
+                    }
+                    if (encoded->size() < file->size())
+                    {
+                        AddVariant(entry, coding, encoded,
+                            headers + "Content-Encoding: " + HttpEncoder::name(coding) + "\r\n");
+                    }
+                }
+                entry.checked = std::chrono::steady_clock::now();
+                SendCachedFile(entry, req, resp);
+                size_t size = entry.size();
+
+                std::lock_guard<std::mutex> lock(cache_mutex_);
+                auto it = cache_index_.find(name);
+                if (it != cache_index_.end())
+                {
+                    // Another thread cached it meanwhile
+                    EvictCachedFile(it->second);
+                }
+                while (!cache_lru_.empty() && (cache_size_ + size > cache_budget_))
+                {
+                    EvictCachedFile(std::prev(cache_lru_.end()));
+                }
+                if (cache_size_ + size <= cache_budget_)
+                {
+                    cache_size_ += size;
+                    cache_lru_.push_front(std::move(entry));
+                    cache_index_[name] = cache_lru_.begin();
+                }
+                return true;
+            }
+
+            /**
+             * Add the representation of the file in the coding, with its own ETag.
+             * @param headers Content-Type and the other headers of all representations
+             */
+            static void AddVariant(CachedFile& entry, HttpEncoder::Coding coding, std::shared_ptr<HttpFile> file,
+                std::string const& headers)
+            {
+                char version[48];
+                snprintf(version, sizeof(version), "%llx-%llx", static_cast<unsigned long long>(entry.file->size()),
+                    static_cast<unsigned long long>(entry.file->lastModified()));
+                std::string etag = "\"" + std::string(version) +
+                    ((coding == HttpEncoder::Identity) ? std::string() : std::string("-") + HttpEncoder::name(coding)) +
+                    "\"";
+                std::string all = headers + "ETag: " + etag + "\r\n";
+                // A 304 carries the validators and Vary of the 200 (RFC 9110 15.4.5), not the representation
+                std::string notModified;
+                for (size_t begin = 0, end; begin < all.size(); begin = end + 2)
+                {
+                    end = all.find("\r\n", begin);
+                    std::string_view line(all.data() + begin, end - begin);
+                    if ((line.rfind(CONTENT_TYPE, 0) != 0) && (line.rfind("Content-Encoding:", 0) != 0))
+                    {
+                        notModified.append(all, begin, end + 2 - begin);
+                    }
+                }
+                entry.variants.push_back({ coding, std::move(file), std::move(all), etag, std::move(notModified) });
+                entry.codings |= coding;
+            }
+
+            void EvictCachedFile(std::list<CachedFile>::iterator entry)
+            {
+                cache_size_ -= entry->size();
+                cache_index_.erase(entry->name);
+                cache_lru_.erase(entry);
+            }
+
             /**
              * Return whether a file is found whose location is searched for relative to
-             * where the executable was triggered. If the file is valid, fill result with
-             * the file data/information required to display it on a webpage
+             * where the executable was triggered. If the file is valid, open it for
+             * streaming: the contents are sent by the server without being read.
              * @param name of the file to look for,
-             * @param resulting file information, necessary for displaying them on a
-             * webpage
-             * @returns whether a file was found and result filled with display
-             * information
+             * @param resulting open file, its size is used as Content-Length
+             * @returns whether a file was found and opened
              */
-            bool FileGetSuccess(const std::string& fileNameUrl, std::vector<char>& result)
+            bool FileGetSuccess(const std::string& fileNameUrl, std::shared_ptr<HttpFile>& result)
             {
                 std::string filename = fileNameUrl;
 #ifdef _WIN32
                 std::replace(filename.begin(), filename.end(), '/', '\\');
 #endif
+                result = HttpFile::open(filename);
+                return (result != nullptr);
+            };
+
+            static char const* PrecompressedExtension(HttpEncoder::Coding coding)
+            {
+                return (coding == HttpEncoder::Brotli) ? ".br" : ".gz";
+            }
 
-                std::streampos size;
-                std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-                if (file.is_open())
+            /**
+             * Stream the .br or .gz sibling of the file instead of the file, if there is
+             * one the client accepts. The siblings are trusted to match the file.
+             * @returns whether a sibling was opened
+             */
+            bool OpenPrecompressed(const std::string& filename, HttpRequest const& req, HttpResponse& resp)
+            {
+                for (HttpEncoder::Coding coding : { HttpEncoder::Brotli, HttpEncoder::Gzip })
                 {
-                    size = file.tellg();
-                    if (size)
+                    std::shared_ptr<HttpFile> encoded;
+                    if ((acceptedCoding(req, m_compression & coding) == coding) &&
+                        FileGetSuccess(filename + PrecompressedExtension(coding), encoded))
                     {
-                        result.resize(size);
-                        file.seekg(0, std::ios::beg);
-                        file.read(result.data(), size);
+                        resp.headers["Content-Encoding"] = HttpEncoder::name(coding);
+                        resp.file = std::move(encoded);
+                        return true;
                     }
-                    file.close();
-                    return true;
                 }
                 return false;
-            };
+            }
 
             /**
              * Returns the extension of a file
@@ -125,11 +364,27 @@ namespace http
                   auto f = GetFileName(req.uri);
                   auto filename = f.c_str() + 1;
 
-                  std::vector<char> content;
+                  bool cached = (cache_budget_ > 0);
+                  if (cached && FindCachedFile(filename, req, resp))
+                  {
+                    return resp.code;
+                  }
+
+                  std::shared_ptr<HttpFile> content;
                   if (FileGetSuccess(filename, content))
                   {
-                    resp.headers[CONTENT_TYPE] = GetMimeContentType(filename);
-                    resp.body = std::string(content.data(), content.size());
+                    if (cached && CacheFile(filename, content, req, resp))
+                    {
+                      return resp.code;
+                    }
+                    std::string type = GetMimeContentType(filename);
+                    resp.headers[CONTENT_TYPE] = type;
+                    resp.file = std::move(content);
+                    if ((m_compression != HttpEncoder::Identity) && HttpEncoder::compressible(type))
+                    {
+                      resp.headers["Vary"] = "Accept-Encoding";
+                      OpenPrecompressed(filename, req, resp);
+                    }
                     resp.code = 200;
                     resp.message = HttpServer::getDefaultResponseMessage(resp.code);
                     return resp.code;
@@ -149,8 +404,18 @@ namespace http
                 {"css", "text/css"},   {"png", "image/png"},  {"js", "text/javascript"},
                 {"htm", "text/html"},  {"html", "text/html"}, {"json", "application/json"},
                 {"txt", "text/plain"}, {"jpg", "image/jpeg"}, {"jpeg", "image/jpeg"},
+                {"mjs", "text/javascript"}, {"svg", "image/svg+xml"}, {"xml", "application/xml"},
             };
             const std::string root_endpt_ = "/";
+
+            // Cache of loaded files, most recently used first
+            std::mutex cache_mutex_;
+            std::list<CachedFile> cache_lru_;
+            std::unordered_map<std::string, std::list<CachedFile>::iterator> cache_index_;
+            size_t cache_size_ = 0;
+            size_t cache_budget_ = 0;
+            size_t cache_max_file_size_ = 0;
+            std::chrono::steady_clock::duration cache_revalidate_ = std::chrono::seconds(1);
         };
     }
 }
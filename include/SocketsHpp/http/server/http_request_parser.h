@@ -0,0 +1,581 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SOCKETSHPP_HTTP_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SOCKETSHPP_HTTP_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+SOCKETSHPP_NS_BEGIN
+namespace http
+{
+    namespace server
+    {
+
+        /// <summary>
+        /// Incremental scanner of a request head. Every call only looks at bytes received
+        /// since the previous one and records where lines end, so that the parser splits
+        /// the head into lines without scanning it again. Line feeds are located 32 (AVX2)
+        /// or 16 (SSE2, NEON) bytes at a time.
+        /// </summary>
+        class HttpHeadScanner
+        {
+        public:
+            /// <summary>
+            /// Continue scanning for the empty line that ends the head.
+            /// </summary>
+            /// <param name="data">Received bytes, starting at the head. Bytes already scanned must
+            /// not change between calls.</param>
+            /// <returns>Head length including the empty line, 0 if not received yet</returns>
+            size_t scan(std::string_view data)
+            {
+                if (m_headLength != 0)
+                {
+                    return m_headLength;
+                }
+                char const* base = data.data();
+                size_t size = data.size();
+                size_t pos = m_scanned;
+#if defined(__AVX2__)
+                __m256i const lf256 = _mm256_set1_epi8('\n');
+                for (; pos + 32 <= size; pos += 32)
+                {
+                    __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(base + pos));
+                    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf256)));
+                    if ((mask != 0) && scanMask(base, pos, mask, 1))
+                    {
+                        return m_headLength;
+                    }
+                }
+#endif
+#if defined(__AVX2__) || defined(SOCKETSHPP_HTTP_SCAN_SSE2)
+                __m128i const lf128 = _mm_set1_epi8('\n');
+                for (; pos + 16 <= size; pos += 16)
+                {
+                    __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(base + pos));
+                    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf128)));
+                    if ((mask != 0) && scanMask(base, pos, mask, 1))
+                    {
+                        return m_headLength;
+                    }
+                }
+#elif defined(SOCKETSHPP_HTTP_SCAN_NEON)
+                uint8x16_t const lf = vdupq_n_u8('\n');
+                for (; pos + 16 <= size; pos += 16)
+                {
+                    uint8x16_t block = vld1q_u8(reinterpret_cast<uint8_t const*>(base + pos));
+                    // Narrow the comparison to 4 bits per byte
+                    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(block, lf)), 4);
+                    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) & 0x8888888888888888ULL;
+                    if ((mask != 0) && scanMask(base, pos, mask, 4))
+                    {
+                        return m_headLength;
+                    }
+                }
+#endif
+                for (; pos < size; pos++)
+                {
+                    if ((base[pos] == '\n') && onLineEnd(base, pos))
+                    {
+                        return m_headLength;
+                    }
+                }
+                m_scanned = size;
+                return 0;
+            }
+
+            /// <summary>
+            /// Number of bytes examined so far.
+            /// </summary>
+            size_t scanned() const { return (m_headLength != 0) ? m_headLength : m_scanned; }
+
+            /// <summary>
+            /// Offsets of line feeds found so far, the last one ends the head once it is found.
+            /// </summary>
+            std::vector<uint32_t> const& lineEnds() const { return m_lineEnds; }
+
+            /// <summary>
+            /// Start scanning the next head, keeps capacity.
+            /// </summary>
+            void reset()
+            {
+                m_scanned = 0;
+                m_headLength = 0;
+                m_lineEnds.clear();
+            }
+
+        private:
+            template <typename Mask>
+            bool scanMask(char const* base, size_t pos, Mask mask, unsigned bitsPerByte)
+            {
+                while (mask != 0)
+                {
+                    if (onLineEnd(base, pos + countTrailingZeros(mask) / bitsPerByte))
+                    {
+                        return true;
+                    }
+                    mask &= mask - 1;
+                }
+                return false;
+            }
+
+            bool onLineEnd(char const* base, size_t pos)
+            {
+                size_t start = m_lineEnds.empty() ? 0 : (m_lineEnds.back() + 1);
+                m_lineEnds.push_back(static_cast<uint32_t>(pos));
+                size_t length = pos - start;
+                if ((length == 0) || ((length == 1) && (base[start] == '\r')))
+                {
+                    m_headLength = pos + 1;
+                    return true;
+                }
+                return false;
+            }
+
+            static unsigned countTrailingZeros(uint64_t mask)
+            {
+#ifdef _MSC_VER
+                unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+                _BitScanForward64(&index, mask);
+#else
+                if (!_BitScanForward(&index, static_cast<unsigned long>(mask)))
+                {
+                    _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+                    index += 32;
+                }
+#endif
+                return static_cast<unsigned>(index);
+#else
+                return static_cast<unsigned>(__builtin_ctzll(mask));
+#endif
+            }
+
+            size_t m_scanned{ 0 };
+            size_t m_headLength{ 0 };
+            std::vector<uint32_t> m_lineEnds;
+        };
+
+        /// <summary>
+        /// Request header as it appears on the wire, name case is preserved.
+        /// </summary>
+        struct HttpHeaderView
+        {
+            std::string_view name;
+            std::string_view value;
+        };
+
+        /// <summary>
+        /// Request line and headers parsed in place: all fields point into the buffer
+        /// the request was parsed from and are only valid as long as that buffer.
+        /// Headers are kept in a flat vector, which keeps its capacity between requests,
+        /// so that parsing allocates nothing once the connection is warmed up.
+        /// </summary>
+        struct HttpRequestHead
+        {
+            /// <summary>
+            /// Headers the server looks at, detected while parsing.
+            /// </summary>
+            enum KnownHeader
+            {
+                AcceptEncoding,
+                ContentLength,
+                Connection,
+                Expect,
+                Host,
+                TransferEncoding,
+                KnownHeaderCount
+            };
+
+            std::string_view method;
+            std::string_view uri;
+            std::string_view protocol;
+            std::vector<HttpHeaderView> headers;
+
+            void clear()
+            {
+                method = uri = protocol = std::string_view();
+                headers.clear();
+                for (auto& index : m_known)
+                {
+                    index = -1;
+                }
+            }
+
+            /// <summary>
+            /// Find header by case-insensitive name. If the header is repeated, the last one wins.
+            /// </summary>
+            /// <returns>nullptr if there is no such header</returns>
+            HttpHeaderView const* find(std::string_view name) const
+            {
+                for (size_t i = headers.size(); i-- > 0;)
+                {
+                    if (equalsIgnoreCase(headers[i].name, name))
+                    {
+                        return &headers[i];
+                    }
+                }
+                return nullptr;
+            }
+
+            /// <summary>
+            /// Find well-known header without comparing names.
+            /// </summary>
+            /// <returns>nullptr if there is no such header</returns>
+            HttpHeaderView const* find(KnownHeader header) const
+            {
+                int index = m_known[header];
+                return (index >= 0) ? &headers[static_cast<size_t>(index)] : nullptr;
+            }
+
+            /// <summary>
+            /// Parse request line and headers, up to and including the empty line. Lines may
+            /// end with either CRLF or LF.
+            /// </summary>
+            /// <param name="data">Request head, the views point into it</param>
+            /// <returns>false if the request is malformed</returns>
+            bool parse(std::string_view data)
+            {
+                HttpHeadScanner scanner;
+                if (scanner.scan(data) != data.size())
+                {
+                    clear();
+                    return false;
+                }
+                return parse(data, scanner.lineEnds());
+            }
+
+            /// <summary>
+            /// Parse request head split into lines by HttpHeadScanner.
+            /// </summary>
+            /// <param name="data">Request head, the views point into it</param>
+            /// <param name="lineEnds">Line feed offsets, the last one ends the empty line</param>
+            /// <returns>false if the request is malformed</returns>
+            bool parse(std::string_view data, std::vector<uint32_t> const& lineEnds)
+            {
+                clear();
+                if (lineEnds.size() < 2)
+                {
+                    return false;
+                }
+
+                // Request line
+                std::string_view line;
+                if (!getLine(data, lineEnds, 0, line))
+                {
+                    return false;
+                }
+                size_t space = line.find(' ');
+                if ((space == 0) || (space == std::string_view::npos))
+                {
+                    return false;
+                }
+                method = line.substr(0, space);
+                size_t next = line.find_first_not_of(' ', space);
+                if (next == std::string_view::npos)
+                {
+                    return false;
+                }
+                line.remove_prefix(next);
+                space = line.find(' ');
+                if (space == std::string_view::npos)
+                {
+                    return false;
+                }
+                uri = line.substr(0, space);
+                next = line.find_first_not_of(' ', space);
+                if (next == std::string_view::npos)
+                {
+                    return false;
+                }
+                protocol = line.substr(next);
+                if (protocol.find(' ') != std::string_view::npos)
+                {
+                    return false;
+                }
+
+                // Headers, the last line is empty
+                for (size_t i = 1; i + 1 < lineEnds.size(); i++)
+                {
+                    if (!getLine(data, lineEnds, i, line))
+                    {
+                        return false;
+                    }
+                    size_t colon = line.find(':');
+                    if ((colon == 0) || (colon == std::string_view::npos))
+                    {
+                        return false;
+                    }
+                    HttpHeaderView header;
+                    header.name = line.substr(0, colon);
+                    if (header.name.find(' ') != std::string_view::npos)
+                    {
+                        return false;
+                    }
+                    size_t value = line.find_first_not_of(' ', colon + 1);
+                    header.value = (value != std::string_view::npos) ? line.substr(value) : std::string_view();
+
+                    int known = classify(header.name);
+                    if (known >= 0)
+                    {
+                        m_known[known] = static_cast<int>(headers.size());
+                    }
+                    headers.push_back(header);
+                }
+                return true;
+            }
+
+            static bool equalsIgnoreCase(std::string_view str, std::string_view other)
+            {
+                if (str.size() != other.size())
+                {
+                    return false;
+                }
+                for (size_t i = 0; i < str.size(); i++)
+                {
+                    if (toLower(str[i]) != toLower(other[i]))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+        private:
+            static char toLower(char ch) { return ((ch >= 'A') && (ch <= 'Z')) ? static_cast<char>(ch + 32) : ch; }
+
+            /// <summary>
+            /// Detect well-known header by name length first, so that most names are
+            /// rejected without comparing them.
+            /// </summary>
+            /// <returns>KnownHeader or -1</returns>
+            static int classify(std::string_view name)
+            {
+                switch (name.size())
+                {
+                case 4:
+                    return equalsIgnoreCase(name, "Host") ? Host : -1;
+                case 6:
+                    return equalsIgnoreCase(name, "Expect") ? Expect : -1;
+                case 10:
+                    return equalsIgnoreCase(name, "Connection") ? Connection : -1;
+                case 14:
+                    return equalsIgnoreCase(name, "Content-Length") ? ContentLength : -1;
+                case 15:
+                    return equalsIgnoreCase(name, "Accept-Encoding") ? AcceptEncoding : -1;
+                case 17:
+                    return equalsIgnoreCase(name, "Transfer-Encoding") ? TransferEncoding : -1;
+                default:
+                    return -1;
+                }
+            }
+
+            /// <summary>
+            /// Get line without its CRLF or LF. Lines with a bare CR are rejected.
+            /// </summary>
+            static bool getLine(std::string_view data, std::vector<uint32_t> const& lineEnds, size_t index,
+                std::string_view& line)
+            {
+                size_t begin = (index == 0) ? 0 : (lineEnds[index - 1] + 1);
+                size_t end = lineEnds[index];
+                if ((end > begin) && (data[end - 1] == '\r'))
+                {
+                    end--;
+                }
+                line = data.substr(begin, end - begin);
+                return std::memchr(line.data(), '\r', line.size()) == nullptr;
+            }
+
+            int m_known[KnownHeaderCount]{ -1, -1, -1, -1, -1, -1 };
+        };
+
+        /// <summary>
+        /// Incremental decoder of a chunked body. Data of every chunk is handed over in place,
+        /// in as many pieces as it arrives in, so that the body is never assembled in memory.
+        /// Chunk extensions and trailers are skipped.
+        /// </summary>
+        class HttpChunkedDecoder
+        {
+        public:
+            enum Result
+            {
+                NeedMore,  // All input is consumed, the body continues
+                Done,      // Body ended, the bytes after it are not consumed
+                Error      // Malformed chunk, or the data callback stopped decoding
+            };
+
+            static constexpr size_t const MaxLineLength = 4096;  // Size line or trailer field
+
+            /// <summary>
+            /// Decode bytes received since the previous call.
+            /// </summary>
+            /// <param name="data">Received bytes</param>
+            /// <param name="consumed">Number of bytes decoded</param>
+            /// <param name="onData">Called with pieces of chunk data, returns false to stop</param>
+            template <typename F>
+            Result decode(std::string_view data, size_t& consumed, F&& onData)
+            {
+                size_t pos = 0;
+                Result result = NeedMore;
+                while ((pos < data.size()) && (result == NeedMore))
+                {
+                    if (m_state == ChunkData)
+                    {
+                        size_t size = static_cast<size_t>(std::min<uint64_t>(m_remaining, data.size() - pos));
+                        if (!onData(data.substr(pos, size)))
+                        {
+                            result = Error;
+                            break;
+                        }
+                        pos += size;
+                        m_remaining -= size;
+                        if (m_remaining == 0)
+                        {
+                            m_state = ChunkEnd;
+                        }
+                        continue;
+                    }
+                    result = step(data[pos++]);
+                }
+                consumed = pos;
+                return result;
+            }
+
+            /// <summary>
+            /// Start decoding the next body.
+            /// </summary>
+            void reset()
+            {
+                m_state = Size;
+                m_remaining = 0;
+                m_digits = 0;
+                m_lineLength = 0;
+                m_field = false;
+            }
+
+        private:
+            enum State
+            {
+                Size,       // Hex digits of the chunk size
+                Extension,  // Up to the end of the size line
+                ChunkData,
+                ChunkEnd,   // CRLF after the data
+                Trailer     // Trailer fields up to the empty line
+            };
+
+            Result step(char ch)
+            {
+                if ((ch != '\n') && (++m_lineLength > MaxLineLength))
+                {
+                    return Error;
+                }
+                switch (m_state)
+                {
+                case Size:
+                {
+                    int digit = hexDigit(ch);
+                    if (digit >= 0)
+                    {
+                        // Sizes over 2^60 are rejected, before they overflow
+                        if (m_remaining >> 60)
+                        {
+                            return Error;
+                        }
+                        m_remaining = (m_remaining << 4) | static_cast<uint64_t>(digit);
+                        m_digits++;
+                        return NeedMore;
+                    }
+                    if (m_digits == 0)
+                    {
+                        return Error;
+                    }
+                    m_state = Extension;
+                    return (ch == '\n') ? endSizeLine() : NeedMore;
+                }
+                case Extension:
+                    return (ch == '\n') ? endSizeLine() : NeedMore;
+                case ChunkEnd:
+                    if (ch == '\r')
+                    {
+                        return NeedMore;
+                    }
+                    if (ch != '\n')
+                    {
+                        return Error;
+                    }
+                    m_state = Size;
+                    m_digits = 0;
+                    m_lineLength = 0;
+                    return NeedMore;
+                case Trailer:
+                    if (ch != '\n')
+                    {
+                        m_field |= (ch != '\r');
+                        return NeedMore;
+                    }
+                    {
+                        // Empty line, possibly with CR, ends the body
+                        bool empty = !m_field;
+                        m_field = false;
+                        m_lineLength = 0;
+                        return empty ? Done : NeedMore;
+                    }
+                case ChunkData:
+                    break;
+                }
+                return Error;
+            }
+
+            Result endSizeLine()
+            {
+                m_lineLength = 0;
+                m_state = (m_remaining != 0) ? ChunkData : Trailer;
+                return NeedMore;
+            }
+
+            static int hexDigit(char ch)
+            {
+                if ((ch >= '0') && (ch <= '9'))
+                {
+                    return ch - '0';
+                }
+                if ((ch >= 'a') && (ch <= 'f'))
+                {
+                    return ch - 'a' + 10;
+                }
+                if ((ch >= 'A') && (ch <= 'F'))
+                {
+                    return ch - 'A' + 10;
+                }
+                return -1;
+            }
+
+            State m_state{ Size };
+            uint64_t m_remaining{ 0 };
+            size_t m_digits{ 0 };
+            size_t m_lineLength{ 0 };
+            bool m_field{ false };  // Trailer line is not empty
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,183 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+SOCKETSHPP_NS_BEGIN
+namespace http
+{
+    namespace server
+    {
+
+        /// <summary>
+        /// Router of request paths to handlers registered for path prefixes. Prefixes are
+        /// compiled into a radix tree, every node of which keeps the list of routes matching
+        /// all paths that reach it, so that lookup takes one walk down the path.
+        /// </summary>
+        template <typename Handler>
+        class HttpRouter
+        {
+        public:
+            struct Route
+            {
+                std::string prefix;
+                Handler* handler;
+            };
+
+            /// <summary>
+            /// Compile routes, replacing the previous ones. Routes without a handler are skipped.
+            /// </summary>
+            /// <param name="routes">Routes in the order they are tried</param>
+            void build(std::vector<Route> routes)
+            {
+                m_routes.clear();
+                m_nodes.clear();
+                m_nodes.emplace_back();
+                for (auto& route : routes)
+                {
+                    if (route.handler != nullptr)
+                    {
+                        uint32_t index = static_cast<uint32_t>(m_routes.size());
+                        m_nodes[insert(route.prefix)].matches.push_back(index);
+                        m_routes.push_back(std::move(route));
+                    }
+                }
+                inherit(0, {});
+            }
+
+            size_t size() const { return m_routes.size(); }
+
+            /// <summary>
+            /// Call f for every route whose prefix starts the path, in the order of the routes,
+            /// until it returns true.
+            /// </summary>
+            /// <returns>true if f accepted a route</returns>
+            template <typename F>
+            bool match(std::string_view path, F&& f) const
+            {
+                if (m_nodes.empty())
+                {
+                    return false;
+                }
+                Node const* node = &m_nodes[0];
+                size_t pos = 0;
+                while (pos < path.size())
+                {
+                    char const* edge = static_cast<char const*>(
+                        std::memchr(node->firstBytes.data(), path[pos], node->firstBytes.size()));
+                    if (edge == nullptr)
+                    {
+                        break;
+                    }
+                    size_t index = static_cast<size_t>(edge - node->firstBytes.data());
+                    Node const* child = &m_nodes[node->children[index]];
+                    std::string_view label = child->label;
+                    if (path.compare(pos, label.size(), label) != 0)
+                    {
+                        break;
+                    }
+                    pos += label.size();
+                    node = child;
+                }
+                for (uint32_t index : node->matches)
+                {
+                    if (f(m_routes[index]))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+        private:
+            struct Node
+            {
+                std::string label;              // Edge from the parent
+                std::string firstBytes;         // First byte of every child label
+                std::vector<uint32_t> children;
+                std::vector<uint32_t> matches;  // Routes matching paths that reach the node
+            };
+
+            /// <summary>
+            /// Add prefix to the tree, splitting edges as needed.
+            /// </summary>
+            /// <returns>Node of the prefix</returns>
+            uint32_t insert(std::string_view prefix)
+            {
+                uint32_t node = 0;
+                size_t pos = 0;
+                while (pos < prefix.size())
+                {
+                    size_t edge = m_nodes[node].firstBytes.find(prefix[pos]);
+                    if (edge == std::string::npos)
+                    {
+                        uint32_t child = addNode(std::string(prefix.substr(pos)));
+                        m_nodes[node].firstBytes += prefix[pos];
+                        m_nodes[node].children.push_back(child);
+                        return child;
+                    }
+
+                    uint32_t child = m_nodes[node].children[edge];
+                    std::string_view label = m_nodes[child].label;
+                    size_t common = 0;
+                    while ((common < label.size()) && (pos + common < prefix.size()) &&
+                        (label[common] == prefix[pos + common]))
+                    {
+                        common++;
+                    }
+                    if (common < label.size())
+                    {
+                        // Split the edge: the new node takes the common part
+                        std::string commonLabel(label.substr(0, common));
+                        uint32_t split = addNode(std::move(commonLabel));
+                        m_nodes[child].label.erase(0, common);
+                        m_nodes[split].firstBytes += m_nodes[child].label[0];
+                        m_nodes[split].children.push_back(child);
+                        m_nodes[node].children[edge] = split;
+                        child = split;
+                    }
+                    node = child;
+                    pos += common;
+                }
+                return node;
+            }
+
+            uint32_t addNode(std::string label)
+            {
+                m_nodes.emplace_back();
+                m_nodes.back().label = std::move(label);
+                return static_cast<uint32_t>(m_nodes.size() - 1);
+            }
+
+            /// <summary>
+            /// Merge routes of the ancestors into every node, keeping route order.
+            /// </summary>
+            void inherit(uint32_t node, std::vector<uint32_t> const& inherited)
+            {
+                std::vector<uint32_t> matches;
+                matches.reserve(inherited.size() + m_nodes[node].matches.size());
+                std::merge(inherited.begin(), inherited.end(), m_nodes[node].matches.begin(),
+                    m_nodes[node].matches.end(), std::back_inserter(matches));
+                m_nodes[node].matches = std::move(matches);
+                for (size_t i = 0; i < m_nodes[node].children.size(); i++)
+                {
+                    inherit(m_nodes[node].children[i], m_nodes[node].matches);
+                }
+            }
+
+            std::vector<Route> m_routes;
+            std::vector<Node> m_nodes;
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
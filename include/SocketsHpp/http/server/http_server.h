@@ -4,11 +4,31 @@
 
 #include <SocketsHpp/config.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
-
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "./http_compression.h"
+#include "./http_request_parser.h"
+#include "./http_router.h"
+#include "./websocket.h"
+#include "../../net/common/metrics.h"
+#include "../../net/common/reactor_pool.h"
+#include "../../net/common/send_budget.h"
+#include "../../net/common/thread_pool.h"
 #include "../../net/common/socket_tools.h"
+#include "../../net/common/task.h"
+#include "../../net/common/tls.h"
 
 SOCKETSHPP_NS_BEGIN
 namespace http
@@ -16,10 +36,19 @@ namespace http
     namespace server
     {
 
+        using BufferPool = net::utils::BufferPool;
+        using Counter = net::utils::Counter;
+        using LatencyHistogram = net::utils::LatencyHistogram;
         using Reactor = net::utils::Reactor;
+        using ReactorMetrics = net::utils::ReactorMetrics;
+        using ReactorPool = net::utils::ReactorPool;
+        using SendBudget = net::utils::SendBudget;
         using Socket = net::utils::Socket;
         using SocketAddr = net::utils::SocketAddr;
         using SocketParams = net::utils::SocketParams;
+        using ThreadPool = net::utils::ThreadPool;
+        using TlsContext = net::utils::TlsContext;
+        using TlsSession = net::utils::TlsSession;
 
         static constexpr const char* CONTENT_TYPE = "Content-Type";
         static constexpr const char* CONTENT_TYPE_TEXT = "text/plain";
@@ -31,24 +60,290 @@ namespace http
             std::string method;
             std::string uri;
             std::string protocol;
-            std::map<std::string, std::string> headers;
+            std::map<std::string, std::string> headers;  // Not filled if disabled, see setRequestHeadersMap
             std::string content;
+            HttpRequestHead head;  // Parsed in place, valid only while the request is handled
+        };
+
+        /// <summary>
+        /// File sent as response body. The server streams it with Socket::sendfile,
+        /// so that the contents are never copied to user space, or sends it from
+        /// memory once the file has been loaded.
+        /// </summary>
+        class HttpFile
+        {
+        public:
+            /// <summary>
+            /// Open regular file for reading. Size and modification time are taken once,
+            /// when the file is opened.
+            /// </summary>
+            /// <param name="path">File path</param>
+            /// <returns>nullptr if the file can't be opened or is not a regular file</returns>
+            static std::shared_ptr<HttpFile> open(const std::string& path)
+            {
+#ifdef _WIN32
+                HANDLE handle = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+                if (handle == INVALID_HANDLE_VALUE)
+                {
+                    return nullptr;
+                }
+                LARGE_INTEGER size;
+                FILETIME modified;
+                if ((::GetFileType(handle) != FILE_TYPE_DISK) || !::GetFileSizeEx(handle, &size) ||
+                    !::GetFileTime(handle, NULL, NULL, &modified))
+                {
+                    ::CloseHandle(handle);
+                    return nullptr;
+                }
+                return std::shared_ptr<HttpFile>(
+                    new HttpFile(handle, static_cast<uint64_t>(size.QuadPart), toTime(modified)));
+#else
+                int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    return nullptr;
+                }
+                struct stat st;
+                if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+                {
+                    ::close(fd);
+                    return nullptr;
+                }
+                return std::shared_ptr<HttpFile>(new HttpFile(fd, static_cast<uint64_t>(st.st_size), st.st_mtime));
+#endif
+            }
+
+            /// <summary>
+            /// Get size and modification time of a regular file without opening it.
+            /// </summary>
+            /// <returns>false if the file doesn't exist or is not a regular file</returns>
+            static bool stat(const std::string& path, uint64_t& size, time_t& lastModified)
+            {
+#ifdef _WIN32
+                WIN32_FILE_ATTRIBUTE_DATA attributes;
+                if (!::GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes) ||
+                    (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                {
+                    return false;
+                }
+                size = (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+                lastModified = toTime(attributes.ftLastWriteTime);
+#else
+                struct stat st;
+                if ((::stat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode))
+                {
+                    return false;
+                }
+                size = static_cast<uint64_t>(st.st_size);
+                lastModified = st.st_mtime;
+#endif
+                return true;
+            }
+
+            /// <summary>
+            /// Loaded file with the given contents, e.g. a compressed variant of another one.
+            /// </summary>
+            static std::shared_ptr<HttpFile> fromMemory(std::string contents, time_t lastModified)
+            {
+#ifdef _WIN32
+                std::shared_ptr<HttpFile> file(new HttpFile(INVALID_HANDLE_VALUE, contents.size(), lastModified));
+#else
+                std::shared_ptr<HttpFile> file(new HttpFile(-1, contents.size(), lastModified));
+#endif
+                file->m_contents = std::move(contents);
+                file->m_loaded = true;
+                return file;
+            }
+
+            HttpFile(const HttpFile&) = delete;
+            HttpFile& operator=(const HttpFile&) = delete;
+
+            ~HttpFile() { closeHandle(); }
+
+            Socket::FileHandle handle() const { return m_handle; }
+
+            uint64_t size() const { return m_size; }
+
+            time_t lastModified() const { return m_lastModified; }
+
+            /// <summary>
+            /// Contents of a loaded file, nullptr if the file is streamed.
+            /// </summary>
+            char const* data() const { return m_loaded ? m_contents.data() : nullptr; }
+
+            /// <summary>
+            /// Read the whole file into memory and close it. The contents are immutable
+            /// afterwards: call it before the file is shared between responses.
+            /// </summary>
+            /// <returns>false if the file could not be read, then it stays open</returns>
+            bool load()
+            {
+                if (m_loaded)
+                {
+                    return true;
+                }
+                if (!read(0, static_cast<size_t>(m_size), m_contents))
+                {
+                    m_contents.clear();
+                    return false;
+                }
+                m_loaded = true;
+                closeHandle();
+                return true;
+            }
+
+            /// <summary>
+            /// Read part of the file, for connections that can't send it directly.
+            /// </summary>
+            /// <returns>false if fewer than count bytes could be read</returns>
+            bool read(uint64_t offset, size_t count, std::string& result) const
+            {
+                if (m_loaded)
+                {
+                    result.assign(m_contents, static_cast<size_t>(std::min<uint64_t>(offset, m_size)), count);
+                    return result.size() == count;
+                }
+                result.resize(count);
+                size_t total = 0;
+                while (total < count)
+                {
+#ifdef _WIN32
+                    OVERLAPPED overlapped = {};
+                    overlapped.Offset = static_cast<DWORD>(offset + total);
+                    overlapped.OffsetHigh = static_cast<DWORD>((offset + total) >> 32);
+                    DWORD length = 0;
+                    DWORD chunk = static_cast<DWORD>(std::min<size_t>(count - total, 0x40000000));
+                    if (!::ReadFile(m_handle, &result[total], chunk, &length, &overlapped) || (length == 0))
+                    {
+                        break;
+                    }
+#else
+                    ssize_t length =
+                        ::pread(m_handle, &result[total], count - total, static_cast<off_t>(offset + total));
+                    if (length <= 0)
+                    {
+                        if ((length < 0) && (errno == EINTR))
+                        {
+                            continue;
+                        }
+                        break;
+                    }
+#endif
+                    total += static_cast<size_t>(length);
+                }
+                result.resize(total);
+                return total == count;
+            }
+
+        private:
+            HttpFile(Socket::FileHandle handle, uint64_t size, time_t lastModified)
+                : m_handle(handle), m_size(size), m_lastModified(lastModified)
+            {
+            }
+
+#ifdef _WIN32
+            static time_t toTime(FILETIME const& fileTime)
+            {
+                // 100ns intervals since 1601 to seconds since 1970
+                ULARGE_INTEGER ticks;
+                ticks.LowPart = fileTime.dwLowDateTime;
+                ticks.HighPart = fileTime.dwHighDateTime;
+                return static_cast<time_t>((ticks.QuadPart - 116444736000000000ULL) / 10000000ULL);
+            }
+#endif
+
+            void closeHandle()
+            {
+#ifdef _WIN32
+                if (m_handle != INVALID_HANDLE_VALUE)
+                {
+                    ::CloseHandle(m_handle);
+                    m_handle = INVALID_HANDLE_VALUE;
+                }
+#else
+                if (m_handle >= 0)
+                {
+                    ::close(m_handle);
+                    m_handle = -1;
+                }
+#endif
+            }
+
+            Socket::FileHandle m_handle;
+            uint64_t m_size;
+            time_t m_lastModified;
+            bool m_loaded{ false };
+            std::string m_contents;
         };
 
+        /// <summary>
+        /// Producer of a response body that is generated while it is sent. It is pulled whenever
+        /// the socket can take more data, and appends the next part of the body to the buffer
+        /// (at least one byte, a few KiB to a few hundred KiB is best).
+        /// Returns false once the body is complete.
+        /// </summary>
+        using BodyProducer = std::function<bool(std::string& buffer)>;
+
+        class WebSocketHandler;
+
         struct HttpResponse
         {
             int code;
             std::string message;
             std::map<std::string, std::string> headers;
             std::string body;
+            std::shared_ptr<HttpFile> file;  // Sent as the body instead of `body`, if set
+            std::string rawHeaders;          // Pre-serialized "Name: value\r\n" lines sent after `headers`
+            // Generates the body instead of `body`, with chunked transfer coding for HTTP/1.1
+            // clients, until the connection is closed for HTTP/1.0 ones
+            BodyProducer producer;
+            // Takes the connection over after a 101 response, see WebSocketHandler::upgrade
+            WebSocketHandler* webSocket{ nullptr };
+            bool webSocketDeflate{ false };  // permessage-deflate is negotiated
         };
 
         using CallbackFunction = std::function<int(HttpRequest const& request, HttpResponse& response)>;
 
+        /// <summary>
+        /// Receiver of a request body, called with every piece of it as it arrives instead of
+        /// collecting it in HttpRequest::content. Returns 0 to go on, or a status code that
+        /// rejects the request.
+        /// </summary>
+        using BodyFunction = std::function<int(HttpRequest const& request, std::string_view data)>;
+
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+        template <typename T = void>
+        using Task = net::utils::Task<T>;
+
+        /// <summary>
+        /// Handler coroutine: suspends the connection while it awaits sockets or timers of the
+        /// reactor, see net::utils::readable(), writable() and sleepFor(). The request and the
+        /// response stay valid until it completes.
+        /// </summary>
+        using CoroutineFunction = std::function<Task<int>(HttpRequest const& request, HttpResponse& response)>;
+#endif
+
         class HttpRequestCallback
         {
+        public:
+            /// <summary>
+            /// Where the handler runs: on the reactor thread, or on a worker thread of the
+            /// server, so that a blocking handler doesn't stall other connections.
+            /// </summary>
+            enum Execution
+            {
+                Inline,
+                Offload
+            };
+
         protected:
             CallbackFunction callback = nullptr;
+            Execution execution_ = Inline;
+            BodyFunction bodyCallback = nullptr;
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+            CoroutineFunction coroutine = nullptr;
+#endif
 
         public:
             HttpRequestCallback() {};
@@ -56,9 +351,44 @@ namespace http
             HttpRequestCallback& operator=(HttpRequestCallback other)
             {
                 callback = other.callback;
+                execution_ = other.execution_;
+                bodyCallback = other.bodyCallback;
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+                coroutine = other.coroutine;
+#endif
                 return *this;
             };
 
+            HttpRequestCallback& setExecution(Execution execution)
+            {
+                execution_ = execution;
+                return *this;
+            }
+
+            Execution execution() const { return execution_; }
+
+            /// <summary>
+            /// Stream request bodies: the first matching handler with a body callback receives
+            /// the body of the request as it arrives, before any handler is called for the request.
+            /// Its size isn't limited by setRequestLimits then. Body callbacks run on the reactor thread.
+            /// </summary>
+            HttpRequestCallback& setBodyCallback(BodyFunction func)
+            {
+                bodyCallback = func;
+                return *this;
+            }
+
+            virtual bool streamsBody() const { return bodyCallback != nullptr; }
+
+            virtual int onHttpRequestBody(HttpRequest const& request, std::string_view data)
+            {
+                if (bodyCallback != nullptr)
+                {
+                    return bodyCallback(request, data);
+                }
+                return 0;
+            }
+
             HttpRequestCallback(CallbackFunction func) : callback(func) {};
 
             HttpRequestCallback& operator=(CallbackFunction func)
@@ -75,481 +405,2262 @@ namespace http
                 }
                 return 0;
             };
+
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+            HttpRequestCallback(CoroutineFunction func) : coroutine(func) {};
+
+            HttpRequestCallback& operator=(CoroutineFunction func)
+            {
+                coroutine = func;
+                return (*this);
+            }
+
+            /// <summary>
+            /// Whether the handler is a coroutine, then it runs on the reactor thread and
+            /// the server calls onHttpRequestAsync instead of onHttpRequest.
+            /// </summary>
+            virtual bool isCoroutine() const { return coroutine != nullptr; }
+
+            virtual Task<int> onHttpRequestAsync(HttpRequest const& request, HttpResponse& response)
+            {
+                return coroutine(request, response);
+            }
+#endif
         };
 
-        // Simple HTTP server
-        // Goals:
-        //   - Support enough of HTTP to be used as a mock
-        //   - Be flexible to allow creating various test scenarios
-        // Out of scope:
-        //   - Performance
-        //   - Full support of RFC 7230-7237
-        class HttpServer : private Reactor::SocketCallback
+        class WebSocket;
+
+        /// <summary>
+        /// WebSocket endpoint: answers upgrade requests of its path with 101 Switching Protocols,
+        /// then the server hands the connection over to the callbacks, on the same reactor thread.
+        /// The callback function of the base class runs first, e.g. to authorize the upgrade: a
+        /// status code it returns rejects the request. Must outlive the server.
+        /// </summary>
+        class WebSocketHandler : public HttpRequestCallback
         {
-        protected:
-            struct Connection
-            {
-                Socket socket;
-                std::string receiveBuffer;
-                std::string sendBuffer;
-                enum
-                {
-                    Idle,
-                    ReceivingHeaders,
-                    Sending100Continue,
-                    ReceivingBody,
-                    Processing,
-                    SendingHeaders,
-                    SendingBody,
-                    Closing
-                } state;
-                size_t contentLength;
-                bool keepalive;
-                HttpRequest request;
-                HttpResponse response;
-            };
+        public:
+            std::function<void(WebSocket& ws)> onOpen;
+            // The message is only valid during the call
+            std::function<void(WebSocket& ws, std::string_view message, bool binary)> onMessage;
+            // Once the connection is gone, with the code of the peer, 1006 if it didn't send one
+            std::function<void(WebSocket& ws, uint16_t code)> onClose;
 
-            std::string m_serverHost;
-            bool allowKeepalive{ true };
-            Reactor m_reactor;
-            std::list<Socket> m_listeningSockets;
+            std::vector<std::string> protocols;  // Subprotocols, the first one the client offers is selected
+            bool deflate{ true };                // Negotiate permessage-deflate, if it is compiled in
+            size_t deflateMinSize{ 128 };        // Smaller messages are sent uncompressed
+            size_t maxMessageSize{ 16 * 1024 * 1024 };  // Larger messages close with 1009, 0 - unlimited
+            // Unsent bytes of a connection before it is dropped as too slow, 0 - unlimited
+            size_t maxQueuedBytes{ 16 * 1024 * 1024 };
 
-            class HttpRequestHandler : public std::pair<std::string, HttpRequestCallback*>
+            WebSocketHandler() = default;
+
+            explicit WebSocketHandler(CallbackFunction func) : HttpRequestCallback(func) {}
+
+            virtual int onHttpRequest(HttpRequest const& request, HttpResponse& response) override
             {
-            public:
-                HttpRequestHandler(std::string key, HttpRequestCallback* value)
+                int result = HttpRequestCallback::onHttpRequest(request, response);
+                return (result != 0) ? result : upgrade(request, response);
+            }
+
+            /// <summary>
+            /// Validate the opening handshake and set up the 101 response: the accept key, the
+            /// subprotocol and the extensions.
+            /// </summary>
+            /// <returns>101, or the status code that rejects the request</returns>
+            int upgrade(HttpRequest const& request, HttpResponse& response)
+            {
+                HttpRequestHead const& head = request.head;
+                HttpHeaderView const* upgradeHeader = head.find("Upgrade");
+                HttpHeaderView const* connection = head.find(HttpRequestHead::Connection);
+                if ((upgradeHeader == nullptr) || !WebSocketHandshake::hasToken(upgradeHeader->value, "websocket") ||
+                    (connection == nullptr) || !WebSocketHandshake::hasToken(connection->value, "upgrade"))
                 {
-                    first = key;
-                    second = value;
-                };
+                    response.headers["Upgrade"] = "websocket";
+                    return 426;  // Upgrade Required
+                }
+                if (head.method != "GET")
+                {
+                    response.headers["Allow"] = "GET";
+                    return 405;  // Method Not Allowed
+                }
+                HttpHeaderView const* key = head.find("Sec-WebSocket-Key");
+                if ((head.protocol != "HTTP/1.1") || (key == nullptr) || !WebSocketHandshake::validKey(key->value))
+                {
+                    return 400;  // Bad Request
+                }
+                HttpHeaderView const* version = head.find("Sec-WebSocket-Version");
+                if ((version == nullptr) || (WebSocketHandshake::trim(version->value) != "13"))
+                {
+                    response.headers["Upgrade"] = "websocket";
+                    response.headers["Sec-WebSocket-Version"] = "13";
+                    return 426;  // Upgrade Required
+                }
 
-                HttpRequestHandler() : std::pair<std::string, HttpRequestCallback*>()
+                response.headers["Upgrade"] = "websocket";
+                response.headers["Sec-WebSocket-Accept"] = WebSocketHandshake::acceptKey(key->value);
+                HttpHeaderView const* offered = head.find("Sec-WebSocket-Protocol");
+                for (std::string_view list = (offered != nullptr) ? offered->value : std::string_view(); !list.empty();)
                 {
-                    first = "";
-                    second = nullptr;
-                };
+                    size_t end = list.find(',');
+                    std::string_view protocol = WebSocketHandshake::trim(list.substr(0, end));
+                    list = (end == std::string_view::npos) ? std::string_view() : list.substr(end + 1);
+                    if (std::find(protocols.begin(), protocols.end(), protocol) != protocols.end())
+                    {
+                        response.headers["Sec-WebSocket-Protocol"] = std::string(protocol);
+                        break;
+                    }
+                }
+                HttpHeaderView const* extensions = head.find("Sec-WebSocket-Extensions");
+                response.webSocketDeflate = deflate && WebSocketDeflate::available() && (extensions != nullptr) &&
+                    WebSocketHandshake::acceptsDeflate(extensions->value);
+                if (response.webSocketDeflate)
+                {
+                    response.headers["Sec-WebSocket-Extensions"] = WebSocketHandshake::DeflateResponse;
+                }
+                response.webSocket = this;
+                return 101;  // Switching Protocols
+            }
+        };
 
-                HttpRequestHandler& operator=(std::pair<std::string, HttpRequestCallback*> other)
+        /// <summary>
+        /// Upgraded connection, owned by the server until onClose returns. Its methods must be
+        /// called on the reactor thread of the connection: from the callbacks of the handler, or
+        /// through Reactor::execute. Other threads reach the connections with HttpServer::broadcast.
+        /// </summary>
+        class WebSocket
+        {
+        public:
+            WebSocket(WebSocketHandler& handler, HttpRequest const& request, bool deflate, std::string protocol)
+                : m_handler(handler), m_request(request), m_deflate(deflate), m_protocol(std::move(protocol))
+            {
+                m_reader.reset(deflate, handler.maxMessageSize);
+            }
+
+            WebSocket(const WebSocket&) = delete;
+            WebSocket& operator=(const WebSocket&) = delete;
+
+            /// <summary>
+            /// Queue a message and send as much of the queue as the socket takes.
+            /// </summary>
+            /// <returns>false if the connection is closing</returns>
+            bool send(std::string_view message, bool binary = false)
+            {
+                if (m_closeSent)
                 {
-                    first = other.first;
-                    second = other.second;
-                    return (*this);
-                };
+                    return false;
+                }
+                uint8_t opcode = binary ? WebSocketFrame::Binary : WebSocketFrame::Text;
+                Frame frame;
+                // Reused by the connections of the thread
+                thread_local std::string compressed;
+                if (m_deflate && (message.size() >= m_handler.deflateMinSize) &&
+                    WebSocketDeflate::compress(message, compressed) && (compressed.size() < message.size()))
+                {
+                    WebSocketFrame::serialize(frame.own, opcode, compressed, true);
+                }
+                else
+                {
+                    WebSocketFrame::serialize(frame.own, opcode, message);
+                }
+                queue(std::move(frame));
+                flush();
+                return !m_failed;
+            }
 
-                HttpRequestHandler& operator=(HttpRequestCallback& cb)
+            /// <summary>
+            /// Send a Ping, the client answers with a Pong.
+            /// </summary>
+            /// <returns>false if the connection is closing or the payload is over 125 bytes</returns>
+            bool ping(std::string_view payload = std::string_view())
+            {
+                if (m_closeSent || (payload.size() > WebSocketFrame::MaxControlSize))
                 {
-                    second = &cb;
-                    return (*this);
-                };
+                    return false;
+                }
+                queueControl(WebSocketFrame::Ping, payload);
+                flush();
+                return !m_failed;
+            }
 
-                HttpRequestHandler& operator=(HttpRequestCallback* cb)
+            /// <summary>
+            /// Start the close handshake. Messages that arrive until the client answers are dropped.
+            /// </summary>
+            /// <param name="reason">Truncated to fit into a control frame</param>
+            void close(uint16_t code = WebSocketFrame::NormalClosure, std::string_view reason = std::string_view())
+            {
+                if (m_closeSent)
                 {
-                    second = cb;
-                    return (*this);
-                };
+                    return;
+                }
+                char payload[WebSocketFrame::MaxControlSize];
+                payload[0] = static_cast<char>(code >> 8);
+                payload[1] = static_cast<char>(code & 0xFF);
+                size_t size = std::min(reason.size(), sizeof(payload) - 2);
+                std::memcpy(payload + 2, reason.data(), size);
+                queueControl(WebSocketFrame::Close, std::string_view(payload, size + 2));
+                m_closeSent = true;
+                flush();
+            }
+
+            /// <summary>
+            /// Upgrade request, with the headers of the client.
+            /// </summary>
+            HttpRequest const& request() const { return m_request; }
+
+            WebSocketHandler& handler() const { return m_handler; }
+
+            /// <summary>
+            /// Selected subprotocol, empty if there is none.
+            /// </summary>
+            std::string const& protocol() const { return m_protocol; }
+
+            /// <summary>
+            /// Whether permessage-deflate is negotiated.
+            /// </summary>
+            bool deflate() const { return m_deflate; }
+
+            /// <summary>
+            /// Whether the server sent its Close frame, no more messages can be sent.
+            /// </summary>
+            bool closing() const { return m_closeSent; }
+
+            /// <summary>
+            /// Bytes of queued frames that are not sent yet.
+            /// </summary>
+            size_t queuedBytes() const { return m_queued - m_offset; }
+
+        private:
+            friend class HttpServer;
+
+            /// <summary>
+            /// Serialized frame, its own or shared with the other connections of a broadcast.
+            /// </summary>
+            struct Frame
+            {
+                std::shared_ptr<std::string const> shared;
+                std::string own;
+
+                std::string_view data() const { return shared ? std::string_view(*shared) : std::string_view(own); }
             };
 
-            std::list<HttpRequestHandler> m_handlers;
+            void flush()
+            {
+                if (m_flush)
+                {
+                    m_flush();
+                }
+            }
 
-            std::map<Socket, Connection> m_connections;
-            size_t m_maxRequestHeadersSize, m_maxRequestContentSize;
+            void queue(Frame frame)
+            {
+                m_queued += frame.data().size();
+                m_frames.push_back(std::move(frame));
+            }
 
-        public:
-            void setKeepalive(bool keepAlive) { allowKeepalive = keepAlive; }
+            void queueControl(uint8_t opcode, std::string_view payload)
+            {
+                Frame frame;
+                WebSocketFrame::serialize(frame.own, opcode, payload);
+                queue(std::move(frame));
+            }
 
-            HttpServer()
-                : m_serverHost("unnamed"),
-                allowKeepalive(true),
-                m_reactor(*this),
-                m_maxRequestHeadersSize(8192),
-                m_maxRequestContentSize(2 * 1024 * 1024) {};
+            /// <summary>
+            /// Close with a status code: send the Close frame, if not sent yet, and stop reading.
+            /// </summary>
+            void fail(uint16_t code)
+            {
+                if (!m_closeSent)
+                {
+                    char payload[2] = { static_cast<char>(code >> 8), static_cast<char>(code & 0xFF) };
+                    queueControl(WebSocketFrame::Close, std::string_view(payload, 2));
+                    m_closeSent = true;
+                }
+                m_failed = true;
+                m_closeCode = code;
+            }
+
+            /// <summary>
+            /// Give up the connection without the close handshake.
+            /// </summary>
+            void abort()
+            {
+                m_frames.clear();
+                m_queued = 0;
+                m_offset = 0;
+                m_closeSent = true;
+                m_failed = true;
+            }
+
+            /// <summary>
+            /// Drop the frames the socket took.
+            /// </summary>
+            void consume(size_t sent)
+            {
+                m_offset += sent;
+                while (!m_frames.empty() && (m_offset >= m_frames.front().data().size()))
+                {
+                    size_t size = m_frames.front().data().size();
+                    m_offset -= size;
+                    m_queued -= size;
+                    m_frames.pop_front();
+                }
+            }
+
+            /// <summary>
+            /// Take the first frame out of the queue, for a completion-based reactor that owns what it sends.
+            /// </summary>
+            std::string take()
+            {
+                Frame& frame = m_frames.front();
+                std::string data = frame.shared ? std::string(*frame.shared) : std::move(frame.own);
+                m_queued -= data.size();
+                m_frames.pop_front();
+                return data;
+            }
+
+            /// <summary>
+            /// Whether the close handshake is complete, or failed, and the queue is sent.
+            /// </summary>
+            bool finished() const { return m_closeSent && (m_closeReceived || m_failed) && m_frames.empty(); }
+
+            WebSocketHandler& m_handler;
+            HttpRequest const& m_request;
+            bool m_deflate;
+            std::string m_protocol;
+            WebSocketReader m_reader;
+            std::deque<Frame> m_frames;  // Not sent yet, in order
+            size_t m_offset{ 0 };       // Bytes of the first frame already sent
+            size_t m_queued{ 0 };       // Bytes of the frames in the queue
+            bool m_closeSent{ false };
+            bool m_closeReceived{ false };
+            bool m_failed{ false };     // Protocol error or lost connection, nothing more is read
+            uint16_t m_closeCode{ WebSocketFrame::AbnormalClosure };  // Reported to onClose
+            std::function<void()> m_flush;  // Set by the server, sends the queue
+        };
+
+        /// <summary>
+        /// Snapshot of the server counters, see HttpServer::metrics(). Counters only grow, the
+        /// connection gauges are computed from them when the snapshot is taken.
+        /// </summary>
+        struct HttpServerMetrics
+        {
+            static constexpr size_t const States = 8;
+            // Connection states in the order of HttpServer::Connection::State
+            static constexpr char const* const StateNames[States] = { "idle", "receiving_headers",
+                "sending_100_continue", "receiving_body", "processing", "sending_response", "closing", "websocket" };
+
+            ReactorMetrics::Snapshot reactors;  // Summed over the reactors of the server
+            uint64_t connectionsOpened{ 0 };
+            uint64_t connectionsClosed{ 0 };
+            uint64_t requests{ 0 };                    // Requests processed, including rejected ones
+            std::array<uint64_t, States> connections{};  // Open connections per state
+            LatencyHistogram processing;               // From the complete request to the queued response, in ns
+
+            uint64_t activeConnections() const
+            {
+                return (connectionsOpened > connectionsClosed) ? connectionsOpened - connectionsClosed : 0;
+            }
+
+            /// <summary>
+            /// Serialize in the Prometheus text exposition format.
+            /// </summary>
+            /// <param name="prefix">Prepended to every metric name</param>
+            std::string toPrometheus(std::string const& prefix = "socketshpp_") const
+            {
+                std::string out;
+                auto header = [&](char const* name, char const* type, char const* help) {
+                    out += "# HELP " + prefix + name + " " + help + "\n";
+                    out += "# TYPE " + prefix + name + " " + type + "\n";
+                };
+                auto counter = [&](char const* name, uint64_t value, char const* help) {
+                    header(name, "counter", help);
+                    out += prefix + name + " " + std::to_string(value) + "\n";
+                };
+                auto number = [](double value) {
+                    char buffer[32];
+                    snprintf(buffer, sizeof(buffer), "%.9g", value);
+                    return std::string(buffer);
+                };
+
+                counter("reactor_wakeups_total", reactors.wakeups, "Returns from the event wait.");
+                counter("reactor_events_total", reactors.events, "Events and completions handled.");
+                counter("reactor_full_wakeups_total", reactors.fullWakeups, "Waits that filled the event batch.");
+                header("reactor_events_per_wakeup", "gauge", "Average events handled per wakeup.");
+                out += prefix + "reactor_events_per_wakeup " + number(reactors.eventsPerWakeup()) + "\n";
+                counter("accepts_total", reactors.accepts, "Connections accepted.");
+                counter("read_bytes_total", reactors.bytesRead, "Bytes received.");
+                counter("written_bytes_total", reactors.bytesWritten, "Bytes sent.");
+                counter("partial_writes_total", reactors.partialWrites, "Sends that took only part of the data.");
+                counter("would_block_total", reactors.wouldBlock, "Receives and sends that would block.");
+
+                counter("http_connections_opened_total", connectionsOpened, "Connections opened.");
+                counter("http_connections_closed_total", connectionsClosed, "Connections closed.");
+                header("http_connections", "gauge", "Open connections by state.");
+                for (size_t i = 0; i < States; i++)
+                {
+                    out += prefix + "http_connections{state=\"" + StateNames[i] + "\"} " +
+                        std::to_string(connections[i]) + "\n";
+                }
+                counter("http_requests_total", requests, "Requests processed.");
+                header("http_request_processing_seconds", "summary",
+                    "Time from the complete request to the queued response.");
+                for (double quantile : { 0.5, 0.9, 0.99, 0.999 })
+                {
+                    out += prefix + "http_request_processing_seconds{quantile=\"" + number(quantile) + "\"} " +
+                        number(static_cast<double>(processing.percentile(quantile)) / 1e9) + "\n";
+                }
+                out += prefix + "http_request_processing_seconds_sum " +
+                    number(static_cast<double>(processing.sum()) / 1e9) + "\n";
+                out += prefix + "http_request_processing_seconds_count " + std::to_string(processing.count()) + "\n";
+                return out;
+            }
+        };
+
+        // Simple HTTP server
+        // Goals:
+        //   - Support enough of HTTP to be used as a mock
+        //   - Be flexible to allow creating various test scenarios
+        // Out of scope:
+        //   - Performance
+        //   - Full support of RFC 7230-7237
+        class HttpServer : private Reactor::SocketCallback
+        {
+        protected:
+            struct QueuedResponse
+            {
+                std::string headers;  // Status line and headers, or "100 Continue"
+                std::string body;
+                std::shared_ptr<HttpFile> file;
+                BodyProducer producer;
+                bool chunked{ false };  // Produced body is sent in chunks
+
+                /// <summary>
+                /// File that has to be streamed with sendfile, is not in memory.
+                /// </summary>
+                bool streamsFile() const { return file && (file->data() == nullptr); }
+
+                /// <summary>
+                /// Body is sent after the gather write, in parts.
+                /// </summary>
+                bool streams() const { return streamsFile() || (producer != nullptr); }
+            };
+
+            /// <summary>
+            /// Queue of responses that keeps the buffers of sent responses for reuse.
+            /// </summary>
+            class ResponseQueue
+            {
+            public:
+                QueuedResponse& push()
+                {
+                    if (m_size == m_items.size())
+                    {
+                        m_items.emplace_back();
+                    }
+                    return m_items[m_size++];
+                }
+
+                void clear()
+                {
+                    for (size_t i = 0; i < m_size; i++)
+                    {
+                        m_items[i].headers.clear();
+                        m_items[i].body.clear();
+                        m_items[i].file.reset();
+                        m_items[i].producer = nullptr;
+                    }
+                    m_size = 0;
+                }
+
+                size_t size() const { return m_size; }
+                bool empty() const { return m_size == 0; }
+                QueuedResponse& operator[](size_t index) { return m_items[index]; }
+                QueuedResponse& back() { return m_items[m_size - 1]; }
+                QueuedResponse const* begin() const { return m_items.data(); }
+                QueuedResponse const* end() const { return m_items.data() + m_size; }
+
+            private:
+                std::vector<QueuedResponse> m_items;
+                size_t m_size{ 0 };
+            };
+
+            using Router = HttpRouter<HttpRequestCallback>;
+
+            /// <summary>
+            /// Connection counters of one reactor, written by its thread and padded to a cache
+            /// line of their own. Connections opened by a reactor may close on another one.
+            /// </summary>
+            struct alignas(64) ConnectionMetrics
+            {
+                Reactor const* reactor{ nullptr };
+                Counter opened;  // Accepted by the thread of the reactor
+                Counter closed;
+                std::array<Counter, HttpServerMetrics::States> entered;  // Transitions into a state
+                std::array<Counter, HttpServerMetrics::States> left;     // Transitions out of it
+                LatencyHistogram processing;
+            };
+
+            struct Connection
+            {
+                Socket socket;
+                Reactor* reactor;
+                ConnectionMetrics* metrics{ nullptr };  // Of the reactor, see setState
+                std::unique_ptr<TlsSession> tls;  // Encrypts the connection, nullptr - plaintext
+                std::string receiveBuffer;
+                std::string requestHead;  // Request line and headers, request.head points into it
+                HttpHeadScanner headScanner;  // Progress of the search for the end of the head
+                // Responses waiting to be sent, in request order. Only the last one may stream
+                // its file or produced body, the others are sent with one gather write.
+                ResponseQueue sendQueue;
+                size_t sendOffset{ 0 };          // Bytes of the gather write already sent
+                uint64_t sendFileOffset{ 0 };    // Bytes of the streamed file already sent
+                std::string produced;            // Part of the produced body being sent, with chunk framing
+                size_t producedOffset{ 0 };      // Bytes of it already sent, or where it starts
+                bool chunked{ false };           // Request body uses chunked transfer coding
+                HttpChunkedDecoder chunkedDecoder;
+                HttpRequestCallback* bodyHandler{ nullptr };  // Receives the request body as it arrives
+                size_t bodyReceived{ 0 };        // Bytes of the streamed body with Content-Length
+                bool receivePaused{ false };     // Socket waits for Writable, not Readable
+                // Handler runs on a worker thread or as a suspended coroutine, the request and
+                // the response belong to it until it returns
+                bool suspended{ false };
+                bool closed{ false };                 // Peer closed while suspended, close once the handler returns
+                Router::Route const* suspendedRoute{ nullptr };
+                int handlerResult{ 0 };
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+                Task<int> task;
+#endif
+                // Deadline of what the connection waits for, see updateTimeout
+                enum TimeoutPhase
+                {
+                    NoTimeout,
+                    IdleTimeout,
+                    HeaderTimeout,
+                    BodyTimeout,
+                    WriteTimeout
+                } timeoutPhase{ NoTimeout };
+                static char const* phaseName(TimeoutPhase phase)
+                {
+                    static char const* const names[] = { "", "idle", "header", "body", "write" };
+                    return names[phase];
+                }
+                Reactor::TimerId timer{ 0 };
+                uint64_t requests{ 0 };          // Heads received, a new request restarts the header deadline
+                uint64_t timeoutRequest{ 0 };    // Request the header deadline was armed for
+                size_t sendAccounted{ 0 };       // Unsent bytes accounted in the send budget
+                bool writePaused{ false };       // Over the send budget, requests wait until the peer takes more
+                enum State
+                {
+                    Idle,
+                    ReceivingHeaders,
+                    Sending100Continue,
+                    ReceivingBody,
+                    Processing,
+                    SendingResponse,
+                    Closing,
+                    Upgraded  // Handed over to a WebSocket handler, see startWebSocket
+                } state;
+                std::chrono::steady_clock::time_point processingStart;
+                static_assert(Upgraded + 1 == HttpServerMetrics::States, "State names don't match the states");
+                size_t contentLength;
+                bool keepalive;
+                HttpRequest request;
+                HttpResponse response;
+                std::unique_ptr<WebSocket> webSocket;  // Once upgraded
+                size_t webSocketIndex{ 0 };            // In the WebSocket list of the reactor
+            };
+
+            /// <summary>
+            /// Upgraded connections of one reactor, accessed by its thread only, see broadcast().
+            /// </summary>
+            struct alignas(64) ReactorWebSockets
+            {
+                Reactor const* reactor{ nullptr };
+                std::vector<Connection*> connections;
+            };
+
+            std::string m_serverHost;
+            std::string m_hostHeader{ "Host: unnamed\r\n" };  // Precomputed from m_serverHost
+            bool allowKeepalive{ true };
+            ReactorPool m_reactors;
+            std::list<Socket> m_listeningSockets;
+            std::map<Socket, std::shared_ptr<TlsContext>> m_tlsListeners;  // Listening sockets that serve TLS
+            bool m_reusePort{ false };
+            size_t m_listenBacklog{ static_cast<size_t>(Socket::MaxBacklog) };
+            int m_deferAccept{ 0 };  // Seconds, 0 - accept before the request arrives
+            int m_fastOpen{ 0 };     // Fast Open queue length, 0 - disabled
+
+            class HttpRequestHandler : public std::pair<std::string, HttpRequestCallback*>
+            {
+            public:
+                HttpRequestHandler(std::string key, HttpRequestCallback* value)
+                {
+                    first = key;
+                    second = value;
+                };
+
+                HttpRequestHandler() : std::pair<std::string, HttpRequestCallback*>()
+                {
+                    first = "";
+                    second = nullptr;
+                };
+
+                HttpRequestHandler& operator=(std::pair<std::string, HttpRequestCallback*> other)
+                {
+                    first = other.first;
+                    second = other.second;
+                    return (*this);
+                };
+
+                HttpRequestHandler& operator=(HttpRequestCallback& cb)
+                {
+                    second = &cb;
+                    return (*this);
+                };
+
+                HttpRequestHandler& operator=(HttpRequestCallback* cb)
+                {
+                    second = cb;
+                    return (*this);
+                };
+            };
+
+            std::list<HttpRequestHandler> m_handlers;
+            Router m_router;  // Compiled from m_handlers by start()
+            std::unique_ptr<ThreadPool> m_workers;  // Runs offloaded handlers
+
+            // Connections of all reactors. The lock only guards the map itself:
+            // every connection is accessed solely by the reactor that owns it,
+            // which finds it in the socket context.
+            std::recursive_mutex m_connectionsMutex;
+            std::map<Socket, Connection> m_connections;
+            // Per reactor, in the order of m_reactors, created by start()
+            std::vector<std::unique_ptr<ConnectionMetrics>> m_metrics;
+            HttpRequestCallback m_metricsHandler;  // Serves metrics(), see enableMetrics
+            // Per reactor, in the order of m_reactors, created by start()
+            std::vector<std::unique_ptr<ReactorWebSockets>> m_webSockets;
+
+            // Largest part of a file body sent by one system call
+            static constexpr size_t const kSendFileChunkSize = 1024 * 1024;
+            // Part of a file read into memory at a time, if TLS can't send it directly
+            static constexpr size_t const kTlsFileChunkSize = 64 * 1024;
+            // Bound of setPipelineDepth, the gather write takes up to 3 buffers per response
+            static constexpr size_t const kMaxPipelineDepth = 64;
+            // WebSocket frames sent by one gather write
+            static constexpr size_t const kMaxWebSocketFrames = 3 * kMaxPipelineDepth;
+            size_t m_maxRequestHeadersSize, m_maxRequestContentSize;
+            bool m_requestHeadersMap{ true };
+            size_t m_pipelineDepth{ 16 };
+            std::chrono::milliseconds m_headerTimeout{ 0 };
+            std::chrono::milliseconds m_bodyTimeout{ 0 };
+            std::chrono::milliseconds m_idleTimeout{ 0 };
+            std::chrono::milliseconds m_writeTimeout{ 0 };
+            SendBudget m_sendBudget;
+            unsigned m_compression{ HttpEncoder::Identity };  // Codings offered, see setCompression
+            size_t m_compressionMinSize{ 0 };
+
+        public:
+            void setKeepalive(bool keepAlive) { allowKeepalive = keepAlive; }
+
+            /// <summary>
+            /// Use edge-triggered event notification, see Reactor::setEdgeTriggered.
+            /// Connections are drained until EAGAIN and state transitions don't re-arm
+            /// the socket with a syscall.
+            /// </summary>
+            void setEdgeTriggered(bool edgeTriggered) { m_reactors.setEdgeTriggered(edgeTriggered); }
+
+            /// <summary>
+            /// Set maximum number of events every reactor harvests per wakeup.
+            /// </summary>
+            void setEventBatchSize(size_t eventBatchSize) { m_reactors.setEventBatchSize(eventBatchSize); }
+
+            /// <summary>
+            /// Set maximum number of connections every reactor accepts per wakeup, see
+            /// Reactor::setAcceptBudget.
+            /// </summary>
+            void setAcceptBudget(size_t acceptBudget) { m_reactors.setAcceptBudget(acceptBudget); }
+
+            /// <summary>
+            /// Set the queue length of connections waiting to be accepted, up to SOMAXCONN, so
+            /// that reconnect storms don't overflow it. Applies to listening ports added later.
+            /// </summary>
+            void setListenBacklog(size_t backlog) { m_listenBacklog = backlog; }
+
+            /// <summary>
+            /// Accept connections once the request arrives (TCP_DEFER_ACCEPT on Linux), so that
+            /// idle connects take no connection state. Applies to listening ports added later.
+            /// </summary>
+            /// <param name="seconds">How long a connection may wait for its request, 0 - off</param>
+            void setDeferAccept(int seconds) { m_deferAccept = seconds; }
+
+            /// <summary>
+            /// Accept requests in the SYN of returning clients (TCP_FASTOPEN). Applies to
+            /// listening ports added later.
+            /// </summary>
+            /// <param name="queueLength">Pending Fast Open connections, 0 - off</param>
+            void setFastOpen(int queueLength) { m_fastOpen = queueLength; }
+
+            /// <summary>
+            /// Select event notification facility, see Reactor::setBackend. On io_uring
+            /// connections are accepted, received and sent by the reactor.
+            /// </summary>
+            /// <returns>false if the backend is not supported, then the default one is used</returns>
+            bool setBackend(Reactor::Backend backend) { return m_reactors.setBackend(backend); }
+
+            /// <summary>
+            /// Make socket tables owned by reactor threads, see Reactor::setThreadOwned.
+            /// Request handling then takes no locks besides accepting and closing connections.
+            /// </summary>
+            /// <returns>false if not supported, then reactors keep locking</returns>
+            bool setThreadOwned(bool threadOwned) { return m_reactors.setThreadOwned(threadOwned); }
+
+            HttpServer()
+                : m_serverHost("unnamed"),
+                allowKeepalive(true),
+                m_reactors(*this),
+                m_maxRequestHeadersSize(8192),
+                m_maxRequestContentSize(2 * 1024 * 1024) {};
+
+            HttpServer(std::string serverHost, int port = 30000) : HttpServer()
+            {
+                std::ostringstream os;
+                os << serverHost << ":" << port;
+                setServerName(os.str());
+                addListeningPort(port);
+            };
+
+            ~HttpServer()
+            {
+                for (auto& sock : m_listeningSockets)
+                {
+                    sock.close();
+                }
+            }
+
+            void setRequestLimits(size_t maxRequestHeadersSize, size_t maxRequestContentSize)
+            {
+                m_maxRequestHeadersSize = maxRequestHeadersSize;
+                m_maxRequestContentSize = maxRequestContentSize;
+            }
+
+            /// <summary>
+            /// Copy request headers into HttpRequest::headers. Handlers that only use
+            /// HttpRequest::head may turn it off, then parsing a request allocates nothing
+            /// once the connection is warmed up.
+            /// </summary>
+            void setRequestHeadersMap(bool enabled) { m_requestHeadersMap = enabled; }
+
+            /// <summary>
+            /// Set maximum number of pipelined requests answered with one write. Complete requests
+            /// already received are processed back to back and their responses are flushed
+            /// together, depth 1 sends every response on its own.
+            /// </summary>
+            void setPipelineDepth(size_t depth)
+            {
+                m_pipelineDepth = std::min(std::max<size_t>(depth, 1), kMaxPipelineDepth);
+            }
+
+            /// <summary>
+            /// Close connections that don't send the request line and headers within the timeout,
+            /// counted from the first byte of the request. Bytes trickling in don't extend it.
+            /// 0 - no timeout, the default.
+            /// </summary>
+            void setHeaderTimeout(std::chrono::milliseconds timeout) { m_headerTimeout = timeout; }
+
+            /// <summary>
+            /// Close connections that receive no part of the request body within the timeout.
+            /// 0 - no timeout, the default.
+            /// </summary>
+            void setBodyTimeout(std::chrono::milliseconds timeout) { m_bodyTimeout = timeout; }
+
+            /// <summary>
+            /// Close connections that wait for a request longer than the timeout: new ones and
+            /// keep-alive ones between requests. 0 - no timeout, the default.
+            /// </summary>
+            void setIdleTimeout(std::chrono::milliseconds timeout) { m_idleTimeout = timeout; }
+
+            /// <summary>
+            /// Close connections whose peer takes no part of the response within the timeout.
+            /// 0 - no timeout, the default.
+            /// </summary>
+            void setWriteTimeout(std::chrono::milliseconds timeout) { m_writeTimeout = timeout; }
+
+            /// <summary>
+            /// Compress bodies of text, JSON, JavaScript and XML responses with the best coding
+            /// the client accepts. Bodies in memory are compressed at once, produced bodies as
+            /// they are pulled, with a fixed amount of encoder state per response.
+            /// </summary>
+            /// <param name="codings">HttpEncoder::Coding flags, 0 disables. Codings that are not compiled in
+            /// are only served from precompressed files</param>
+            /// <param name="minSize">Smaller bodies in memory are sent as they are</param>
+            void setCompression(unsigned codings = HttpEncoder::available(), size_t minSize = 1024)
+            {
+                m_compression = codings;
+                m_compressionMinSize = minSize;
+            }
+
+            /// <summary>
+            /// Set watermarks of unsent response bytes of every connection, see SendBudget. Over the
+            /// high watermark the connection stops answering pipelined requests and, on a completion-based
+            /// reactor, stops receiving, until the peer takes the responses down to the low watermark.
+            /// Must be called before start().
+            /// </summary>
+            /// <param name="high">Bytes, 0 - no limit, the default</param>
+            /// <param name="low">Bytes</param>
+            void setSendWatermarks(size_t high, size_t low) { m_sendBudget.setConnectionWatermarks(high, low); }
+
+            /// <summary>
+            /// Set watermarks of unsent response bytes of all connections together. Connections that
+            /// have responses queued stop reading while the total is over the budget.
+            /// Must be called before start().
+            /// </summary>
+            /// <param name="high">Bytes, 0 - no limit, the default</param>
+            /// <param name="low">Bytes</param>
+            void setGlobalSendWatermarks(size_t high, size_t low) { m_sendBudget.setGlobalWatermarks(high, low); }
+
+            /// <summary>
+            /// Unsent response bytes of all connections, if send watermarks are set.
+            /// </summary>
+            size_t pendingSendBytes() const { return m_sendBudget.pending(); }
+
+            void setServerName(std::string const& name)
+            {
+                m_serverHost = name;
+                m_hostHeader = "Host: " + name + "\r\n";
+            }
+
+            /// <summary>
+            /// Listen on a TCP port.
+            /// </summary>
+            /// <param name="port">Port number, 0 - any available port</param>
+            /// <param name="numWorkers">Number of reactor threads serving the port, 0 - one per hardware
+            /// thread. Must be called before start().</param>
+            /// <param name="tls">Serve TLS on the port, nullptr - plaintext</param>
+            /// <returns>Port number</returns>
+            int addListeningPort(int port, size_t numWorkers = 1, std::shared_ptr<TlsContext> tls = nullptr)
+            {
+                numWorkers = m_reactors.resize(numWorkers);
+                bool reusePort = (numWorkers > 1) && ReactorPool::HasReusePort;
+                m_reusePort |= reusePort;
+
+                // Every reactor gets its own SO_REUSEPORT listening socket, unless the platform
+                // can't balance them. Then reactor #0 accepts and spreads connections round-robin.
+                size_t numListeners = reusePort ? numWorkers : 1;
+                for (size_t i = 0; i < numListeners; i++)
+                {
+                    Socket socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                    socket.setNonBlocking();
+                    socket.setReuseAddr();
+                    if (reusePort)
+                    {
+                        socket.setReusePort();
+                    }
+
+                    SocketAddr addr(0, port);
+                    socket.bind(addr);
+                    socket.getsockname(addr);
+                    // Resolve ephemeral port, so that other listeners share it.
+                    port = addr.port();
+
+                    if ((m_deferAccept > 0) && !socket.setDeferAccept(m_deferAccept))
+                    {
+                        LOG_WARN("HttpServer: TCP_DEFER_ACCEPT is not supported");
+                    }
+                    if ((m_fastOpen > 0) && !socket.setFastOpen(m_fastOpen))
+                    {
+                        LOG_WARN("HttpServer: TCP_FASTOPEN is not supported");
+                    }
+                    socket.listen(m_listenBacklog);
+                    m_listeningSockets.push_back(socket);
+                    if (tls)
+                    {
+                        m_tlsListeners[socket] = tls;
+                    }
+                    m_reactors[i].addSocket(socket, Reactor::Accepted);
+                    LOG_INFO("HttpServer: Listening on %s%s", addr.toString().c_str(), tls ? " (TLS)" : "");
+                }
+
+                return port;
+            }
+
+            /// <summary>
+            /// Listen on a TCP port for TLS connections. Handshakes run on the reactor threads,
+            /// established connections hand their keys to kernel TLS where the context allows.
+            /// </summary>
+            /// <param name="tls">Server context with a certificate</param>
+            /// <returns>Port number, -1 if the context can't serve</returns>
+            int addTlsListeningPort(int port, std::shared_ptr<TlsContext> tls, size_t numWorkers = 1)
+            {
+                if (!tls || !tls->valid() || (tls->role() != TlsContext::Server))
+                {
+                    LOG_ERROR("HttpServer: invalid TLS context for port %d", port);
+                    return -1;
+                }
+                return addListeningPort(port, numWorkers, std::move(tls));
+            }
+
+            HttpRequestHandler& addHandler(const std::string& root, HttpRequestCallback& handler)
+            {
+                // No thread-safety here!
+                m_handlers.push_back({ root, &handler });
+                LOG_INFO("HttpServer: Added handler for %s", root.c_str());
+                return m_handlers.back();
+            }
+
+            HttpRequestHandler& operator[](const std::string& root)
+            {
+                // No thread-safety here!
+                m_handlers.push_back({ root, nullptr });
+                LOG_INFO("HttpServer: Added handler for %s", root.c_str());
+                return m_handlers.back();
+            }
+
+            HttpServer& operator+=(std::pair<const std::string&, HttpRequestCallback&> other)
+            {
+                LOG_INFO("HttpServer: Added handler for %s", other.first.c_str());
+                m_handlers.push_back(HttpRequestHandler(other.first, &other.second));
+                return (*this);
+            };
+
+            /// <summary>
+            /// Counters and connection gauges of the server, summed over its reactors. Can be
+            /// called from any thread while the server runs.
+            /// </summary>
+            HttpServerMetrics metrics() const
+            {
+                HttpServerMetrics result;
+                for (size_t i = 0; i < m_reactors.size(); i++)
+                {
+                    result.reactors += m_reactors[i].metrics().snapshot();
+                }
+                std::array<uint64_t, HttpServerMetrics::States> entered{};
+                std::array<uint64_t, HttpServerMetrics::States> left{};
+                for (auto const& metrics : m_metrics)
+                {
+                    result.connectionsOpened += metrics->opened.value();
+                    result.connectionsClosed += metrics->closed.value();
+                    for (size_t i = 0; i < HttpServerMetrics::States; i++)
+                    {
+                        entered[i] += metrics->entered[i].value();
+                        left[i] += metrics->left[i].value();
+                    }
+                    result.processing.add(metrics->processing);
+                }
+                // Accepted connections start idle. Counters are read one by one, clamp what is behind.
+                entered[Connection::Idle] += result.connectionsOpened;
+                for (size_t i = 0; i < HttpServerMetrics::States; i++)
+                {
+                    result.connections[i] = (entered[i] > left[i]) ? entered[i] - left[i] : 0;
+                }
+                result.requests = entered[Connection::Processing];
+                return result;
+            }
+
+            /// <summary>
+            /// Serve metrics() in the Prometheus text format. Must be called before start().
+            /// </summary>
+            /// <param name="path">Request path of the metrics</param>
+            void enableMetrics(std::string const& path = "/metrics")
+            {
+                m_metricsHandler = HttpRequestCallback([this](HttpRequest const&, HttpResponse& resp) {
+                    resp.headers[CONTENT_TYPE] = "text/plain; version=0.0.4";
+                    resp.body = metrics().toPrometheus();
+                    return 200;
+                });
+                addHandler(path, m_metricsHandler);
+            }
+
+            /// <summary>
+            /// Send a message to every open connection of the WebSocket handler. The frame is
+            /// serialized once, and compressed once for the clients with permessage-deflate: the
+            /// connections of each reactor queue the same buffer. Can be called from any thread
+            /// while the server runs, other reactors send the message after the events they are
+            /// handling.
+            /// </summary>
+            void broadcast(WebSocketHandler const& handler, std::string_view message, bool binary = false)
+            {
+                uint8_t opcode = binary ? WebSocketFrame::Binary : WebSocketFrame::Text;
+                auto plain = std::make_shared<std::string>();
+                WebSocketFrame::serialize(*plain, opcode, message);
+                std::shared_ptr<std::string> deflated;
+                std::string compressed;
+                if (handler.deflate && (message.size() >= handler.deflateMinSize) &&
+                    WebSocketDeflate::compress(message, compressed) && (compressed.size() < message.size()))
+                {
+                    deflated = std::make_shared<std::string>();
+                    WebSocketFrame::serialize(*deflated, opcode, compressed, true);
+                }
+
+                WebSocketHandler const* handlerPtr = &handler;
+                std::shared_ptr<std::string const> plainFrame = std::move(plain);
+                std::shared_ptr<std::string const> deflatedFrame = std::move(deflated);
+                for (size_t i = 0; i < m_reactors.size(); i++)
+                {
+                    Reactor* reactor = &m_reactors[i];
+                    auto fanOut = [this, reactor, handlerPtr, plainFrame, deflatedFrame]() {
+                        // Flushing never removes connections from the list
+                        std::vector<Connection*> const& connections = webSocketsOf(reactor).connections;
+                        for (size_t j = 0; j < connections.size(); j++)
+                        {
+                            Connection& conn = *connections[j];
+                            WebSocket& ws = *conn.webSocket;
+                            if ((&ws.handler() != handlerPtr) || ws.closing())
+                            {
+                                continue;
+                            }
+                            ws.queue({ (ws.deflate() && deflatedFrame) ? deflatedFrame : plainFrame, std::string() });
+                            flushWebSocket(conn);
+                            updateSendBudget(conn);
+                            updateTimeout(conn);
+                        }
+                    };
+                    if (reactor == Reactor::current())
+                    {
+                        fanOut();
+                    }
+                    else if (!reactor->execute(std::move(fanOut)))
+                    {
+                        LOG_WARN("HttpServer: broadcast can't reach reactor %zu", i);
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Compile the handlers into the router and start serving. Handlers must be
+            /// registered before the server starts.
+            /// </summary>
+            void start()
+            {
+                std::vector<Router::Route> routes;
+                for (auto const& handler : m_handlers)
+                {
+                    routes.push_back({ handler.first, handler.second });
+                }
+                m_router.build(std::move(routes));
+                bool offload = std::any_of(m_handlers.begin(), m_handlers.end(), [](HttpRequestHandler const& handler) {
+                    return (handler.second != nullptr) && (handler.second->execution() == HttpRequestCallback::Offload);
+                });
+                if (offload && !m_workers)
+                {
+                    m_workers.reset(new ThreadPool());
+                }
+                if (m_workers)
+                {
+                    m_workers->start();
+                }
+                if (m_metrics.size() != m_reactors.size())
+                {
+                    m_metrics.clear();
+                    for (size_t i = 0; i < m_reactors.size(); i++)
+                    {
+                        m_metrics.emplace_back(new ConnectionMetrics());
+                        m_metrics.back()->reactor = &m_reactors[i];
+                    }
+                }
+                if (m_webSockets.size() != m_reactors.size())
+                {
+                    m_webSockets.clear();
+                    for (size_t i = 0; i < m_reactors.size(); i++)
+                    {
+                        m_webSockets.emplace_back(new ReactorWebSockets());
+                        m_webSockets.back()->reactor = &m_reactors[i];
+                    }
+                }
+                m_reactors.start();
+            }
+
+            void stop()
+            {
+                // Workers finish running handlers first, their responses are still posted to the reactors
+                if (m_workers)
+                {
+                    m_workers->stop();
+                }
+                m_reactors.stop();
+                for (auto& sock : m_listeningSockets)
+                {
+                    sock.close();
+                }
+                m_listeningSockets.clear();
+                m_tlsListeners.clear();
+            }
+
+            /// <summary>
+            /// Set up the worker threads that run handlers with the Offload execution policy.
+            /// Default is one thread per hardware thread, created if any handler is offloaded.
+            /// Must be called before start().
+            /// </summary>
+            /// <param name="numThreads">Number of worker threads, 0 - one per hardware thread</param>
+            /// <param name="capacity">Maximum number of requests queued or handled, further requests are
+            /// answered with 503 Service Unavailable</param>
+            void setWorkerThreads(size_t numThreads, size_t capacity = ThreadPool::DefaultCapacity)
+            {
+                m_workers.reset(new ThreadPool(numThreads, capacity));
+            }
+
+        protected:
+            virtual void onSocketAcceptable(Socket socket) override
+            {
+                // Listening sockets are registered as Reactor::Accepted
+                LOG_TRACE("HttpServer: unexpected acceptable socket fd=0x%x", static_cast<int>(socket.m_sock));
+                (void)socket;
+            }
+
+            virtual void onSocketAccepted(Socket socket, Socket csocket) override
+            {
+                LOG_TRACE("HttpServer: accepted on socket fd=0x%x", static_cast<int>(socket.m_sock));
+                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) !=
+                    m_listeningSockets.end());
+
+                // Sharded listener keeps the connection on the accepting reactor.
+                Reactor* target = Reactor::current();
+                if (!m_reusePort || (target == nullptr))
+                {
+                    target = &m_reactors.next();
+                }
+
+                // Listeners are not added once the server runs, the map is read-only
+                std::unique_ptr<TlsSession> tls;
+                auto tlsIt = m_tlsListeners.find(socket);
+                if (tlsIt != m_tlsListeners.end())
+                {
+                    tls = tlsIt->second->accept(csocket);
+                    if (!tls)
+                    {
+                        csocket.close();
+                        return;
+                    }
+                }
+
+                SocketAddr caddr;
+                csocket.getpeername(caddr);
+                Connection* connPtr;
+                {
+                    LOCKGUARD(m_connectionsMutex);
+                    connPtr = &m_connections[csocket];
+                }
+                Connection& conn = *connPtr;
+                conn.socket = csocket;
+                conn.reactor = target;
+                conn.tls = std::move(tls);
+                // Counted as opened where accepted, as idle until the state changes
+                metricsOf((Reactor::current() != nullptr) ? Reactor::current() : target).opened.add();
+                conn.metrics = &metricsOf(target);
+                conn.state = Connection::Idle;
+                conn.request.client = caddr.toString();
+                // Completion-based reactor keeps receiving for the lifetime of the connection,
+                // TLS connections wait for the ClientHello
+                target->addSocket(csocket,
+                    completionBased(conn) ? Reactor::Received : (Reactor::Readable | Reactor::Closed), &conn);
+                LOG_TRACE("HttpServer: [%s] accepted", conn.request.client.c_str());
+                // Timers belong to the reactor thread
+                if (target == Reactor::current())
+                {
+                    updateTimeout(conn);
+                }
+                else if ((m_idleTimeout.count() != 0) && target->canExecute())
+                {
+                    target->execute([this, csocket, connPtr]() {
+                        if (findConnection(csocket) == connPtr)
+                        {
+                            updateTimeout(*connPtr);
+                        }
+                    });
+                }
+            }
+
+            virtual void onSocketReceived(Socket socket, char const* data, size_t size) override
+            {
+                LOG_TRACE("HttpServer: [fd=0x%x] received %zu", static_cast<int>(socket.m_sock), size);
+                Connection* connPtr = findConnection(socket);
+                if (connPtr == nullptr)
+                {
+                    return;
+                }
+                Connection& conn = *connPtr;
+                if (size == 0)
+                {
+                    handleConnectionClosed(conn);
+                    return;
+                }
+                conn.receiveBuffer.append(data, size);
+                // Receive completed before it was paused, the data waits until the send budget resumes
+                if (!conn.writePaused)
+                {
+                    handleConnection(conn);
+                }
+                if (findConnection(socket) == &conn)
+                {
+                    updateSendBudget(conn);
+                    updateTimeout(conn);
+                }
+            }
+
+            virtual void onSocketReadable(Socket socket) override
+            {
+                LOG_TRACE("HttpServer: reading socket fd=0x%x", static_cast<int>(socket.m_sock));
+                // No thread-safety here!
+                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
+                    m_listeningSockets.end());
+
+                Connection* connPtr = findConnection(socket);
+                if (connPtr == nullptr)
+                {
+                    return;
+                }
+                Connection& conn = *connPtr;
+                if (conn.tls && !conn.tls->established() && !continueHandshake(conn))
+                {
+                    return;
+                }
+
+                // Edge-triggered reactor requires reading until EAGAIN. So does TLS:
+                // records decrypted ahead are buffered by the session, they don't wake the reactor up.
+                bool drain = conn.reactor->isEdgeTriggered() || conn.tls;
+                bool closed = false;
+                size_t total = 0;
+                // Reused reactor buffer, large enough to take most requests in one call
+                BufferPool::Chunk chunk = conn.reactor->buffers().acquire();
+                char* buffer = chunk.data();
+                for (;;)
+                {
+                    int received = receive(conn, buffer, chunk.size());
+                    LOG_TRACE("HttpServer: [%s] received %d", conn.request.client.c_str(), received);
+                    if (received <= 0)
+                    {
+                        closed = (received == 0) || !wouldBlock(conn);
+                        break;
+                    }
+                    conn.receiveBuffer.append(buffer, buffer + received);
+                    total += received;
+                    if (!drain)
+                    {
+                        break;
+                    }
+                    if (total >= chunk.size())
+                    {
+                        // Streamed bodies are handed over as they arrive, not collected until EAGAIN
+                        handleConnection(conn);
+                        total = 0;
+                        if (findConnection(socket) != &conn)
+                        {
+                            return;
+                        }
+                    }
+                }
+
+                if (total > 0)
+                {
+                    handleConnection(conn);
+                }
+                // Connection may have been closed while handling the request
+                if (findConnection(socket) != &conn)
+                {
+                    return;
+                }
+                if (closed)
+                {
+                    handleConnectionClosed(conn);
+                    return;
+                }
+                updateSendBudget(conn);
+                updateTimeout(conn);
+            }
+
+            virtual void onSocketWritable(Socket socket) override
+            {
+                LOG_TRACE("HttpServer: writing socket fd=0x%x", static_cast<int>(socket.m_sock));
+
+                // No thread-safety here!
+                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
+                    m_listeningSockets.end());
+
+                Connection* connPtr = findConnection(socket);
+                if (connPtr == nullptr)
+                {
+                    return;
+                }
+                Connection& conn = *connPtr;
+                if (conn.tls && !conn.tls->established())
+                {
+                    // Requests may have arrived with the last flight of the handshake
+                    if (continueHandshake(conn))
+                    {
+                        onSocketReadable(socket);
+                    }
+                    return;
+                }
+
+                if (!sendMore(conn))
+                {
+                    handleConnection(conn);
+                }
+                if (findConnection(socket) == &conn)
+                {
+                    updateSendBudget(conn);
+                    updateTimeout(conn);
+                }
+            }
+
+            virtual void onSocketSent(Socket socket, size_t pending) override
+            {
+                (void)pending;
+                Connection* connPtr = findConnection(socket);
+                if (connPtr == nullptr)
+                {
+                    return;
+                }
+                Connection& conn = *connPtr;
+                bool paused = conn.writePaused;
+                updateSendBudget(conn);
+                if (paused && !conn.writePaused && !conn.suspended)
+                {
+                    // Answer the requests received meanwhile
+                    handleConnection(conn);
+                    if (findConnection(socket) != &conn)
+                    {
+                        return;
+                    }
+                    updateSendBudget(conn);
+                }
+                updateTimeout(conn);
+            }
+
+            virtual void onSocketClosed(Socket socket) override
+            {
+                LOG_TRACE("HttpServer: closing socket fd=0x%x", static_cast<int>(socket.m_sock));
+                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
+                    m_listeningSockets.end());
+
+                Connection* connPtr = findConnection(socket);
+                if (connPtr == nullptr)
+                {
+                    return;
+                }
+
+                handleConnectionClosed(*connPtr);
+            }
+
+            /// <summary>
+            /// Send queued responses with one gather write, then stream the file of the last one,
+            /// if it is not loaded. Partial writes advance sendOffset and sendFileOffset.
+            /// </summary>
+            /// <returns>true if there is more data to send</returns>
+            bool sendMore(Connection& conn, bool shutdownAfter = false)
+            {
+                if (conn.sendQueue.empty())
+                {
+                    return false;
+                }
+
+                // Completion-based reactor sends in the background, every part is queued in order
+                if (completionBased(conn))
+                {
+                    for (size_t i = 0; i < conn.sendQueue.size(); i++)
+                    {
+                        QueuedResponse& response = conn.sendQueue[i];
+                        bool last = (i + 1 == conn.sendQueue.size());
+                        if (response.body.empty())
+                        {
+                            conn.reactor->send(conn.socket, std::move(response.headers), last && shutdownAfter);
+                        }
+                        else
+                        {
+                            conn.reactor->send(conn.socket, std::move(response.headers));
+                            conn.reactor->send(conn.socket, std::move(response.body), last && shutdownAfter);
+                        }
+                    }
+                    conn.sendQueue.clear();
+                    conn.sendOffset = 0;
+                    return false;
+                }
+
+                Socket::IoVec vecs[3 * kMaxPipelineDepth];
+                size_t count = 0;
+                size_t total = 0;
+                size_t skip = conn.sendOffset;
+                for (auto const& response : conn.sendQueue)
+                {
+                    std::string_view parts[3] = { response.headers, response.body, std::string_view() };
+                    if (response.file && !response.streamsFile())
+                    {
+                        parts[2] = std::string_view(response.file->data(), static_cast<size_t>(response.file->size()));
+                    }
+                    for (auto const& part : parts)
+                    {
+                        total += part.size();
+                        if (skip >= part.size())
+                        {
+                            skip -= part.size();
+                            continue;
+                        }
+                        vecs[count++] = Socket::ioVec(part.data() + skip, part.size() - skip);
+                        skip = 0;
+                    }
+                }
+
+                if (conn.sendOffset < total)
+                {
+                    int sent = sendv(conn, vecs, count);
+                    LOG_TRACE("HttpServer: [%s] sent %d", conn.request.client.c_str(), sent);
+                    if (sent < 0 && !wouldBlock(conn))
+                    {
+                        return true;
+                    }
+                    if (sent > 0)
+                    {
+                        conn.sendOffset += static_cast<size_t>(sent);
+                    }
+
+                    if (conn.sendOffset < total)
+                    {
+                        conn.reactor->addSocket(conn.socket,
+                            Reactor::Writable | Reactor::Closed);
+                        conn.receivePaused = true;
+                        return true;
+                    }
+                }
+
+                QueuedResponse& last = conn.sendQueue.back();
+                if (last.streamsFile())
+                {
+                    uint64_t size = last.file->size();
+                    while (conn.sendFileOffset < size)
+                    {
+                        size_t chunk =
+                            static_cast<size_t>(std::min<uint64_t>(size - conn.sendFileOffset, kSendFileChunkSize));
+                        int64_t sent = sendfile(conn, last.file->handle(), conn.sendFileOffset, chunk);
+                        LOG_TRACE("HttpServer: [%s] sent file %lld", conn.request.client.c_str(),
+                            static_cast<long long>(sent));
+                        if (sent > 0)
+                        {
+                            continue;
+                        }
+                        if ((sent < 0) && wouldBlock(conn))
+                        {
+                            conn.reactor->addSocket(conn.socket,
+                                Reactor::Writable | Reactor::Closed);
+                            conn.receivePaused = true;
+                            return true;
+                        }
+                        // File shrank or the socket failed: the response can't be completed
+                        LOG_WARN("HttpServer: [%s] failed to send file", conn.request.client.c_str());
+                        conn.keepalive = false;
+                        break;
+                    }
+                }
+                else if (last.producer && !sendProduced(conn, last))
+                {
+                    return true;
+                }
+
+                conn.sendQueue.clear();
+                conn.sendOffset = 0;
+                conn.sendFileOffset = 0;
+                return false;
+            }
+
+            /// <summary>
+            /// Pull the body of the response from its producer and send it part by part, so that
+            /// only one part is in memory at a time.
+            /// </summary>
+            /// <returns>false if the socket can't take more data, the connection waits for Writable</returns>
+            bool sendProduced(Connection& conn, QueuedResponse& response)
+            {
+                for (;;)
+                {
+                    if (conn.producedOffset == conn.produced.size())
+                    {
+                        if (!response.producer)
+                        {
+                            conn.produced.clear();
+                            conn.producedOffset = 0;
+                            return true;
+                        }
+                        produce(conn, response);
+                        continue;
+                    }
+                    int sent = send(conn, conn.produced.data() + conn.producedOffset,
+                        conn.produced.size() - conn.producedOffset);
+                    if (sent > 0)
+                    {
+                        conn.producedOffset += static_cast<size_t>(sent);
+                        continue;
+                    }
+                    if ((sent < 0) && wouldBlock(conn))
+                    {
+                        conn.reactor->addSocket(conn.socket, Reactor::Writable | Reactor::Closed);
+                        conn.receivePaused = true;
+                        return false;
+                    }
+                    LOG_WARN("HttpServer: [%s] failed to send body", conn.request.client.c_str());
+                    response.producer = nullptr;
+                    conn.produced.clear();
+                    conn.producedOffset = 0;
+                    conn.keepalive = false;
+                    return true;
+                }
+            }
 
-            HttpServer(std::string serverHost, int port = 30000) : HttpServer()
+            /// <summary>
+            /// Get the next part of the body from the producer, framed as a chunk if needed.
+            /// The chunk size goes into the space reserved in front of the data.
+            /// </summary>
+            void produce(Connection& conn, QueuedResponse& response)
             {
-                std::ostringstream os;
-                os << serverHost << ":" << port;
-                setServerName(os.str());
-                addListeningPort(port);
-            };
+                static constexpr size_t const kChunkHeaderSize = 18;  // Up to 16 hex digits and CRLF
+                std::string& buffer = conn.produced;
+                size_t start = response.chunked ? kChunkHeaderSize : 0;
+                buffer.assign(start, ' ');
+                bool more = response.producer(buffer);
+                if (buffer.size() < start)
+                {
+                    buffer.resize(start);
+                }
+                size_t size = buffer.size() - start;
+                conn.producedOffset = start;
+                if (response.chunked && (size != 0))
+                {
+                    char header[kChunkHeaderSize];
+                    char* end = std::to_chars(header, header + kChunkHeaderSize - 2, size, 16).ptr;
+                    *end++ = '\r';
+                    *end++ = '\n';
+                    size_t length = static_cast<size_t>(end - header);
+                    conn.producedOffset = start - length;
+                    buffer.replace(conn.producedOffset, length, header, length);
+                    buffer.append("\r\n");
+                }
+                if (!more)
+                {
+                    response.producer = nullptr;
+                    if (response.chunked)
+                    {
+                        buffer.append("0\r\n\r\n");
+                    }
+                }
+            }
 
-            ~HttpServer()
+            /// <summary>
+            /// Flush batched responses before waiting for more request data, and resume receiving
+            /// if the socket was waiting for Writable.
+            /// </summary>
+            /// <returns>true if responses are still being sent, the connection resumes once they are</returns>
+            bool flushAndReceive(Connection& conn)
             {
-                for (auto& sock : m_listeningSockets)
+                if (sendMore(conn))
                 {
-                    sock.close();
+                    return true;
+                }
+                if (conn.receivePaused)
+                {
+                    conn.receivePaused = false;
+                    if (!completionBased(conn))
+                    {
+                        conn.reactor->addSocket(conn.socket,
+                            Reactor::Readable | Reactor::Closed);
+                    }
                 }
+                return false;
             }
 
-            void setRequestLimits(size_t maxRequestHeadersSize, size_t maxRequestContentSize)
+        protected:
+            Connection* findConnection(Socket socket)
             {
-                m_maxRequestHeadersSize = maxRequestHeadersSize;
-                m_maxRequestContentSize = maxRequestContentSize;
+                // Reactor threads don't have to lock the map
+                Reactor* reactor = Reactor::current();
+                if (reactor != nullptr)
+                {
+                    return static_cast<Connection*>(reactor->context(socket));
+                }
+                LOCKGUARD(m_connectionsMutex);
+                auto connIt = m_connections.find(socket);
+                return (connIt != m_connections.end()) ? &connIt->second : nullptr;
             }
 
-            void setServerName(std::string const& name) { m_serverHost = name; }
-
-            int addListeningPort(int port)
+            /// <summary>
+            /// Whether the reactor receives and sends for the connection. TLS connections are
+            /// driven by readiness on every backend: their records go through the session.
+            /// </summary>
+            static bool completionBased(Connection const& conn)
             {
-                Socket socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-                socket.setNonBlocking();
-                socket.setReuseAddr();
-
-                SocketAddr addr(0, port);
-                socket.bind(addr);
-                socket.getsockname(addr);
-
-                socket.listen(10);
-                m_listeningSockets.push_back(socket);
-                m_reactor.addSocket(socket, Reactor::Acceptable);
-                LOG_INFO("HttpServer: Listening on %s", addr.toString().c_str());
+                return conn.reactor->isCompletionBased() && !conn.tls;
+            }
 
-                return addr.port();
+            /// <summary>
+            /// Continue the TLS handshake and wait for the socket event it needs. Failed
+            /// handshakes close the connection.
+            /// </summary>
+            /// <returns>true once the connection is established</returns>
+            bool continueHandshake(Connection& conn)
+            {
+                bool writing = conn.tls->wantsWrite();
+                TlsSession::Status status = conn.tls->handshake();
+                if (status == TlsSession::Ok)
+                {
+                    if (writing)
+                    {
+                        conn.reactor->addSocket(conn.socket, Reactor::Readable | Reactor::Closed);
+                    }
+                    return true;
+                }
+                if (conn.tls->wouldBlock())
+                {
+                    if (writing != conn.tls->wantsWrite())
+                    {
+                        conn.reactor->addSocket(conn.socket,
+                            (conn.tls->wantsWrite() ? Reactor::Writable : Reactor::Readable) | Reactor::Closed);
+                    }
+                    // The idle timeout also bounds the handshake
+                    updateTimeout(conn);
+                    return false;
+                }
+                LOG_WARN("HttpServer: [%s] TLS handshake failed", conn.request.client.c_str());
+                handleConnectionClosed(conn);
+                return false;
             }
 
-            HttpRequestHandler& addHandler(const std::string& root, HttpRequestCallback& handler)
+            int receive(Connection& conn, char* buffer, size_t size)
             {
-                // No thread-safety here!
-                m_handlers.push_back({ root, &handler });
-                LOG_INFO("HttpServer: Added handler for %s", root.c_str());
-                return m_handlers.back();
+                int result = conn.tls ? conn.tls->read(buffer, size) : conn.socket.recv(buffer, size);
+                conn.reactor->metrics().received(result, (result < 0) && wouldBlock(conn));
+                return result;
             }
 
-            HttpRequestHandler& operator[](const std::string& root)
+            int send(Connection& conn, char const* data, size_t size)
             {
-                // No thread-safety here!
-                m_handlers.push_back({ root, nullptr });
-                LOG_INFO("HttpServer: Added handler for %s", root.c_str());
-                return m_handlers.back();
+                int result = conn.tls ? conn.tls->write(data, size) : conn.socket.send(data, size);
+                conn.reactor->metrics().sent(result, size, (result < 0) && wouldBlock(conn));
+                return result;
             }
 
-            HttpServer& operator+=(std::pair<const std::string&, HttpRequestCallback&> other)
+            int sendv(Connection& conn, Socket::IoVec const* vecs, size_t count)
             {
-                LOG_INFO("HttpServer: Added handler for %s", other.first.c_str());
-                m_handlers.push_back(HttpRequestHandler(other.first, &other.second));
-                return (*this);
-            };
+                int result = conn.tls ? conn.tls->writev(vecs, count) : conn.socket.sendv(vecs, count);
+                size_t size = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    size += Socket::ioVecSize(vecs[i]);
+                }
+                conn.reactor->metrics().sent(result, size, (result < 0) && wouldBlock(conn));
+                return result;
+            }
 
-            void start() { m_reactor.start(); }
+            int64_t sendfile(Connection& conn, Socket::FileHandle file, uint64_t& offset, size_t count)
+            {
+                int64_t result =
+                    conn.tls ? conn.tls->sendfile(file, offset, count) : conn.socket.sendfile(file, offset, count);
+                conn.reactor->metrics().sent(result, count, (result < 0) && wouldBlock(conn));
+                return result;
+            }
 
-            void stop() { m_reactor.stop(); }
+            /// <summary>
+            /// Whether the last receive or send failed only because the socket would block.
+            /// </summary>
+            static bool wouldBlock(Connection const& conn)
+            {
+                return conn.tls ? conn.tls->wouldBlock() : (conn.socket.error() == Socket::ErrorWouldBlock);
+            }
 
-        protected:
-            virtual void onSocketAcceptable(Socket socket) override
+            /// <summary>
+            /// Body producer that reads the file part by part, for TLS connections that
+            /// encrypt in user space and can't use sendfile.
+            /// </summary>
+            static BodyProducer fileProducer(Connection& conn, std::shared_ptr<HttpFile> file)
             {
-                LOG_TRACE("HttpServer: accepting socket fd=0x%llx", socket.m_sock);
-                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) !=
-                    m_listeningSockets.end());
+                Connection* connPtr = &conn;
+                uint64_t offset = 0;
+                return [connPtr, file, offset](std::string& buffer) mutable {
+                    size_t count = static_cast<size_t>(std::min<uint64_t>(file->size() - offset, kTlsFileChunkSize));
+                    // File bodies are not chunked: nothing is reserved in front of the data
+                    if (!file->read(offset, count, buffer))
+                    {
+                        LOG_WARN("HttpServer: [%s] failed to read file", connPtr->request.client.c_str());
+                        connPtr->keepalive = false;
+                        return false;
+                    }
+                    offset += count;
+                    return offset < file->size();
+                };
+            }
 
-                Socket csocket;
-                SocketAddr caddr;
-                if (socket.accept(csocket, caddr))
+            ConnectionMetrics& metricsOf(Reactor const* reactor)
+            {
+                for (auto& metrics : m_metrics)
                 {
-                    csocket.setNonBlocking();
-                    Connection& conn = m_connections[csocket];
-                    conn.socket = csocket;
-                    conn.state = Connection::Idle;
-                    conn.request.client = caddr.toString();
-                    m_reactor.addSocket(csocket, Reactor::Readable | Reactor::Closed);
-                    LOG_TRACE("HttpServer: [%s] accepted", conn.request.client.c_str());
+                    if (metrics->reactor == reactor)
+                    {
+                        return *metrics;
+                    }
                 }
+                return *m_metrics.front();
             }
 
-            virtual void onSocketReadable(Socket socket) override
+            ReactorWebSockets& webSocketsOf(Reactor const* reactor)
             {
-                LOG_TRACE("HttpServer: reading socket fd=0x%llx", socket.m_sock);
-                // No thread-safety here!
-                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
-                    m_listeningSockets.end());
-
-                // No thread-safety here!
-                auto connIt = m_connections.find(socket);
-                if (connIt == m_connections.end())
+                for (auto& webSockets : m_webSockets)
                 {
-                    return;
+                    if (webSockets->reactor == reactor)
+                    {
+                        return *webSockets;
+                    }
                 }
-                Connection& conn = connIt->second;
+                return *m_webSockets.front();
+            }
 
-                char buffer[2048] = { 0 };
-                int received = socket.recv(buffer, sizeof(buffer));
-                LOG_TRACE("HttpServer: [%s] received %d", conn.request.client.c_str(), received);
-                if (received <= 0)
+            /// <summary>
+            /// Move the connection to another state, counting the transition and timing
+            /// the processing of requests.
+            /// </summary>
+            void setState(Connection& conn, Connection::State state)
+            {
+                conn.metrics->left[conn.state].add();
+                conn.metrics->entered[state].add();
+                if (state == Connection::Processing)
                 {
-                    handleConnectionClosed(conn);
-                    return;
+                    conn.processingStart = std::chrono::steady_clock::now();
                 }
-                conn.receiveBuffer.append(buffer, buffer + received);
-
-                handleConnection(conn);
+                else if (conn.state == Connection::Processing)
+                {
+                    auto elapsed = std::chrono::steady_clock::now() - conn.processingStart;
+                    conn.metrics->processing.record(static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                }
+                conn.state = state;
             }
 
-            virtual void onSocketWritable(Socket socket) override
+            void handleConnectionClosed(Connection& conn)
             {
-                LOG_TRACE("HttpServer: writing socket fd=0x%llx", socket.m_sock);
-
-                // No thread-safety here!
-                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
-                    m_listeningSockets.end());
-
-                // No thread-safety here!
-                auto connIt = m_connections.find(socket);
-                if (connIt == m_connections.end())
+                LOG_TRACE("HttpServer: [%s] closed", conn.request.client.c_str());
+                if (conn.state != Connection::Idle && conn.state != Connection::Closing &&
+                    conn.state != Connection::Upgraded)
+                {
+                    LOG_WARN("HttpServer: [%s] connection closed unexpectedly", conn.request.client.c_str());
+                }
+                if (conn.timer != 0)
+                {
+                    conn.reactor->cancelTimer(conn.timer);
+                    conn.timer = 0;
+                    conn.timeoutPhase = Connection::NoTimeout;
+                }
+                if (conn.sendAccounted != 0)
+                {
+                    m_sendBudget.update(conn.sendAccounted, 0, false);
+                }
+                conn.writePaused = false;
+                conn.reactor->removeSocket(conn.socket);
+                if (conn.suspended)
                 {
+                    // The handler still uses the connection, see onRequestHandled
+                    conn.closed = true;
                     return;
                 }
-                Connection& conn = connIt->second;
-
-                if (!sendMore(conn))
+                if (conn.webSocket)
                 {
-                    handleConnection(conn);
+                    closeWebSocket(conn);
                 }
+                conn.metrics->left[conn.state].add();
+                conn.metrics->closed.add();
+                LOCKGUARD(m_connectionsMutex);
+                auto connIt = m_connections.find(conn.socket);
+                conn.socket.close();
+                m_connections.erase(connIt);
             }
 
-            virtual void onSocketClosed(Socket socket) override
+            /// <summary>
+            /// Response bytes of the connection that are not sent yet. Files streamed from disk
+            /// don't count, they are not in memory.
+            /// </summary>
+            size_t unsentBytes(Connection& conn)
             {
-                LOG_TRACE("HttpServer: closing socket fd=0x%llx", socket.m_sock);
-                assert(std::find(m_listeningSockets.begin(), m_listeningSockets.end(), socket) ==
-                    m_listeningSockets.end());
-
-                auto connIt = m_connections.find(socket);
-                if (connIt == m_connections.end())
+                // Completion-based reactor takes over what is flushed
+                size_t total = conn.reactor->pendingSend(conn.socket);
+                size_t queued = 0;
+                for (auto const& response : conn.sendQueue)
                 {
-                    return;
+                    queued += response.headers.size() + response.body.size();
+                    if (response.file && !response.streamsFile())
+                    {
+                        queued += static_cast<size_t>(response.file->size());
+                    }
                 }
-                Connection& conn = connIt->second;
-
-                handleConnectionClosed(conn);
+                total += queued - std::min(conn.sendOffset, queued);
+                if (!conn.sendQueue.empty())
+                {
+                    total += conn.produced.size() - std::min(conn.producedOffset, conn.produced.size());
+                }
+                if (conn.webSocket)
+                {
+                    total += conn.webSocket->queuedBytes();
+                }
+                return total;
             }
 
-            bool sendMore(Connection& conn)
+            /// <summary>
+            /// Account unsent bytes of the connection in the send budget. Crossing the high
+            /// watermark stops receiving on a completion-based reactor, readiness-based ones
+            /// already wait for Writable only while responses are blocked.
+            /// </summary>
+            void updateSendBudget(Connection& conn)
             {
-                if (conn.sendBuffer.empty())
+                if (!m_sendBudget.enabled())
                 {
-                    return false;
+                    return;
                 }
-
-                int sent = conn.socket.send(conn.sendBuffer.data(), static_cast<int>(conn.sendBuffer.size()));
-                LOG_TRACE("HttpServer: [%s] sent %d", conn.request.client.c_str(), sent);
-                if (sent < 0 && conn.socket.error() != Socket::ErrorWouldBlock)
+                size_t pending = unsentBytes(conn);
+                bool paused = m_sendBudget.update(conn.sendAccounted, pending, conn.writePaused);
+                if (paused == conn.writePaused)
                 {
-                    return true;
+                    return;
                 }
-                conn.sendBuffer.erase(0, sent);
-
-                if (!conn.sendBuffer.empty())
+                conn.writePaused = paused;
+                LOG_TRACE("HttpServer: [%s] write %s, %zu bytes pending", conn.request.client.c_str(),
+                    paused ? "paused" : "resumed", pending);
+                if (completionBased(conn))
                 {
-                    m_reactor.addSocket(conn.socket,
-                        Reactor::Writable | Reactor::Closed);
-                    return true;
+                    // Reactor keeps sending what is queued
+                    conn.reactor->addSocket(conn.socket, paused ? Reactor::Closed : Reactor::Received);
                 }
+            }
 
-                return false;
+            /// <summary>
+            /// Whether the connection may answer another request before its responses are sent.
+            /// </summary>
+            bool withinSendBudget(Connection& conn)
+            {
+                updateSendBudget(conn);
+                return !conn.writePaused;
             }
 
-        protected:
-            void handleConnectionClosed(Connection& conn)
+            /// <summary>
+            /// Arm the deadline of what the connection waits for once an event is handled. The
+            /// header deadline covers the whole head of a request, the others restart with every
+            /// event. Expired connections are closed. Must be called by the reactor that owns it.
+            /// </summary>
+            void updateTimeout(Connection& conn)
             {
-                LOG_TRACE("HttpServer: [%s] closed", conn.request.client.c_str());
-                if (conn.state != Connection::Idle && conn.state != Connection::Closing)
+                if (conn.reactor != Reactor::current())
                 {
-                    LOG_WARN("HttpServer: [%s] connection closed unexpectedly", conn.request.client.c_str());
+                    return;
                 }
-                m_reactor.removeSocket(conn.socket);
-                auto connIt = m_connections.find(conn.socket);
-                conn.socket.close();
-                m_connections.erase(connIt);
+                auto phase = Connection::NoTimeout;
+                std::chrono::milliseconds timeout(0);
+                bool sending = !conn.sendQueue.empty() || (conn.webSocket && (conn.webSocket->queuedBytes() != 0));
+                if (conn.suspended)
+                {
+                    // The handler takes as long as it takes, a hangup still closes the connection
+                }
+                else if ((sending && conn.receivePaused && !completionBased(conn)) || conn.writePaused)
+                {
+                    phase = Connection::WriteTimeout;
+                    timeout = m_writeTimeout;
+                }
+                else if (conn.state == Connection::Upgraded)
+                {
+                    // Messages flow for as long as both sides like, the answer to a Close is awaited
+                    // for the idle timeout
+                    if (conn.webSocket->closing())
+                    {
+                        phase = Connection::IdleTimeout;
+                        timeout = m_idleTimeout;
+                    }
+                }
+                else if ((conn.state == Connection::ReceivingHeaders) && !conn.receiveBuffer.empty())
+                {
+                    phase = Connection::HeaderTimeout;
+                    timeout = m_headerTimeout;
+                }
+                else if ((conn.state == Connection::ReceivingBody) || (conn.state == Connection::Sending100Continue))
+                {
+                    phase = Connection::BodyTimeout;
+                    timeout = m_bodyTimeout;
+                }
+                else if ((conn.state == Connection::Idle) || (conn.state == Connection::ReceivingHeaders) ||
+                    (conn.state == Connection::Closing))
+                {
+                    phase = Connection::IdleTimeout;
+                    timeout = m_idleTimeout;
+                }
+                if (timeout.count() <= 0)
+                {
+                    phase = Connection::NoTimeout;
+                }
+                if ((phase == conn.timeoutPhase) &&
+                    ((phase == Connection::NoTimeout) ||
+                        ((phase == Connection::HeaderTimeout) && (conn.requests == conn.timeoutRequest))))
+                {
+                    return;
+                }
+
+                if (conn.timer != 0)
+                {
+                    conn.reactor->cancelTimer(conn.timer);
+                    conn.timer = 0;
+                }
+                conn.timeoutPhase = phase;
+                conn.timeoutRequest = conn.requests;
+                if (phase == Connection::NoTimeout)
+                {
+                    return;
+                }
+                conn.timer = conn.reactor->addTimer(timeout, [this, &conn]() {
+                    LOG_WARN("HttpServer: [%s] %s timeout", conn.request.client.c_str(),
+                        Connection::phaseName(conn.timeoutPhase));
+                    conn.timer = 0;
+                    conn.timeoutPhase = Connection::NoTimeout;
+                    handleConnectionClosed(conn);
+                });
             }
 
             void handleConnection(Connection& conn)
             {
+                if (conn.state == Connection::Upgraded)
+                {
+                    handleWebSocket(conn);
+                    return;
+                }
                 for (;;)
                 {
                     if (conn.state == Connection::Idle)
                     {
                         conn.response.code = 0;
-                        conn.state = Connection::ReceivingHeaders;
+                        setState(conn, Connection::ReceivingHeaders);
                         LOG_TRACE("HttpServer: [%s] receiving headers", conn.request.client.c_str());
                     }
 
                     if (conn.state == Connection::ReceivingHeaders)
                     {
-                        bool lfOnly = false;
-                        size_t ofs = conn.receiveBuffer.find("\r\n\r\n");
-                        if (ofs == std::string::npos)
-                        {
-                            lfOnly = true;
-                            ofs = conn.receiveBuffer.find("\n\n");
-                        }
-                        size_t headersLen = (ofs != std::string::npos) ? ofs : conn.receiveBuffer.length();
+                        // Only bytes received since the last event are scanned
+                        size_t headLen = conn.headScanner.scan(conn.receiveBuffer);
+                        size_t headersLen = (headLen != 0) ? headLen : conn.headScanner.scanned();
                         if (headersLen > m_maxRequestHeadersSize)
                         {
                             LOG_WARN("HttpServer: [%s] headers too long - %u", conn.request.client.c_str(),
                                 static_cast<unsigned>(headersLen));
+                            conn.headScanner.reset();
+                            conn.request.head.clear();
+                            conn.request.protocol.clear();
                             conn.response.code = 431;  // Request Header Fields Too Large
                             conn.keepalive = false;
-                            conn.state = Connection::Processing;
+                            setState(conn, Connection::Processing);
                             continue;
                         }
-                        if (ofs == std::string::npos)
+                        if (headLen == 0)
                         {
+                            flushAndReceive(conn);
                             return;
                         }
 
+                        // Keep the head apart, so that request.head stays valid while the body is received
+                        conn.requestHead.assign(conn.receiveBuffer, 0, headLen);
+                        conn.receiveBuffer.erase(0, headLen);
+                        conn.requests++;
                         if (!parseHeaders(conn))
                         {
                             LOG_WARN("HttpServer: [%s] invalid headers", conn.request.client.c_str());
                             conn.response.code = 400;  // Bad Request
                             conn.keepalive = false;
-                            conn.state = Connection::Processing;
+                            setState(conn, Connection::Processing);
                             continue;
                         }
                         LOG_INFO("HttpServer: [%s] %s %s %s", conn.request.client.c_str(),
                             conn.request.method.c_str(), conn.request.uri.c_str(),
                             conn.request.protocol.c_str());
-                        conn.receiveBuffer.erase(0, ofs + (lfOnly ? 2 : 4));
 
-                        conn.keepalive = (conn.request.protocol == "HTTP/1.1");
-                        auto const connection = conn.request.headers.find("Connection");
-                        if (connection != conn.request.headers.end())
+                        HttpRequestHead const& head = conn.request.head;
+                        conn.keepalive = (head.protocol == "HTTP/1.1");
+                        auto const connection = head.find(HttpRequestHead::Connection);
+                        if (connection != nullptr)
                         {
-                            if (equalsLowercased(connection->second, "keep-alive"))
+                            if (HttpRequestHead::equalsIgnoreCase(connection->value, "keep-alive"))
                             {
                                 conn.keepalive = true;
                             }
-                            else if (equalsLowercased(connection->second, "close"))
+                            else if (HttpRequestHead::equalsIgnoreCase(connection->value, "close"))
                             {
                                 conn.keepalive = false;
                             }
                         }
 
-                        auto const contentLength = conn.request.headers.find("Content-Length");
-                        if (contentLength != conn.request.headers.end())
+                        conn.contentLength = 0;
+                        auto const contentLength = head.find(HttpRequestHead::ContentLength);
+                        if (contentLength != nullptr)
                         {
-                            conn.contentLength = atoi(contentLength->second.c_str());
+                            char const* first = contentLength->value.data();
+                            char const* last = first + contentLength->value.size();
+                            auto parsed = std::from_chars(first, last, conn.contentLength);
+                            if ((parsed.ec != std::errc()) || (parsed.ptr != last))
+                            {
+                                LOG_WARN("HttpServer: [%s] invalid content length", conn.request.client.c_str());
+                                conn.response.code = 400;  // Bad Request
+                                conn.keepalive = false;
+                                setState(conn, Connection::Processing);
+                                continue;
+                            }
                         }
-                        else
+                        conn.chunked = false;
+                        auto const transferEncoding = head.find(HttpRequestHead::TransferEncoding);
+                        if (transferEncoding != nullptr)
+                        {
+                            // Length next to chunked coding is ambiguous, a request smuggling attempt
+                            if (contentLength != nullptr)
+                            {
+                                LOG_WARN("HttpServer: [%s] both content length and transfer encoding",
+                                    conn.request.client.c_str());
+                                conn.response.code = 400;  // Bad Request
+                                conn.keepalive = false;
+                                setState(conn, Connection::Processing);
+                                continue;
+                            }
+                            std::string_view coding = transferEncoding->value;
+                            while (!coding.empty() && ((coding.back() == ' ') || (coding.back() == '\t')))
+                            {
+                                coding.remove_suffix(1);
+                            }
+                            if (!HttpRequestHead::equalsIgnoreCase(coding, "chunked"))
+                            {
+                                LOG_WARN("HttpServer: [%s] unsupported transfer encoding - %.*s",
+                                    conn.request.client.c_str(), static_cast<int>(coding.size()), coding.data());
+                                conn.response.code = 501;  // Not Implemented
+                                conn.keepalive = false;
+                                setState(conn, Connection::Processing);
+                                continue;
+                            }
+                            conn.chunked = true;
+                            conn.chunkedDecoder.reset();
+                        }
+                        bool hasBody = conn.chunked || (conn.contentLength != 0);
+                        conn.bodyHandler = hasBody ? findBodyHandler(conn) : nullptr;
+                        conn.bodyReceived = 0;
+                        if (conn.chunked || (conn.bodyHandler != nullptr))
                         {
-                            conn.contentLength = 0;
+                            conn.request.content.clear();
                         }
-                        if (conn.contentLength > m_maxRequestContentSize)
+
+                        if ((conn.bodyHandler == nullptr) && (conn.contentLength > m_maxRequestContentSize))
                         {
                             LOG_WARN("HttpServer: [%s] content too long - %u", conn.request.client.c_str(),
                                 static_cast<unsigned>(conn.contentLength));
                             conn.response.code = 413;  // Payload Too Large
                             conn.keepalive = false;
-                            conn.state = Connection::Processing;
+                            setState(conn, Connection::Processing);
                             continue;
                         }
 
-                        auto const expect = conn.request.headers.find("Expect");
-                        if (expect != conn.request.headers.end() && conn.request.protocol == "HTTP/1.1")
+                        auto const expect = head.find(HttpRequestHead::Expect);
+                        if (expect != nullptr && head.protocol == "HTTP/1.1")
                         {
-                            if (!equalsLowercased(expect->second, "100-continue"))
+                            if (!HttpRequestHead::equalsIgnoreCase(expect->value, "100-continue"))
                             {
-                                LOG_WARN("HttpServer: [%s] unknown expectation - %s", conn.request.client.c_str(),
-                                    expect->second.c_str());
+                                LOG_WARN("HttpServer: [%s] unknown expectation - %.*s", conn.request.client.c_str(),
+                                    static_cast<int>(expect->value.size()), expect->value.data());
                                 conn.response.code = 417;  // Expectation Failed
                                 conn.keepalive = false;
-                                conn.state = Connection::Processing;
+                                setState(conn, Connection::Processing);
                                 continue;
                             }
-                            conn.sendBuffer = "HTTP/1.1 100 Continue\r\n\r\n";
-                            conn.state = Connection::Sending100Continue;
+                            conn.sendQueue.push().headers = "HTTP/1.1 100 Continue\r\n\r\n";
+                            setState(conn, Connection::Sending100Continue);
                             LOG_TRACE("HttpServer: [%s] sending \"100 Continue\"", conn.request.client.c_str());
                             continue;
                         }
 
-                        conn.state = Connection::ReceivingBody;
+                        setState(conn, Connection::ReceivingBody);
                         LOG_TRACE("HttpServer: [%s] receiving body", conn.request.client.c_str());
                     }
 
                     if (conn.state == Connection::Sending100Continue)
                     {
-                        if (sendMore(conn))
+                        // Batched responses go out first, in order
+                        if (flushAndReceive(conn))
+                        {
+                            return;
+                        }
+
+                        setState(conn, Connection::ReceivingBody);
+                        LOG_TRACE("HttpServer: [%s] receiving body", conn.request.client.c_str());
+                    }
+
+                    if (conn.state == Connection::ReceivingBody)
+                    {
+                        if (conn.chunked || (conn.bodyHandler != nullptr))
+                        {
+                            if (!receiveBody(conn))
+                            {
+                                flushAndReceive(conn);
+                                return;
+                            }
+                        }
+                        else
+                        {
+                            if (conn.receiveBuffer.length() < conn.contentLength)
+                            {
+                                flushAndReceive(conn);
+                                return;
+                            }
+
+                            if (conn.receiveBuffer.length() == conn.contentLength)
+                            {
+                                conn.request.content = std::move(conn.receiveBuffer);
+                                conn.receiveBuffer.clear();
+                            }
+                            else
+                            {
+                                conn.request.content.assign(conn.receiveBuffer, 0, conn.contentLength);
+                                conn.receiveBuffer.erase(0, conn.contentLength);
+                            }
+                        }
+
+                        setState(conn, Connection::Processing);
+                        LOG_TRACE("HttpServer: [%s] processing request", conn.request.client.c_str());
+                    }
+
+                    if (conn.state == Connection::Processing)
+                    {
+                        if (conn.suspended)
+                        {
+                            // Keep watching for hangup only, until the handler returns
+                            if (!completionBased(conn) && conn.sendQueue.empty())
+                            {
+                                conn.reactor->addSocket(conn.socket, Reactor::Closed);
+                            }
+                            return;
+                        }
+                        if (!processRequest(conn))
+                        {
+                            // Batched responses go out while the handler runs
+                            if (!sendMore(conn) && !completionBased(conn))
+                            {
+                                conn.reactor->addSocket(conn.socket, Reactor::Closed);
+                            }
+                            conn.receivePaused = true;
+                            return;
+                        }
+                        if (conn.response.code == -1)
                         {
+                            LOG_TRACE("HttpServer: [%s] closing by request", conn.request.client.c_str());
+                            handleConnectionClosed(conn);
                             return;
                         }
+                        if (conn.response.message.empty())
+                        {
+                            conn.response.message = getDefaultResponseMessage(conn.response.code);
+                        }
+                        encodeResponse(conn);
+                        bool head = (conn.request.method == "HEAD");
+                        if (!hasBody(conn.response.code))
+                        {
+                            // Whatever the handler set, the client would read it as the next response
+                            dropBody(conn.response);
+                        }
 
-                        conn.state = Connection::ReceivingBody;
-                        LOG_TRACE("HttpServer: [%s] receiving body", conn.request.client.c_str());
-                    }
-
-                    if (conn.state == Connection::ReceivingBody)
-                    {
-                        if (conn.receiveBuffer.length() < conn.contentLength)
+                        if (conn.response.producer && !head)
                         {
-                            return;
+                            conn.response.body.clear();
+                            conn.response.file.reset();
+                            if (completionBased(conn))
+                            {
+                                // Reactor sends from memory only: produce the whole body
+                                while (conn.response.producer(conn.response.body))
+                                {
+                                }
+                                conn.response.producer = nullptr;
+                            }
+                            else if (!isChunked(conn))
+                            {
+                                // Closing the connection ends the body
+                                conn.keepalive = false;
+                            }
                         }
 
-                        if (conn.receiveBuffer.length() == conn.contentLength)
+                        QueuedResponse& queued = conn.sendQueue.push();
+                        writeResponseHead(conn, queued.headers);
+                        if (head)
                         {
-                            conn.request.content = std::move(conn.receiveBuffer);
-                            conn.receiveBuffer.clear();
+                            // Headers describe the body a GET would get, the body is not sent
+                            dropBody(conn.response);
                         }
-                        else
+                        // Swapping keeps both buffers for reuse by the next responses
+                        queued.body.swap(conn.response.body);
+                        conn.response.body.clear();
+                        queued.file = std::move(conn.response.file);
+                        queued.chunked = isChunked(conn);
+                        queued.producer = std::move(conn.response.producer);
+                        conn.response.producer = nullptr;
+                        if (queued.streamsFile() && completionBased(conn))
                         {
-                            conn.request.content.assign(conn.receiveBuffer, 0, conn.contentLength);
-                            conn.receiveBuffer.erase(0, conn.contentLength);
+                            // Reactor sends from memory only: read the file in
+                            if (!queued.file->read(0, static_cast<size_t>(queued.file->size()), queued.body))
+                            {
+                                LOG_WARN("HttpServer: [%s] failed to read file", conn.request.client.c_str());
+                                conn.keepalive = false;
+                            }
+                            queued.file.reset();
                         }
-
-                        conn.state = Connection::Processing;
-                        LOG_TRACE("HttpServer: [%s] processing request", conn.request.client.c_str());
-                    }
-
-                    if (conn.state == Connection::Processing)
-                    {
-                        processRequest(conn);
-
-                        std::ostringstream os;
-                        os << conn.request.protocol << ' ' << conn.response.code << ' ' << conn.response.message
-                            << "\r\n";
-                        for (auto const& header : conn.response.headers)
+                        else if (queued.streamsFile() && conn.tls && !conn.tls->kernelSend())
                         {
-                            os << header.first << ": " << header.second << "\r\n";
+                            // Encrypted in user space: the file is read part by part, like a produced body
+                            queued.producer = fileProducer(conn, std::move(queued.file));
                         }
-                        os << "\r\n";
-
-                        conn.sendBuffer = os.str();
-                        conn.state = Connection::SendingHeaders;
-                        LOG_TRACE("HttpServer: [%s] sending headers", conn.request.client.c_str());
-                    }
-
-                    if (conn.state == Connection::SendingHeaders)
-                    {
-                        if (sendMore(conn))
+                        if (conn.response.webSocket && (conn.response.code == 101))
                         {
+                            startWebSocket(conn);
                             return;
                         }
-
-                        conn.sendBuffer = std::move(conn.response.body);
-                        conn.state = Connection::SendingBody;
-                        LOG_TRACE("HttpServer: [%s] sending body", conn.request.client.c_str());
+                        setState(conn, Connection::SendingResponse);
+                        LOG_TRACE("HttpServer: [%s] sending response", conn.request.client.c_str());
                     }
 
-                    if (conn.state == Connection::SendingBody)
+                    if (conn.state == Connection::SendingResponse)
                     {
-                        if (sendMore(conn))
+                        conn.keepalive &= allowKeepalive;
+                        bool completion = completionBased(conn);
+
+                        // More requests are already received: answer them in the same write
+                        if (conn.keepalive && !conn.receiveBuffer.empty() &&
+                            (conn.sendQueue.size() < m_pipelineDepth) &&
+                            (conn.sendQueue.empty() || !conn.sendQueue.back().streams()) && withinSendBudget(conn))
                         {
-                            return;
+                            setState(conn, Connection::Idle);
+                            LOG_TRACE("HttpServer: [%s] next pipelined request", conn.request.client.c_str());
+                            continue;
                         }
 
-                        conn.keepalive &= allowKeepalive;
+                        // Completion-based reactor shuts the socket down once the body is sent
+                        if (sendMore(conn, completion && !conn.keepalive))
+                        {
+                            return;
+                        }
 
                         if (conn.keepalive)
                         {
-                            m_reactor.addSocket(conn.socket,
-                                Reactor::Readable | Reactor::Closed);
-                            conn.state = Connection::Idle;
+                            flushAndReceive(conn);
+                            setState(conn, Connection::Idle);
                             LOG_TRACE("HttpServer: [%s] idle (keep-alive)", conn.request.client.c_str());
                             if (conn.receiveBuffer.empty())
                             {
                                 return;
                             }
+                            // Pipelined requests wait while the responses are over the send budget
+                            if (!withinSendBudget(conn))
+                            {
+                                return;
+                            }
+                        }
+                        else if (completion)
+                        {
+                            // Shutdown follows the response, see sendMore
+                            setState(conn, Connection::Closing);
+                            LOG_TRACE("HttpServer: [%s] closing", conn.request.client.c_str());
                         }
                         else
                         {
+                            if (conn.tls)
+                            {
+                                conn.tls->shutdown();
+                            }
                             conn.socket.shutdown(Socket::ShutdownSend);
-                            m_reactor.addSocket(conn.socket, Reactor::Closed);
-                            conn.state = Connection::Closing;
+                            conn.reactor->addSocket(conn.socket, Reactor::Closed);
+                            setState(conn, Connection::Closing);
                             LOG_TRACE("HttpServer: [%s] closing", conn.request.client.c_str());
                         }
                     }
@@ -563,189 +2674,690 @@ namespace http
 
             bool parseHeaders(Connection& conn)
             {
-                // Method
-                char const* begin = conn.receiveBuffer.c_str();
-                char const* ptr = begin;
-                while (*ptr && *ptr != ' ' && *ptr != '\r' && *ptr != '\n')
-                {
-                    ptr++;
-                }
-                if (*ptr != ' ')
+                HttpRequestHead& head = conn.request.head;
+                bool parsed = head.parse(conn.requestHead, conn.headScanner.lineEnds());
+                conn.headScanner.reset();
+                if (!parsed)
                 {
+                    conn.request.protocol.clear();
                     return false;
                 }
-                conn.request.method.assign(begin, ptr);
-                while (*ptr == ' ')
-                {
-                    ptr++;
-                }
 
-                // URI
-                begin = ptr;
-                while (*ptr && *ptr != ' ' && *ptr != '\r' && *ptr != '\n')
+                // Compatibility fields, assigning reuses their capacity
+                conn.request.method.assign(head.method.data(), head.method.size());
+                conn.request.uri.assign(head.uri.data(), head.uri.size());
+                conn.request.protocol.assign(head.protocol.data(), head.protocol.size());
+                conn.request.headers.clear();
+                if (m_requestHeadersMap)
                 {
-                    ptr++;
+                    for (auto const& header : head.headers)
+                    {
+                        conn.request.headers[normalizeHeaderName(header.name)] = std::string(header.value);
+                    }
                 }
-                if (*ptr != ' ')
-                {
+                return true;
+            }
+
+            /// <summary>
+            /// First handler of the request that receives the body as it arrives.
+            /// </summary>
+            /// <returns>nullptr if the body is collected in request.content</returns>
+            HttpRequestCallback* findBodyHandler(Connection& conn)
+            {
+                HttpRequestCallback* handler = nullptr;
+                m_router.match(conn.request.head.uri, [&handler](Router::Route const& route) {
+                    if (route.handler->streamsBody())
+                    {
+                        handler = route.handler;
+                        return true;
+                    }
                     return false;
-                }
-                conn.request.uri.assign(begin, ptr);
-                while (*ptr == ' ')
+                });
+                return handler;
+            }
+
+            /// <summary>
+            /// Decode received part of a chunked body, or hand it over to the body handler.
+            /// </summary>
+            /// <returns>true once the body is complete or rejected, then response.code is set</returns>
+            bool receiveBody(Connection& conn)
+            {
+                auto onData = [this, &conn](std::string_view data) {
+                    if (conn.bodyHandler != nullptr)
+                    {
+                        int result = conn.bodyHandler->onHttpRequestBody(conn.request, data);
+                        if (result != 0)
+                        {
+                            conn.response.code = result;
+                            return false;
+                        }
+                        return true;
+                    }
+                    if (conn.request.content.size() + data.size() > m_maxRequestContentSize)
+                    {
+                        LOG_WARN("HttpServer: [%s] content too long", conn.request.client.c_str());
+                        conn.response.code = 413;  // Payload Too Large
+                        return false;
+                    }
+                    conn.request.content.append(data.data(), data.size());
+                    return true;
+                };
+
+                size_t consumed = 0;
+                bool done = false;
+                if (conn.chunked)
                 {
-                    ptr++;
+                    auto result = conn.chunkedDecoder.decode(conn.receiveBuffer, consumed, onData);
+                    if ((result == HttpChunkedDecoder::Error) && (conn.response.code == 0))
+                    {
+                        LOG_WARN("HttpServer: [%s] invalid chunk", conn.request.client.c_str());
+                        conn.response.code = 400;  // Bad Request
+                    }
+                    done = (result != HttpChunkedDecoder::NeedMore);
                 }
-
-                // Protocol
-                begin = ptr;
-                while (*ptr && *ptr != ' ' && *ptr != '\r' && *ptr != '\n')
+                else
                 {
-                    ptr++;
+                    consumed = std::min(conn.receiveBuffer.size(), conn.contentLength - conn.bodyReceived);
+                    if ((consumed != 0) && !onData(std::string_view(conn.receiveBuffer.data(), consumed)))
+                    {
+                        done = true;
+                    }
+                    conn.bodyReceived += consumed;
+                    done |= (conn.bodyReceived == conn.contentLength);
                 }
-                if (*ptr != '\r' && *ptr != '\n')
+                conn.receiveBuffer.erase(0, consumed);
+                if (conn.response.code != 0)
                 {
-                    return false;
+                    // The rest of the body is not read
+                    conn.keepalive = false;
                 }
-                conn.request.protocol.assign(begin, ptr);
-                if (*ptr == '\r')
+                return done;
+            }
+
+            static std::string normalizeHeaderName(std::string_view name)
+            {
+                std::string result(name);
+                bool first = true;
+                for (char& ch : result)
                 {
-                    ptr++;
+                    if (first)
+                    {
+                        ch = static_cast<char>(::toupper(ch));
+                        first = false;
+                    }
+                    else if (ch == '-')
+                    {
+                        first = true;
+                    }
+                    else
+                    {
+                        ch = static_cast<char>(::tolower(ch));
+                    }
                 }
-                if (*ptr != '\n')
+                return result;
+            }
+
+            /// <summary>
+            /// Run the handlers of the request, until one of them suspends the connection.
+            /// Called again once the suspended handler returns, to go on with the next ones.
+            /// </summary>
+            /// <returns>false if the connection is suspended, onRequestHandled resumes it</returns>
+            bool processRequest(Connection& conn)
+            {
+                Router::Route const* route = conn.suspendedRoute;
+                conn.suspendedRoute = nullptr;
+                if (route == nullptr)
                 {
-                    return false;
+                    conn.response.message.clear();
+                    conn.response.headers.clear();
+                    conn.response.body.clear();
+                    conn.response.file.reset();
+                    conn.response.rawHeaders.clear();
+                    conn.response.producer = nullptr;
+                    conn.response.webSocket = nullptr;
+                    conn.response.webSocketDeflate = false;
+
+                    if (conn.response.code != 0)
+                    {
+                        return true;
+                    }
+                    conn.response.code = 404;  // Not Found
                 }
-                ptr++;
 
-                // Headers
-                conn.request.headers.clear();
-                while (*ptr != '\r' && *ptr != '\n')
+                for (;;)
                 {
-                    // Name
-                    begin = ptr;
-                    while (*ptr && *ptr != ':' && *ptr != ' ' && *ptr != '\r' && *ptr != '\n')
+                    if ((route != nullptr) && (conn.handlerResult != 0))
                     {
-                        ptr++;
+                        conn.response.code = conn.handlerResult;
+                        return true;
                     }
-                    if (*ptr != ':')
+                    route = runHandlers(conn, route);
+                    if (route == nullptr)
                     {
-                        return false;
+                        return true;
                     }
-                    std::string name = normalizeHeaderName(begin, ptr);
-                    ptr++;
-                    while (*ptr == ' ')
+                    if (suspendHandler(conn, *route))
                     {
-                        ptr++;
+                        conn.suspendedRoute = route;
+                        return false;
                     }
+                }
+            }
 
-                    // Value
-                    begin = ptr;
-                    while (*ptr && *ptr != '\r' && *ptr != '\n')
+            /// <summary>
+            /// Call handlers of matching prefixes in registration order, until one of them answers.
+            /// </summary>
+            /// <param name="after">Handler that returned last, nullptr to start with the first one</param>
+            /// <returns>Handler that has to suspend the connection, nullptr if the request is handled</returns>
+            Router::Route const* runHandlers(Connection& conn, Router::Route const* after)
+            {
+                bool skip = (after != nullptr);
+                bool canOffload = m_workers && conn.reactor->canExecute();
+                Router::Route const* suspending = nullptr;
+                m_router.match(conn.request.head.uri, [&](Router::Route const& route) {
+                    if (skip)
+                    {
+                        skip = (&route != after);
+                        return false;
+                    }
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+                    if (route.handler->isCoroutine())
                     {
-                        ptr++;
+                        suspending = &route;
+                        return true;
                     }
-                    conn.request.headers[name] = std::string(begin, ptr);
-                    if (*ptr == '\r')
+#endif
+                    if (canOffload && (route.handler->execution() == HttpRequestCallback::Offload))
                     {
-                        ptr++;
+                        suspending = &route;
+                        return true;
                     }
-                    if (*ptr != '\n')
+                    LOG_TRACE("HttpServer: [%s] using handler for %s", conn.request.client.c_str(),
+                        route.prefix.c_str());
+                    int result = route.handler->onHttpRequest(conn.request, conn.response);
+                    if (result != 0)
                     {
-                        return false;
+                        conn.response.code = result;
+                        return true;
                     }
-                    ptr++;
-                }
+                    return false;
+                });
+                return suspending;
+            }
 
-                if (*ptr == '\r')
+            /// <summary>
+            /// Start the coroutine of the handler, or hand the handler over to a worker thread.
+            /// </summary>
+            /// <returns>false if the handler returned already, its result is in handlerResult</returns>
+            bool suspendHandler(Connection& conn, Router::Route const& route)
+            {
+                Connection* connPtr = &conn;
+                conn.handlerResult = 0;
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+                if (route.handler->isCoroutine())
                 {
-                    ptr++;
+                    LOG_TRACE("HttpServer: [%s] using coroutine for %s", conn.request.client.c_str(),
+                        route.prefix.c_str());
+                    conn.task = route.handler->onHttpRequestAsync(conn.request, conn.response);
+                    conn.suspended = !conn.task.start([this, connPtr]() {
+                        connPtr->handlerResult = connPtr->task.result();
+                        onRequestHandled(*connPtr);
+                    });
+                    if (!conn.suspended)
+                    {
+                        conn.handlerResult = conn.task.result();
+                        conn.task.reset();
+                    }
+                    return conn.suspended;
                 }
-                if (*ptr != '\n')
+#endif
+                Router::Route const* routePtr = &route;
+                conn.suspended = m_workers->submit([this, connPtr, routePtr]() {
+                    LOG_TRACE("HttpServer: [%s] using handler for %s", connPtr->request.client.c_str(),
+                        routePtr->prefix.c_str());
+                    connPtr->handlerResult = routePtr->handler->onHttpRequest(connPtr->request, connPtr->response);
+                    connPtr->reactor->execute([this, connPtr]() { onRequestHandled(*connPtr); });
+                });
+                if (!conn.suspended)
                 {
+                    LOG_WARN("HttpServer: [%s] too many offloaded requests", conn.request.client.c_str());
+                    conn.handlerResult = 503;  // Service Unavailable
                     return false;
                 }
-                ptr++;
-
+                LOG_TRACE("HttpServer: [%s] request offloaded", conn.request.client.c_str());
                 return true;
             }
 
-            static bool equalsLowercased(std::string const& str, char const* mask)
+            /// <summary>
+            /// Resume the connection once the suspended handler returns, on the reactor thread.
+            /// </summary>
+            void onRequestHandled(Connection& conn)
+            {
+                conn.suspended = false;
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+                // Called from the final suspension point of the coroutine, it is safe to destroy
+                conn.task.reset();
+#endif
+                if (conn.closed)
+                {
+                    handleConnectionClosed(conn);
+                    return;
+                }
+                Socket socket = conn.socket;
+                handleConnection(conn);
+                if (findConnection(socket) == &conn)
+                {
+                    updateSendBudget(conn);
+                    updateTimeout(conn);
+                }
+            }
+
+            /// <summary>
+            /// Hand the connection over to the WebSocket handler once the 101 response is queued.
+            /// Frames sent right behind the upgrade request are in the receive buffer already.
+            /// </summary>
+            void startWebSocket(Connection& conn)
             {
-                char const* ptr = str.c_str();
-                while (*ptr && *mask && ::tolower(*ptr) == *mask)
+                WebSocketHandler& handler = *conn.response.webSocket;
+                auto protocol = conn.response.headers.find("Sec-WebSocket-Protocol");
+                conn.webSocket.reset(new WebSocket(handler, conn.request, conn.response.webSocketDeflate,
+                    (protocol != conn.response.headers.end()) ? protocol->second : std::string()));
+                Connection* connPtr = &conn;
+                conn.webSocket->m_flush = [this, connPtr]() {
+                    flushWebSocket(*connPtr);
+                    updateSendBudget(*connPtr);
+                    updateTimeout(*connPtr);
+                };
+                std::vector<Connection*>& connections = webSocketsOf(conn.reactor).connections;
+                conn.webSocketIndex = connections.size();
+                connections.push_back(&conn);
+                setState(conn, Connection::Upgraded);
+                LOG_TRACE("HttpServer: [%s] upgraded to WebSocket", conn.request.client.c_str());
+                if (handler.onOpen)
                 {
-                    ptr++;
-                    mask++;
+                    handler.onOpen(*conn.webSocket);
                 }
-                return !*ptr && !*mask;
+                handleWebSocket(conn);
             }
 
-            static std::string normalizeHeaderName(char const* begin, char const* end)
+            /// <summary>
+            /// Read the frames received on the upgraded connection, then send what is queued.
+            /// </summary>
+            void handleWebSocket(Connection& conn)
             {
-                std::string result(begin, end);
-                bool first = true;
-                for (char& ch : result)
+                WebSocket& ws = *conn.webSocket;
+                if (!ws.m_closeReceived && !ws.m_failed && !conn.receiveBuffer.empty())
                 {
-                    if (first)
+                    size_t consumed = ws.m_reader.read(&conn.receiveBuffer[0], conn.receiveBuffer.size(),
+                        [this, &conn](uint8_t opcode, std::string_view payload) {
+                            return onWebSocketFrame(conn, opcode, payload);
+                        });
+                    conn.receiveBuffer.erase(0, consumed);
+                    if (ws.m_reader.error() != 0)
                     {
-                        ch = static_cast<char>(::toupper(ch));
-                        first = false;
+                        LOG_WARN("HttpServer: [%s] WebSocket protocol error %u", conn.request.client.c_str(),
+                            static_cast<unsigned>(ws.m_reader.error()));
+                        ws.fail(ws.m_reader.error());
                     }
-                    else if (ch == '-')
+                }
+                if (ws.m_closeReceived || ws.m_failed)
+                {
+                    // Nothing follows the Close frame
+                    conn.receiveBuffer.clear();
+                }
+                flushWebSocket(conn);
+            }
+
+            /// <summary>
+            /// Handle a message or a control frame of the client.
+            /// </summary>
+            /// <returns>false once the client closed, the rest of the data is dropped</returns>
+            bool onWebSocketFrame(Connection& conn, uint8_t opcode, std::string_view payload)
+            {
+                WebSocket& ws = *conn.webSocket;
+                switch (opcode)
+                {
+                case WebSocketFrame::Text:
+                case WebSocketFrame::Binary:
+                    if (!ws.m_closeSent && ws.m_handler.onMessage)
                     {
-                        first = true;
+                        ws.m_handler.onMessage(ws, payload, opcode == WebSocketFrame::Binary);
+                    }
+                    return true;
+                case WebSocketFrame::Ping:
+                    if (!ws.m_closeSent)
+                    {
+                        ws.queueControl(WebSocketFrame::Pong, payload);
+                    }
+                    return true;
+                case WebSocketFrame::Close:
+                    ws.m_closeReceived = true;
+                    ws.m_closeCode = WebSocketFrame::NoStatus;
+                    if (payload.size() >= 2)
+                    {
+                        ws.m_closeCode = static_cast<uint16_t>(
+                            (static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1]));
+                    }
+                    if (!ws.m_closeSent)
+                    {
+                        // Echo the status code
+                        ws.queueControl(WebSocketFrame::Close, payload.substr(0, 2));
+                        ws.m_closeSent = true;
+                    }
+                    return false;
+                default:
+                    return true;
+                }
+            }
+
+            /// <summary>
+            /// Send the queued frames of the upgraded connection after the responses before them,
+            /// with gather writes of up to kMaxWebSocketFrames frames. Shuts the connection down once
+            /// the close handshake is complete, drops it if the client doesn't keep up with the queue.
+            /// Never removes the connection: it is called from the callbacks of the handler and by
+            /// broadcast(), the reactor reports the hangup.
+            /// </summary>
+            void flushWebSocket(Connection& conn)
+            {
+                if (conn.state != Connection::Upgraded)
+                {
+                    return;
+                }
+                WebSocket& ws = *conn.webSocket;
+                bool blocked = sendMore(conn);
+                if (!blocked && completionBased(conn))
+                {
+                    // Reactor sends in the background and owns what it sends
+                    while (!ws.m_frames.empty())
+                    {
+                        conn.reactor->send(conn.socket, ws.take());
+                    }
+                }
+                while (!blocked && !ws.m_frames.empty())
+                {
+                    Socket::IoVec vecs[kMaxWebSocketFrames];
+                    size_t count = 0;
+                    size_t total = 0;
+                    for (auto const& frame : ws.m_frames)
+                    {
+                        if (count == kMaxWebSocketFrames)
+                        {
+                            break;
+                        }
+                        std::string_view data = frame.data();
+                        if (count == 0)
+                        {
+                            data.remove_prefix(ws.m_offset);
+                        }
+                        vecs[count++] = Socket::ioVec(data.data(), data.size());
+                        total += data.size();
+                    }
+                    int sent = sendv(conn, vecs, count);
+                    LOG_TRACE("HttpServer: [%s] sent frames %d", conn.request.client.c_str(), sent);
+                    if ((sent < 0) && !wouldBlock(conn))
+                    {
+                        // Connection is lost, nothing more can be sent
+                        ws.abort();
+                        break;
+                    }
+                    size_t done = (sent > 0) ? static_cast<size_t>(sent) : 0;
+                    ws.consume(done);
+                    if (done < total)
+                    {
+                        conn.reactor->addSocket(conn.socket, Reactor::Writable | Reactor::Closed);
+                        conn.receivePaused = true;
+                        blocked = true;
+                    }
+                }
+
+                size_t unsent = ws.queuedBytes() + conn.reactor->pendingSend(conn.socket);
+                if ((ws.m_handler.maxQueuedBytes != 0) && (unsent > ws.m_handler.maxQueuedBytes))
+                {
+                    LOG_WARN("HttpServer: [%s] WebSocket client is too slow, %zu bytes unsent",
+                        conn.request.client.c_str(), unsent);
+                    ws.abort();
+                    // Wakes the receive up, it sees the end of the stream
+                    conn.socket.shutdown(Socket::ShutdownBoth);
+                    if (!completionBased(conn))
+                    {
+                        conn.reactor->addSocket(conn.socket, Reactor::Readable | Reactor::Closed);
+                    }
+                    setState(conn, Connection::Closing);
+                    return;
+                }
+                if (blocked)
+                {
+                    return;
+                }
+                if (ws.finished())
+                {
+                    if (completionBased(conn))
+                    {
+                        // Shutdown follows what is in flight
+                        conn.reactor->send(conn.socket, std::string(), true);
                     }
                     else
                     {
-                        ch = static_cast<char>(::tolower(ch));
+                        if (conn.tls)
+                        {
+                            conn.tls->shutdown();
+                        }
+                        conn.socket.shutdown(Socket::ShutdownSend);
+                        conn.reactor->addSocket(conn.socket, Reactor::Closed);
                     }
+                    setState(conn, Connection::Closing);
+                    LOG_TRACE("HttpServer: [%s] WebSocket closing", conn.request.client.c_str());
+                    return;
+                }
+                flushAndReceive(conn);
+            }
+
+            /// <summary>
+            /// Unregister the upgraded connection that is being closed and tell the handler.
+            /// </summary>
+            void closeWebSocket(Connection& conn)
+            {
+                std::vector<Connection*>& connections = webSocketsOf(conn.reactor).connections;
+                Connection* last = connections.back();
+                connections[conn.webSocketIndex] = last;
+                last->webSocketIndex = conn.webSocketIndex;
+                connections.pop_back();
+
+                WebSocket& ws = *conn.webSocket;
+                ws.abort();
+                ws.m_flush = nullptr;
+                LOG_TRACE("HttpServer: [%s] WebSocket closed with %u", conn.request.client.c_str(),
+                    static_cast<unsigned>(ws.m_closeCode));
+                if (ws.m_handler.onClose)
+                {
+                    ws.m_handler.onClose(ws, ws.m_closeCode);
                 }
-                return result;
             }
 
-            void processRequest(Connection& conn)
+            /// <summary>
+            /// Content coding of the response to the request, the best one both sides support.
+            /// </summary>
+            HttpEncoder::Coding acceptedCoding(HttpRequest const& request, unsigned codings) const
             {
-                conn.response.message.clear();
-                conn.response.headers.clear();
-                conn.response.body.clear();
+                HttpHeaderView const* acceptEncoding = request.head.find(HttpRequestHead::AcceptEncoding);
+                return (acceptEncoding != nullptr) ? HttpEncoder::negotiate(acceptEncoding->value, codings) :
+                    HttpEncoder::Identity;
+            }
 
-                if (conn.response.code == 0)
+            /// <summary>
+            /// Response encoding stage: compress the body of an eligible response, see setCompression.
+            /// Files are sent as they are, HttpFileServer serves precompressed variants of them.
+            /// </summary>
+            void encodeResponse(Connection& conn)
+            {
+                HttpResponse& response = conn.response;
+                unsigned codings = m_compression & HttpEncoder::available();
+                if ((codings == HttpEncoder::Identity) || response.file || !hasBody(response.code) ||
+                    (response.headers.count("Content-Encoding") != 0))
                 {
-                    conn.response.code = 404;  // Not Found
-                    for (auto& handler : m_handlers)
+                    return;
+                }
+                auto contentType = response.headers.find(CONTENT_TYPE);
+                if ((contentType == response.headers.end()) || !HttpEncoder::compressible(contentType->second) ||
+                    (!response.producer && (response.body.size() < m_compressionMinSize)))
+                {
+                    return;
+                }
+                // The body depends on Accept-Encoding from now on, whatever this client accepts
+                std::string& vary = response.headers["Vary"];
+                vary = vary.empty() ? "Accept-Encoding" : (vary + ", Accept-Encoding");
+                HttpEncoder::Coding coding = acceptedCoding(conn.request, codings);
+                if (coding == HttpEncoder::Identity)
+                {
+                    return;
+                }
+
+                if (response.producer)
+                {
+                    auto encoder = std::make_shared<HttpEncoder>();
+                    if (!encoder->start(coding))
                     {
-                        if (conn.request.uri.length() >= handler.first.length() &&
-                            strncmp(conn.request.uri.c_str(), handler.first.c_str(), handler.first.length()) == 0)
+                        return;
+                    }
+                    // Every part is compressed as it is pulled, only the encoder state is kept
+                    response.producer = [producer = std::move(response.producer), encoder,
+                                            part = std::string()](std::string& buffer) mutable {
+                        size_t size = buffer.size();
+                        bool more = true;
+                        while (more && (buffer.size() == size))
                         {
-                            LOG_TRACE("HttpServer: [%s] using handler for %s", conn.request.client.c_str(),
-                                handler.first.c_str());
-                            // auto callback = handler.second; // Bazel gets mad at this unused
-                            // var, uncomment when using
-                            int result = handler.second->onHttpRequest(conn.request, conn.response);
-                            if (result != 0)
+                            part.clear();
+                            more = producer(part);
+                            if (!encoder->write(part, buffer, !more))
                             {
-                                conn.response.code = result;
-                                break;
+                                LOG_WARN("HttpServer: failed to compress response body");
+                                return false;
                             }
                         }
+                        return more;
+                    };
+                }
+                else
+                {
+                    // Swapping keeps both buffers of the reactor thread for reuse
+                    thread_local std::string encoded;
+                    if (!HttpEncoder::compress(coding, response.body, encoded, HttpEncoder::Fast) ||
+                        (encoded.size() >= response.body.size()))
+                    {
+                        return;
                     }
+                    response.body.swap(encoded);
+                }
+                response.headers["Content-Encoding"] = HttpEncoder::name(coding);
+            }
 
-                    if (conn.response.code == -1)
+            /// <summary>
+            /// Serialize status line and headers. Host, Connection, Date and Content-Length are
+            /// set by the server from precomputed lines, handler values of these are ignored.
+            /// 1xx, 204 and 304 responses have no Content-Length.
+            /// </summary>
+            void writeResponseHead(Connection& conn, std::string& out)
+            {
+                HttpResponse const& response = conn.response;
+                char number[24];
+                out.clear();
+                // Requests rejected before the request line is parsed are answered with HTTP/1.1
+                out.append(conn.request.protocol.empty() ? std::string_view("HTTP/1.1") :
+                    std::string_view(conn.request.protocol));
+                out += ' ';
+                out.append(number, std::to_chars(number, number + sizeof(number), response.code).ptr);
+                out += ' ';
+                out.append(response.message);
+                out.append("\r\n");
+
+                for (auto const& header : response.headers)
+                {
+                    if (isServerHeader(header.first))
                     {
-                        LOG_TRACE("HttpServer: [%s] closing by request", conn.request.client.c_str());
-                        handleConnectionClosed(conn);
+                        continue;
                     }
+                    out.append(header.first);
+                    out.append(": ");
+                    out.append(header.second);
+                    out.append("\r\n");
                 }
 
-                if (conn.response.message.empty())
+                out.append(m_hostHeader);
+                bool upgrade = (response.webSocket != nullptr) && (response.code == 101);
+                if (upgrade)
+                {
+                    out.append("Connection: Upgrade\r\n");
+                }
+                else
+                {
+                    out.append((conn.keepalive && allowKeepalive) ? "Connection: keep-alive\r\n" :
+                        "Connection: close\r\n");
+                }
+                out.append(dateHeader());
+                if (!hasBody(response.code))
+                {
+                    // No body and no Content-Length (RFC 9110 8.6), an upgraded connection carries frames from now on
+                }
+                else if (response.producer)
+                {
+                    if (isChunked(conn))
+                    {
+                        out.append("Transfer-Encoding: chunked\r\n");
+                    }
+                }
+                else
                 {
-                    conn.response.message = getDefaultResponseMessage(conn.response.code);
+                    out.append("Content-Length: ");
+                    uint64_t length = response.file ? response.file->size() : response.body.size();
+                    out.append(number, std::to_chars(number, number + sizeof(number), length).ptr);
+                    out.append("\r\n");
                 }
+                out.append(response.rawHeaders);
+                out.append("\r\n");
+            }
+
+            /// <summary>
+            /// Whether responses with the status code have a body: 1xx, 204 and 304 don't (RFC 9110 6.4.1).
+            /// </summary>
+            static bool hasBody(int code) { return (code >= 200) && (code != 204) && (code != 304); }
+
+            static void dropBody(HttpResponse& response)
+            {
+                response.body.clear();
+                response.file.reset();
+                response.producer = nullptr;
+            }
+
+            static bool isServerHeader(std::string const& name)
+            {
+                return (name == "Host") || (name == "Connection") || (name == "Date") || (name == "Content-Length") ||
+                    (name == "Transfer-Encoding");
+            }
+
+            /// <summary>
+            /// Whether the produced response body is sent in chunks, HTTP/1.0 clients read it until close.
+            /// </summary>
+            static bool isChunked(Connection const& conn)
+            {
+                return (conn.response.producer != nullptr) && (conn.request.protocol == "HTTP/1.1");
+            }
 
-                conn.response.headers["Host"] = m_serverHost;
-                conn.response.headers["Connection"] = (conn.keepalive ? "keep-alive" : "close");
-                conn.response.headers["Date"] = formatTimestamp(time(nullptr));
-                conn.response.headers["Content-Length"] = std::to_string(conn.response.body.size());
+            /// <summary>
+            /// Date header line, formatted at most once per second on every reactor thread.
+            /// </summary>
+            static std::string_view dateHeader()
+            {
+                thread_local time_t cachedTime = -1;
+                thread_local char line[48];
+                thread_local size_t length = 0;
+                time_t now = time(nullptr);
+                if (now != cachedTime)
+                {
+                    cachedTime = now;
+                    length = static_cast<size_t>(
+                        snprintf(line, sizeof(line), "Date: %s\r\n", formatTimestamp(now).c_str()));
+                }
+                return std::string_view(line, length);
             }
 
             static std::string formatTimestamp(time_t time)
@@ -0,0 +1,962 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+// WebSocket protocol (RFC 6455) pieces the server builds on: frames, the opening handshake and
+// permessage-deflate (RFC 7692). permessage-deflate needs zlib, it is opt-in like the content
+// codings: define HAVE_ZLIB and link ZLIB::ZLIB, otherwise the extension is never negotiated.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "./http_request_parser.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SOCKETSHPP_WS_UNMASK_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SOCKETSHPP_WS_UNMASK_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+SOCKETSHPP_NS_BEGIN
+namespace http
+{
+    namespace server
+    {
+
+        /// <summary>
+        /// Frame header parsed in place, and the writers of frames the server sends.
+        /// </summary>
+        struct WebSocketFrame
+        {
+            enum Opcode : uint8_t
+            {
+                Continuation = 0,
+                Text = 1,
+                Binary = 2,
+                Close = 8,
+                Ping = 9,
+                Pong = 10
+            };
+
+            /// <summary>
+            /// Status codes of Close frames.
+            /// </summary>
+            enum Status : uint16_t
+            {
+                NormalClosure = 1000,
+                GoingAway = 1001,
+                ProtocolError = 1002,
+                UnsupportedData = 1003,
+                NoStatus = 1005,      // Close frame without a code, never sent
+                AbnormalClosure = 1006,  // Connection lost without a Close frame, never sent
+                InvalidPayload = 1007,
+                PolicyViolation = 1008,
+                MessageTooBig = 1009,
+                InternalError = 1011
+            };
+
+            enum Result
+            {
+                NeedMore,
+                Ok,
+                Error
+            };
+
+            // 2 bytes, 8 bytes of extended length and the mask key
+            static constexpr size_t const MaxHeaderSize = 14;
+            // Payload of control frames
+            static constexpr size_t const MaxControlSize = 125;
+
+            bool fin{ false };
+            bool rsv1{ false };  // Compressed message, see permessage-deflate
+            uint8_t opcode{ 0 };
+            bool masked{ false };
+            uint8_t mask[4]{};
+            uint64_t length{ 0 };
+            size_t headerSize{ 0 };
+
+            /// <summary>
+            /// Parse the frame header. The payload doesn't have to be received yet.
+            /// </summary>
+            /// <returns>NeedMore if the header is incomplete, Error if RSV2 or RSV3 is set or the
+            /// length is out of range</returns>
+            Result parse(char const* data, size_t size)
+            {
+                if (size < 2)
+                {
+                    return NeedMore;
+                }
+                uint8_t const* bytes = reinterpret_cast<uint8_t const*>(data);
+                fin = (bytes[0] & 0x80) != 0;
+                rsv1 = (bytes[0] & 0x40) != 0;
+                opcode = bytes[0] & 0x0F;
+                masked = (bytes[1] & 0x80) != 0;
+                length = bytes[1] & 0x7F;
+                if ((bytes[0] & 0x30) != 0)
+                {
+                    return Error;
+                }
+                size_t extended = (length == 126) ? 2 : ((length == 127) ? 8 : 0);
+                headerSize = 2 + extended + (masked ? 4 : 0);
+                if (size < headerSize)
+                {
+                    return NeedMore;
+                }
+                if (extended != 0)
+                {
+                    length = 0;
+                    for (size_t i = 0; i < extended; i++)
+                    {
+                        length = (length << 8) | bytes[2 + i];
+                    }
+                    // Minimal encoding is not enforced, the most significant bit must be 0
+                    if ((length >> 63) != 0)
+                    {
+                        return Error;
+                    }
+                }
+                if (masked)
+                {
+                    std::memcpy(mask, bytes + 2 + extended, 4);
+                }
+                return Ok;
+            }
+
+            /// <summary>
+            /// Write a frame header with the shortest length encoding.
+            /// </summary>
+            /// <param name="out">At least MaxHeaderSize bytes</param>
+            /// <param name="mask">Mask key of client frames, nullptr - unmasked</param>
+            /// <returns>Header size</returns>
+            static size_t writeHeader(char* out, uint8_t opcode, uint64_t length, bool fin = true, bool rsv1 = false,
+                uint8_t const* mask = nullptr)
+            {
+                uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+                bytes[0] = static_cast<uint8_t>((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | (opcode & 0x0F));
+                uint8_t maskBit = (mask != nullptr) ? 0x80 : 0;
+                size_t size = 2;
+                if (length < 126)
+                {
+                    bytes[1] = static_cast<uint8_t>(maskBit | length);
+                }
+                else
+                {
+                    size_t extended = (length <= 0xFFFF) ? 2 : 8;
+                    bytes[1] = static_cast<uint8_t>(maskBit | ((extended == 2) ? 126 : 127));
+                    for (size_t i = 0; i < extended; i++)
+                    {
+                        bytes[2 + i] = static_cast<uint8_t>(length >> (8 * (extended - 1 - i)));
+                    }
+                    size += extended;
+                }
+                if (mask != nullptr)
+                {
+                    std::memcpy(bytes + size, mask, 4);
+                    size += 4;
+                }
+                return size;
+            }
+
+            /// <summary>
+            /// Append an unmasked frame with the whole payload, as the server sends it.
+            /// </summary>
+            static void serialize(std::string& out, uint8_t opcode, std::string_view payload, bool rsv1 = false)
+            {
+                size_t offset = out.size();
+                out.resize(offset + MaxHeaderSize + payload.size());
+                size_t headerSize = writeHeader(&out[offset], opcode, payload.size(), true, rsv1);
+                if (!payload.empty())
+                {
+                    std::memcpy(&out[offset + headerSize], payload.data(), payload.size());
+                }
+                out.resize(offset + headerSize + payload.size());
+            }
+
+            /// <summary>
+            /// Apply the mask key to a payload in place, 32 or 16 bytes per step with SIMD,
+            /// 8 bytes per step otherwise. Masking and unmasking are the same operation.
+            /// </summary>
+            static void unmask(char* data, size_t size, uint8_t const mask[4])
+            {
+                uint32_t key;
+                std::memcpy(&key, mask, 4);
+                size_t pos = 0;
+#if defined(__AVX2__)
+                __m256i const key256 = _mm256_set1_epi32(static_cast<int>(key));
+                for (; pos + 32 <= size; pos += 32)
+                {
+                    __m256i* block = reinterpret_cast<__m256i*>(data + pos);
+                    _mm256_storeu_si256(block, _mm256_xor_si256(_mm256_loadu_si256(block), key256));
+                }
+#endif
+#if defined(__AVX2__) || defined(SOCKETSHPP_WS_UNMASK_SSE2)
+                __m128i const key128 = _mm_set1_epi32(static_cast<int>(key));
+                for (; pos + 16 <= size; pos += 16)
+                {
+                    __m128i* block = reinterpret_cast<__m128i*>(data + pos);
+                    _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), key128));
+                }
+#elif defined(SOCKETSHPP_WS_UNMASK_NEON)
+                uint8x16_t const key128 = vreinterpretq_u8_u32(vdupq_n_u32(key));
+                for (; pos + 16 <= size; pos += 16)
+                {
+                    uint8_t* block = reinterpret_cast<uint8_t*>(data + pos);
+                    vst1q_u8(block, veorq_u8(vld1q_u8(block), key128));
+                }
+#endif
+                // Blocks are multiples of 4 bytes, the key stays in phase
+                uint64_t key64 = (static_cast<uint64_t>(key) << 32) | key;
+                for (; pos + 8 <= size; pos += 8)
+                {
+                    uint64_t word;
+                    std::memcpy(&word, data + pos, 8);
+                    word ^= key64;
+                    std::memcpy(data + pos, &word, 8);
+                }
+                for (; pos < size; pos++)
+                {
+                    data[pos] = static_cast<char>(data[pos] ^ mask[pos & 3]);
+                }
+            }
+
+            /// <summary>
+            /// Whether the text is well-formed UTF-8, as Text messages and close reasons must be.
+            /// Overlong forms, surrogates and code points past U+10FFFF are rejected.
+            /// </summary>
+            static bool validUtf8(std::string_view text)
+            {
+                uint8_t const* bytes = reinterpret_cast<uint8_t const*>(text.data());
+                size_t size = text.size();
+                size_t pos = 0;
+                while (pos < size)
+                {
+                    // ASCII runs 8 bytes at a time
+                    if (pos + 8 <= size)
+                    {
+                        uint64_t word;
+                        std::memcpy(&word, bytes + pos, 8);
+                        if ((word & 0x8080808080808080ULL) == 0)
+                        {
+                            pos += 8;
+                            continue;
+                        }
+                    }
+                    uint8_t lead = bytes[pos];
+                    if (lead < 0x80)
+                    {
+                        pos++;
+                        continue;
+                    }
+                    size_t trailing;
+                    uint8_t low = 0x80;
+                    uint8_t high = 0xBF;
+                    if ((lead >= 0xC2) && (lead <= 0xDF))
+                    {
+                        trailing = 1;
+                    }
+                    else if ((lead >= 0xE0) && (lead <= 0xEF))
+                    {
+                        trailing = 2;
+                        low = (lead == 0xE0) ? 0xA0 : 0x80;
+                        high = (lead == 0xED) ? 0x9F : 0xBF;
+                    }
+                    else if ((lead >= 0xF0) && (lead <= 0xF4))
+                    {
+                        trailing = 3;
+                        low = (lead == 0xF0) ? 0x90 : 0x80;
+                        high = (lead == 0xF4) ? 0x8F : 0xBF;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                    if ((size - pos <= trailing) || (bytes[pos + 1] < low) || (bytes[pos + 1] > high))
+                    {
+                        return false;
+                    }
+                    for (size_t i = 2; i <= trailing; i++)
+                    {
+                        if ((bytes[pos + i] & 0xC0) != 0x80)
+                        {
+                            return false;
+                        }
+                    }
+                    pos += trailing + 1;
+                }
+                return true;
+            }
+
+            /// <summary>
+            /// Whether the peer may send the status code in a Close frame.
+            /// </summary>
+            static bool validStatus(uint16_t code)
+            {
+                return ((code >= 1000) && (code <= 1003)) || ((code >= 1007) && (code <= 1014)) ||
+                    ((code >= 3000) && (code <= 4999));
+            }
+        };
+
+        /// <summary>
+        /// Opening handshake: the accept key and the extension parameters the server agrees to.
+        /// </summary>
+        struct WebSocketHandshake
+        {
+            // Extension response of the server side of permessage-deflate. Both sides start every
+            // message with a fresh window: the server keeps no compression state per connection,
+            // and one compressed frame can be sent to every client.
+            static constexpr char const* const DeflateResponse =
+                "permessage-deflate; server_no_context_takeover; client_no_context_takeover";
+
+            /// <summary>
+            /// Whether the comma-separated header value lists the token, in any case.
+            /// </summary>
+            static bool hasToken(std::string_view value, std::string_view token)
+            {
+                while (!value.empty())
+                {
+                    size_t end = value.find(',');
+                    if (HttpRequestHead::equalsIgnoreCase(trim(value.substr(0, end)), token))
+                    {
+                        return true;
+                    }
+                    value = (end == std::string_view::npos) ? std::string_view() : value.substr(end + 1);
+                }
+                return false;
+            }
+
+            /// <summary>
+            /// Whether Sec-WebSocket-Key is the base64 encoding of 16 bytes.
+            /// </summary>
+            static bool validKey(std::string_view key)
+            {
+                key = trim(key);
+                if ((key.size() != 24) || (key[22] != '=') || (key[23] != '='))
+                {
+                    return false;
+                }
+                for (size_t i = 0; i < 22; i++)
+                {
+                    char c = key[i];
+                    if (!(((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) ||
+                            (c == '+') || (c == '/')))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /// <summary>
+            /// Sec-WebSocket-Accept for the Sec-WebSocket-Key of the client.
+            /// </summary>
+            static std::string acceptKey(std::string_view key)
+            {
+                std::string text(trim(key));
+                text += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+                uint8_t digest[20];
+                sha1(text, digest);
+                return base64(digest, sizeof(digest));
+            }
+
+            /// <summary>
+            /// Find an offer of permessage-deflate in Sec-WebSocket-Extensions that the server
+            /// can accept with DeflateResponse. Offers that limit the window of the server are
+            /// declined, the client may list a fallback after them.
+            /// </summary>
+            static bool acceptsDeflate(std::string_view extensions)
+            {
+                while (!extensions.empty())
+                {
+                    size_t end = extensions.find(',');
+                    std::string_view offer = extensions.substr(0, end);
+                    extensions = (end == std::string_view::npos) ? std::string_view() : extensions.substr(end + 1);
+
+                    size_t params = offer.find(';');
+                    if (!HttpRequestHead::equalsIgnoreCase(trim(offer.substr(0, params)), "permessage-deflate"))
+                    {
+                        continue;
+                    }
+                    bool acceptable = true;
+                    unsigned seen = 0;  // Parameters must not repeat
+                    while (acceptable && (params != std::string_view::npos))
+                    {
+                        offer = offer.substr(params + 1);
+                        params = offer.find(';');
+                        std::string_view param = trim(offer.substr(0, params));
+                        size_t equals = param.find('=');
+                        std::string_view name = trim(param.substr(0, equals));
+                        std::string_view value =
+                            (equals == std::string_view::npos) ? std::string_view() : trim(param.substr(equals + 1));
+                        if ((value.size() >= 2) && (value.front() == '"') && (value.back() == '"'))
+                        {
+                            value = value.substr(1, value.size() - 2);
+                        }
+                        static char const* const kParams[] = { "server_no_context_takeover",
+                            "client_no_context_takeover", "server_max_window_bits", "client_max_window_bits" };
+                        size_t index = 0;
+                        while ((index < 4) && !HttpRequestHead::equalsIgnoreCase(name, kParams[index]))
+                        {
+                            index++;
+                        }
+                        if ((index == 4) || ((seen & (1u << index)) != 0))
+                        {
+                            acceptable = false;
+                            break;
+                        }
+                        seen |= 1u << index;
+                        if (index < 2)
+                        {
+                            acceptable = value.empty();
+                        }
+                        else if (index == 2)
+                        {
+                            // Frames are compressed with the full window
+                            acceptable = (value == "15");
+                        }
+                        else
+                        {
+                            // Messages of the client are inflated with the full window, whatever it uses
+                            acceptable = value.empty() ||
+                                ((value.size() <= 2) && (windowBits(value) >= 8) && (windowBits(value) <= 15));
+                        }
+                    }
+                    if (acceptable)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            static std::string_view trim(std::string_view value)
+            {
+                while (!value.empty() && ((value.front() == ' ') || (value.front() == '\t')))
+                {
+                    value.remove_prefix(1);
+                }
+                while (!value.empty() && ((value.back() == ' ') || (value.back() == '\t')))
+                {
+                    value.remove_suffix(1);
+                }
+                return value;
+            }
+
+        private:
+            /// <returns>Value of a window bits parameter, -1 if it is not a number</returns>
+            static int windowBits(std::string_view value)
+            {
+                int bits = 0;
+                for (char c : value)
+                {
+                    if ((c < '0') || (c > '9'))
+                    {
+                        return -1;
+                    }
+                    bits = bits * 10 + (c - '0');
+                }
+                return bits;
+            }
+
+            static void sha1(std::string_view data, uint8_t digest[20])
+            {
+                uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+                // Padded to a multiple of 64 bytes, the bit length at the end
+                std::string message(data);
+                uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+                message += static_cast<char>(0x80);
+                while (message.size() % 64 != 56)
+                {
+                    message += '\0';
+                }
+                for (int i = 7; i >= 0; i--)
+                {
+                    message += static_cast<char>(bits >> (8 * i));
+                }
+                auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+                for (size_t block = 0; block < message.size(); block += 64)
+                {
+                    uint32_t w[80];
+                    for (size_t i = 0; i < 16; i++)
+                    {
+                        uint8_t const* p = reinterpret_cast<uint8_t const*>(message.data() + block + 4 * i);
+                        w[i] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                            (static_cast<uint32_t>(p[2]) << 8) | p[3];
+                    }
+                    for (size_t i = 16; i < 80; i++)
+                    {
+                        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+                    }
+                    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+                    for (size_t i = 0; i < 80; i++)
+                    {
+                        uint32_t f, k;
+                        if (i < 20)
+                        {
+                            f = (b & c) | (~b & d);
+                            k = 0x5A827999;
+                        }
+                        else if (i < 40)
+                        {
+                            f = b ^ c ^ d;
+                            k = 0x6ED9EBA1;
+                        }
+                        else if (i < 60)
+                        {
+                            f = (b & c) | (b & d) | (c & d);
+                            k = 0x8F1BBCDC;
+                        }
+                        else
+                        {
+                            f = b ^ c ^ d;
+                            k = 0xCA62C1D6;
+                        }
+                        uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+                        e = d;
+                        d = c;
+                        c = rotl(b, 30);
+                        b = a;
+                        a = temp;
+                    }
+                    h[0] += a;
+                    h[1] += b;
+                    h[2] += c;
+                    h[3] += d;
+                    h[4] += e;
+                }
+                for (size_t i = 0; i < 20; i++)
+                {
+                    digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - 8 * (i % 4)));
+                }
+            }
+
+            static std::string base64(uint8_t const* data, size_t size)
+            {
+                static char const kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+                std::string out;
+                for (size_t i = 0; i < size; i += 3)
+                {
+                    uint32_t group = static_cast<uint32_t>(data[i]) << 16;
+                    if (i + 1 < size)
+                    {
+                        group |= static_cast<uint32_t>(data[i + 1]) << 8;
+                    }
+                    if (i + 2 < size)
+                    {
+                        group |= data[i + 2];
+                    }
+                    out += kAlphabet[(group >> 18) & 0x3F];
+                    out += kAlphabet[(group >> 12) & 0x3F];
+                    out += (i + 1 < size) ? kAlphabet[(group >> 6) & 0x3F] : '=';
+                    out += (i + 2 < size) ? kAlphabet[group & 0x3F] : '=';
+                }
+                return out;
+            }
+        };
+
+        /// <summary>
+        /// Raw DEFLATE of whole messages for permessage-deflate without context takeover. The
+        /// streams are kept per thread and reset for every message, connections don't own any.
+        /// </summary>
+        class WebSocketDeflate
+        {
+        public:
+            /// <summary>
+            /// Whether the extension is compiled in.
+            /// </summary>
+            static bool available()
+            {
+#ifdef HAVE_ZLIB
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Compress a message into the payload of its frames: the output of a sync flush
+            /// without the empty block at its end.
+            /// </summary>
+            /// <returns>false if the extension is not available or the encoder failed</returns>
+            static bool compress(std::string_view input, std::string& output)
+            {
+                output.clear();
+#ifdef HAVE_ZLIB
+                z_stream* stream = streams().deflater();
+                if (stream == nullptr)
+                {
+                    return false;
+                }
+                stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+                stream->avail_in = static_cast<uInt>(input.size());
+                for (;;)
+                {
+                    size_t offset = output.size();
+                    size_t room = std::max<size_t>(1024, input.size() / 2);
+                    output.resize(offset + room);
+                    stream->next_out = reinterpret_cast<Bytef*>(&output[offset]);
+                    stream->avail_out = static_cast<uInt>(room);
+                    int result = deflate(stream, Z_SYNC_FLUSH);
+                    output.resize(offset + room - stream->avail_out);
+                    if (result == Z_STREAM_ERROR)
+                    {
+                        return false;
+                    }
+                    // Z_BUF_ERROR: the flush before filled the output exactly, there is nothing left
+                    if ((stream->avail_out != 0) || (result == Z_BUF_ERROR))
+                    {
+                        break;
+                    }
+                }
+                if ((output.size() < 4) || (output.compare(output.size() - 4, 4, kTail, 4) != 0))
+                {
+                    return false;
+                }
+                output.resize(output.size() - 4);
+                return true;
+#else
+                (void)input;
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Decompress the payload of a message and append it to the output.
+            /// </summary>
+            /// <param name="maxSize">Limit of the decompressed size, 0 - unlimited</param>
+            /// <returns>false if the payload is malformed, larger than the limit or the extension is
+            /// not available</returns>
+            static bool decompress(std::string_view input, std::string& output, size_t maxSize)
+            {
+#ifdef HAVE_ZLIB
+                z_stream* stream = streams().inflater();
+                if (stream == nullptr)
+                {
+                    return false;
+                }
+                size_t start = output.size();
+                // The empty block the sender removed goes after the payload
+                std::string_view parts[2] = { input, std::string_view(kTail, 4) };
+                for (auto const& part : parts)
+                {
+                    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(part.data()));
+                    stream->avail_in = static_cast<uInt>(part.size());
+                    for (;;)
+                    {
+                        size_t offset = output.size();
+                        size_t room = std::max<size_t>(16 * 1024, part.size() * 2);
+                        output.resize(offset + room);
+                        stream->next_out = reinterpret_cast<Bytef*>(&output[offset]);
+                        stream->avail_out = static_cast<uInt>(room);
+                        int result = inflate(stream, Z_SYNC_FLUSH);
+                        output.resize(offset + room - stream->avail_out);
+                        if ((maxSize != 0) && (output.size() - start > maxSize))
+                        {
+                            return false;
+                        }
+                        if (result == Z_STREAM_END)
+                        {
+                            // Final block of the sender, whatever follows is ignored
+                            return true;
+                        }
+                        if ((result != Z_OK) && (result != Z_BUF_ERROR))
+                        {
+                            return false;
+                        }
+                        if ((stream->avail_in == 0) && (stream->avail_out != 0))
+                        {
+                            break;
+                        }
+                    }
+                }
+                return true;
+#else
+                (void)input;
+                (void)output;
+                (void)maxSize;
+                return false;
+#endif
+            }
+
+        private:
+#ifdef HAVE_ZLIB
+            static constexpr char const kTail[4] = { 0x00, 0x00, static_cast<char>(0xFF), static_cast<char>(0xFF) };
+
+            /// <summary>
+            /// Streams of the thread, created on first use and freed when the thread exits.
+            /// </summary>
+            struct Streams
+            {
+                z_stream deflate_{};
+                z_stream inflate_{};
+                bool hasDeflate{ false };
+                bool hasInflate{ false };
+
+                ~Streams()
+                {
+                    if (hasDeflate)
+                    {
+                        deflateEnd(&deflate_);
+                    }
+                    if (hasInflate)
+                    {
+                        inflateEnd(&inflate_);
+                    }
+                }
+
+                z_stream* deflater()
+                {
+                    if (hasDeflate)
+                    {
+                        return (deflateReset(&deflate_) == Z_OK) ? &deflate_ : nullptr;
+                    }
+                    // Negative window bits: raw DEFLATE without the zlib header
+                    hasDeflate = deflateInit2(&deflate_, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+                    return hasDeflate ? &deflate_ : nullptr;
+                }
+
+                z_stream* inflater()
+                {
+                    if (hasInflate)
+                    {
+                        return (inflateReset(&inflate_) == Z_OK) ? &inflate_ : nullptr;
+                    }
+                    hasInflate = inflateInit2(&inflate_, -15) == Z_OK;
+                    return hasInflate ? &inflate_ : nullptr;
+                }
+            };
+
+            static Streams& streams()
+            {
+                thread_local Streams instance;
+                return instance;
+            }
+#endif
+        };
+
+        /// <summary>
+        /// Reader of the frames a client sends. Complete frames are unmasked in place in the
+        /// receive buffer: a message of one uncompressed frame is handed over as a view into
+        /// the buffer, fragments and compressed messages are assembled first. Control frames
+        /// are handed over as they arrive, also between fragments.
+        /// </summary>
+        class WebSocketReader
+        {
+        public:
+            /// <summary>
+            /// Start reading a new connection.
+            /// </summary>
+            /// <param name="deflate">Whether permessage-deflate is negotiated, allows RSV1</param>
+            /// <param name="maxMessageSize">Limit of a message, decompressed and assembled, 0 - unlimited</param>
+            void reset(bool deflate, size_t maxMessageSize)
+            {
+                m_deflate = deflate;
+                m_maxMessageSize = maxMessageSize;
+                m_fragmented = false;
+                m_compressed = false;
+                m_opcode = 0;
+                m_message.clear();
+                m_error = 0;
+            }
+
+            /// <summary>
+            /// Read the complete frames at the start of the data.
+            /// </summary>
+            /// <param name="callback">Called as bool(uint8_t opcode, std::string_view payload) with every
+            /// message, Text or Binary, and every control frame. The payload is only valid during the call.
+            /// Returns false to stop reading.</param>
+            /// <returns>Bytes of the frames read, the rest waits for more data. After a protocol error
+            /// error() is the status code to close the connection with.</returns>
+            template <typename Callback>
+            size_t read(char* data, size_t size, Callback&& callback)
+            {
+                size_t pos = 0;
+                while (m_error == 0)
+                {
+                    WebSocketFrame frame;
+                    WebSocketFrame::Result result = frame.parse(data + pos, size - pos);
+                    if (result == WebSocketFrame::NeedMore)
+                    {
+                        break;
+                    }
+                    // Headers are checked before the payload arrives, oversized messages are never buffered
+                    m_error = (result == WebSocketFrame::Error) ?
+                        static_cast<uint16_t>(WebSocketFrame::ProtocolError) : check(frame);
+                    if (m_error != 0)
+                    {
+                        break;
+                    }
+                    if (size - pos - frame.headerSize < frame.length)
+                    {
+                        break;
+                    }
+                    char* payload = data + pos + frame.headerSize;
+                    size_t length = static_cast<size_t>(frame.length);
+                    WebSocketFrame::unmask(payload, length, frame.mask);
+                    pos += frame.headerSize + length;
+
+                    bool more = true;
+                    if (frame.opcode >= WebSocketFrame::Close)
+                    {
+                        if ((frame.opcode == WebSocketFrame::Close) && !validClose(std::string_view(payload, length)))
+                        {
+                            m_error = WebSocketFrame::ProtocolError;
+                            break;
+                        }
+                        more = callback(frame.opcode, std::string_view(payload, length));
+                    }
+                    else if (frame.fin && !m_fragmented && !frame.rsv1)
+                    {
+                        // Zero-copy: the message is the unmasked payload in the buffer
+                        std::string_view message(payload, length);
+                        if ((frame.opcode == WebSocketFrame::Text) && !WebSocketFrame::validUtf8(message))
+                        {
+                            m_error = WebSocketFrame::InvalidPayload;
+                            break;
+                        }
+                        more = callback(frame.opcode, message);
+                    }
+                    else
+                    {
+                        if (!m_fragmented)
+                        {
+                            m_fragmented = true;
+                            m_opcode = frame.opcode;
+                            m_compressed = frame.rsv1;
+                        }
+                        m_message.append(payload, length);
+                        if (frame.fin)
+                        {
+                            more = deliver(callback);
+                        }
+                    }
+                    if (!more)
+                    {
+                        break;
+                    }
+                }
+                return pos;
+            }
+
+            /// <summary>
+            /// Status code of the protocol error that stopped reading, 0 - none.
+            /// </summary>
+            uint16_t error() const { return m_error; }
+
+        private:
+            /// <summary>
+            /// Validate the frame header against the state of the message.
+            /// </summary>
+            /// <returns>Status code to close with, 0 if the frame is valid</returns>
+            uint16_t check(WebSocketFrame const& frame) const
+            {
+                if (!frame.masked)
+                {
+                    return WebSocketFrame::ProtocolError;
+                }
+                if (frame.opcode >= WebSocketFrame::Close)
+                {
+                    bool known = (frame.opcode <= WebSocketFrame::Pong);
+                    return (known && frame.fin && !frame.rsv1 && (frame.length <= WebSocketFrame::MaxControlSize)) ?
+                        0 : WebSocketFrame::ProtocolError;
+                }
+                if ((frame.opcode > WebSocketFrame::Binary) ||
+                    (m_fragmented != (frame.opcode == WebSocketFrame::Continuation)))
+                {
+                    return WebSocketFrame::ProtocolError;
+                }
+                // Only the first frame of a message carries RSV1
+                if (frame.rsv1 && (!m_deflate || m_fragmented))
+                {
+                    return WebSocketFrame::ProtocolError;
+                }
+                if ((m_maxMessageSize != 0) && (frame.length > m_maxMessageSize - m_message.size()))
+                {
+                    return WebSocketFrame::MessageTooBig;
+                }
+                return 0;
+            }
+
+            static bool validClose(std::string_view payload)
+            {
+                if (payload.empty())
+                {
+                    return true;
+                }
+                if (payload.size() < 2)
+                {
+                    return false;
+                }
+                uint16_t code = static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) |
+                    static_cast<uint8_t>(payload[1]));
+                return WebSocketFrame::validStatus(code) && WebSocketFrame::validUtf8(payload.substr(2));
+            }
+
+            /// <summary>
+            /// Hand over the assembled message, decompressed if needed, and start the next one.
+            /// </summary>
+            template <typename Callback>
+            bool deliver(Callback& callback)
+            {
+                std::string_view message = m_message;
+                if (m_compressed)
+                {
+                    // Reused by the connections of the thread
+                    thread_local std::string inflated;
+                    inflated.clear();
+                    if (!WebSocketDeflate::decompress(m_message, inflated, m_maxMessageSize))
+                    {
+                        m_error = ((m_maxMessageSize != 0) && (inflated.size() > m_maxMessageSize)) ?
+                            WebSocketFrame::MessageTooBig : WebSocketFrame::InvalidPayload;
+                        return false;
+                    }
+                    message = inflated;
+                }
+                bool more = true;
+                if ((m_opcode == WebSocketFrame::Text) && !WebSocketFrame::validUtf8(message))
+                {
+                    m_error = WebSocketFrame::InvalidPayload;
+                    more = false;
+                }
+                else
+                {
+                    more = callback(m_opcode, message);
+                }
+                m_fragmented = false;
+                m_compressed = false;
+                m_message.clear();
+                // Idle connections don't keep the buffer of a large message
+                if (m_message.capacity() > kKeptCapacity)
+                {
+                    m_message.shrink_to_fit();
+                }
+                return more;
+            }
+
+            static constexpr size_t const kKeptCapacity = 64 * 1024;
+
+            bool m_deflate{ false };
+            size_t m_maxMessageSize{ 0 };
+            bool m_fragmented{ false };  // Continuation frames of m_opcode follow
+            bool m_compressed{ false };
+            uint8_t m_opcode{ 0 };
+            std::string m_message;  // Fragments received so far
+            uint16_t m_error{ 0 };
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,153 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <cstddef>
+#include <vector>
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Pool of fixed-size receive buffers. Buffers are recycled as they are, without
+        /// zero-initialization, and only freed when the pool holds too many of them.
+        /// Not thread-safe: every Reactor owns a pool used by its own thread.
+        /// </summary>
+        struct BufferPool
+        {
+            static constexpr size_t const DefaultChunkSize = 64 * 1024;
+            static constexpr size_t const DefaultMaxFree = 64;
+
+            /// <summary>
+            /// Buffer handed out by the pool, returned to it on destruction or reset().
+            /// </summary>
+            class Chunk
+            {
+            public:
+                Chunk() = default;
+
+                Chunk(Chunk&& other) noexcept : m_pool(other.m_pool), m_data(other.m_data)
+                {
+                    other.m_pool = nullptr;
+                    other.m_data = nullptr;
+                }
+
+                Chunk& operator=(Chunk&& other) noexcept
+                {
+                    if (this != &other)
+                    {
+                        reset();
+                        m_pool = other.m_pool;
+                        m_data = other.m_data;
+                        other.m_pool = nullptr;
+                        other.m_data = nullptr;
+                    }
+                    return *this;
+                }
+
+                Chunk(const Chunk&) = delete;
+                Chunk& operator=(const Chunk&) = delete;
+
+                ~Chunk() { reset(); }
+
+                char* data() const { return m_data; }
+
+                size_t size() const { return (m_pool != nullptr) ? m_pool->m_chunkSize : 0; }
+
+                explicit operator bool() const { return m_data != nullptr; }
+
+                /// <summary>
+                /// Return the buffer to the pool.
+                /// </summary>
+                void reset()
+                {
+                    if (m_data != nullptr)
+                    {
+                        m_pool->release(m_data);
+                        m_pool = nullptr;
+                        m_data = nullptr;
+                    }
+                }
+
+            private:
+                friend struct BufferPool;
+
+                Chunk(BufferPool* pool, char* data) : m_pool(pool), m_data(data) {}
+
+                BufferPool* m_pool{ nullptr };
+                char* m_data{ nullptr };
+            };
+
+            /// <summary>
+            /// BufferPool constructor
+            /// </summary>
+            /// <param name="chunkSize">Size of every buffer</param>
+            /// <param name="maxFree">Maximum number of free buffers kept for reuse</param>
+            BufferPool(size_t chunkSize = DefaultChunkSize, size_t maxFree = DefaultMaxFree)
+                : m_chunkSize(chunkSize), m_maxFree(maxFree)
+            {
+            }
+
+            BufferPool(const BufferPool&) = delete;
+            BufferPool& operator=(const BufferPool&) = delete;
+
+            /// <summary>
+            /// Chunks must be returned before the pool is destroyed.
+            /// </summary>
+            ~BufferPool()
+            {
+                for (char* data : m_free)
+                {
+                    delete[] data;
+                }
+            }
+
+            /// <summary>
+            /// Get a buffer. Contents are undefined.
+            /// </summary>
+            Chunk acquire()
+            {
+                char* data;
+                if (m_free.empty())
+                {
+                    data = new char[m_chunkSize];
+                }
+                else
+                {
+                    data = m_free.back();
+                    m_free.pop_back();
+                }
+                return Chunk(this, data);
+            }
+
+            size_t chunkSize() const { return m_chunkSize; }
+
+            /// <summary>
+            /// Number of free buffers ready for reuse.
+            /// </summary>
+            size_t available() const { return m_free.size(); }
+
+        private:
+            void release(char* data)
+            {
+                if (m_free.size() < m_maxFree)
+                {
+                    m_free.push_back(data);
+                    return;
+                }
+                delete[] data;
+            }
+
+            size_t m_chunkSize;
+            size_t m_maxFree;
+            std::vector<char*> m_free;
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
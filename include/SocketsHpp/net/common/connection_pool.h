@@ -0,0 +1,416 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "./socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Non-blocking stream connects on a reactor, TCP or Unix domain. A connect completes once
+        /// the socket is writable, the deadline runs on the reactor timers, so that no thread blocks
+        /// in ::connect. Must be used by the reactor thread, callbacks run on it. Connects still
+        /// pending when the connector is destroyed are cancelled without a callback.
+        /// </summary>
+        class Connector
+        {
+        public:
+            /// <summary>
+            /// Connected non-blocking socket and error 0, or an invalid socket and the error code.
+            /// </summary>
+            using Callback = std::function<void(Socket socket, int error)>;
+
+            using ConnectId = uint64_t;
+
+            explicit Connector(Reactor& reactor) : m_reactor(reactor) {}
+
+            Connector(const Connector&) = delete;
+            Connector& operator=(const Connector&) = delete;
+
+            ~Connector()
+            {
+                for (auto& entry : m_pending)
+                {
+                    abort(*entry.second);
+                }
+            }
+
+            Reactor& reactor() { return m_reactor; }
+
+            /// <summary>
+            /// Number of connects in progress.
+            /// </summary>
+            size_t pending() const { return m_pending.size(); }
+
+            /// <summary>
+            /// Connect to the address. The callback runs before connect() returns if the connect
+            /// fails right away.
+            /// </summary>
+            /// <param name="timeout">Deadline of the connect, 0 - none</param>
+            /// <returns>Id for cancel(), 0 if the callback has run already</returns>
+            ConnectId connect(SocketAddr const& addr, Callback callback,
+                std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+            {
+                int af = addr.isUnixDomain ? AF_UNIX : addr.m_data.sa_family;
+                Socket socket(af, SOCK_STREAM, 0);
+                if (socket.invalid())
+                {
+                    callback(Socket(), socket.error());
+                    return 0;
+                }
+                socket.setNonBlocking();
+                if (!socket.connectNonBlocking(addr))
+                {
+                    int error = socket.error();
+                    socket.close();
+                    callback(Socket(), error);
+                    return 0;
+                }
+
+                // Also a connect that completed at once is reported by the reactor
+                ConnectId id = ++m_lastId;
+                std::unique_ptr<Pending> pending(new Pending(*this, id, socket, std::move(callback)));
+                if (timeout.count() > 0)
+                {
+                    pending->timer = m_reactor.addTimer(timeout, [this, id]() {
+                        finish(id, Socket::ErrorTimedOut);
+                    });
+                }
+                m_reactor.addWaiter(socket, Reactor::Writable | Reactor::Closed, pending.get());
+                m_pending[id] = std::move(pending);
+                return id;
+            }
+
+            /// <summary>
+            /// Cancel connect in progress, without a callback. Ids of completed connects are ignored.
+            /// </summary>
+            void cancel(ConnectId id)
+            {
+                auto it = m_pending.find(id);
+                if (it == m_pending.end())
+                {
+                    return;
+                }
+                abort(*it->second);
+                m_pending.erase(it);
+            }
+
+        private:
+            struct Pending : public SocketWaiter
+            {
+                Connector& owner;
+                ConnectId id;
+                Socket socket;
+                Callback callback;
+                Reactor::TimerId timer{ 0 };
+
+                Pending(Connector& owner, ConnectId id, Socket socket, Callback callback) :
+                    owner(owner), id(id), socket(socket), callback(std::move(callback))
+                {
+                }
+
+                void onSocketReady(Socket sock, int state) override
+                {
+                    int error = sock.connectError();
+                    if ((error == 0) && !(state & Reactor::Writable))
+                    {
+                        error = Socket::ErrorNotConnected;
+                    }
+                    owner.finish(id, error);
+                }
+            };
+
+            void abort(Pending& pending)
+            {
+                m_reactor.cancelTimer(pending.timer);
+                m_reactor.removeSocket(pending.socket);
+                pending.socket.close();
+            }
+
+            void finish(ConnectId id, int error)
+            {
+                auto it = m_pending.find(id);
+                if (it == m_pending.end())
+                {
+                    return;
+                }
+                // The callback may start and cancel other connects
+                std::unique_ptr<Pending> pending = std::move(it->second);
+                m_pending.erase(it);
+                m_reactor.cancelTimer(pending->timer);
+                Socket socket = pending->socket;
+                if (error != 0)
+                {
+                    // Still added to the reactor if the deadline expired
+                    m_reactor.removeSocket(socket);
+                    socket.close();
+                    pending->callback(Socket(), error);
+                    return;
+                }
+                pending->callback(socket, 0);
+            }
+
+            Reactor& m_reactor;
+            std::unordered_map<ConnectId, std::unique_ptr<Pending>> m_pending;
+            ConnectId m_lastId{ 0 };
+        };
+
+        /// <summary>
+        /// Pool of established stream connections keyed by the peer address, TCP or Unix domain.
+        /// Released connections wait idle and are handed out again, most recently released first,
+        /// if they pass a health check: the peer has neither closed them nor sent anything
+        /// unsolicited. At most max-per-host connections of an address are open, in use or idle,
+        /// further acquires wait for a release in FIFO order. Idle connections are closed once the
+        /// idle timeout expires. Must be used by the reactor thread, callbacks run on it.
+        /// </summary>
+        class ConnectionPool
+        {
+        public:
+            using Callback = Connector::Callback;
+
+            static constexpr size_t const DefaultMaxPerHost = 8;
+
+            explicit ConnectionPool(Reactor& reactor) : m_reactor(reactor), m_connector(reactor) {}
+
+            ConnectionPool(const ConnectionPool&) = delete;
+            ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+            /// <summary>
+            /// Close idle connections. Pending acquires are dropped without a callback, connections
+            /// in use stay with their owners.
+            /// </summary>
+            ~ConnectionPool()
+            {
+                for (auto& entry : m_hosts)
+                {
+                    for (auto& idle : entry.second.idle)
+                    {
+                        m_reactor.cancelTimer(idle.timer);
+                        idle.socket.close();
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Limit connections of every address. Must be set before connections are acquired.
+            /// </summary>
+            /// <param name="max">Connections open at once, 0 - no limit</param>
+            void setMaxPerHost(size_t max) { m_maxPerHost = max; }
+
+            /// <summary>
+            /// Close connections idle for so long, 0 - keep them until they fail the health check.
+            /// </summary>
+            void setIdleTimeout(std::chrono::milliseconds timeout) { m_idleTimeout = timeout; }
+
+            /// <summary>
+            /// Deadline of new connections, 0 - none.
+            /// </summary>
+            void setConnectTimeout(std::chrono::milliseconds timeout) { m_connectTimeout = timeout; }
+
+            /// <summary>
+            /// Hand out a connection to the address: an idle one that is still healthy, a new one
+            /// if the address is below the limit, otherwise the next one released. The callback
+            /// runs before acquire() returns if an idle connection is reused or the connect fails
+            /// right away. Every connection handed out must be released.
+            /// </summary>
+            void acquire(SocketAddr const& addr, Callback callback)
+            {
+                std::string key = keyOf(addr);
+                Host& host = m_hosts[key];
+                while (!host.idle.empty())
+                {
+                    Idle idle = host.idle.back();
+                    host.idle.pop_back();
+                    m_reactor.cancelTimer(idle.timer);
+                    if (healthy(idle.socket))
+                    {
+                        callback(idle.socket, 0);
+                        return;
+                    }
+                    idle.socket.close();
+                    host.open--;
+                }
+                if ((m_maxPerHost == 0) || (host.open < m_maxPerHost))
+                {
+                    open(key, addr, std::move(callback));
+                    return;
+                }
+                host.waiters.push_back(Waiter{ addr, std::move(callback) });
+            }
+
+            /// <summary>
+            /// Give back a connection handed out by acquire(). It is kept for reuse if it is healthy,
+            /// closed otherwise. The caller must not use it afterwards.
+            /// </summary>
+            /// <param name="reuse">false to close it, e.g. if a response was not read completely</param>
+            void release(SocketAddr const& addr, Socket socket, bool reuse = true)
+            {
+                std::string key = keyOf(addr);
+                auto it = m_hosts.find(key);
+                if (it == m_hosts.end())
+                {
+                    socket.close();
+                    return;
+                }
+                Host& host = it->second;
+                if (!reuse || !healthy(socket))
+                {
+                    socket.close();
+                    host.open--;
+                    next(key, host);
+                    return;
+                }
+                if (!host.waiters.empty())
+                {
+                    Waiter waiter = std::move(host.waiters.front());
+                    host.waiters.pop_front();
+                    waiter.callback(socket, 0);
+                    return;
+                }
+                Reactor::TimerId timer = 0;
+                if (m_idleTimeout.count() > 0)
+                {
+                    timer = m_reactor.addTimer(m_idleTimeout, [this, key, socket]() { expire(key, socket); });
+                }
+                host.idle.push_back(Idle{ socket, timer });
+            }
+
+            /// <summary>
+            /// Connections to the address that are open, in use, idle or connecting.
+            /// </summary>
+            size_t open(SocketAddr const& addr) const
+            {
+                auto it = m_hosts.find(keyOf(addr));
+                return (it != m_hosts.end()) ? it->second.open : 0;
+            }
+
+            /// <summary>
+            /// Idle connections to the address.
+            /// </summary>
+            size_t idle(SocketAddr const& addr) const
+            {
+                auto it = m_hosts.find(keyOf(addr));
+                return (it != m_hosts.end()) ? it->second.idle.size() : 0;
+            }
+
+            /// <summary>
+            /// Acquires of the address waiting for a release.
+            /// </summary>
+            size_t waiting(SocketAddr const& addr) const
+            {
+                auto it = m_hosts.find(keyOf(addr));
+                return (it != m_hosts.end()) ? it->second.waiters.size() : 0;
+            }
+
+            /// <summary>
+            /// Check that an idle non-blocking connection may be reused: nothing to read and
+            /// not closed by the peer.
+            /// </summary>
+            static bool healthy(Socket socket)
+            {
+                char data;
+                int received = socket.recv(&data, sizeof(data), MSG_PEEK);
+                return (received < 0) && (socket.error() == Socket::ErrorWouldBlock);
+            }
+
+        private:
+            struct Idle
+            {
+                Socket socket;
+                Reactor::TimerId timer;
+            };
+
+            struct Waiter
+            {
+                SocketAddr address;
+                Callback callback;
+            };
+
+            struct Host
+            {
+                size_t open{ 0 };
+                std::deque<Idle> idle;  // Most recently released last
+                std::deque<Waiter> waiters;
+            };
+
+            static std::string keyOf(SocketAddr const& addr)
+            {
+                return (addr.isUnixDomain ? "unix:" : "tcp:") + addr.toString();
+            }
+
+            void open(std::string const& key, SocketAddr const& addr, Callback callback)
+            {
+                m_hosts[key].open++;
+                m_connector.connect(
+                    addr,
+                    [this, key, callback](Socket socket, int error) {
+                        if (error != 0)
+                        {
+                            // Hosts are never erased: the entry outlives the connect
+                            Host& host = m_hosts[key];
+                            host.open--;
+                            callback(socket, error);
+                            next(key, host);
+                            return;
+                        }
+                        callback(socket, 0);
+                    },
+                    m_connectTimeout);
+            }
+
+            /// <summary>
+            /// Connect for the first waiter once a connection of the address is closed.
+            /// </summary>
+            void next(std::string const& key, Host& host)
+            {
+                if (host.waiters.empty() || ((m_maxPerHost != 0) && (host.open >= m_maxPerHost)))
+                {
+                    return;
+                }
+                Waiter waiter = std::move(host.waiters.front());
+                host.waiters.pop_front();
+                open(key, waiter.address, std::move(waiter.callback));
+            }
+
+            void expire(std::string const& key, Socket socket)
+            {
+                Host& host = m_hosts[key];
+                auto it = std::find_if(host.idle.begin(), host.idle.end(),
+                    [socket](Idle const& idle) { return idle.socket == socket; });
+                if (it == host.idle.end())
+                {
+                    return;
+                }
+                host.idle.erase(it);
+                socket.close();
+                host.open--;
+                next(key, host);
+            }
+
+            Reactor& m_reactor;
+            Connector m_connector;
+            std::unordered_map<std::string, Host> m_hosts;
+            size_t m_maxPerHost{ DefaultMaxPerHost };
+            std::chrono::milliseconds m_idleTimeout{ 0 };
+            std::chrono::milliseconds m_connectTimeout{ 0 };
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,171 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "./socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Table of per-socket state indexed by the socket descriptor. Entries live in slabs
+        /// of BlockSize slots and never move, so pointers to them stay valid until erase().
+        /// Freed slots are reused first: the table stays dense and inserting into a warm table
+        /// doesn't allocate. Sockets are indexed by a flat array on POSIX, a hash map on Windows.
+        /// Not thread-safe.
+        /// </summary>
+        template <typename T, size_t BlockSize = 256>
+        class ConnectionTable
+        {
+        public:
+            static constexpr uint32_t const npos = static_cast<uint32_t>(-1);
+
+            ConnectionTable() = default;
+
+            ConnectionTable(const ConnectionTable&) = delete;
+            ConnectionTable& operator=(const ConnectionTable&) = delete;
+
+            size_t size() const { return m_size; }
+
+            bool empty() const { return m_size == 0; }
+
+            /// <summary>
+            /// Number of slots allocated, in use or free.
+            /// </summary>
+            size_t capacity() const { return m_blocks.size() * BlockSize; }
+
+            T* find(Socket const& socket)
+            {
+                uint32_t slot = slotOf(socket);
+                return (slot != npos) ? &at(slot) : nullptr;
+            }
+
+            /// <summary>
+            /// Entry of the socket, a default-constructed one if the socket is not in the table.
+            /// </summary>
+            T& insert(Socket const& socket)
+            {
+                uint32_t slot = slotOf(socket);
+                if (slot != npos)
+                {
+                    return at(slot);
+                }
+                if (!m_free.empty())
+                {
+                    slot = m_free.back();
+                    m_free.pop_back();
+                }
+                else
+                {
+                    slot = static_cast<uint32_t>(m_used++);
+                    if ((slot % BlockSize) == 0)
+                    {
+                        m_blocks.emplace_back(new T[BlockSize]);
+                    }
+                }
+                setSlot(socket, slot);
+                m_size++;
+                return at(slot);
+            }
+
+            /// <summary>
+            /// Remove the socket. Its entry is reset to a default-constructed one, releasing
+            /// what it holds, and its slot is reused by the next insert().
+            /// </summary>
+            /// <returns>false if the socket is not in the table</returns>
+            bool erase(Socket const& socket)
+            {
+                uint32_t slot = slotOf(socket);
+                if (slot == npos)
+                {
+                    return false;
+                }
+                at(slot) = T();
+                m_free.push_back(slot);
+                setSlot(socket, npos);
+                m_size--;
+                return true;
+            }
+
+            /// <summary>
+            /// Call the function with the socket and the entry of every connection in the table.
+            /// The function must not insert or erase.
+            /// </summary>
+            template <typename F>
+            void forEach(F&& function)
+            {
+#ifdef _WIN32
+                for (auto const& item : m_index)
+                {
+                    function(Socket(item.first), at(item.second));
+                }
+#else
+                for (size_t fd = 0; fd < m_index.size(); fd++)
+                {
+                    if (m_index[fd] != npos)
+                    {
+                        function(Socket(static_cast<Socket::Type>(fd)), at(m_index[fd]));
+                    }
+                }
+#endif
+            }
+
+        private:
+            T& at(uint32_t slot) { return m_blocks[slot / BlockSize][slot % BlockSize]; }
+
+            uint32_t slotOf(Socket const& socket) const
+            {
+#ifdef _WIN32
+                auto it = m_index.find(socket.m_sock);
+                return (it != m_index.end()) ? it->second : npos;
+#else
+                size_t fd = static_cast<size_t>(socket.m_sock);
+                return (fd < m_index.size()) ? m_index[fd] : npos;
+#endif
+            }
+
+            void setSlot(Socket const& socket, uint32_t slot)
+            {
+#ifdef _WIN32
+                if (slot == npos)
+                {
+                    m_index.erase(socket.m_sock);
+                    return;
+                }
+                m_index[socket.m_sock] = slot;
+#else
+                size_t fd = static_cast<size_t>(socket.m_sock);
+                if (fd >= m_index.size())
+                {
+                    m_index.resize(std::max(fd + 1, m_index.size() * 2), npos);
+                }
+                m_index[fd] = slot;
+#endif
+            }
+
+            std::vector<std::unique_ptr<T[]>> m_blocks;
+            std::vector<uint32_t> m_free;  // Slots of erased entries, reused last freed first
+            size_t m_used{ 0 };            // Slots ever handed out
+            size_t m_size{ 0 };
+#ifdef _WIN32
+            std::unordered_map<Socket::Type, uint32_t> m_index;
+#else
+            std::vector<uint32_t> m_index;  // Slot by descriptor
+#endif
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
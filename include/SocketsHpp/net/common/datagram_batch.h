@@ -0,0 +1,331 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "./socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Batch of datagrams received and sent by one system call: recvmmsg and sendmmsg on
+        /// Linux, one recvfrom or sendto per datagram elsewhere. Buffers are allocated once
+        /// and reused by every batch. Received datagrams are valid until the next receive().
+        ///
+        /// With Socket::setUdpGro the kernel delivers datagrams of one sender coalesced, they
+        /// are split again by receive(). With setGso replies of equal size to one address are
+        /// sent as one segmented write (UDP_SEGMENT). Not thread-safe.
+        /// </summary>
+        class DatagramBatch
+        {
+        public:
+            static constexpr size_t const DefaultBatchSize = 64;
+            static constexpr size_t const MaxDatagramSize = 0xffff;
+            // Kernel limit of segments per UDP_SEGMENT write
+            static constexpr size_t const MaxSegments = 64;
+
+            struct Datagram
+            {
+                std::string_view data;
+                SocketAddr const* address;  // Sender
+            };
+
+            /// <summary>
+            /// DatagramBatch constructor
+            /// </summary>
+            /// <param name="batchSize">Maximum number of datagrams received or queued at once</param>
+            /// <param name="datagramSize">Size of every receive buffer. Longer datagrams are
+            /// dropped, coalesced datagrams need MaxDatagramSize</param>
+            DatagramBatch(size_t batchSize = DefaultBatchSize, size_t datagramSize = MaxDatagramSize)
+                : m_batchSize(std::max<size_t>(batchSize, 1)),
+                m_datagramSize(std::min(std::max<size_t>(datagramSize, 1), MaxDatagramSize)),
+                m_buffer(m_batchSize * m_datagramSize),
+                m_addresses(m_batchSize),
+                m_sendBuffer(m_batchSize * m_datagramSize)
+            {
+                m_datagrams.reserve(m_batchSize);
+                m_entries.reserve(m_batchSize);
+#ifdef __linux__
+                m_controlSize = CMSG_SPACE(sizeof(int));
+                m_headers.resize(m_batchSize);
+                m_iovecs.resize(m_batchSize);
+                m_control.resize(m_batchSize * m_controlSize);
+                m_messageEnds.resize(m_batchSize);
+#endif
+            }
+
+            DatagramBatch(const DatagramBatch&) = delete;
+            DatagramBatch& operator=(const DatagramBatch&) = delete;
+
+            /// <summary>
+            /// Send equal-sized datagrams queued for one address as one segmented write.
+            /// Turned off again if the kernel doesn't support it.
+            /// </summary>
+            void setGso(bool gso)
+            {
+#ifdef __linux__
+                m_gso = gso;
+#else
+                (void)gso;
+#endif
+            }
+
+            bool gso() const { return m_gso; }
+
+            /// <summary>
+            /// Wait for datagrams and receive as many as are available, up to the batch size.
+            /// Previously received datagrams are discarded.
+            /// </summary>
+            /// <returns>Number of datagrams received, -1 on error</returns>
+            int receive(Socket socket)
+            {
+                m_datagrams.clear();
+#ifdef __linux__
+                for (size_t i = 0; i < m_batchSize; i++)
+                {
+                    m_iovecs[i].iov_base = m_buffer.data() + i * m_datagramSize;
+                    m_iovecs[i].iov_len = m_datagramSize;
+                    msghdr& header = m_headers[i].msg_hdr;
+                    header = {};
+                    header.msg_name = static_cast<sockaddr*>(m_addresses[i]);
+                    header.msg_namelen = sizeof(sockaddr_un);
+                    header.msg_iov = &m_iovecs[i];
+                    header.msg_iovlen = 1;
+                    header.msg_control = m_control.data() + i * m_controlSize;
+                    header.msg_controllen = m_controlSize;
+                }
+                int count = ::recvmmsg(socket, m_headers.data(), static_cast<unsigned>(m_batchSize), MSG_WAITFORONE,
+                    nullptr);
+                if (count < 0)
+                {
+                    return -1;
+                }
+                for (int i = 0; i < count; i++)
+                {
+                    msghdr& header = m_headers[i].msg_hdr;
+                    size_t length = m_headers[i].msg_len;
+                    if (header.msg_flags & MSG_TRUNC)
+                    {
+                        LOG_WARN("DatagramBatch: dropped datagram longer than %zu bytes", m_datagramSize);
+                        continue;
+                    }
+                    size_t segment = length;
+                    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(&header, cmsg))
+                    {
+                        if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+                        {
+                            int size = 0;
+                            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                            segment = (size > 0) ? static_cast<size_t>(size) : length;
+                        }
+                    }
+                    char const* data = static_cast<char const*>(m_iovecs[i].iov_base);
+                    for (size_t offset = 0; offset < length; offset += segment)
+                    {
+                        m_datagrams.push_back({ std::string_view(data + offset, std::min(segment, length - offset)),
+                            &m_addresses[i] });
+                    }
+                }
+#else
+                int size = socket.recvfrom(m_buffer.data(), m_datagramSize, 0, m_addresses[0]);
+                if (size < 0)
+                {
+                    return -1;
+                }
+                if (size > 0)
+                {
+                    m_datagrams.push_back({ std::string_view(m_buffer.data(), size), &m_addresses[0] });
+                }
+#endif
+                // Zero-length datagrams carry nothing, the socket also reports them once shut down
+                return static_cast<int>(m_datagrams.size());
+            }
+
+            size_t size() const { return m_datagrams.size(); }
+
+            bool empty() const { return m_datagrams.empty(); }
+
+            Datagram const& operator[](size_t index) const { return m_datagrams[index]; }
+
+            std::vector<Datagram>::const_iterator begin() const { return m_datagrams.begin(); }
+
+            std::vector<Datagram>::const_iterator end() const { return m_datagrams.end(); }
+
+            /// <summary>
+            /// Queue datagram for send(). The data is copied.
+            /// </summary>
+            /// <returns>false if the batch is full or the datagram is too long</returns>
+            bool queue(SocketAddr const& address, std::string_view data)
+            {
+                if ((m_entries.size() >= m_batchSize) || (data.size() > MaxDatagramSize) ||
+                    (m_sendUsed + data.size() > m_sendBuffer.size()))
+                {
+                    return false;
+                }
+                memcpy(m_sendBuffer.data() + m_sendUsed, data.data(), data.size());
+                m_entries.push_back({ m_sendUsed, data.size(), address });
+                m_sendUsed += data.size();
+                return true;
+            }
+
+            /// <summary>
+            /// Queue datagram back to the sender of a received one.
+            /// </summary>
+            bool reply(Datagram const& datagram, std::string_view data) { return queue(*datagram.address, data); }
+
+            /// <summary>
+            /// Number of queued datagrams.
+            /// </summary>
+            size_t pending() const { return m_entries.size(); }
+
+            /// <summary>
+            /// Send queued datagrams. The queue is empty afterwards, also on error.
+            /// </summary>
+            /// <returns>Number of datagrams sent, -1 if none could be sent</returns>
+            int send(Socket socket)
+            {
+                size_t sent = 0;
+                bool failed = false;
+#ifdef __linux__
+                while (sent < m_entries.size())
+                {
+                    bool segmented = false;
+                    size_t count = prepare(sent, segmented);
+                    int result = ::sendmmsg(socket, m_headers.data(), static_cast<unsigned>(count), 0);
+                    if (result > 0)
+                    {
+                        sent = m_messageEnds[result - 1];
+                        continue;
+                    }
+                    if ((result < 0) && (errno == EINTR))
+                    {
+                        continue;
+                    }
+                    if ((result < 0) && segmented && ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT)))
+                    {
+                        LOG_WARN("DatagramBatch: segmented send not supported, errno=%d", errno);
+                        m_gso = false;
+                        continue;
+                    }
+                    LOG_ERROR("DatagramBatch: send failed, errno=%d", errno);
+                    failed = true;
+                    break;
+                }
+#else
+                for (auto& entry : m_entries)
+                {
+                    if (socket.sendto(m_sendBuffer.data() + entry.offset, entry.size, 0, entry.address) < 0)
+                    {
+                        LOG_ERROR("DatagramBatch: send failed");
+                        failed = true;
+                        break;
+                    }
+                    sent++;
+                }
+#endif
+                m_entries.clear();
+                m_sendUsed = 0;
+                return (failed && (sent == 0)) ? -1 : static_cast<int>(sent);
+            }
+
+        private:
+            struct Entry
+            {
+                size_t offset;  // In m_sendBuffer
+                size_t size;
+                SocketAddr address;
+            };
+
+            static bool sameAddress(SocketAddr const& a, SocketAddr const& b)
+            {
+                return (a.size() == b.size()) &&
+                    (memcmp(static_cast<sockaddr const*>(a), static_cast<sockaddr const*>(b), a.size()) == 0);
+            }
+
+#ifdef __linux__
+            /// <summary>
+            /// Fill send headers with queued datagrams, starting at the first entry. With GSO
+            /// consecutive entries to one address share a header: they are adjacent in the
+            /// send buffer and all but the last one have the size of the first.
+            /// </summary>
+            /// <returns>Number of headers</returns>
+            size_t prepare(size_t first, bool& segmented)
+            {
+                size_t count = 0;
+                size_t entry = first;
+                while (entry < m_entries.size())
+                {
+                    Entry& start = m_entries[entry];
+                    size_t segment = start.size;
+                    size_t total = start.size;
+                    size_t next = entry + 1;
+                    while (m_gso && (segment != 0) && (next < m_entries.size()) && (next - entry < MaxSegments) &&
+                        (m_entries[next - 1].size == segment) && (m_entries[next].size <= segment) &&
+                        (m_entries[next].size != 0) && (total + m_entries[next].size <= MaxDatagramSize) &&
+                        sameAddress(m_entries[next].address, start.address))
+                    {
+                        total += m_entries[next].size;
+                        next++;
+                    }
+
+                    m_iovecs[count].iov_base = m_sendBuffer.data() + start.offset;
+                    m_iovecs[count].iov_len = total;
+                    msghdr& header = m_headers[count].msg_hdr;
+                    header = {};
+                    header.msg_name = static_cast<sockaddr*>(start.address);
+                    header.msg_namelen = static_cast<socklen_t>(start.address.size());
+                    header.msg_iov = &m_iovecs[count];
+                    header.msg_iovlen = 1;
+                    if (next - entry > 1)
+                    {
+                        header.msg_control = m_control.data() + count * m_controlSize;
+                        header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                        cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+                        cmsg->cmsg_level = SOL_UDP;
+                        cmsg->cmsg_type = UDP_SEGMENT;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                        uint16_t size = static_cast<uint16_t>(segment);
+                        memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+                        segmented = true;
+                    }
+                    m_messageEnds[count] = next;
+                    count++;
+                    entry = next;
+                }
+                return count;
+            }
+#endif
+
+            size_t m_batchSize;
+            size_t m_datagramSize;
+            std::vector<char> m_buffer;  // Receive buffers, m_datagramSize each
+            std::vector<SocketAddr> m_addresses;
+            std::vector<Datagram> m_datagrams;
+            std::vector<char> m_sendBuffer;  // Queued datagrams, back to back
+            size_t m_sendUsed{ 0 };
+            std::vector<Entry> m_entries;
+            bool m_gso{ false };
+#ifdef __linux__
+            size_t m_controlSize;
+            std::vector<mmsghdr> m_headers;
+            std::vector<iovec> m_iovecs;
+            std::vector<char> m_control;  // Ancillary data, m_controlSize per header
+            std::vector<size_t> m_messageEnds;  // Entry after the last one of every header
+#endif
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,454 @@
+// Copyright The OpenTelemetry Authors; Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+// Minimal io_uring wrapper on top of raw syscalls, so that the library
+// keeps depending on the system C runtime only (no liburing).
+//
+// The backend is compiled in when kernel headers are recent enough (Linux 6.0+:
+// multishot recv and provided buffer rings). Define HAVE_NO_IO_URING to opt out.
+// Whether the running kernel supports it is checked in Reactor::setBackend.
+
+#if defined(__linux__) && !defined(HAVE_NO_IO_URING)
+#  ifdef __has_include
+#    if __has_include(<linux/io_uring.h>)
+#      include <linux/io_uring.h>
+#      if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && !defined(HAVE_IO_URING)
+#        define HAVE_IO_URING
+#      endif
+#    endif
+#  endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#  include <algorithm>
+#  include <cerrno>
+#  include <cstdint>
+#  include <cstring>
+#  include <vector>
+
+#  include <poll.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+
+#  ifndef __NR_io_uring_setup
+#    define __NR_io_uring_setup 425
+#  endif
+#  ifndef __NR_io_uring_enter
+#    define __NR_io_uring_enter 426
+#  endif
+#  ifndef __NR_io_uring_register
+#    define __NR_io_uring_register 427
+#  endif
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Submission and completion rings of one io_uring instance.
+        /// Not thread-safe: the owner serializes access to the submission ring.
+        /// Completion ring is only consumed by the thread that waits on it.
+        /// </summary>
+        struct Uring
+        {
+            int m_fd{ -1 };
+            unsigned m_features{ 0 };
+
+            // Submission ring
+            void* m_sqRing{ nullptr };
+            size_t m_sqRingSize{ 0 };
+            unsigned* m_sqHead{ nullptr };
+            unsigned* m_sqTail{ nullptr };
+            unsigned* m_sqArray{ nullptr };
+            unsigned m_sqMask{ 0 };
+            unsigned m_sqEntries{ 0 };
+            io_uring_sqe* m_sqes{ nullptr };
+            size_t m_sqesSize{ 0 };
+            unsigned m_sqLocalTail{ 0 };  // Prepared entries end here
+            unsigned m_sqPublished{ 0 };  // Entries visible to the kernel end here
+
+            // Completion ring
+            void* m_cqRing{ nullptr };
+            size_t m_cqRingSize{ 0 };
+            unsigned* m_cqHead{ nullptr };
+            unsigned* m_cqTail{ nullptr };
+            unsigned m_cqMask{ 0 };
+            io_uring_cqe* m_cqes{ nullptr };
+
+            Uring() {}
+
+            Uring(Uring const&) = delete;
+
+            Uring& operator=(Uring const&) = delete;
+
+            ~Uring() { close(); }
+
+            bool valid() const { return m_fd >= 0; }
+
+            /// <summary>
+            /// Create the ring and map it into process memory.
+            /// </summary>
+            /// <param name="entries">Submission queue size, completion queue is 4x bigger</param>
+            /// <returns>true on success, false if io_uring is not available</returns>
+            bool init(unsigned entries)
+            {
+                io_uring_params params;
+                memset(&params, 0, sizeof(params));
+                params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+                params.cq_entries = entries * 4;
+                int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+                if (fd < 0)
+                {
+                    LOG_WARN("Uring: io_uring_setup failed, errno=%d", errno);
+                    return false;
+                }
+                m_fd = fd;
+                m_features = params.features;
+
+                m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                if (m_features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+                }
+
+                m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                    IORING_OFF_SQ_RING);
+                if (m_sqRing == MAP_FAILED)
+                {
+                    m_sqRing = nullptr;
+                    close();
+                    return false;
+                }
+                if (m_features & IORING_FEAT_SINGLE_MMAP)
+                {
+                    m_cqRing = m_sqRing;
+                }
+                else
+                {
+                    m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fd, IORING_OFF_CQ_RING);
+                    if (m_cqRing == MAP_FAILED)
+                    {
+                        m_cqRing = nullptr;
+                        close();
+                        return false;
+                    }
+                }
+
+                m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                    IORING_OFF_SQES);
+                if (sqes == MAP_FAILED)
+                {
+                    close();
+                    return false;
+                }
+                m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+                char* sq = static_cast<char*>(m_sqRing);
+                m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                m_sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+                m_sqLocalTail = m_sqPublished = *m_sqTail;
+
+                char* cq = static_cast<char*>(m_cqRing);
+                m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+                return true;
+            }
+
+            void close()
+            {
+                if (m_sqes != nullptr)
+                {
+                    ::munmap(m_sqes, m_sqesSize);
+                    m_sqes = nullptr;
+                }
+                if ((m_cqRing != nullptr) && (m_cqRing != m_sqRing))
+                {
+                    ::munmap(m_cqRing, m_cqRingSize);
+                }
+                m_cqRing = nullptr;
+                if (m_sqRing != nullptr)
+                {
+                    ::munmap(m_sqRing, m_sqRingSize);
+                    m_sqRing = nullptr;
+                }
+                if (m_fd >= 0)
+                {
+                    ::close(m_fd);
+                    m_fd = -1;
+                }
+            }
+
+            /// <summary>
+            /// Check whether the kernel supports an opcode
+            /// </summary>
+            bool probe(unsigned opcode) const
+            {
+                const unsigned numOps = 256;
+                std::vector<char> buffer(sizeof(io_uring_probe) + numOps * sizeof(io_uring_probe_op), 0);
+                io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+                if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, numOps) < 0)
+                {
+                    return false;
+                }
+                return (opcode <= probe->last_op) && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+            }
+
+            /// <summary>
+            /// Make room for count submission entries, flushing the ring to the kernel if needed.
+            /// Linked entries must be reserved together, so that a flush doesn't split the chain.
+            /// </summary>
+            bool reserve(unsigned count)
+            {
+                unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+                if (m_sqLocalTail - head + count > m_sqEntries)
+                {
+                    submit();
+                    head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+                    if (m_sqLocalTail - head + count > m_sqEntries)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /// <summary>
+            /// Obtain next free submission entry, flushing the ring to the kernel if it is full.
+            /// </summary>
+            io_uring_sqe* getSqe()
+            {
+                if (!reserve(1))
+                {
+                    return nullptr;
+                }
+                unsigned index = m_sqLocalTail & m_sqMask;
+                io_uring_sqe* sqe = &m_sqes[index];
+                memset(sqe, 0, sizeof(*sqe));
+                m_sqArray[index] = index;
+                m_sqLocalTail++;
+                return sqe;
+            }
+
+            /// <summary>
+            /// Make prepared entries visible to the kernel.
+            /// </summary>
+            /// <returns>Number of entries to pass to enter()</returns>
+            unsigned publish()
+            {
+                unsigned count = m_sqLocalTail - m_sqPublished;
+                __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+                m_sqPublished = m_sqLocalTail;
+                return count;
+            }
+
+            /// <summary>
+            /// Submit prepared entries without waiting
+            /// </summary>
+            int submit()
+            {
+                unsigned count = publish();
+                return (count != 0) ? enter(count, 0, 0) : 0;
+            }
+
+            /// <summary>
+            /// Submit published entries and optionally wait for completions.
+            /// Entries are published separately, so that the caller may wait without
+            /// holding the lock that serializes access to the submission ring.
+            /// </summary>
+            /// <param name="toSubmit">Number of published entries</param>
+            /// <param name="waitNr">Number of completions to wait for</param>
+            /// <param name="timeoutMs">Wait timeout, negative - infinite</param>
+            int enter(unsigned toSubmit, unsigned waitNr, int timeoutMs)
+            {
+                unsigned flags = 0;
+                io_uring_getevents_arg arg;
+                __kernel_timespec ts;
+                void* argp = nullptr;
+                size_t argsz = 0;
+                if (waitNr != 0)
+                {
+                    flags |= IORING_ENTER_GETEVENTS;
+                    if (timeoutMs >= 0)
+                    {
+                        ts.tv_sec = timeoutMs / 1000;
+                        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+                        memset(&arg, 0, sizeof(arg));
+                        arg.ts = reinterpret_cast<uint64_t>(&ts);
+                        flags |= IORING_ENTER_EXT_ARG;
+                        argp = &arg;
+                        argsz = sizeof(arg);
+                    }
+                }
+                int rc = static_cast<int>(::syscall(__NR_io_uring_enter, m_fd, toSubmit, waitNr, flags, argp, argsz));
+                if ((rc < 0) && (errno != ETIME) && (errno != EINTR) && (errno != EBUSY))
+                {
+                    LOG_ERROR("Uring: io_uring_enter failed, errno=%d", errno);
+                }
+                return rc;
+            }
+
+            /// <summary>
+            /// Visit available completions, then release them to the kernel.
+            /// </summary>
+            /// <returns>Number of completions visited</returns>
+            template <typename F>
+            unsigned forEachCompletion(F visitor)
+            {
+                unsigned head = *m_cqHead;
+                unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+                unsigned count = 0;
+                while (head != tail)
+                {
+                    // Copy: visitor may submit more work that completes into the ring
+                    io_uring_cqe cqe = m_cqes[head & m_cqMask];
+                    head++;
+                    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+                    visitor(cqe);
+                    count++;
+                    if (head == tail)
+                    {
+                        tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+                    }
+                }
+                return count;
+            }
+
+            int registerBuffers(unsigned opcode, void* arg, unsigned count)
+            {
+                return static_cast<int>(::syscall(__NR_io_uring_register, m_fd, opcode, arg, count));
+            }
+
+        };
+
+        /// <summary>
+        /// Ring of provided receive buffers (IORING_REGISTER_PBUF_RING): the kernel picks
+        /// a buffer when data arrives, so that idle connections don't pin any memory.
+        /// </summary>
+        struct UringBufferRing
+        {
+            Uring* m_ring{ nullptr };
+            io_uring_buf_ring* m_bufRing{ nullptr };
+            size_t m_bufRingSize{ 0 };
+            std::vector<char> m_storage;
+            unsigned m_entries{ 0 };
+            unsigned m_bufferSize{ 0 };
+            unsigned short m_groupId{ 0 };
+            unsigned short m_tail{ 0 };
+
+            UringBufferRing() {}
+
+            UringBufferRing(UringBufferRing const&) = delete;
+
+            UringBufferRing& operator=(UringBufferRing const&) = delete;
+
+            ~UringBufferRing() { close(); }
+
+            /// <summary>
+            /// Register buffer group with the ring
+            /// </summary>
+            /// <param name="ring">Ring</param>
+            /// <param name="groupId">Buffer group id</param>
+            /// <param name="entries">Number of buffers, power of 2</param>
+            /// <param name="bufferSize">Size of each buffer</param>
+            bool init(Uring& ring, unsigned short groupId, unsigned entries, unsigned bufferSize)
+            {
+                m_bufRingSize = entries * sizeof(io_uring_buf);
+                void* mem = ::mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+                if (mem == MAP_FAILED)
+                {
+                    return false;
+                }
+                m_bufRing = static_cast<io_uring_buf_ring*>(mem);
+
+                io_uring_buf_reg reg;
+                memset(&reg, 0, sizeof(reg));
+                reg.ring_addr = reinterpret_cast<uint64_t>(m_bufRing);
+                reg.ring_entries = entries;
+                reg.bgid = groupId;
+                if (ring.registerBuffers(IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+                {
+                    LOG_WARN("Uring: buffer ring registration failed, errno=%d", errno);
+                    ::munmap(m_bufRing, m_bufRingSize);
+                    m_bufRing = nullptr;
+                    return false;
+                }
+                m_ring = &ring;
+                m_entries = entries;
+                m_bufferSize = bufferSize;
+                m_groupId = groupId;
+                m_storage.resize(static_cast<size_t>(entries) * bufferSize);
+                m_tail = 0;
+                for (unsigned bid = 0; bid < entries; bid++)
+                {
+                    add(static_cast<unsigned short>(bid));
+                }
+                publish();
+                return true;
+            }
+
+            void close()
+            {
+                if (m_bufRing == nullptr)
+                {
+                    return;
+                }
+                if ((m_ring != nullptr) && m_ring->valid())
+                {
+                    io_uring_buf_reg reg;
+                    memset(&reg, 0, sizeof(reg));
+                    reg.bgid = m_groupId;
+                    m_ring->registerBuffers(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+                }
+                ::munmap(m_bufRing, m_bufRingSize);
+                m_bufRing = nullptr;
+                m_ring = nullptr;
+            }
+
+            bool valid() const { return m_bufRing != nullptr; }
+
+            char* data(unsigned short bid) { return m_storage.data() + static_cast<size_t>(bid) * m_bufferSize; }
+
+            /// <summary>
+            /// Give buffer back to the kernel
+            /// </summary>
+            void recycle(unsigned short bid)
+            {
+                add(bid);
+                publish();
+            }
+
+        private:
+            void add(unsigned short bid)
+            {
+                // Not m_bufRing->bufs: in C++ the flexible array of the kernel header
+                // lands after an empty struct of size 1, at the wrong offset.
+                io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(m_bufRing) + (m_tail & (m_entries - 1));
+                buf->addr = reinterpret_cast<uint64_t>(data(bid));
+                buf->len = m_bufferSize;
+                buf->bid = bid;
+                m_tail++;
+            }
+
+            void publish() { __atomic_store_n(&m_bufRing->tail, m_tail, __ATOMIC_RELEASE); }
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
+
+#endif
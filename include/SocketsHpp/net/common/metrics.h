@@ -0,0 +1,308 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Counter with a single writer thread, read by any. Updates are a relaxed load and store,
+        /// no locked instruction: readers see every value eventually, never a torn one.
+        /// </summary>
+        class Counter
+        {
+        public:
+            void add(uint64_t value = 1)
+            {
+                m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+
+            void reset() { m_value.store(0, std::memory_order_relaxed); }
+
+            uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<uint64_t> m_value{ 0 };
+        };
+
+        /// <summary>
+        /// Log-linear histogram of latencies in nanoseconds, in the style of HdrHistogram: every
+        /// power of two is split into 32 buckets, so that values are kept within about 3%, up to
+        /// 2^42 ns (73 minutes). Recording is O(1) and has a single writer thread. Snapshots of
+        /// several histograms are merged into a plain one with add().
+        /// </summary>
+        class LatencyHistogram
+        {
+        public:
+            static constexpr unsigned const SubBucketBits = 5;
+            static constexpr unsigned const MaxValueBits = 42;
+            static constexpr uint64_t const SubBuckets = uint64_t(1) << SubBucketBits;
+            static constexpr size_t const Buckets = (MaxValueBits - SubBucketBits + 1) * SubBuckets;
+            static constexpr uint64_t const MaxValue = (uint64_t(1) << MaxValueBits) - 1;
+
+            LatencyHistogram() = default;
+
+            /// <summary>
+            /// Copy of the values recorded so far, see add().
+            /// </summary>
+            LatencyHistogram(const LatencyHistogram& other) { add(other); }
+
+            LatencyHistogram& operator=(const LatencyHistogram& other)
+            {
+                if (this != &other)
+                {
+                    reset();
+                    add(other);
+                }
+                return *this;
+            }
+
+            /// <summary>
+            /// Forget recorded values. Must be called by the writer thread.
+            /// </summary>
+            void reset()
+            {
+                for (auto& bucket : m_buckets)
+                {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                m_count.reset();
+                m_sum.reset();
+                m_max.store(0, std::memory_order_relaxed);
+            }
+
+            /// <summary>
+            /// Record one value, larger ones count as the maximum value.
+            /// </summary>
+            void record(uint64_t value)
+            {
+                value = std::min(value, MaxValue);
+                std::atomic<uint64_t>& bucket = m_buckets[bucketOf(value)];
+                bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                m_count.add();
+                m_sum.add(value);
+                if (value > m_max.load(std::memory_order_relaxed))
+                {
+                    m_max.store(value, std::memory_order_relaxed);
+                }
+            }
+
+            /// <summary>
+            /// Add the values of another histogram, recorded by another thread. Not atomic as a
+            /// whole: the result may miss values recorded meanwhile.
+            /// </summary>
+            void add(LatencyHistogram const& other)
+            {
+                for (size_t i = 0; i < Buckets; i++)
+                {
+                    uint64_t count = other.m_buckets[i].load(std::memory_order_relaxed);
+                    if (count != 0)
+                    {
+                        m_buckets[i].store(m_buckets[i].load(std::memory_order_relaxed) + count,
+                            std::memory_order_relaxed);
+                    }
+                }
+                m_count.add(other.count());
+                m_sum.add(other.sum());
+                m_max.store(std::max(max(), other.max()), std::memory_order_relaxed);
+            }
+
+            uint64_t count() const { return m_count.value(); }
+
+            uint64_t sum() const { return m_sum.value(); }
+
+            uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+            /// <summary>
+            /// Highest value equivalent to the one at the quantile.
+            /// </summary>
+            /// <param name="quantile">From 0 to 1, e.g. 0.99</param>
+            /// <returns>Value, 0 if nothing was recorded</returns>
+            uint64_t percentile(double quantile) const
+            {
+                uint64_t total = 0;
+                for (auto const& bucket : m_buckets)
+                {
+                    total += bucket.load(std::memory_order_relaxed);
+                }
+                if (total == 0)
+                {
+                    return 0;
+                }
+                quantile = std::min(std::max(quantile, 0.0), 1.0);
+                uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(total) + 0.5);
+                rank = std::max<uint64_t>(rank, 1);
+                uint64_t seen = 0;
+                for (size_t i = 0; i < Buckets; i++)
+                {
+                    seen += m_buckets[i].load(std::memory_order_relaxed);
+                    if (seen >= rank)
+                    {
+                        return std::min(upperBound(i), max());
+                    }
+                }
+                return max();
+            }
+
+            /// <summary>
+            /// Bucket of the value: exact below 2 * SubBuckets, then SubBuckets per power of two.
+            /// </summary>
+            static size_t bucketOf(uint64_t value)
+            {
+                if (value < SubBuckets)
+                {
+                    return static_cast<size_t>(value);
+                }
+                unsigned shift = highestBit(value) - SubBucketBits;
+                return static_cast<size_t>(shift * SubBuckets + (value >> shift));
+            }
+
+            /// <summary>
+            /// Largest value that falls into the bucket.
+            /// </summary>
+            static uint64_t upperBound(size_t bucket)
+            {
+                if (bucket < 2 * SubBuckets)
+                {
+                    return bucket;
+                }
+                uint64_t shift = bucket / SubBuckets - 1;
+                uint64_t mantissa = bucket % SubBuckets + SubBuckets;
+                return ((mantissa + 1) << shift) - 1;
+            }
+
+        private:
+            static unsigned highestBit(uint64_t value)
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#else
+                unsigned bit = 0;
+                while (value >>= 1)
+                {
+                    bit++;
+                }
+                return bit;
+#endif
+            }
+
+            std::array<std::atomic<uint64_t>, Buckets> m_buckets{};
+            Counter m_count;
+            Counter m_sum;
+            std::atomic<uint64_t> m_max{ 0 };
+        };
+
+        /// <summary>
+        /// Counters of one reactor, written by its thread only and padded to a cache line of
+        /// their own, so that reading them from another thread costs the reactor nothing.
+        /// </summary>
+        struct alignas(64) ReactorMetrics
+        {
+            Counter wakeups;        // Returns from the event wait
+            Counter events;         // Events or completions harvested by the waits
+            Counter fullWakeups;    // Waits that filled the event batch, more events were likely pending
+            Counter accepts;        // Connections accepted by the reactor, see Reactor::Accepted
+            Counter bytesRead;      // Received by the reactor and by its callbacks
+            Counter bytesWritten;   // Sent by the reactor and by its callbacks
+            Counter partialWrites;  // Sends that took only part of the data
+            Counter wouldBlock;     // Receives and sends that returned EAGAIN
+
+            /// <summary>
+            /// Plain copy of the counters, summed over reactors with +=.
+            /// </summary>
+            struct Snapshot
+            {
+                uint64_t wakeups{ 0 };
+                uint64_t events{ 0 };
+                uint64_t fullWakeups{ 0 };
+                uint64_t accepts{ 0 };
+                uint64_t bytesRead{ 0 };
+                uint64_t bytesWritten{ 0 };
+                uint64_t partialWrites{ 0 };
+                uint64_t wouldBlock{ 0 };
+
+                Snapshot& operator+=(Snapshot const& other)
+                {
+                    wakeups += other.wakeups;
+                    events += other.events;
+                    fullWakeups += other.fullWakeups;
+                    accepts += other.accepts;
+                    bytesRead += other.bytesRead;
+                    bytesWritten += other.bytesWritten;
+                    partialWrites += other.partialWrites;
+                    wouldBlock += other.wouldBlock;
+                    return *this;
+                }
+
+                /// <summary>
+                /// Average events handled per wakeup.
+                /// </summary>
+                double eventsPerWakeup() const
+                {
+                    return (wakeups != 0) ? static_cast<double>(events) / static_cast<double>(wakeups) : 0.0;
+                }
+            };
+
+            Snapshot snapshot() const
+            {
+                Snapshot result;
+                result.wakeups = wakeups.value();
+                result.events = events.value();
+                result.fullWakeups = fullWakeups.value();
+                result.accepts = accepts.value();
+                result.bytesRead = bytesRead.value();
+                result.bytesWritten = bytesWritten.value();
+                result.partialWrites = partialWrites.value();
+                result.wouldBlock = wouldBlock.value();
+                return result;
+            }
+
+            /// <summary>
+            /// Account a receive of the callback: bytes, or EAGAIN.
+            /// </summary>
+            void received(int result, bool blocked)
+            {
+                if (result > 0)
+                {
+                    bytesRead.add(static_cast<uint64_t>(result));
+                }
+                else if (blocked)
+                {
+                    wouldBlock.add();
+                }
+            }
+
+            /// <summary>
+            /// Account a send of the callback: bytes and whether all were taken, or EAGAIN.
+            /// </summary>
+            void sent(int64_t result, size_t size, bool blocked)
+            {
+                if (result > 0)
+                {
+                    bytesWritten.add(static_cast<uint64_t>(result));
+                    if (static_cast<size_t>(result) < size)
+                    {
+                        partialWrites.add();
+                    }
+                }
+                else if (blocked)
+                {
+                    wouldBlock.add();
+                }
+            }
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,242 @@
+// Copyright The OpenTelemetry Authors; Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "./socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Pool of Reactors. Every Reactor runs its own event loop thread with its own
+        /// epoll / kqueue descriptor, all of them dispatching into the same callback.
+        ///
+        /// Sharding of incoming connections is done by the owner of the pool:
+        /// - if the platform balances SO_REUSEPORT listeners (Linux), every Reactor gets
+        ///   its own listening socket and keeps the connections it accepts;
+        /// - otherwise one Reactor accepts and hands out connections with next().
+        /// </summary>
+        struct ReactorPool
+        {
+#if defined(__linux__) && defined(SO_REUSEPORT)
+            static constexpr bool const HasReusePort = true;
+#else
+            static constexpr bool const HasReusePort = false;
+#endif
+
+            Reactor::SocketCallback& m_callback;
+
+            std::vector<std::unique_ptr<Reactor>> m_reactors;
+
+            std::atomic<size_t> m_next{ 0 };
+
+            // Options applied to every reactor, including the ones added by resize()
+            bool m_edgeTriggered{ false };
+            size_t m_eventBatchSize{ Reactor::DefaultEventBatchSize };
+            size_t m_acceptBudget{ Reactor::DefaultAcceptBudget };
+            Reactor::Backend m_backend{ Reactor::Default };
+            bool m_threadOwned{ false };
+            bool m_cpuAffinity{ false };
+
+            /// <summary>
+            /// ReactorPool constructor
+            /// </summary>
+            /// <param name="callback">Socket callback shared by all reactors</param>
+            /// <param name="numWorkers">Number of reactors, 0 - one per hardware thread</param>
+            ReactorPool(Reactor::SocketCallback& callback, size_t numWorkers = 1) : m_callback(callback)
+            {
+                resize(numWorkers);
+            }
+
+            /// <summary>
+            /// Default number of workers: one per hardware thread.
+            /// </summary>
+            static size_t defaultSize()
+            {
+                size_t result = std::thread::hardware_concurrency();
+                return (result != 0) ? result : 1;
+            }
+
+            /// <summary>
+            /// Grow the pool to at least numWorkers reactors. Must be called before start().
+            /// </summary>
+            /// <param name="numWorkers">Number of reactors, 0 - one per hardware thread</param>
+            /// <returns>Effective number of workers requested</returns>
+            size_t resize(size_t numWorkers)
+            {
+                if (numWorkers == 0)
+                {
+                    numWorkers = defaultSize();
+                }
+                while (m_reactors.size() < numWorkers)
+                {
+                    m_reactors.push_back(std::unique_ptr<Reactor>(new Reactor(m_callback)));
+                    m_reactors.back()->setEdgeTriggered(m_edgeTriggered);
+                    m_reactors.back()->setEventBatchSize(m_eventBatchSize);
+                    m_reactors.back()->setAcceptBudget(m_acceptBudget);
+                    m_reactors.back()->setBackend(m_backend);
+                    m_reactors.back()->setThreadOwned(m_threadOwned);
+                    m_reactors.back()->setCpu(m_cpuAffinity ? cpuOf(m_reactors.size() - 1) : -1);
+                }
+                return numWorkers;
+            }
+
+            size_t size() const { return m_reactors.size(); }
+
+            /// <summary>
+            /// Switch all reactors to edge-triggered (or back to level-triggered) mode.
+            /// See Reactor::setEdgeTriggered.
+            /// </summary>
+            void setEdgeTriggered(bool edgeTriggered)
+            {
+                m_edgeTriggered = edgeTriggered;
+                for (auto& reactor : m_reactors)
+                {
+                    reactor->setEdgeTriggered(edgeTriggered);
+                }
+            }
+
+            bool isEdgeTriggered() const { return m_edgeTriggered; }
+
+            /// <summary>
+            /// Set maximum number of events harvested per wakeup by every reactor.
+            /// Must be called before start().
+            /// </summary>
+            void setEventBatchSize(size_t eventBatchSize)
+            {
+                m_eventBatchSize = eventBatchSize;
+                for (auto& reactor : m_reactors)
+                {
+                    reactor->setEventBatchSize(eventBatchSize);
+                }
+            }
+
+            /// <summary>
+            /// Set maximum number of connections every reactor accepts from a listening socket
+            /// per wakeup. Must be called before start(). See Reactor::setAcceptBudget.
+            /// </summary>
+            void setAcceptBudget(size_t acceptBudget)
+            {
+                m_acceptBudget = acceptBudget;
+                for (auto& reactor : m_reactors)
+                {
+                    reactor->setAcceptBudget(acceptBudget);
+                }
+            }
+
+            /// <summary>
+            /// Select event notification facility of all reactors. Must be called before start().
+            /// See Reactor::setBackend.
+            /// </summary>
+            /// <returns>false if the backend is not supported, then reactors keep the default one</returns>
+            bool setBackend(Reactor::Backend backend)
+            {
+                bool result = true;
+                for (auto& reactor : m_reactors)
+                {
+                    result &= reactor->setBackend(backend);
+                }
+                m_backend = result ? backend : Reactor::Default;
+                if (!result)
+                {
+                    for (auto& reactor : m_reactors)
+                    {
+                        reactor->setBackend(Reactor::Default);
+                    }
+                }
+                return result;
+            }
+
+            /// <summary>
+            /// Make socket tables owned by reactor threads. Must be called before start().
+            /// See Reactor::setThreadOwned.
+            /// </summary>
+            /// <returns>false if not supported, then reactors keep locking</returns>
+            bool setThreadOwned(bool threadOwned)
+            {
+                bool result = true;
+                for (auto& reactor : m_reactors)
+                {
+                    result &= reactor->setThreadOwned(threadOwned);
+                }
+                m_threadOwned = result && threadOwned;
+                if (!result)
+                {
+                    for (auto& reactor : m_reactors)
+                    {
+                        reactor->setThreadOwned(false);
+                    }
+                }
+                return result;
+            }
+
+            bool isThreadOwned() const { return m_threadOwned; }
+
+            /// <summary>
+            /// Pin reactor N to CPU N, wrapping around the hardware threads. Must be called
+            /// before start(). See Reactor::setCpu.
+            /// </summary>
+            /// <returns>false if not supported, then threads are not pinned</returns>
+            bool setCpuAffinity(bool cpuAffinity)
+            {
+                bool result = true;
+                for (size_t i = 0; i < m_reactors.size(); i++)
+                {
+                    result &= m_reactors[i]->setCpu(cpuAffinity ? cpuOf(i) : -1);
+                }
+                m_cpuAffinity = result && cpuAffinity;
+                return result;
+            }
+
+            bool hasCpuAffinity() const { return m_cpuAffinity; }
+
+            /// <summary>
+            /// CPU of the reactor with the index when pinned.
+            /// </summary>
+            static int cpuOf(size_t index) { return static_cast<int>(index % defaultSize()); }
+
+            Reactor& operator[](size_t index) { return *m_reactors[index]; }
+
+            Reactor const& operator[](size_t index) const { return *m_reactors[index]; }
+
+            /// <summary>
+            /// Pick the next reactor in round-robin order.
+            /// </summary>
+            Reactor& next() { return *m_reactors[m_next++ % m_reactors.size()]; }
+
+            /// <summary>
+            /// Start all reactors
+            /// </summary>
+            void start()
+            {
+                for (auto& reactor : m_reactors)
+                {
+                    reactor->start();
+                }
+            }
+
+            /// <summary>
+            /// Stop all reactors
+            /// </summary>
+            void stop()
+            {
+                for (auto& reactor : m_reactors)
+                {
+                    reactor->stop();
+                }
+            }
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,104 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Budget of outbound bytes that connections queued and the peer has not taken yet,
+        /// checked against high and low watermarks. A connection stops reading requests once its
+        /// own bytes, or the bytes of all connections, reach the high watermark, and resumes once
+        /// they are down to the low one. Only connections that have bytes queued are paused for
+        /// the global budget: they resume as their sends complete, no other connection has to be
+        /// woken up. The total is shared by reactor threads, every connection is updated by its own.
+        /// </summary>
+        class SendBudget
+        {
+        public:
+            SendBudget() = default;
+
+            SendBudget(const SendBudget&) = delete;
+            SendBudget& operator=(const SendBudget&) = delete;
+
+            /// <summary>
+            /// Set watermarks of every connection. Must be set before connections are served.
+            /// </summary>
+            /// <param name="high">Pause at so many bytes, 0 - no limit</param>
+            /// <param name="low">Resume at so many bytes, at most the high watermark</param>
+            void setConnectionWatermarks(size_t high, size_t low)
+            {
+                m_connectionHigh = high;
+                m_connectionLow = std::min(low, high);
+            }
+
+            /// <summary>
+            /// Set watermarks of all connections together. Must be set before connections are served.
+            /// </summary>
+            /// <param name="high">Pause at so many bytes, 0 - no limit</param>
+            /// <param name="low">Resume at so many bytes, at most the high watermark</param>
+            void setGlobalWatermarks(size_t high, size_t low)
+            {
+                m_globalHigh = high;
+                m_globalLow = std::min(low, high);
+            }
+
+            bool enabled() const { return (m_connectionHigh != 0) || (m_globalHigh != 0); }
+
+            /// <summary>
+            /// Bytes queued by all connections.
+            /// </summary>
+            size_t pending() const { return m_pending.load(std::memory_order_relaxed); }
+
+            /// <summary>
+            /// Account the bytes a connection has queued now.
+            /// </summary>
+            /// <param name="accounted">Bytes of the connection accounted so far, updated</param>
+            /// <param name="pending">Bytes queued by the connection, 0 once it is closed</param>
+            /// <param name="paused">Whether the connection is paused</param>
+            /// <returns>Whether the connection should be paused</returns>
+            bool update(size_t& accounted, size_t pending, bool paused)
+            {
+                size_t total;
+                if (pending >= accounted)
+                {
+                    total = m_pending.fetch_add(pending - accounted, std::memory_order_relaxed) + (pending - accounted);
+                }
+                else
+                {
+                    total = m_pending.fetch_sub(accounted - pending, std::memory_order_relaxed) - (accounted - pending);
+                }
+                accounted = pending;
+                if (pending == 0)
+                {
+                    return false;
+                }
+                if (!paused)
+                {
+                    return ((m_connectionHigh != 0) && (pending >= m_connectionHigh)) ||
+                        ((m_globalHigh != 0) && (total >= m_globalHigh));
+                }
+                return ((m_connectionHigh != 0) && (pending > m_connectionLow)) ||
+                    ((m_globalHigh != 0) && (total > m_globalLow));
+            }
+
+        private:
+            size_t m_connectionHigh{ 0 };
+            size_t m_connectionLow{ 0 };
+            size_t m_globalHigh{ 0 };
+            size_t m_globalLow{ 0 };
+            std::atomic<size_t> m_pending{ 0 };
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
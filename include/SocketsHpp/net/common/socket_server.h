@@ -5,28 +5,45 @@
 #include <SocketsHpp/config.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <functional>
+#include <initializer_list>
 #include <iterator>
 #include <list>
-#include <map>
+#include <memory>
 #include <mutex>
-#include <set>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "./connection_table.h"
+#include "./datagram_batch.h"
+#include "./reactor_pool.h"
+#include "./send_budget.h"
 #include "./socket_tools.h"
+#include "./tls.h"
 
 SOCKETSHPP_NS_BEGIN
 namespace net
 {
     namespace common {
 
+        using BufferPool = net::utils::BufferPool;
+        template <typename T>
+        using ConnectionTable = net::utils::ConnectionTable<T>;
+        using DatagramBatch = net::utils::DatagramBatch;
         using Reactor = net::utils::Reactor;
+        using ReactorPool = net::utils::ReactorPool;
+        using SendBudget = net::utils::SendBudget;
         using Socket = net::utils::Socket;
         using SocketAddr = net::utils::SocketAddr;
         using SocketParams = net::utils::SocketParams;
+        using TlsContext = net::utils::TlsContext;
+        using TlsSession = net::utils::TlsSession;
 
         /**
          * @brief Common Server for TCP, UDP and Unix Domain.
@@ -45,21 +62,80 @@ namespace net
                     Aborted      // Connection aborted
                 };
 
-                Socket socket;      // Active client-server socket
-                SocketAddr client;  // Client address
+                /**
+                 * @brief Set of connection states kept in one bitmask, with the
+                 * insert / erase / count interface of std::set<State>.
+                 */
+                class StateSet
+                {
+                public:
+                    StateSet() = default;
+
+                    StateSet(std::initializer_list<State> states)
+                    {
+                        for (State state : states)
+                        {
+                            insert(state);
+                        }
+                    }
+
+                    void insert(State state) { m_bits |= bit(state); }
+
+                    void erase(State state) { m_bits &= ~bit(state); }
+
+                    size_t count(State state) const { return (m_bits & bit(state)) ? 1 : 0; }
+
+                    void clear() { m_bits = 0; }
 
-                std::string request_buffer;   // Receive buffer for current event
-                std::string response_buffer;  // Send buffer for current event
+                    bool empty() const { return m_bits == 0; }
 
-                std::set<State> state;  // Current connection state
+                    bool operator==(StateSet const& other) const { return m_bits == other.m_bits; }
+
+                    bool operator!=(StateSet const& other) const { return m_bits != other.m_bits; }
+
+                private:
+                    static uint8_t bit(State state) { return static_cast<uint8_t>(1u << state); }
+
+                    uint8_t m_bits{ 0 };
+                };
+
+                Socket socket;               // Active client-server socket
+                SocketAddr client;           // Client address
+                Reactor* reactor{ nullptr };  // Reactor that owns the socket
+                std::unique_ptr<TlsSession> tls;  // Encrypts the stream, nullptr - plaintext
+
+                std::string_view request_data;  // Received bytes, only valid during onRequest
+                BufferPool::Chunk receive_chunk;  // Reactor buffer that holds the received bytes
+                std::string response_buffer;      // Send buffer, emptied once it is sent
+                size_t response_offset{ 0 };      // Bytes of response_buffer already sent
+
+                StateSet state;  // Current connection state
                 bool keepalive{ true };   // Keep connection alive (reserved for future use)
+                Reactor::TimerId idle_timer{ 0 };  // Closes the connection once idle_timeout expires
+                size_t send_accounted{ 0 };  // Unsent bytes accounted in send_budget
+                bool write_paused{ false };  // Not reading requests until the client takes more of the responses
+            };
+
+            // State of one datagram socket, used by the reactor thread that receives from it
+            struct DatagramWorker
+            {
+                Socket socket;
+                Connection conn;  // Scratch connection reused for every datagram
+                std::unique_ptr<DatagramBatch> batch;  // Created by the reactor thread, see onDatagrams
             };
 
             SocketAddr bind_address;  // Server bind address
             bool is_bound{ false };
             SocketParams server_socket_params;  // Server socket params
             Socket server_socket;               // Server listening socket
-            Reactor reactor;                    // Socket event handler
+            std::vector<Socket> listening_sockets;  // Stream listeners, one per reactor with reuse_port
+            ReactorPool reactors;               // Socket event handlers
+            bool reuse_port{ false };           // Every reactor accepts or receives on its own socket
+            bool cpu_affinity{ false };         // Pin reactor N to CPU N, UDP socket N hints SO_INCOMING_CPU
+            std::chrono::milliseconds idle_timeout{ 0 };  // Close connections without events for so long, 0 - never
+            std::shared_ptr<TlsContext> tls_context;      // Serve TLS on stream connections, nullptr - plaintext
+            int defer_accept{ 0 };  // TCP: accept once the first request arrives, wait up to so many seconds
+            int fast_open{ 0 };     // TCP: Fast Open queue length, accept requests in the SYN, 0 - off
 
             // Custom callback when server receives data
             std::function<void(Connection& conn)> onRequest;
@@ -67,9 +143,31 @@ namespace net
             // Custom callback when server sends a response
             std::function<void(Connection& conn)> onResponse;
 
-            // Active client-server connections protected by recursive mutex
+            // Outbound bytes connections may queue. Connections over the budget stop reading
+            // requests until the client takes enough of their responses. Within the budget
+            // requests are also read while a response is sent: onRequest appends to response_buffer.
+            SendBudget send_budget;
+
+            // Custom callbacks when a connection stops and resumes reading for its send budget
+            std::function<void(Connection& conn)> onWritePaused;
+            std::function<void(Connection& conn)> onWriteResumed;
+
+            // Custom callback when UDP server receives a batch of datagrams. Replaces onRequest:
+            // replies queued to the batch are sent together once the callback returns.
+            std::function<void(DatagramBatch& batch)> onDatagrams;
+            size_t datagram_batch_size{ DatagramBatch::DefaultBatchSize };  // Datagrams per system call
+            size_t datagram_size{ DatagramBatch::MaxDatagramSize };  // Longer datagrams are dropped
+            bool datagram_gro{ false };  // Receive datagrams coalesced by the kernel (UDP_GRO)
+            bool datagram_gso{ false };  // Send equal-sized replies to one client as one write (UDP_SEGMENT)
+
+            // Datagram sockets, one per reactor with reuse_port
+            std::vector<std::unique_ptr<DatagramWorker>> datagram_workers;
+
+            // Active client-server connections protected by recursive mutex. The lock only
+            // guards the table: reactors find connections in socket context, see FindConnection.
+            // Entries don't move while the connection is open.
             std::recursive_mutex connections_mutex;
-            std::map<Socket, Connection> connections;
+            ConnectionTable<Connection> connections;
 
             // Macro to safely obtain TEMPORARY string buffer pointer
 #define CLID(conn) conn.client.toString().c_str()
@@ -80,13 +178,16 @@ namespace net
              * @brief Route to start TCP, UDP or Unix Domain socket server.
              * @param addr Address or Unix domain socket name to bind to.
              * @param sock Socket type.
-             * @param numConnections Maximum number of connections.
+             * @param numConnections Listen backlog: connections waiting to be accepted, up to SOMAXCONN.
+             * @param numWorkers Number of reactor threads, 0 - one per hardware thread. Datagram
+             * sockets only use more than one where SO_REUSEPORT is balanced, see ReactorPool.
              */
-            SocketServer(SocketAddr addr, SocketParams params, int numConnections = 10)
-                : bind_address(addr), server_socket_params(params), reactor(*this)
+            SocketServer(SocketAddr addr, SocketParams params, int numConnections = Socket::MaxBacklog,
+                size_t numWorkers = 1)
+                : bind_address(addr),
+                server_socket_params(params),
+                reactors(*this, ((params.type == SOCK_STREAM) || ReactorPool::HasReusePort) ? numWorkers : 1)
             {
-                server_socket = Socket(server_socket_params);
-
                 // Default lambda here implements an echo server
                 onRequest = [this](Connection& conn) {
                     conn.state.insert(SocketServer::Connection::Responding);
@@ -96,75 +197,256 @@ namespace net
                     // Empty response
                 };
 
-                int rc = server_socket.bind(bind_address);
-                if (rc != 0)
+                // With more than one reactor each of them listens on its own SO_REUSEPORT
+                // socket, so that the kernel spreads incoming connections (or datagrams
+                // by their source address) across threads.
+                // Unix domain sockets and platforms without SO_REUSEPORT balancing use one
+                // listening socket and distribute accepted connections round-robin.
+                reuse_port = (reactors.size() > 1) && ReactorPool::HasReusePort && !bind_address.isUnixDomain;
+                size_t numListeners = reuse_port ? reactors.size() : 1;
+                for (size_t i = 0; i < numListeners; i++)
                 {
-                    LOG_ERROR("Server: bind failed! result=%d", rc);
-                    return;
+                    Socket socket(server_socket_params);
+                    if (server_socket_params.type == SOCK_STREAM)
+                    {
+                        // Connections of a stopped server linger in TIME_WAIT
+                        socket.setReuseAddr();
+                    }
+                    if (reuse_port)
+                    {
+                        socket.setReusePort();
+                    }
+
+                    int rc = socket.bind(bind_address);
+                    if (rc != 0)
+                    {
+                        LOG_ERROR("Server: bind failed! result=%d", rc);
+                        socket.close();
+                        return;
+                    }
+
+                    if (i == 0)
+                    {
+                        server_socket = socket;
+                        is_bound = true;
+                        LOG_INFO("Server: bind successful. result=%d", rc);
+                        // Resolve ephemeral port, so that other listeners share it.
+                        server_socket.getsockname(bind_address);
+                    }
+
+                    if (server_socket_params.type == SOCK_STREAM)
+                    {
+                        // In TCP and Unix Domain mode we listen and the reactor accepts.
+                        // Non-blocking, so that edge-triggered reactor may drain the backlog.
+                        socket.setNonBlocking();
+                        socket.listen(static_cast<size_t>(numConnections));
+                        listening_sockets.push_back(socket);
+                        reactors[i].addSocket(socket, Reactor::Accepted);
+                    }
+                    else
+                    {
+                        // In UDP mode we read in a loop, no need to accept.
+                        datagram_workers.emplace_back(new DatagramWorker());
+                        DatagramWorker& worker = *datagram_workers.back();
+                        worker.socket = socket;
+                        worker.conn.socket = socket;
+                        worker.conn.reactor = &reactors[i];
+                        reactors[i].addSocket(socket, Reactor::Readable, &worker);
+                    }
                 }
 
-                is_bound = true;
-                LOG_INFO("Server: bind successful. result=%d", rc);
-                server_socket.getsockname(bind_address);
-                if (server_socket_params.type == SOCK_STREAM)
+                LOG_INFO("Server: Listening on %s://%s", server_socket_params.scheme(),
+                    bind_address.toString().c_str());
+            }
+
+            /**
+             * @brief Start server. Applies defer_accept and fast_open to the TCP listeners.
+             */
+            void Start()
+            {
+                bool tcp = (server_socket_params.type == SOCK_STREAM) && !bind_address.isUnixDomain;
+                for (auto& socket : listening_sockets)
                 {
-                    // In TCP and Unix Domain mode we listen and accept.
-                    reactor.addSocket(server_socket, Reactor::Acceptable);
-                    server_socket.listen(numConnections);
+                    if (tcp && (defer_accept > 0) && !socket.setDeferAccept(defer_accept))
+                    {
+                        LOG_WARN("Server: TCP_DEFER_ACCEPT is not supported");
+                    }
+                    if (tcp && (fast_open > 0) && !socket.setFastOpen(fast_open))
+                    {
+                        LOG_WARN("Server: TCP_FASTOPEN is not supported");
+                    }
                 }
-                else
+                if (cpu_affinity)
                 {
-                    // In UDP mode we read in a loop, no need to accept.
-                    reactor.addSocket(server_socket, Reactor::Readable);
+                    if (!reactors.setCpuAffinity(true))
+                    {
+                        LOG_WARN("Server: CPU affinity is not supported");
+                    }
+                    for (size_t i = 0; i < datagram_workers.size(); i++)
+                    {
+                        datagram_workers[i]->socket.setIncomingCpu(ReactorPool::cpuOf(i));
+                    }
                 }
-
-                LOG_INFO("Server: Listening on %s://%s", server_socket_params.scheme(),
-                    bind_address.toString().c_str());
+                reactors.start();
             }
 
             /**
-             * @brief Start server.
+             * @brief Stop server. Closes the listening sockets and the connections, so that
+             * the address may be bound again.
              */
-            void Start() { reactor.start(); }
+            void Stop()
+            {
+                reactors.stop();
+                // Reactors are joined, nothing uses the sockets anymore
+                for (auto& socket : listening_sockets)
+                {
+                    socket.close();
+                }
+                listening_sockets.clear();
+                LOCKGUARD(connections_mutex);
+                std::vector<Socket> sockets;
+                connections.forEach([&sockets](Socket socket, Connection&) { sockets.push_back(socket); });
+                for (Socket socket : sockets)
+                {
+                    // Drops the TLS session first, it may still send close_notify
+                    connections.erase(socket);
+                    socket.close();
+                }
+            }
 
             /**
-             * @brief Stop server.
+             * @brief Find connection of a client socket.
+             * Reactor threads get it from the socket context without locking connections.
+             * @param socket Client socket.
+             * @return Connection or nullptr for listening and datagram sockets.
              */
-            void Stop() { reactor.stop(); }
+            Connection* FindConnection(Socket socket)
+            {
+                if (server_socket_params.type != SOCK_STREAM)
+                {
+                    return nullptr;
+                }
+                Reactor* reactor = Reactor::current();
+                if (reactor != nullptr)
+                {
+                    return static_cast<Connection*>(reactor->context(socket));
+                }
+                LOCKGUARD(connections_mutex);
+                return connections.find(socket);
+            }
 
             /**
              * @brief Handle Reactor::State::Acceptable event.
-             * @param socket Client socket.
+             * Listening sockets are registered as Reactor::Accepted, see onSocketAccepted.
+             * @param socket Listening socket.
              */
             virtual void onSocketAcceptable(Socket socket) override
             {
-                LOG_TRACE("Server: accepting socket fd=0x%llx", socket.m_sock);
+                LOG_TRACE("Server: unexpected acceptable socket fd=0x%x", static_cast<int>(socket.m_sock));
+                (void)socket;
+            }
 
-                Socket csocket;
+            /**
+             * @brief Handle Reactor::State::Accepted event: connection accepted by the reactor.
+             * @param socket Listening socket.
+             * @param csocket Client socket.
+             */
+            virtual void onSocketAccepted(Socket socket, Socket csocket) override
+            {
+                LOG_TRACE("Server: accepted on socket fd=0x%x", static_cast<int>(socket.m_sock));
+                (void)socket;
                 SocketAddr caddr;
-                if (socket.accept(csocket, caddr))
-                {
+                csocket.getpeername(caddr);
 #ifdef HAVE_UNIX_DOMAIN
-                    // If server is Unix domain, then the client socket is also Unix domain
-                    if (bind_address.isUnixDomain)
-                    {
-                        caddr.isUnixDomain = bind_address.isUnixDomain;
-                        // Sometimes AF_UNIX does not auto-populate
-                        // the bind address on accept. Thus, copy.
-                        std::copy(std::begin(bind_address.m_data_un.sun_path),
-                            std::end(bind_address.m_data_un.sun_path), std::begin(caddr.m_data_un.sun_path));
-                    };
+                // If server is Unix domain, then the client socket is also Unix domain
+                if (bind_address.isUnixDomain)
+                {
+                    caddr.isUnixDomain = bind_address.isUnixDomain;
+                    // Sometimes AF_UNIX does not auto-populate
+                    // the bind address on accept. Thus, copy.
+                    std::copy(std::begin(bind_address.m_data_un.sun_path),
+                        std::end(bind_address.m_data_un.sun_path), std::begin(caddr.m_data_un.sun_path));
+                };
 #endif
 
+                // Sharded listener keeps the connection on the accepting reactor.
+                Reactor* target = Reactor::current();
+                if (!reuse_port || (target == nullptr))
+                {
+                    target = &reactors.next();
+                }
+
+                std::unique_ptr<TlsSession> tls;
+                if (tls_context)
+                {
+                    tls = tls_context->accept(csocket);
+                    if (!tls)
+                    {
+                        csocket.close();
+                        return;
+                    }
+                }
+
+                Connection* conn_ptr;
+                {
                     LOCKGUARD(connections_mutex);
-                    csocket.setNonBlocking();
-                    Connection& conn = connections[csocket];
-                    conn.socket = csocket;
-                    conn.state = { Connection::Idle };
-                    conn.client = caddr;
-                    reactor.addSocket(csocket, Reactor::Readable | Reactor::Closed);
-                    LOG_TRACE("Server: [%s] accepted", CLID(conn));
+                    conn_ptr = &connections.insert(csocket);
+                }
+                Connection& conn = *conn_ptr;
+                conn.socket = csocket;
+                conn.state = { Connection::Idle };
+                conn.client = caddr;
+                conn.reactor = target;
+                conn.tls = std::move(tls);
+                // Completion-based reactor keeps receiving for the lifetime of the connection,
+                // TLS connections wait for the ClientHello
+                target->addSocket(csocket,
+                    CompletionBased(conn) ? Reactor::Received : (Reactor::Readable | Reactor::Closed), &conn);
+                LOG_TRACE("Server: [%s] accepted", CLID(conn));
+                // Timers belong to the reactor thread
+                if (target == Reactor::current())
+                {
+                    RestartIdleTimer(conn);
+                }
+                else if ((idle_timeout.count() > 0) && target->canExecute())
+                {
+                    target->execute([this, csocket, conn_ptr]() {
+                        if (FindConnection(csocket) == conn_ptr)
+                        {
+                            RestartIdleTimer(*conn_ptr);
+                        }
+                    });
+                }
+            }
+
+            /**
+             * @brief Handle Reactor::State::Received event: data received by completion-based reactor.
+             * @param socket Client socket.
+             * @param data Received data.
+             * @param size Size of data, 0 - end of stream.
+             */
+            virtual void onSocketReceived(Socket socket, char const* data, size_t size) override
+            {
+                Connection* conn_ptr = FindConnection(socket);
+                if (conn_ptr == nullptr)
+                {
+                    return;
+                }
+                Connection& conn_tcp = *conn_ptr;
+                // Reactor buffer is only valid during the call
+                conn_tcp.request_data = std::string_view(data, size);
+                if (size > 0)
+                {
+                    LOG_TRACE("Server: [%s] stream received %zu bytes", CLID(conn_tcp), size);
+                    conn_tcp.state.insert(Connection::Receiving);
+                }
+                else
+                {
+                    conn_tcp.state.insert(Connection::Closing);
                 }
+                onRequest(conn_tcp);
+                conn_tcp.request_data = {};
+                HandleConnection(conn_tcp);
             }
 
             /**
@@ -174,30 +456,92 @@ namespace net
             virtual void onSocketReadable(Socket socket) override
             {
                 LOG_TRACE("Server: reading socket fd=0x%x", static_cast<int>(socket.m_sock));
-                int size = 0;
-                decltype(connections)::iterator it;
-                {
-                    LOCKGUARD(connections_mutex);
-                    it = connections.find(socket);
-                }
-                if (it != connections.end())
+                Connection* conn_ptr = FindConnection(socket);
+                if (conn_ptr != nullptr)
                 {
                     // TCP or Unix domain connection.
-                    Connection& conn_tcp = it->second;
-                    ReadStreamBuffer(conn_tcp);
-                    onRequest(conn_tcp);
-                    HandleConnection(conn_tcp);
+                    Connection& conn_tcp = *conn_ptr;
+                    if (conn_tcp.tls && !conn_tcp.tls->established() && !ContinueHandshake(conn_tcp))
+                    {
+                        return;
+                    }
+                    for (;;)
+                    {
+                        ReadStreamBuffer(conn_tcp);
+                        if (conn_tcp.request_data.empty() && !conn_tcp.state.count(Connection::Closing))
+                        {
+                            // Spurious wakeup, nothing to read yet
+                            conn_tcp.receive_chunk.reset();
+                            return;
+                        }
+                        // Edge-triggered reactor or TLS: full buffer, more data may be waiting
+                        bool more = (conn_tcp.reactor->isEdgeTriggered() || conn_tcp.tls) &&
+                            (conn_tcp.request_data.size() == conn_tcp.receive_chunk.size());
+                        onRequest(conn_tcp);
+                        conn_tcp.request_data = {};
+                        conn_tcp.receive_chunk.reset();
+                        HandleConnection(conn_tcp);
+                        // Connection may have been closed while handling the request
+                        if (!more || (FindConnection(socket) != &conn_tcp))
+                        {
+                            return;
+                        }
+                    }
                 }
-                else
+                else if (server_socket_params.type != SOCK_STREAM)
                 {
-                    // UDP datagram connection.
+                    // UDP datagram of the socket owned by this reactor thread.
+                    DatagramWorker* worker = static_cast<DatagramWorker*>(Reactor::current()->context(socket));
+                    if (worker == nullptr)
+                    {
+                        return;
+                    }
+                    if (onDatagrams)
+                    {
+                        HandleDatagrams(*worker);
+                        return;
+                    }
                     // Read the contents in one shot.
-                    Connection conn_udp;
-                    conn_udp.socket = socket;
+                    Connection& conn_udp = worker->conn;
                     conn_udp.state = { Connection::Receiving };
+                    conn_udp.response_buffer.clear();
                     ReadDatagramBuffer(conn_udp);
                     onRequest(conn_udp);
                     HandleConnection(conn_udp);
+                    conn_udp.request_data = {};
+                    conn_udp.receive_chunk.reset();
+                }
+            }
+
+            /**
+             * @brief Receive a batch of datagrams, pass it to onDatagrams and send the replies.
+             * @param worker Datagram socket owned by the calling reactor thread.
+             */
+            virtual void HandleDatagrams(DatagramWorker& worker)
+            {
+                Socket socket = worker.socket;
+                if (!worker.batch)
+                {
+                    bool gro = datagram_gro && socket.setUdpGro();
+                    if (datagram_gro && !gro)
+                    {
+                        LOG_WARN("Server: UDP_GRO is not supported");
+                    }
+                    // Coalesced datagrams take up to a whole receive buffer
+                    worker.batch.reset(new DatagramBatch(datagram_batch_size,
+                        gro ? DatagramBatch::MaxDatagramSize : datagram_size));
+                    worker.batch->setGso(datagram_gso);
+                }
+                DatagramBatch& batch = *worker.batch;
+                if (batch.receive(socket) <= 0)
+                {
+                    return;
+                }
+                LOG_TRACE("Server: datagram batch of %zu", batch.size());
+                onDatagrams(batch);
+                if (batch.pending() != 0)
+                {
+                    batch.send(socket);
                 }
             }
 
@@ -207,34 +551,58 @@ namespace net
              */
             virtual void onSocketWritable(Socket socket) override
             {
-                LOG_TRACE("Server: writing socket fd=0x%llx", socket.m_sock);
-                decltype(connections)::iterator it;
+                LOG_TRACE("Server: writing socket fd=0x%x", static_cast<int>(socket.m_sock));
+                Connection* conn_ptr = FindConnection(socket);
+                if (conn_ptr == nullptr)
                 {
-                    LOCKGUARD(connections_mutex);
-                    it = connections.find(socket);
-                    if (it == connections.end())
+                    LOG_ERROR("Server: socket not found in connections map!");
+                    return;
+                }
+                Connection& conn = *conn_ptr;
+                if (conn.tls && !conn.tls->established())
+                {
+                    // Requests may have arrived with the last flight of the handshake
+                    if (ContinueHandshake(conn))
                     {
-                        LOG_ERROR("Server: socket not found in connections map!");
-                        return;
+                        onSocketReadable(socket);
                     }
+                    return;
                 }
-                Connection& conn = it->second;
                 conn.state.insert(Connection::Responding);
                 HandleConnection(conn);
             }
 
+            /**
+             * @brief Handle send progress of completion-based reactor.
+             * @param socket Client socket.
+             * @param pending Bytes still queued in the reactor.
+             */
+            virtual void onSocketSent(Socket socket, size_t pending) override
+            {
+                (void)pending;
+                Connection* conn_ptr = FindConnection(socket);
+                if (conn_ptr != nullptr)
+                {
+                    UpdateSendBudget(*conn_ptr);
+                }
+            }
+
             /**
              * @brief Handle event when socket is closed.
              * @param socket
              */
             virtual void onSocketClosed(Socket socket) override
             {
-                LOG_TRACE("Server: closing socket fd=0x%llx", socket.m_sock);
-                LOCKGUARD(connections_mutex);
-                auto it = connections.find(socket);
-                if (it != connections.end())
+                LOG_TRACE("Server: closing socket fd=0x%x", static_cast<int>(socket.m_sock));
+                if (server_socket_params.type != SOCK_STREAM)
+                {
+                    // Datagram socket closed by Stop
+                    return;
+                }
+                Connection* conn_ptr = FindConnection(socket);
+                if (conn_ptr != nullptr)
                 {
-                    Connection& conn = it->second;
+                    Connection& conn = *conn_ptr;
                     conn.state.insert(Connection::Closing);
                     HandleConnection(conn);
                     return;
@@ -243,34 +611,64 @@ namespace net
             }
 
             /**
-             * @brief Read from TCP or Unix Domain connection into request_buffer.
-             * This function invokes `HandleConnection` to process the buffer.
+             * @brief Read from TCP or Unix Domain connection into a reactor buffer,
+             * viewed by request_data. The caller returns the buffer after onRequest.
+             *
+             * Level-triggered reactor reads once per event. Edge-triggered reactor and TLS
+             * drain the socket until EAGAIN or until the buffer is full: records decrypted ahead
+             * are buffered by the session and don't wake the reactor up. End of stream
+             * after some data marks the connection for closing once the data has been handled.
              *
              * @param conn_tcp Connection object.
              */
             virtual void ReadStreamBuffer(Connection& conn_tcp)
             {
-                conn_tcp.request_buffer.clear();
-                conn_tcp.request_buffer.resize(4096, 0);
-                size_t size = conn_tcp.socket.readall(conn_tcp.request_buffer);
+                bool drain = conn_tcp.reactor->isEdgeTriggered() || conn_tcp.tls;
+                bool closed = false;
+                size_t size = 0;
+                if (!conn_tcp.receive_chunk)
+                {
+                    conn_tcp.receive_chunk = conn_tcp.reactor->buffers().acquire();
+                }
+                char* buffer = conn_tcp.receive_chunk.data();
+                size_t capacity = conn_tcp.receive_chunk.size();
+                while (size < capacity)
+                {
+                    int received = conn_tcp.tls ? conn_tcp.tls->read(buffer + size, capacity - size)
+                                                : conn_tcp.socket.recv(buffer + size, capacity - size);
+                    if (received <= 0)
+                    {
+                        bool blocked = conn_tcp.tls ? conn_tcp.tls->wouldBlock()
+                                                    : (conn_tcp.socket.error() == Socket::ErrorWouldBlock);
+                        closed = (received == 0) || !blocked;
+                        break;
+                    }
+                    size += received;
+                    if (!drain)
+                    {
+                        break;
+                    }
+                }
+                conn_tcp.request_data = std::string_view(buffer, size);
+
                 if (size > 0)
                 {
                     LOG_TRACE("Server: [%s] stream read %zu bytes", CLID(conn_tcp), size);
-                    conn_tcp.request_buffer.resize(size);
-                    // Handle connection: process request_buffer
+                    // Handle connection: process request_data
                     conn_tcp.state.insert(Connection::Receiving);
                 }
-                else
+                if (closed)
                 {
-                    conn_tcp.request_buffer.resize(0);
-                    LOG_ERROR("Server: [%s] failed to read client stream, errno=%d", CLID(conn_tcp), errno);
+                    if (size == 0)
+                    {
+                        LOG_ERROR("Server: [%s] failed to read client stream, errno=%d", CLID(conn_tcp), errno);
+                    }
                     conn_tcp.state.insert(Connection::Closing);
                 }
             }
 
             /**
-             * @brief Read from UDP connection into request_buffer.
-             * This function invokes `HandleConnection` to process the buffer.
+             * @brief Read from UDP connection into a reactor buffer, viewed by request_data.
              *
              * @param conn_udp
              */
@@ -278,19 +676,19 @@ namespace net
             {
                 // Maximum size is 0xffff - (sizeof(IP Header) + sizeof(UDP Header)).
                 // Try to read the entire datagram.
-                conn_udp.request_buffer.resize(0xffff);
-                int size = conn_udp.socket.recvfrom((void*)(conn_udp.request_buffer.data()), 0xffff, 0,
-                    conn_udp.client);
+                conn_udp.receive_chunk = conn_udp.reactor->buffers().acquire();
+                int size = conn_udp.socket.recvfrom(conn_udp.receive_chunk.data(),
+                    std::min<size_t>(conn_udp.receive_chunk.size(), 0xffff), 0, conn_udp.client);
                 if (size > 0)
                 {
-                    LOG_ERROR("Server: [%s] datagram read %d bytes", CLID(conn_udp), size);
-                    conn_udp.request_buffer.resize(size);
-                    // Handle connection: process request_buffer
+                    LOG_TRACE("Server: [%s] datagram read %d bytes", CLID(conn_udp), size);
+                    conn_udp.request_data = std::string_view(conn_udp.receive_chunk.data(), size);
+                    // Handle connection: process request_data
                     conn_udp.state.insert(Connection::Receiving);
                 }
                 else
                 {
-                    conn_udp.request_buffer.resize(0);
+                    conn_udp.request_data = {};
                     LOG_ERROR("Server: [%s] failed to read client datagram", CLID(conn_udp));
                 }
             }
@@ -313,12 +711,9 @@ namespace net
                 }
 
                 size_t total_bytes_sent = 0;
-                uint32_t optval = 0;
-
-                conn.socket.getsockopt(SOL_SOCKET, SO_TYPE, optval);
 
                 // Handle UDP response
-                if (optval == SOCK_DGRAM)
+                if (server_socket_params.type == SOCK_DGRAM)
                 {
                     total_bytes_sent =
                         conn.socket.sendto(conn.response_buffer.data(),
@@ -328,16 +723,32 @@ namespace net
                 }
 
                 // Handle TCP and Unix Domain response
-                reactor.addSocket(conn.socket, Reactor::Writable);
-                total_bytes_sent = conn.socket.writeall(conn.response_buffer);
-                if (conn.response_buffer.size() != total_bytes_sent)
+                if (CompletionBased(conn))
                 {
-                    conn.response_buffer.erase(0, total_bytes_sent);
+                    // Reactor sends in the background
+                    conn.response_buffer.erase(0, conn.response_offset);
+                    conn.response_offset = 0;
+                    conn.reactor->send(conn.socket, std::move(conn.response_buffer));
+                    conn.response_buffer.clear();
+                    conn.state.erase(Connection::Responding);
+                    conn.state.insert(Connection::Idle);
+                    return false;
+                }
+                conn.reactor->addSocket(conn.socket, Reactor::Writable);
+                // Partial writes move the offset, the buffer is not shifted
+                std::string_view pending(conn.response_buffer);
+                pending.remove_prefix(std::min(conn.response_offset, pending.size()));
+                total_bytes_sent = conn.tls ? conn.tls->writeall(pending) : conn.socket.writeall(pending);
+                if (pending.size() != total_bytes_sent)
+                {
+                    conn.response_offset += total_bytes_sent;
                     LOG_WARN("Server: [%s] response blocked, total sent %zu bytes", CLID(conn), total_bytes_sent);
                     // Need to send more
                     conn.state.insert(Connection::Responding);
                     return true;
                 }
+                conn.response_offset = 0;
+                conn.response_buffer.clear();
 
                 // Done sending
                 conn.state.erase(Connection::Responding);
@@ -361,16 +772,29 @@ namespace net
 
                 // reactor.addSocket(conn.socket, SocketTools::Reactor::Closed);
 
-                reactor.removeSocket(conn.socket);
+                if (conn.idle_timer != 0)
+                {
+                    conn.reactor->cancelTimer(conn.idle_timer);
+                    conn.idle_timer = 0;
+                }
+                if (conn.send_accounted != 0)
+                {
+                    send_budget.update(conn.send_accounted, 0, false);
+                }
+                conn.write_paused = false;
+                conn.reactor->removeSocket(conn.socket);
+                // Locked until the entry is erased: the descriptor may be reused once closed
                 LOCKGUARD(connections_mutex);
-                auto it = connections.find(conn.socket);
+                Socket socket = conn.socket;
+                bool owned = (connections.find(socket) == &conn);
                 conn.socket.close();
+                conn.tls.reset();
                 conn.state.clear();
                 conn.state.insert(Connection::Closed);
                 LOG_TRACE("Server: [%s] connection closed.", CLID(conn));
-                if (it != connections.end())
+                if (owned)
                 {
-                    connections.erase(it);
+                    connections.erase(socket);
                 }
             }
 
@@ -382,10 +806,148 @@ namespace net
             void CloseConnection(Connection& conn)
             {
                 LOG_TRACE("Server: [%s] closing connection...", CLID(conn));
+                if (conn.tls)
+                {
+                    conn.tls->shutdown();
+                }
                 conn.socket.shutdown(Socket::ShutdownSend);
                 onConnectionClosed(conn);
             }
 
+            /**
+             * @brief Restart idle_timeout of the connection, it is closed once the timeout
+             * expires without another event. Must be called by the reactor that owns it.
+             * @param conn TCP or Unix domain connection.
+             */
+            void RestartIdleTimer(Connection& conn)
+            {
+                if ((idle_timeout.count() <= 0) || (conn.reactor != Reactor::current()) ||
+                    (server_socket_params.type != SOCK_STREAM))
+                {
+                    return;
+                }
+                if (conn.idle_timer != 0)
+                {
+                    conn.reactor->cancelTimer(conn.idle_timer);
+                }
+                conn.idle_timer = conn.reactor->addTimer(idle_timeout, [this, &conn]() {
+                    LOG_WARN("Server: [%s] idle timeout", CLID(conn));
+                    conn.idle_timer = 0;
+                    conn.state = { Connection::Closing };
+                    onConnectionClosed(conn);
+                });
+            }
+
+            /**
+             * @brief Account unsent bytes of the connection in send_budget, pause or resume
+             * reading requests when it crosses the watermarks. Readiness-based reactor keeps
+             * a paused connection waiting for Writable only, see HandleConnection.
+             * @param conn TCP or Unix domain connection.
+             */
+            void UpdateSendBudget(Connection& conn)
+            {
+                if (!send_budget.enabled() || (server_socket_params.type != SOCK_STREAM))
+                {
+                    return;
+                }
+                bool completion = CompletionBased(conn);
+                size_t pending = 0;
+                if (completion)
+                {
+                    pending = conn.reactor->pendingSend(conn.socket);
+                }
+                else if (conn.state.count(Connection::Responding))
+                {
+                    pending = conn.response_buffer.size() - std::min(conn.response_offset, conn.response_buffer.size());
+                }
+                bool paused = send_budget.update(conn.send_accounted, pending, conn.write_paused);
+                if (paused == conn.write_paused)
+                {
+                    return;
+                }
+                conn.write_paused = paused;
+                if (completion)
+                {
+                    // Reactor keeps sending what is queued
+                    conn.reactor->addSocket(conn.socket, paused ? Reactor::Closed : Reactor::Received);
+                }
+                if (paused)
+                {
+                    LOG_TRACE("Server: [%s] write paused, %zu bytes pending", CLID(conn), pending);
+                    if (onWritePaused)
+                    {
+                        onWritePaused(conn);
+                    }
+                }
+                else
+                {
+                    LOG_TRACE("Server: [%s] write resumed, %zu bytes pending", CLID(conn), pending);
+                    if (onWriteResumed)
+                    {
+                        onWriteResumed(conn);
+                    }
+                }
+            }
+
+            /**
+             * @brief Whether the reactor receives and sends for the connection. TLS connections
+             * are driven by readiness on every backend: their records go through the session.
+             * @param conn
+             */
+            static bool CompletionBased(Connection const& conn)
+            {
+                return conn.reactor->isCompletionBased() && !conn.tls;
+            }
+
+            /**
+             * @brief Continue the TLS handshake and wait for the socket event it needs.
+             * Failed handshakes close the connection.
+             * @param conn TCP or Unix domain connection.
+             * @return true once the connection is established.
+             */
+            bool ContinueHandshake(Connection& conn)
+            {
+                bool writing = conn.tls->wantsWrite();
+                TlsSession::Status status = conn.tls->handshake();
+                if (status == TlsSession::Ok)
+                {
+                    if (writing)
+                    {
+                        conn.reactor->addSocket(conn.socket, Reactor::Readable | Reactor::Closed);
+                    }
+                    return true;
+                }
+                if (conn.tls->wouldBlock())
+                {
+                    if (writing != conn.tls->wantsWrite())
+                    {
+                        conn.reactor->addSocket(conn.socket,
+                            (conn.tls->wantsWrite() ? Reactor::Writable : Reactor::Readable) | Reactor::Closed);
+                    }
+                    // The idle timeout also bounds the handshake
+                    RestartIdleTimer(conn);
+                    return false;
+                }
+                LOG_WARN("Server: [%s] TLS handshake failed", CLID(conn));
+                conn.state = { Connection::Closing };
+                onConnectionClosed(conn);
+                return false;
+            }
+
+            /**
+             * @brief Update readiness events of the connection socket. Completion-based
+             * reactor keeps receiving and sends without waiting for readiness.
+             * @param conn
+             * @param flags Reactor::State flags.
+             */
+            void ArmConnection(Connection& conn, int flags)
+            {
+                if (!CompletionBased(conn))
+                {
+                    conn.reactor->addSocket(conn.socket, flags);
+                }
+            }
+
             /**
              * @brief Handle connection state update.
              *
@@ -403,17 +965,25 @@ namespace net
 
                 if (conn.state.count(Connection::Responding))
                 {
-                    reactor.addSocket(conn.socket, Reactor::Writable | Reactor::Closed);
+                    ArmConnection(conn, Reactor::Writable | Reactor::Closed);
                     // Got data to send back
                     LOG_TRACE("Server: [%s] responding...", CLID(conn));
                     // If WriteResponseBuffer returns true, then more data to send.
-                    if (WriteResponseBuffer(conn))
+                    bool more = WriteResponseBuffer(conn);
+                    UpdateSendBudget(conn);
+                    if (more)
                     {
+                        if (send_budget.enabled() && !conn.write_paused)
+                        {
+                            // Within the budget the next requests are read meanwhile
+                            ArmConnection(conn, Reactor::Readable | Reactor::Writable | Reactor::Closed);
+                        }
+                        RestartIdleTimer(conn);
                         return;
                     }
                     // No more data to send. Stop responding.
                     conn.state.erase(Connection::Responding);
-                    reactor.addSocket(conn.socket, Reactor::Readable | Reactor::Closed);
+                    ArmConnection(conn, Reactor::Readable | Reactor::Closed);
                 }
 
                 if (conn.state.count(Connection::Closing))
@@ -426,8 +996,9 @@ namespace net
                 if (conn.keepalive)
                 {
                     LOG_TRACE("Server: [%s] idle (keep-alive)", CLID(conn));
-                    reactor.addSocket(conn.socket, Reactor::Readable | Reactor::Closed);
+                    ArmConnection(conn, Reactor::Readable | Reactor::Closed);
                     conn.state.insert(Connection::Idle);
+                    RestartIdleTimer(conn);
                 }
             }
         };
@@ -7,13 +7,17 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _MSC_VER
@@ -37,6 +41,7 @@
 #  include <WS2tcpip.h>
 #  include <WinSock2.h>
 #  include <Windows.h>
+#  include <MSWSock.h>
 
 #  ifdef min
 // NOMINMAX may be a better choice. However, defining it globally
@@ -48,6 +53,8 @@
 
 // This code requires WinSock2 on Windows.
 #  pragma comment(lib, "ws2_32.lib")
+// TransmitFile
+#  pragma comment(lib, "mswsock.lib")
 // Workaround for libcurl redefinition of afunix.h struct :
 // https://github.com/curl/curl/blob/7645324072c2f052fa662aded6f26821141ecda1/lib/config-win32.h#L721
 // Unfortunately libcurl defines a structure that should otherwise be normally defined by afunix.h .
@@ -68,6 +75,22 @@
 
 #  ifdef __linux__
 #    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <sys/sendfile.h>
+#    include <netinet/udp.h>
+#    include <pthread.h>
+#    include <sched.h>
+#    include <signal.h>
+#    ifndef SO_INCOMING_CPU
+#      define SO_INCOMING_CPU 49
+#    endif
+// UDP generic segmentation and receive offload, Linux 4.18+ and 5.0+
+#    ifndef UDP_SEGMENT
+#      define UDP_SEGMENT 103
+#    endif
+#    ifndef UDP_GRO
+#      define UDP_GRO 104
+#    endif
 #  endif
 
 #  if __APPLE__
@@ -85,10 +108,17 @@
 #  include <netinet/in.h>
 #  include <netinet/tcp.h>
 #  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/uio.h>
 #  include <sys/un.h>
 
 #endif
 
+#include "./buffer_pool.h"
+#include "./io_uring.h"
+#include "./metrics.h"
+#include "./timer_wheel.h"
+
 #if !defined(_MSC_VER) && !defined(__STDC_LIB_EXT1__)
 #  ifndef strncpy_s
 #    define strncpy_s(dest, destsz, src, count) \
@@ -470,6 +500,21 @@ namespace net
 #endif
             }
 
+            /// <summary>
+            /// Fail writes to a reset connection with EPIPE instead of raising SIGPIPE, where
+            /// sends can't pass MSG_NOSIGNAL (SO_NOSIGPIPE on Mac and BSD).
+            /// </summary>
+            /// <returns>false if not supported</returns>
+            bool setNoSigPipe()
+            {
+#ifdef SO_NOSIGPIPE
+                int value = 1;
+                return (::setsockopt(m_sock, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value)) == 0);
+#else
+                return false;
+#endif
+            }
+
             bool setReuseAddr()
             {
                 assert(m_sock != Invalid);
@@ -482,6 +527,48 @@ namespace net
                     sizeof(value)) == 0);
             }
 
+            bool setReusePort()
+            {
+                assert(m_sock != Invalid);
+#ifdef SO_REUSEPORT
+                int value = 1;
+                return (::setsockopt(m_sock, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<char*>(&value),
+                    sizeof(value)) == 0);
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Let the kernel hand over consecutive datagrams of one sender coalesced into
+            /// one buffer, see DatagramBatch. Only supported by UDP sockets on Linux.
+            /// </summary>
+            bool setUdpGro()
+            {
+                assert(m_sock != Invalid);
+#ifdef __linux__
+                int value = 1;
+                return (::setsockopt(m_sock, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0);
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Hint that the socket is served by a thread running on the CPU. Among SO_REUSEPORT
+            /// sockets Linux prefers the one whose CPU handles the incoming packet.
+            /// </summary>
+            bool setIncomingCpu(int cpu)
+            {
+                assert(m_sock != Invalid);
+#ifdef __linux__
+                return (::setsockopt(m_sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0);
+#else
+                (void)cpu;
+                return false;
+#endif
+            }
+
             bool setNoDelay()
             {
                 assert(m_sock != Invalid);
@@ -500,6 +587,40 @@ namespace net
                 return (::connect(m_sock, (const sockaddr*)addr, addr.size()) == 0);
             }
 
+            /// <summary>
+            /// Start connecting a non-blocking socket. The socket becomes writable once the connect
+            /// completes, successfully or not: then connectError() tells which.
+            /// </summary>
+            /// <returns>false if the connect failed right away</returns>
+            bool connectNonBlocking(SocketAddr const& addr)
+            {
+                assert(m_sock != Invalid);
+                if (::connect(m_sock, (const sockaddr*)addr, addr.size()) == 0)
+                {
+                    return true;
+                }
+#ifdef _WIN32
+                return (error() == WSAEWOULDBLOCK);
+#else
+                // Interrupted connect goes on asynchronously as well
+                return (error() == EINPROGRESS) || (error() == EINTR);
+#endif
+            }
+
+            /// <summary>
+            /// Pending error of the socket (SO_ERROR), cleared by the call.
+            /// </summary>
+            /// <returns>0 once a non-blocking connect succeeded</returns>
+            int connectError()
+            {
+                int value = 0;
+                if (getsockopt(SOL_SOCKET, SO_ERROR, value) != 0)
+                {
+                    return error();
+                }
+                return value;
+            }
+
             void close()
             {
 #ifdef _WIN32
@@ -595,12 +716,215 @@ namespace net
                 return total_bytes_sent;
             }
 
-            int send(void const* buffer, size_t size)
+            // Sends to a peer that reset the connection fail with EPIPE instead of raising SIGPIPE.
+            // Mac has no MSG_NOSIGNAL, accepted sockets are set SO_NOSIGPIPE instead.
+#ifdef MSG_NOSIGNAL
+            static constexpr int const NoSignal = MSG_NOSIGNAL;
+#else
+            static constexpr int const NoSignal = 0;
+#endif
+
+            int send(void const* buffer, size_t size, int flags = 0)
             {
                 assert(m_sock != Invalid);
                 if ((m_sock == Invalid) || (buffer == nullptr) || (size == 0))
                     return 0;
-                return static_cast<int>(::send(m_sock, reinterpret_cast<char const*>(buffer), size, 0));
+                return static_cast<int>(
+                    ::send(m_sock, reinterpret_cast<char const*>(buffer), size, flags | NoSignal));
+            }
+
+#ifdef _WIN32
+            using IoVec = WSABUF;
+#else
+            using IoVec = struct iovec;
+#endif
+
+            // Buffers passed to one sendv call, the same limit as IOV_MAX on Linux and Mac
+            static constexpr size_t const MaxIoVecs = 1024;
+
+            /// <summary>
+            /// Describe one buffer of a gather write.
+            /// </summary>
+            static IoVec ioVec(void const* data, size_t size)
+            {
+                IoVec vec;
+#ifdef _WIN32
+                vec.buf = reinterpret_cast<CHAR*>(const_cast<void*>(data));
+                vec.len = static_cast<ULONG>(size);
+#else
+                vec.iov_base = const_cast<void*>(data);
+                vec.iov_len = size;
+#endif
+                return vec;
+            }
+
+            /// <summary>
+            /// Size of one buffer of a gather write.
+            /// </summary>
+            static size_t ioVecSize(IoVec const& vec)
+            {
+#ifdef _WIN32
+                return vec.len;
+#else
+                return vec.iov_len;
+#endif
+            }
+
+            /// <summary>
+            /// Skip bytes of a gather write that have been sent: buffers sent completely are
+            /// dropped, the first buffer sent partially is advanced.
+            /// </summary>
+            /// <param name="vecs">Buffers, updated to point at the first buffer not sent</param>
+            /// <param name="count">Number of buffers</param>
+            /// <param name="bytes">Number of bytes sent</param>
+            /// <returns>Number of buffers left</returns>
+            static size_t advanceIoVec(IoVec*& vecs, size_t count, size_t bytes)
+            {
+                while (count > 0)
+                {
+                    size_t size = ioVecSize(*vecs);
+                    if (bytes < size)
+                    {
+#ifdef _WIN32
+                        vecs->buf += bytes;
+                        vecs->len -= static_cast<ULONG>(bytes);
+#else
+                        vecs->iov_base = static_cast<char*>(vecs->iov_base) + bytes;
+                        vecs->iov_len -= bytes;
+#endif
+                        break;
+                    }
+                    bytes -= size;
+                    vecs++;
+                    count--;
+                }
+                return count;
+            }
+
+            /// <summary>
+            /// Gather write: send several buffers with one system call, sendmsg or WSASend.
+            /// At most MaxIoVecs buffers are sent per call.
+            /// </summary>
+            /// <returns>Number of bytes sent or -1 on error</returns>
+            int sendv(IoVec const* vecs, size_t count, int flags = 0)
+            {
+                assert(m_sock != Invalid);
+                if ((m_sock == Invalid) || (vecs == nullptr) || (count == 0))
+                    return 0;
+                count = std::min(count, MaxIoVecs);
+#ifdef _WIN32
+                DWORD sent = 0;
+                if (::WSASend(m_sock, const_cast<LPWSABUF>(vecs), static_cast<DWORD>(count), &sent,
+                        static_cast<DWORD>(flags), NULL, NULL) != 0)
+                {
+                    return -1;
+                }
+                return static_cast<int>(sent);
+#else
+                struct msghdr msg = {};
+                msg.msg_iov = const_cast<struct iovec*>(vecs);
+                msg.msg_iovlen = count;
+                return static_cast<int>(::sendmsg(m_sock, &msg, flags | NoSignal));
+#endif
+            }
+
+            /// <summary>
+            /// Send all buffers, continuing after partial writes.
+            /// </summary>
+            /// <param name="vecs">Buffers, advanced past the bytes sent</param>
+            /// <param name="count">Number of buffers</param>
+            /// <returns>Total number of bytes sent</returns>
+            size_t writeallv(IoVec* vecs, size_t count)
+            {
+                size_t total_bytes_sent = 0;
+                while (count > 0)
+                {
+                    int bytes_sent = sendv(vecs, count);
+                    if (bytes_sent <= 0)
+                    {
+                        // send() error occurred or can't send anymore.
+                        break;
+                    }
+                    total_bytes_sent += bytes_sent;
+                    count = advanceIoVec(vecs, count, static_cast<size_t>(bytes_sent));
+                }
+                return total_bytes_sent;
+            }
+
+#ifdef _WIN32
+            using FileHandle = HANDLE;
+#else
+            using FileHandle = int;
+#endif
+
+            /// <summary>
+            /// Send part of a file without copying it to user space: sendfile on Linux and Mac,
+            /// TransmitFile on Windows. Non-blocking socket may send less than requested.
+            /// Linux sendfile can't take MSG_NOSIGNAL: the calling thread blocks SIGPIPE on its
+            /// first call, a reset connection fails with EPIPE instead of ending the process.
+            /// </summary>
+            /// <param name="file">Open file</param>
+            /// <param name="offset">File offset, advanced past the bytes sent</param>
+            /// <param name="count">Number of bytes to send</param>
+            /// <returns>Number of bytes sent, 0 at end of file, -1 on error</returns>
+            int64_t sendfile(FileHandle file, uint64_t& offset, size_t count)
+            {
+                assert(m_sock != Invalid);
+                if ((m_sock == Invalid) || (count == 0))
+                    return 0;
+#if defined(__linux__)
+                // SIGPIPE of sendfile goes to the calling thread, blocked it stays pending
+                static thread_local bool sigPipeBlocked = false;
+                sigset_t sigPipe;
+                sigemptyset(&sigPipe);
+                sigaddset(&sigPipe, SIGPIPE);
+                if (!sigPipeBlocked)
+                {
+                    pthread_sigmask(SIG_BLOCK, &sigPipe, nullptr);
+                    sigPipeBlocked = true;
+                }
+                off_t position = static_cast<off_t>(offset);
+                ssize_t sent = ::sendfile(m_sock, file, &position, count);
+                if (sent > 0)
+                {
+                    offset = static_cast<uint64_t>(position);
+                }
+                else if ((sent < 0) && (errno == EPIPE))
+                {
+                    // Discard the pending signal, so that unblocking it later doesn't deliver it
+                    struct timespec now = {};
+                    while (::sigtimedwait(&sigPipe, nullptr, &now) == SIGPIPE)
+                    {
+                    }
+                    errno = EPIPE;
+                }
+                return static_cast<int64_t>(sent);
+#elif defined(__APPLE__)
+                off_t length = static_cast<off_t>(count);
+                int rc = ::sendfile(file, m_sock, static_cast<off_t>(offset), &length, nullptr, 0);
+                if ((rc != 0) && !((errno == EAGAIN) && (length > 0)))
+                {
+                    return -1;
+                }
+                offset += static_cast<uint64_t>(length);
+                return static_cast<int64_t>(length);
+#elif defined(_WIN32)
+                // TransmitFile sends from the current file position, at most 2GB - 1 at a time
+                DWORD length = static_cast<DWORD>(std::min<size_t>(count, 0x7ffffffe));
+                LARGE_INTEGER position;
+                position.QuadPart = static_cast<LONGLONG>(offset);
+                if (!::SetFilePointerEx(file, position, NULL, FILE_BEGIN) ||
+                    !::TransmitFile(m_sock, file, length, 0, NULL, NULL, 0))
+                {
+                    return -1;
+                }
+                offset += length;
+                return static_cast<int64_t>(length);
+#else
+                (void)file;
+                (void)offset;
+                return -1;
+#endif
             }
 
             int sendto(void const* buffer, size_t size, int flags, SocketAddr& destAddr)
@@ -630,6 +954,17 @@ namespace net
                 return (::getsockname(m_sock, addr, &addrlen) == 0);
             }
 
+            bool getpeername(SocketAddr& addr) const
+            {
+                assert(m_sock != Invalid);
+#ifdef _WIN32
+                int addrlen = sizeof(addr);
+#else
+                socklen_t addrlen = sizeof(addr);
+#endif
+                return (::getpeername(m_sock, addr, &addrlen) == 0);
+            }
+
             template <typename T>
             int getsockopt(int level, int optname, T& optval)
             {
@@ -642,10 +977,18 @@ namespace net
 #endif
             }
 
+            // Longest queue of connections waiting to be accepted
+            static constexpr int const MaxBacklog = SOMAXCONN;
+
+            /// <summary>
+            /// Listen for connections. The kernel may cap the backlog further, e.g.
+            /// net.core.somaxconn on Linux.
+            /// </summary>
+            /// <param name="backlog">Connections waiting to be accepted, up to MaxBacklog</param>
             bool listen(size_t backlog)
             {
                 assert(m_sock != Invalid);
-                return (::listen(m_sock, backlog) == 0);
+                return (::listen(m_sock, static_cast<int>(std::min<size_t>(backlog, MaxBacklog))) == 0);
             }
 
             bool accept(Socket& csock, SocketAddr& caddr)
@@ -657,7 +1000,66 @@ namespace net
                 socklen_t addrlen = sizeof(caddr);
 #endif
                 csock = ::accept(m_sock, caddr, &addrlen);
+                if (csock.invalid())
+                {
+                    return false;
+                }
+                csock.setNoSigPipe();
+                return true;
+            }
+
+            /// <summary>
+            /// Accept a connection that is non-blocking and not inherited by child processes,
+            /// with a single accept4 call where it is available.
+            /// </summary>
+            bool acceptNonBlocking(Socket& csock, SocketAddr& caddr)
+            {
+#if defined(__linux__) || defined(__FreeBSD__)
+                assert(m_sock != Invalid);
+                socklen_t addrlen = sizeof(caddr);
+                csock = ::accept4(m_sock, caddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
                 return !csock.invalid();
+#else
+                if (!accept(csock, caddr))
+                {
+                    return false;
+                }
+                csock.setNonBlocking();
+                return true;
+#endif
+            }
+
+            /// <summary>
+            /// Defer accepting a connection until it has data (TCP_DEFER_ACCEPT), for protocols
+            /// where the client speaks first. Set on a listening socket.
+            /// </summary>
+            /// <param name="seconds">How long to wait for the data, then the connection is accepted anyway</param>
+            /// <returns>false if not supported</returns>
+            bool setDeferAccept(int seconds)
+            {
+#ifdef TCP_DEFER_ACCEPT
+                return (::setsockopt(m_sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) == 0);
+#else
+                (void)seconds;
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Accept data in the SYN of returning clients (TCP_FASTOPEN), saving a round trip.
+            /// Set on a listening socket.
+            /// </summary>
+            /// <param name="queueLength">Pending Fast Open requests, 1 enables it on Mac and Windows</param>
+            /// <returns>false if not supported</returns>
+            bool setFastOpen(int queueLength)
+            {
+#ifdef TCP_FASTOPEN
+                return (::setsockopt(m_sock, IPPROTO_TCP, TCP_FASTOPEN, reinterpret_cast<char*>(&queueLength),
+                            sizeof(queueLength)) == 0);
+#else
+                (void)queueLength;
+                return false;
+#endif
             }
 
             bool shutdown(int how)
@@ -678,9 +1080,13 @@ namespace net
             enum
             {
 #ifdef _WIN32
-                ErrorWouldBlock = WSAEWOULDBLOCK
+                ErrorWouldBlock = WSAEWOULDBLOCK,
+                ErrorNotConnected = WSAENOTCONN,
+                ErrorTimedOut = WSAETIMEDOUT
 #else
-                ErrorWouldBlock = EWOULDBLOCK
+                ErrorWouldBlock = EWOULDBLOCK,
+                ErrorNotConnected = ENOTCONN,
+                ErrorTimedOut = ETIMEDOUT
 #endif
             };
 
@@ -698,6 +1104,20 @@ namespace net
             };
         };
 
+        /// <summary>
+        /// One-shot listener of socket state, see Reactor::addWaiter.
+        /// </summary>
+        class SocketWaiter
+        {
+        public:
+            /// <summary>
+            /// Socket reached the awaited state. It is already removed from the reactor.
+            /// </summary>
+            /// <param name="socket"></param>
+            /// <param name="state">Reactor::State bits that are active</param>
+            virtual void onSocketReady(Socket socket, int state) = 0;
+        };
+
         /// <summary>
         /// Socket Data
         /// </summary>
@@ -705,63 +1125,325 @@ namespace net
         {
             Socket socket;
             int flags;
+            int ready;             // Edge-triggered mode: readiness latched while not armed
+            void* context;         // Owner's context attached with addSocket
+            SocketWaiter* waiter;  // Notified instead of the callback, see addWaiter
 
-            SocketData() : socket(), flags(0) {}
+            SocketData() : socket(), flags(0), ready(0), context(nullptr), waiter(nullptr) {}
 
             bool operator==(Socket s) { return (socket == s); }
         };
 
         /// <summary>
-        /// Socket Reactor
+        /// Dense array of SocketData with constant time lookup, insertion and removal.
+        /// POSIX descriptors are small integers, so they index a flat table directly.
+        /// WinSock handles are opaque and go through a hash map instead.
+        /// Removal moves the last element into the freed slot: callers that keep
+        /// parallel arrays (WinSock events) must mirror that move.
         /// </summary>
-        struct Reactor : protected common::Thread
+        struct SocketTable
         {
+            static constexpr size_t const npos = static_cast<size_t>(-1);
+
+            std::vector<SocketData> m_data;
+#ifdef _WIN32
+            std::unordered_map<Socket::Type, size_t> m_index;
+#else
+            std::vector<size_t> m_index;
+#endif
+
+            size_t size() const { return m_data.size(); }
+
+            bool empty() const { return m_data.empty(); }
+
+            SocketData& operator[](size_t index) { return m_data[index]; }
+
+            std::vector<SocketData>::iterator begin() { return m_data.begin(); }
+
+            std::vector<SocketData>::iterator end() { return m_data.end(); }
+
             /// <summary>
-            /// Socket State callback
+            /// Find position of socket in the table.
             /// </summary>
-            class SocketCallback
+            /// <returns>Index or npos</returns>
+            size_t indexOf(Socket const& socket) const
             {
-            public:
-                virtual void onSocketReadable(Socket sock) = 0;
-                virtual void onSocketWritable(Socket sock) = 0;
-                virtual void onSocketAcceptable(Socket sock) = 0;
-                virtual void onSocketClosed(Socket sock) = 0;
-            };
+#ifdef _WIN32
+                auto it = m_index.find(socket.m_sock);
+                return (it != m_index.end()) ? it->second : npos;
+#else
+                size_t fd = static_cast<size_t>(socket.m_sock);
+                return (fd < m_index.size()) ? m_index[fd] : npos;
+#endif
+            }
+
+            SocketData* find(Socket const& socket)
+            {
+                size_t index = indexOf(socket);
+                return (index != npos) ? &m_data[index] : nullptr;
+            }
 
             /// <summary>
-            /// Socket State
+            /// Append socket that is not in the table yet.
             /// </summary>
-            enum State
+            SocketData& insert(Socket const& socket)
             {
-                Readable = 1,
-                Writable = 2,
-                Acceptable = 4,
-                Closed = 8
-            };
-
-            SocketCallback& m_callback;
+                assert(indexOf(socket) == npos);
+                setIndex(socket, m_data.size());
+                m_data.push_back(SocketData());
+                m_data.back().socket = socket;
+                return m_data.back();
+            }
 
-            std::recursive_mutex m_sockets_mutex;
-            std::vector<SocketData> m_sockets;
+            /// <summary>
+            /// Remove socket from the table.
+            /// </summary>
+            /// <returns>Index of the freed slot that now holds the former last element, or npos</returns>
+            size_t erase(Socket const& socket)
+            {
+                size_t index = indexOf(socket);
+                if (index == npos)
+                {
+                    return npos;
+                }
+                if (index != m_data.size() - 1)
+                {
+                    m_data[index] = m_data.back();
+                    setIndex(m_data[index].socket, index);
+                }
+                m_data.pop_back();
+#ifdef _WIN32
+                m_index.erase(socket.m_sock);
+#else
+                m_index[static_cast<size_t>(socket.m_sock)] = npos;
+#endif
+                return index;
+            }
 
-            // Event loop is required for stream sockets
-            bool m_streaming{ true };
+            void clear()
+            {
+                m_data.clear();
+                m_index.clear();
+            }
 
+        private:
+            void setIndex(Socket const& socket, size_t index)
+            {
 #ifdef _WIN32
-            /* use WinSock events on Windows */
-            std::vector<WSAEVENT> m_events{};
+                m_index[socket.m_sock] = index;
+#else
+                size_t fd = static_cast<size_t>(socket.m_sock);
+                if (fd >= m_index.size())
+                {
+                    m_index.resize(std::max(fd + 1, m_index.size() * 2), npos);
+                }
+                m_index[fd] = index;
 #endif
+            }
+        };
 
-#ifdef __linux__
+        /// <summary>
+        /// Socket Reactor
+        /// </summary>
+        struct Reactor : protected common::Thread
+        {
+            /// <summary>
+            /// Socket State callback
+            /// </summary>
+            class SocketCallback
+            {
+            public:
+                virtual void onSocketReadable(Socket sock) = 0;
+                virtual void onSocketWritable(Socket sock) = 0;
+                virtual void onSocketAcceptable(Socket sock) = 0;
+                virtual void onSocketClosed(Socket sock) = 0;
+
+                /// <summary>
+                /// Reactor::Accepted: connection accepted by the reactor on a listening socket.
+                /// Client socket is non-blocking. Default implementation rejects it.
+                /// </summary>
+                virtual void onSocketAccepted(Socket listener, Socket client)
+                {
+                    (void)listener;
+                    client.close();
+                }
+
+                /// <summary>
+                /// Reactor::Received: data received by the reactor. Buffer is only valid during the call.
+                /// Size 0 - end of stream or error, no more data follows.
+                /// </summary>
+                virtual void onSocketReceived(Socket sock, char const* data, size_t size)
+                {
+                    (void)sock;
+                    (void)data;
+                    (void)size;
+                }
+
+                /// <summary>
+                /// Data handed to send() by a completion-based reactor went out, pendingSend() bytes
+                /// of the socket are still queued. Not called once the socket is removed.
+                /// </summary>
+                virtual void onSocketSent(Socket sock, size_t pending)
+                {
+                    (void)sock;
+                    (void)pending;
+                }
+            };
+
+            /// <summary>
+            /// Socket State
+            /// </summary>
+            enum State
+            {
+                Readable = 1,
+                Writable = 2,
+                Acceptable = 4,
+                Closed = 8,
+                // Completion events: the reactor performs the I/O and hands over the result.
+                // Native on io_uring backend, emulated on top of readiness elsewhere. Windows only
+                // emulates Accepted.
+                Accepted = 16,
+                Received = 32
+            };
+
+            /// <summary>
+            /// Event notification facility
+            /// </summary>
+            enum Backend
+            {
+                Default,  // epoll on Linux, kqueue on Mac, WinSock events on Windows
+                IoUring   // io_uring on Linux 6.0+
+            };
+
+            SocketCallback& m_callback;
+
+            std::recursive_mutex m_sockets_mutex;
+            SocketTable m_sockets;
+
+            // Event loop is required for stream sockets
+            bool m_streaming{ true };
+
+            static constexpr size_t const DefaultEventBatchSize = 64;
+            static constexpr size_t const DefaultAcceptBudget = 64;
+
+            // Edge-triggered mode: sockets are registered once, interest changes stay in user space
+            bool m_edgeTriggered{ false };
+            size_t m_eventBatchSize{ DefaultEventBatchSize };
+            size_t m_acceptBudget{ DefaultAcceptBudget };
+
+            // Edge-triggered mode: sockets re-armed with latched readiness, dispatched next iteration
+            std::vector<Socket> m_pending;
+
+            // Receive buffers used by callbacks on the reactor thread
+            BufferPool m_buffers;
+
+            // Command posted by another thread, applied by the reactor thread. Add, Remove and Send
+            // are posted in thread-owned mode only, Call by execute() in any mode.
+            struct Command
+            {
+                enum Type
+                {
+                    Add,
+                    Remove,
+                    Send,
+                    Call
+                };
+
+                Type type{ Add };
+                Socket socket;
+                int flags{ 0 };
+                void* context{ nullptr };
+                bool setContext{ false };
+                bool shutdownAfter{ false };
+                std::string data;
+                std::function<void()> call;
+                Command* next{ nullptr };
+            };
+
+            // Timers of the reactor thread
+            TimerWheel m_timers;
+
+            // Counters of the reactor thread
+            ReactorMetrics m_metrics;
+
+            // CPU the reactor thread is pinned to, -1 - not pinned
+            int m_cpu{ -1 };
+
+            // Thread-owned mode: socket table is only accessed by the reactor thread
+            bool m_threadOwned{ false };
+            std::atomic<Command*> m_commands{ nullptr };  // Lock-free stack, newest command first
+#ifndef _WIN32
+            int m_wakeFd{ -1 };       // eventfd on Linux, read end of a pipe on Mac
+            int m_wakeWriteFd{ -1 };  // Same eventfd on Linux, write end of the pipe on Mac
+#endif
+
+#ifdef _WIN32
+            /* use WinSock events on Windows */
+            std::vector<WSAEVENT> m_events{};
+#endif
+
+#ifdef __linux__
             /* use epoll on Linux */
             int m_epollFd;
+            std::vector<epoll_event> m_epollEvents;
 #endif
 
 #ifdef TARGET_OS_MAC
             /* use kqueue on Mac */
-#  define KQUEUE_SIZE 32
             int kq{ 0 };
-            struct kevent m_events[KQUEUE_SIZE];
+            std::vector<struct kevent> m_events;
+#endif
+
+            Backend m_backend{ Default };
+
+#ifdef HAVE_IO_URING
+            /* optionally use io_uring on Linux, see setBackend */
+            static constexpr unsigned const UringEntries = 256;
+            static constexpr unsigned const UringBufferCount = 256;
+            static constexpr unsigned const UringBufferSize = 4096;
+
+            // Operation type in the top byte of completion user data
+            enum UringOp : uint64_t
+            {
+                UringOpPoll = 1,
+                UringOpAccept,
+                UringOpReceive,
+                UringOpSend,
+                UringOpIgnore,
+                UringOpWake
+            };
+
+            // Per descriptor state. Generations tell completions of a closed
+            // socket from the ones of a new socket that reused its descriptor.
+            struct UringSocket
+            {
+                uint32_t gen{ 0 };                  // Multishot accept and receive generation
+                uint32_t baseGen{ 0 };              // First generation of the socket added last
+                uint32_t pollGen{ 0 };              // Poll generation
+                int armed{ 0 };                     // Accepted, Received: multishot operation in flight
+                uint32_t pollEvents{ 0 };           // Poll in flight for these events
+                size_t send{ SocketTable::npos };   // Send in flight
+            };
+
+            // Send in flight. Data sent while it is in flight is queued, so that
+            // the stream keeps its order, and goes out with the next operation.
+            struct UringSend
+            {
+                int fd{ -1 };
+                bool ownsFd{ false };    // Socket removed while sending: fd is a duplicate
+                bool shutdown{ false };  // Shut down sending direction when done
+                bool linked{ false };    // Shutdown is linked to the operation in flight
+                std::string data;
+                size_t offset{ 0 };
+                std::string queued;
+            };
+
+            std::vector<UringSocket> m_uringSockets;  // Indexed by descriptor
+            std::vector<std::unique_ptr<UringSend>> m_uringSends;
+            std::vector<size_t> m_uringFreeSends;
+            std::unique_ptr<Uring> m_uring;
+            std::unique_ptr<UringBufferRing> m_uringBuffers;
+            bool m_uringWakeArmed{ false };  // Poll on the wakeup descriptor in flight
 #endif
 
         public:
@@ -775,251 +1457,1564 @@ namespace net
 #  endif
 #endif
 
-#ifdef TARGET_OS_MAC
-                bzero(&m_events[0], sizeof(m_events));
-                kq = kqueue();
-#endif
+#ifdef TARGET_OS_MAC
+                kq = kqueue();
+#endif
+                createWake();
+
+#ifdef HAVE_IO_URING_DEFAULT
+                setBackend(IoUring);
+#endif
+            }
+
+            ~Reactor()
+            {
+#ifdef HAVE_IO_URING
+                uringClose();
+#endif
+                clearCommands();
+#ifndef _WIN32
+                if (m_wakeFd >= 0)
+                {
+                    ::close(m_wakeFd);
+                }
+                if ((m_wakeWriteFd >= 0) && (m_wakeWriteFd != m_wakeFd))
+                {
+                    ::close(m_wakeWriteFd);
+                }
+#endif
+#ifdef __linux__
+                ::close(m_epollFd);
+#endif
+#ifdef TARGET_OS_MAC
+                ::close(kq);
+#endif
+            }
+
+            /// <summary>
+            /// Switch between level-triggered (default) and edge-triggered event notification.
+            ///
+            /// In edge-triggered mode (EPOLLET on Linux, EV_CLEAR on Mac) every socket is registered
+            /// once for both directions and addSocket only updates user space flags, without a
+            /// syscall. Callbacks must drain the socket until EAGAIN and tolerate spurious
+            /// readiness: an edge received while the socket was not armed is replayed when
+            /// the socket is armed again. Windows socket events are not affected.
+            /// </summary>
+            /// <param name="edgeTriggered"></param>
+            void setEdgeTriggered(bool edgeTriggered)
+            {
+                LOCKGUARD(m_sockets_mutex);
+                if (m_edgeTriggered == edgeTriggered)
+                {
+                    return;
+                }
+                m_edgeTriggered = edgeTriggered;
+                if (!m_streaming)
+                {
+                    return;
+                }
+                // Re-register sockets that were added before the switch
+                for (auto& sd : m_sockets)
+                {
+#ifdef __linux__
+                    epoll_event event = {};
+                    event.data.fd = sd.socket;
+                    event.events = epollEvents(sd.flags);
+                    if (::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, sd.socket, &event) != 0)
+                    {
+                        LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                    }
+#endif
+#ifdef TARGET_OS_MAC
+                    kqueueAdd(sd.socket);
+#endif
+                    sd.ready = 0;
+                }
+            }
+
+            bool isEdgeTriggered() const { return m_edgeTriggered; }
+
+            /// <summary>
+            /// Set maximum number of events harvested by one epoll_wait / kevent call.
+            /// Takes effect on start().
+            /// </summary>
+            /// <param name="eventBatchSize"></param>
+            void setEventBatchSize(size_t eventBatchSize)
+            {
+                m_eventBatchSize = (eventBatchSize != 0) ? eventBatchSize : DefaultEventBatchSize;
+            }
+
+            size_t eventBatchSize() const { return m_eventBatchSize; }
+
+            /// <summary>
+            /// Set maximum number of connections accepted from one listening socket per wakeup,
+            /// so that a burst of connections doesn't hold back the events of open ones. The
+            /// rest is accepted after the next wait. io_uring accepts in the kernel instead.
+            /// </summary>
+            /// <param name="acceptBudget"></param>
+            void setAcceptBudget(size_t acceptBudget)
+            {
+                m_acceptBudget = (acceptBudget != 0) ? acceptBudget : DefaultAcceptBudget;
+            }
+
+            size_t acceptBudget() const { return m_acceptBudget; }
+
+            /// <summary>
+            /// Make the socket table owned by the reactor thread. Must be called before start().
+            ///
+            /// The event loop and callbacks then run without taking any lock. addSocket, removeSocket
+            /// and send called by any other thread are posted to a lock-free queue and applied by the
+            /// reactor thread in order, before its next wait. The reactor thread is woken up with an
+            /// eventfd on Linux and a pipe on Mac. Not supported on Windows.
+            /// </summary>
+            /// <param name="threadOwned"></param>
+            /// <returns>false if not supported, then the reactor keeps locking</returns>
+            bool setThreadOwned(bool threadOwned)
+            {
+#ifdef _WIN32
+                return !threadOwned;
+#else
+                if (threadOwned && (m_wakeFd < 0))
+                {
+                    return false;
+                }
+                m_threadOwned = threadOwned;
+                return true;
+#endif
+            }
+
+            bool isThreadOwned() const { return m_threadOwned; }
+
+            /// <summary>
+            /// Pin the reactor thread to a CPU. Takes effect on start().
+            /// Supported on Linux and Windows (first 64 CPUs).
+            /// </summary>
+            /// <param name="cpu">CPU index, -1 - not pinned</param>
+            /// <returns>false if not supported, then the thread is not pinned</returns>
+            bool setCpu(int cpu)
+            {
+#if defined(__linux__) || defined(_WIN32)
+                m_cpu = cpu;
+                return true;
+#else
+                m_cpu = -1;
+                return cpu < 0;
+#endif
+            }
+
+            int cpu() const { return m_cpu; }
+
+            /// <summary>
+            /// Run function on the reactor thread, before its next wait. Safe to call from any
+            /// thread, functions run in the order they were posted. Functions still queued when
+            /// the reactor stops are discarded. Not supported on Windows.
+            /// </summary>
+            /// <returns>false if not supported, then the function is not run</returns>
+            bool execute(std::function<void()> function)
+            {
+                if (!canExecute())
+                {
+                    return false;
+                }
+                Command* command = new Command();
+                command->type = Command::Call;
+                command->call = std::move(function);
+                post(command);
+                return true;
+            }
+
+            bool canExecute() const
+            {
+#ifdef _WIN32
+                return false;
+#else
+                return m_wakeFd >= 0;
+#endif
+            }
+
+            /// <summary>
+            /// Wait for the socket state once: the waiter is notified instead of the callback,
+            /// after the socket is removed from the reactor. Must be called by the reactor thread.
+            /// </summary>
+            /// <param name="socket">Socket that is not added to the reactor</param>
+            /// <param name="flags">Readable, Writable and/or Closed</param>
+            /// <param name="waiter">Waiter, kept until it is notified or the socket is removed</param>
+            void addWaiter(const Socket& socket, int flags, SocketWaiter* waiter)
+            {
+                auto lock = lockSockets();
+                updateSocket(socket, flags, nullptr, true);
+                SocketData* sd = m_sockets.find(socket);
+                if (sd != nullptr)
+                {
+                    sd->waiter = waiter;
+                }
+            }
+
+            using TimerId = TimerWheel::TimerId;
+
+            /// <summary>
+            /// Run callback on the reactor thread once the delay expires. Timers are checked
+            /// before every wait, waits don't last past the next expiry. Adding and cancelling
+            /// is O(1), so that every connection can keep a deadline. Must be called by the
+            /// reactor thread.
+            /// </summary>
+            /// <returns>Timer id for cancelTimer, never 0</returns>
+            TimerId addTimer(std::chrono::milliseconds delay, std::function<void()> callback)
+            {
+                return m_timers.add(delay, std::move(callback));
+            }
+
+            /// <summary>
+            /// Cancel timer that has not expired yet. Must be called by the reactor thread.
+            /// </summary>
+            void cancelTimer(TimerId id) { m_timers.cancel(id); }
+
+            /// <summary>
+            /// Receive buffers of the reactor. May only be used by the reactor thread:
+            /// callbacks borrow a chunk for reading and return it when they are done.
+            /// </summary>
+            BufferPool& buffers() { return m_buffers; }
+
+            /// <summary>
+            /// Counters of the reactor, readable by any thread. Callbacks account the socket I/O
+            /// they do themselves, see ReactorMetrics::received and ReactorMetrics::sent.
+            /// </summary>
+            ReactorMetrics& metrics() { return m_metrics; }
+
+            ReactorMetrics const& metrics() const { return m_metrics; }
+
+            /// <summary>
+            /// Select event notification facility. Must be called before start().
+            ///
+            /// io_uring backend (Linux 6.0+) arms multishot accept for Reactor::Accepted sockets,
+            /// multishot receive into kernel-selected provided buffers for Reactor::Received
+            /// sockets and delivers readiness with poll requests. Operations queued by callbacks
+            /// are submitted together with the next wait, in one system call. Edge-triggered mode
+            /// has no effect on it.
+            /// </summary>
+            /// <param name="backend">Backend</param>
+            /// <returns>false if the backend is not supported, then the reactor keeps the default one</returns>
+            bool setBackend(Backend backend)
+            {
+                LOCKGUARD(m_sockets_mutex);
+                if (backend == m_backend)
+                {
+                    return true;
+                }
+#ifdef HAVE_IO_URING
+                if (backend == IoUring)
+                {
+                    std::unique_ptr<Uring> ring(new Uring());
+                    unsigned features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+                    // Zero-copy send ships with multishot receive in Linux 6.0
+                    if (!ring->init(std::max<unsigned>(UringEntries, static_cast<unsigned>(m_eventBatchSize))) ||
+                        ((ring->m_features & features) != features) || !ring->probe(IORING_OP_SEND_ZC))
+                    {
+                        LOG_WARN("Reactor: io_uring is not supported, keeping default backend");
+                        return false;
+                    }
+                    std::unique_ptr<UringBufferRing> buffers(new UringBufferRing());
+                    if (!buffers->init(*ring, 0, UringBufferCount, UringBufferSize))
+                    {
+                        return false;
+                    }
+                    m_uring = std::move(ring);
+                    m_uringBuffers = std::move(buffers);
+                    m_backend = IoUring;
+                    if (m_streaming)
+                    {
+                        // Move sockets that were added before the switch
+                        for (auto& sd : m_sockets)
+                        {
+                            ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, sd.socket, nullptr);
+                            uringArm(sd.socket, sd.flags);
+                            sd.ready = 0;
+                        }
+                    }
+                    m_uring->submit();
+                    return true;
+                }
+
+                uringClose();
+                m_backend = Default;
+                if (m_streaming)
+                {
+                    for (auto& sd : m_sockets)
+                    {
+                        epoll_event event = {};
+                        event.data.fd = sd.socket;
+                        event.events = epollEvents(sd.flags);
+                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, sd.socket, &event) != 0)
+                        {
+                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                        }
+                    }
+                }
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            Backend backend() const { return m_backend; }
+
+            /// <summary>
+            /// Whether the reactor performs the I/O itself: callers should then use
+            /// Reactor::Received and send() rather than readiness events.
+            /// </summary>
+            bool isCompletionBased() const { return m_backend == IoUring; }
+
+            /// <summary>
+            /// Send data asynchronously on completion-based backend. The reactor owns the data
+            /// until it is sent; data sent while a previous send is in flight is queued behind it.
+            /// Removing and closing the socket doesn't discard data that is queued.
+            /// </summary>
+            /// <param name="socket">Stream socket</param>
+            /// <param name="data">Data</param>
+            /// <param name="shutdownAfter">Shut down sending direction after the data, linked to the send</param>
+            /// <returns>false if the backend is not completion-based and the caller has to send</returns>
+            bool send(const Socket& socket, std::string data, bool shutdownAfter = false)
+            {
+#ifdef HAVE_IO_URING
+                if (m_backend != IoUring)
+                {
+                    return false;
+                }
+                if (isForeignThread())
+                {
+                    Command* command = new Command();
+                    command->type = Command::Send;
+                    command->socket = socket;
+                    command->data = std::move(data);
+                    command->shutdownAfter = shutdownAfter;
+                    post(command);
+                    return true;
+                }
+                auto lock = lockSockets();
+                UringSocket& us = uringSocket(socket);
+                if (us.send != SocketTable::npos)
+                {
+                    UringSend& op = *m_uringSends[us.send];
+                    if (op.queued.empty())
+                    {
+                        op.queued = std::move(data);
+                    }
+                    else
+                    {
+                        op.queued.append(data);
+                    }
+                    op.shutdown |= shutdownAfter;
+                    return true;
+                }
+                if (data.empty())
+                {
+                    if (shutdownAfter)
+                    {
+                        ::shutdown(socket, SHUT_WR);
+                    }
+                    return true;
+                }
+
+                size_t index;
+                if (m_uringFreeSends.empty())
+                {
+                    index = m_uringSends.size();
+                    m_uringSends.emplace_back(new UringSend());
+                }
+                else
+                {
+                    index = m_uringFreeSends.back();
+                    m_uringFreeSends.pop_back();
+                }
+                UringSend& op = *m_uringSends[index];
+                op.fd = socket;
+                op.ownsFd = false;
+                op.shutdown = shutdownAfter;
+                op.linked = false;
+                op.data = std::move(data);
+                op.offset = 0;
+                us.send = index;
+
+                if (shutdownAfter && m_uring->reserve(2))
+                {
+                    // Kernel shuts down the socket as soon as all the data is sent
+                    io_uring_sqe* sqe = uringSend(index);
+                    sqe->flags |= IOSQE_IO_LINK;
+                    sqe = uringSqe(IORING_OP_SHUTDOWN, socket, uringData(UringOpIgnore, 0, 0));
+                    sqe->len = SHUT_WR;
+                    op.linked = true;
+                }
+                else
+                {
+                    uringSend(index);
+                }
+                uringSubmitIfForeign();
+                return true;
+#else
+                (void)socket;
+                (void)data;
+                (void)shutdownAfter;
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Bytes handed to send() that are not sent yet. Must be called by the reactor thread.
+            /// </summary>
+            size_t pendingSend(const Socket& socket)
+            {
+#ifdef HAVE_IO_URING
+                if (m_backend != IoUring)
+                {
+                    return 0;
+                }
+                auto lock = lockSockets();
+                UringSocket& us = uringSocket(socket);
+                if (us.send == SocketTable::npos)
+                {
+                    return 0;
+                }
+                UringSend const& op = *m_uringSends[us.send];
+                return op.data.size() - op.offset + op.queued.size();
+#else
+                (void)socket;
+                return 0;
+#endif
+            }
+
+            /// <summary>
+            /// Add Socket
+            /// </summary>
+            /// <param name="socket"></param>
+            /// <param name="flags"></param>
+            void addSocket(const Socket& socket, int flags) { updateSocket(socket, flags, nullptr, false); }
+
+            /// <summary>
+            /// Add Socket with owner's context, see context().
+            /// </summary>
+            /// <param name="socket"></param>
+            /// <param name="flags"></param>
+            /// <param name="context">Context pointer, kept until the socket is removed</param>
+            void addSocket(const Socket& socket, int flags, void* context)
+            {
+                updateSocket(socket, flags, context, true);
+            }
+
+            /// <summary>
+            /// Context attached to the socket with addSocket. Callbacks use it to find their
+            /// per-socket state without a lookup in a shared container.
+            /// In thread-owned mode it may only be called by the reactor thread.
+            /// </summary>
+            /// <param name="socket"></param>
+            /// <returns>Context pointer or nullptr</returns>
+            void* context(const Socket& socket)
+            {
+                auto lock = lockSockets();
+                SocketData* sd = m_sockets.find(socket);
+                return (sd != nullptr) ? sd->context : nullptr;
+            }
+
+            /// <summary>
+            /// Remove Socket
+            /// </summary>
+            /// <param name="socket"></param>
+            void removeSocket(const Socket& socket)
+            {
+                if (isForeignThread())
+                {
+                    Command* command = new Command();
+                    command->type = Command::Remove;
+                    command->socket = socket;
+                    post(command);
+                    return;
+                }
+                auto lock = lockSockets();
+                LOG_TRACE("Reactor: Removing socket 0x%x", static_cast<int>(socket));
+                size_t index = m_sockets.indexOf(socket);
+                if (index != SocketTable::npos)
+                {
+                    if (m_streaming)
+                    {
+#ifdef _WIN32
+                        ::WSAEventSelect(socket, m_events[index], 0);
+                        ::WSACloseEvent(m_events[index]);
+                        // Mirror the move of the last socket into the freed slot
+                        m_events[index] = m_events.back();
+                        m_events.pop_back();
+#endif
+#ifdef HAVE_IO_URING
+                        if (m_backend == IoUring)
+                        {
+                            // Submitted right away: the caller is about to close the socket
+                            uringDisarm(socket);
+                            m_uring->submit();
+                        }
+                        else
+#endif
+#ifdef __linux__
+                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, socket, nullptr) != 0)
+                        {
+                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                        };
+#endif
+#ifdef TARGET_OS_MAC
+                        struct kevent event;
+                        bzero(&event, sizeof(event));
+                        event.ident = socket;
+                        EV_SET(&event, socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+                        if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
+                        {
+                            //// Already removed?
+                            LOG_ERROR("cannot delete fd=0x%x from kqueue!", event.ident);
+                        }
+                        EV_SET(&event, socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+                        if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
+                        {
+                            //// Already removed?
+                            LOG_ERROR("cannot delete fd=0x%x from kqueue!", event.ident);
+                        }
+#endif
+                    }
+                    m_sockets.erase(socket);
+                }
+            }
+
+            /// <summary>
+            /// Reactor that owns the calling thread, or nullptr outside of a reactor thread.
+            /// Callbacks use it to find the event loop that delivered the event.
+            /// </summary>
+            static Reactor*& current()
+            {
+                static thread_local Reactor* reactor = nullptr;
+                return reactor;
+            }
+
+            /// <summary>
+            /// Start server
+            /// </summary>
+            void start()
+            {
+                LOG_INFO("Reactor: Starting...");
+#ifdef __linux__
+                m_epollEvents.resize(m_eventBatchSize);
+#endif
+#ifdef TARGET_OS_MAC
+                m_events.resize(m_eventBatchSize);
+#endif
+                startThread();
+            }
+
+            /// <summary>
+            /// Stop server
+            /// </summary>
+            void stop()
+            {
+                LOG_INFO("Reactor: Stopping...");
+                // If UDP server, then force-close it to stop.
+                if (!m_streaming)
+                {
+                    LOCKGUARD(m_sockets_mutex);
+                    if (m_sockets.size())
+                    {
+                        // Closing alone doesn't wake up a thread blocked in recvfrom
+                        m_sockets[0].socket.shutdown(Socket::ShutdownBoth);
+                        m_sockets[0].socket.close();
+                    }
+                }
+#ifndef _WIN32
+                if (m_wakeFd >= 0)
+                {
+                    // Don't wait for the event loop timeout
+                    m_terminate = true;
+                    wake();
+                }
+#endif
+                joinThread();
+                clearCommands();
+
+                // Only acquire the lock after the worker(s) have joined
+                LOCKGUARD(m_sockets_mutex);
+#ifdef _WIN32
+                for (auto& hEvent : m_events)
+                {
+                    ::WSACloseEvent(hEvent);
+                }
+#else /* Linux and Mac */
+                for (auto& sd : m_sockets)
+                {
+#  ifdef HAVE_IO_URING
+                    if (m_backend == IoUring)
+                    {
+                        uringDisarm(sd.socket);
+                        continue;
+                    }
+#  endif
+#  ifdef __linux__
+                    if (::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, sd.socket, nullptr) != 0)
+                    {
+                        LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                    };
+#  endif
+#  ifdef TARGET_OS_MAC
+                    struct kevent event;
+                    bzero(&event, sizeof(event));
+                    event.ident = sd.socket;
+                    EV_SET(&event, sd.socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+                    if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
+                    {
+                        LOG_ERROR("Reactor: cannot delete fd=0x%x from kqueue!", event.ident);
+                    }
+                    EV_SET(&event, sd.socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+                    if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
+                    {
+                        LOG_ERROR("Reactor: cannot delete fd=0x%x from kqueue!", event.ident);
+                    }
+#  endif
+                }
+#endif
+#ifdef HAVE_IO_URING
+                if (m_backend == IoUring)
+                {
+                    m_uring->submit();
+                }
+#endif
+                // unbind: the datagram socket is the reactor's, stream sockets are closed by their server
+                if (!m_streaming && m_sockets.size())
+                {
+                    m_sockets[0].socket.close();
+                }
+                m_sockets.clear();
+            }
+
+        protected:
+            /// <summary>
+            /// Add, update or remove (flags 0) socket. Posted to the reactor thread when called
+            /// by another thread in thread-owned mode.
+            /// </summary>
+            void updateSocket(const Socket& socket, int flags, void* context, bool setContext)
+            {
+                if (isForeignThread())
+                {
+                    Command* command = new Command();
+                    command->type = Command::Add;
+                    command->socket = socket;
+                    command->flags = flags;
+                    command->context = context;
+                    command->setContext = setContext;
+                    post(command);
+                    return;
+                }
+                if (flags == 0)
+                {
+                    removeSocket(socket);
+                    return;
+                }
+
+                auto lock = lockSockets();
+                if ((flags == State::Readable) && (m_sockets.size() == 0))
+                {
+                    // No listen/accept - readable UDP datagram
+                    m_streaming = false;
+                    LOG_TRACE("Reactor: Adding datagram socket 0x%x with flags 0x%x", static_cast<int>(socket),
+                        flags);
+                    m_sockets.insert(socket).context = context;
+                    return;
+                }
+
+                if (m_streaming)
+                {
+                    size_t index = m_sockets.indexOf(socket);
+                    if (index == SocketTable::npos)
+                    {
+                        LOG_TRACE("Reactor: Adding socket 0x%x with flags 0x%x", static_cast<int>(socket), flags);
+#ifdef _WIN32
+                        m_events.push_back(::WSACreateEvent());
+#endif
+                        index = m_sockets.size();
+                        SocketData& sd = m_sockets.insert(socket);
+#ifdef __linux__
+                        if (m_backend == IoUring)
+                        {
+                            // Armed below
+                        }
+                        else
+                        {
+                            epoll_event event = {};
+                            event.data.fd = socket;
+                            event.events = 0;
+                            if (m_edgeTriggered)
+                            {
+                                // Registered once, flags below are filtered in user space
+                                sd.flags = flags;
+                                event.events = epollEvents(flags);
+                            }
+                            if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, socket, &event) != 0)
+                            {
+                                LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                            }
+                        }
+#endif
+#ifdef TARGET_OS_MAC
+                        (void)sd;
+                        kqueueAdd(socket);
+#endif
+                    }
+                    else
+                    {
+                        LOG_TRACE("Reactor: Updating socket 0x%x with flags 0x%x", static_cast<int>(socket), flags);
+                    }
+
+                    SocketData* it = &m_sockets[index];
+                    if (setContext)
+                    {
+                        it->context = context;
+                    }
+#ifdef HAVE_IO_URING
+                    if (m_backend == IoUring)
+                    {
+                        it->flags = flags;
+                        uringArm(socket, flags);
+                        uringSubmitIfForeign();
+                        return;
+                    }
+#endif
+                    if (m_edgeTriggered)
+                    {
+#ifndef _WIN32
+                        // No syscall: replay readiness latched while the socket was not armed
+                        int armed = flags & ~it->flags;
+                        it->flags = flags;
+                        if (it->ready & armed)
+                        {
+                            m_pending.push_back(socket);
+                        }
+                        return;
+#endif
+                    }
+
+                    if (it->flags != flags)
+                    {
+                        it->flags = flags;
+#ifdef _WIN32
+                        long lNetworkEvents = 0;
+                        if (it->flags & Readable)
+                        {
+                            lNetworkEvents |= FD_READ;
+                        }
+                        if (it->flags & Writable)
+                        {
+                            lNetworkEvents |= FD_WRITE;
+                        }
+                        if (it->flags & (Acceptable | Accepted))
+                        {
+                            lNetworkEvents |= FD_ACCEPT;
+                        }
+                        if (it->flags & Closed)
+                        {
+                            lNetworkEvents |= FD_CLOSE;
+                        }
+                        ::WSAEventSelect(socket, m_events[index], lNetworkEvents);
+#endif
+#ifdef __linux__
+                        epoll_event event = {};
+                        event.data.fd = socket;
+                        event.events = epollEvents(it->flags);
+                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, socket, &event) != 0)
+                        {
+                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                        }
+#endif
+#ifdef TARGET_OS_MAC
+                        // TODO: [MG] - Mac OS X socket doesn't currently support updating flags
+#endif
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Acquire m_sockets_mutex, unless the socket table is owned by the reactor thread.
+            /// </summary>
+            std::unique_lock<std::recursive_mutex> lockSockets()
+            {
+                if (m_threadOwned)
+                {
+                    return std::unique_lock<std::recursive_mutex>(m_sockets_mutex, std::defer_lock);
+                }
+                return std::unique_lock<std::recursive_mutex>(m_sockets_mutex);
+            }
+
+            /// <summary>
+            /// Create the descriptor that wakes the reactor thread up when commands are posted:
+            /// an eventfd on Linux, a pipe on Mac.
+            /// </summary>
+            void createWake()
+            {
+#ifndef _WIN32
+#  ifdef __linux__
+                m_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                m_wakeWriteFd = m_wakeFd;
+                if (m_wakeFd >= 0)
+                {
+                    epoll_event event = {};
+                    event.data.fd = m_wakeFd;
+                    event.events = EPOLLIN;
+                    if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event) != 0)
+                    {
+                        LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                    }
+                }
+#  endif
+#  ifdef TARGET_OS_MAC
+                int fds[2];
+                if (::pipe(fds) == 0)
+                {
+                    ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+                    ::fcntl(fds[1], F_SETFL, ::fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+                    m_wakeFd = fds[0];
+                    m_wakeWriteFd = fds[1];
+                    struct kevent event;
+                    EV_SET(&event, m_wakeFd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+                    kevent(kq, &event, 1, NULL, 0, NULL);
+                }
+#  endif
+                if (m_wakeFd < 0)
+                {
+                    LOG_ERROR("Reactor: cannot create wakeup descriptor, errno=%d", errno);
+                }
+#endif
+            }
+
+            /// <summary>
+            /// Thread-owned mode: whether the caller has to post the command to the reactor thread.
+            /// </summary>
+            bool isForeignThread() const { return m_threadOwned && (current() != this); }
+
+            /// <summary>
+            /// Push command onto the queue, wake the reactor thread up if the queue was empty.
+            /// Safe to call from any number of threads.
+            /// </summary>
+            void post(Command* command)
+            {
+                Command* head = m_commands.load(std::memory_order_relaxed);
+                do
+                {
+                    command->next = head;
+                } while (!m_commands.compare_exchange_weak(
+                    head, command, std::memory_order_release, std::memory_order_relaxed));
+                if (head == nullptr)
+                {
+                    wake();
+                }
+            }
+
+            void wake()
+            {
+#ifndef _WIN32
+                uint64_t one = 1;
+                if (::write(m_wakeWriteFd, &one, sizeof(one)) < 0)
+                {
+                    // Full pipe or counter: the reactor thread is awake anyway
+                }
+#endif
+            }
+
+            /// <summary>
+            /// Consume pending wakeups. Must be called before runCommands, so that commands
+            /// posted after it wake the reactor thread up again.
+            /// </summary>
+            void drainWake()
+            {
+#ifndef _WIN32
+                uint64_t buffer[16];
+                while (::read(m_wakeFd, buffer, sizeof(buffer)) > 0)
+                {
+                }
+#endif
+            }
+
+            /// <summary>
+            /// Apply commands posted by other threads, oldest first. Must be called by the reactor thread.
+            /// </summary>
+            void runCommands()
+            {
+                if (m_commands.load(std::memory_order_relaxed) == nullptr)
+                {
+                    return;
+                }
+                Command* command = m_commands.exchange(nullptr, std::memory_order_acquire);
+                Command* list = nullptr;
+                while (command != nullptr)
+                {
+                    Command* next = command->next;
+                    command->next = list;
+                    list = command;
+                    command = next;
+                }
+                while (list != nullptr)
+                {
+                    switch (list->type)
+                    {
+                    case Command::Add:
+                        updateSocket(list->socket, list->flags, list->context, list->setContext);
+                        break;
+                    case Command::Remove:
+                        removeSocket(list->socket);
+                        break;
+                    case Command::Send:
+                        send(list->socket, std::move(list->data), list->shutdownAfter);
+                        break;
+                    case Command::Call:
+                        list->call();
+                        break;
+                    }
+                    Command* next = list->next;
+                    delete list;
+                    list = next;
+                }
+            }
+
+            /// <summary>
+            /// Run callbacks of expired timers. Must be called by the reactor thread.
+            /// </summary>
+            void runTimers() { m_timers.advance(std::chrono::steady_clock::now()); }
+
+            /// <summary>
+            /// Wait timeout that doesn't pass the next timer expiry.
+            /// </summary>
+            /// <param name="maxMs">Timeout if no timer expires earlier</param>
+            int waitTimeout(int maxMs) const { return m_timers.timeout(maxMs); }
+
+            /// <summary>
+            /// Discard commands that the reactor thread didn't apply.
+            /// </summary>
+            void clearCommands()
+            {
+                Command* command = m_commands.exchange(nullptr, std::memory_order_acquire);
+                while (command != nullptr)
+                {
+                    Command* next = command->next;
+                    delete command;
+                    command = next;
+                }
+            }
+
+#ifdef __linux__
+            /// <summary>
+            /// Translate socket flags to epoll interest mask
+            /// </summary>
+            uint32_t epollEvents(int flags) const
+            {
+                if (m_edgeTriggered)
+                {
+                    return EPOLLIN | EPOLLOUT | EPOLLET;
+                }
+                uint32_t events = 0;
+                if (flags & Readable)
+                {
+                    events |= EPOLLIN;
+                };
+                if (flags & Writable)
+                {
+                    events |= EPOLLOUT;
+                };
+                if (flags & (Acceptable | Accepted | Received))
+                {
+                    events |= EPOLLIN;
+                };
+                // if (flags & Closed) - always handled (EPOLLERR | EPOLLHUP)
+                return events;
+            }
+#endif
+
+#ifdef TARGET_OS_MAC
+            /// <summary>
+            /// Register (or re-register) both kqueue filters of a socket
+            /// </summary>
+            void kqueueAdd(Socket const& socket)
+            {
+                unsigned short action = EV_ADD | (m_edgeTriggered ? EV_CLEAR : 0);
+                struct kevent event;
+                EV_SET(&event, socket.m_sock, EVFILT_READ, action, 0, 0, NULL);
+                kevent(kq, &event, 1, NULL, 0, NULL);
+                EV_SET(&event, socket.m_sock, EVFILT_WRITE, action, 0, 0, NULL);
+                kevent(kq, &event, 1, NULL, 0, NULL);
+            }
+#endif
+
+#ifdef HAVE_IO_URING
+            static uint64_t uringData(uint64_t op, uint32_t gen, uint32_t fd)
+            {
+                return (op << 56) | (static_cast<uint64_t>(gen & 0xffffff) << 32) | fd;
+            }
+
+            UringSocket& uringSocket(int fd)
+            {
+                if (static_cast<size_t>(fd) >= m_uringSockets.size())
+                {
+                    m_uringSockets.resize(std::max(static_cast<size_t>(fd) + 1, 2 * m_uringSockets.size()));
+                }
+                return m_uringSockets[fd];
+            }
+
+            io_uring_sqe* uringSqe(uint8_t opcode, int fd, uint64_t data)
+            {
+                io_uring_sqe* sqe = m_uring->getSqe();
+                if (sqe == nullptr)
+                {
+                    LOG_ERROR("Reactor: io_uring submission queue is full!");
+                    return nullptr;
+                }
+                sqe->opcode = opcode;
+                sqe->fd = fd;
+                sqe->user_data = data;
+                return sqe;
+            }
+
+            void uringCancel(uint64_t data)
+            {
+                io_uring_sqe* sqe = uringSqe(IORING_OP_ASYNC_CANCEL, -1, uringData(UringOpIgnore, 0, 0));
+                if (sqe != nullptr)
+                {
+                    sqe->addr = data;
+                }
+            }
+
+            io_uring_sqe* uringSend(size_t index)
+            {
+                UringSend& op = *m_uringSends[index];
+                io_uring_sqe* sqe =
+                    uringSqe(IORING_OP_SEND, op.fd, uringData(UringOpSend, 0, static_cast<uint32_t>(index)));
+                if (sqe != nullptr)
+                {
+                    sqe->addr = reinterpret_cast<uint64_t>(op.data.data() + op.offset);
+                    sqe->len = static_cast<uint32_t>(op.data.size() - op.offset);
+                    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+                }
+                return sqe;
+            }
+
+            /// <summary>
+            /// Submit right away when called outside of the reactor thread, which otherwise
+            /// submits along with its next wait.
+            /// </summary>
+            void uringSubmitIfForeign()
+            {
+                if (current() != this)
+                {
+                    m_uring->submit();
+                }
+            }
+
+            /// <summary>
+            /// Bring operations in flight for the socket in line with its flags.
+            /// Must be called with m_sockets_mutex held.
+            /// </summary>
+            void uringArm(int fd, int flags)
+            {
+                UringSocket& us = uringSocket(fd);
+                int multishot = flags & (Accepted | Received);
+                if (us.armed & ~multishot)
+                {
+                    // Late completions of the cancelled operation are told apart by generation
+                    if (us.armed & Accepted)
+                    {
+                        uringCancel(uringData(UringOpAccept, us.gen, fd));
+                    }
+                    if (us.armed & Received)
+                    {
+                        uringCancel(uringData(UringOpReceive, us.gen, fd));
+                    }
+                    us.armed = 0;
+                    us.gen++;
+                }
+                if ((multishot & Accepted) && !(us.armed & Accepted))
+                {
+                    io_uring_sqe* sqe = uringSqe(IORING_OP_ACCEPT, fd, uringData(UringOpAccept, us.gen, fd));
+                    if (sqe != nullptr)
+                    {
+                        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+                        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+                        us.armed |= Accepted;
+                    }
+                }
+                if ((multishot & Received) && !(us.armed & Received))
+                {
+                    io_uring_sqe* sqe = uringSqe(IORING_OP_RECV, fd, uringData(UringOpReceive, us.gen, fd));
+                    if (sqe != nullptr)
+                    {
+                        sqe->ioprio = IORING_RECV_MULTISHOT;
+                        sqe->flags = IOSQE_BUFFER_SELECT;
+                        sqe->buf_group = m_uringBuffers->m_groupId;
+                        us.armed |= Received;
+                    }
+                }
+
+                // Readiness: one-shot poll re-armed after dispatch, same as level-triggered epoll
+                uint32_t events = 0;
+                if (flags & (Readable | Acceptable))
+                {
+                    events |= POLLIN;
+                }
+                if (flags & Writable)
+                {
+                    events |= POLLOUT;
+                }
+                if ((flags & Closed) && !(flags & Received))
+                {
+                    events |= POLLRDHUP;
+                }
+                if (events != us.pollEvents)
+                {
+                    if (us.pollEvents != 0)
+                    {
+                        uringCancel(uringData(UringOpPoll, us.pollGen, fd));
+                        us.pollEvents = 0;
+                    }
+                    us.pollGen++;
+                    if (events != 0)
+                    {
+                        io_uring_sqe* sqe = uringSqe(IORING_OP_POLL_ADD, fd, uringData(UringOpPoll, us.pollGen, fd));
+                        if (sqe != nullptr)
+                        {
+                            sqe->poll32_events = events;
+                            us.pollEvents = events;
+                        }
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Cancel operations in flight for the socket. Sends keep going on a duplicate
+            /// descriptor, so that the caller may close the socket.
+            /// Must be called with m_sockets_mutex held.
+            /// </summary>
+            void uringDisarm(int fd)
+            {
+                uringArm(fd, 0);
+                UringSocket& us = uringSocket(fd);
+                us.gen++;
+                us.baseGen = us.gen;
+                if (us.send != SocketTable::npos)
+                {
+                    UringSend& op = *m_uringSends[us.send];
+                    op.fd = ::dup(fd);
+                    op.ownsFd = (op.fd >= 0);
+                    us.send = SocketTable::npos;
+                }
+            }
+
+            /// <summary>
+            /// Release the ring. Operations in flight are cancelled.
+            /// </summary>
+            void uringClose()
+            {
+                m_uringBuffers.reset();
+                m_uring.reset();
+                m_uringWakeArmed = false;
+                for (auto& op : m_uringSends)
+                {
+                    if (op->ownsFd && op->fd >= 0)
+                    {
+                        ::close(op->fd);
+                    }
+                }
+                m_uringSends.clear();
+                m_uringFreeSends.clear();
+                m_uringSockets.clear();
+            }
+
+            /// <summary>
+            /// Handle send completion: continue with the remainder or with the queued data.
+            /// </summary>
+            void uringSent(size_t index, int result)
+            {
+                if (index >= m_uringSends.size())
+                {
+                    return;
+                }
+                UringSend& op = *m_uringSends[index];
+                // Owner of the socket is told about progress, unless it removed the socket
+                Socket socket(op.ownsFd ? Socket::Invalid : op.fd);
+                if (result > 0)
+                {
+                    m_metrics.sent(result, op.data.size() - op.offset, false);
+                    op.offset += static_cast<size_t>(result);
+                    if (op.offset < op.data.size())
+                    {
+                        // Short send cancels the linked shutdown
+                        op.linked = false;
+                        uringSend(index);
+                        uringNotifySent(socket);
+                        return;
+                    }
+                    if (!op.queued.empty())
+                    {
+                        op.data.swap(op.queued);
+                        op.queued.clear();
+                        op.offset = 0;
+                        uringSend(index);
+                        uringNotifySent(socket);
+                        return;
+                    }
+                    if (op.shutdown && !op.linked)
+                    {
+                        ::shutdown(op.fd, SHUT_WR);
+                    }
+                }
+                else
+                {
+                    LOG_WARN("Reactor: send to fd=0x%x failed, error=%d", op.fd, -result);
+                }
+
+                if (op.ownsFd)
+                {
+                    ::close(op.fd);
+                }
+                else if (uringSocket(op.fd).send == index)
+                {
+                    uringSocket(op.fd).send = SocketTable::npos;
+                }
+                op.fd = -1;
+                op.ownsFd = false;
+                op.data.clear();
+                op.queued.clear();
+                m_uringFreeSends.push_back(index);
+                uringNotifySent(socket);
+            }
+
+            void uringNotifySent(Socket socket)
+            {
+                if (!socket.invalid() && (m_sockets.find(socket) != nullptr))
+                {
+                    m_callback.onSocketSent(socket, pendingSend(socket));
+                }
+            }
+
+            /// <summary>
+            /// Handle one completion.
+            /// Must be called with m_sockets_mutex held.
+            /// </summary>
+            void uringComplete(io_uring_cqe const& cqe)
+            {
+                uint64_t op = cqe.user_data >> 56;
+                uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32) & 0xffffff;
+                int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+                bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+                if (op == UringOpSend)
+                {
+                    uringSent(static_cast<size_t>(fd), cqe.res);
+                    return;
+                }
+                if (op == UringOpWake)
+                {
+                    // Commands are applied before the next wait
+                    m_uringWakeArmed = false;
+                    drainWake();
+                    return;
+                }
+                if ((op == UringOpIgnore) || (fd < 0))
+                {
+                    return;
+                }
+
+                UringSocket& us = uringSocket(fd);
+                SocketData* sd = m_sockets.find(fd);
+                if (op == UringOpPoll)
+                {
+                    if ((cqe.res < 0) || (sd == nullptr) || (gen != (us.pollGen & 0xffffff)))
+                    {
+                        return;
+                    }
+                    us.pollEvents = 0;
+                    int active = 0;
+                    if (cqe.res & POLLIN)
+                    {
+                        active |= Readable | Acceptable;
+                    }
+                    if (cqe.res & POLLOUT)
+                    {
+                        active |= Writable;
+                    }
+                    if (cqe.res & (POLLHUP | POLLERR | POLLRDHUP))
+                    {
+                        active |= Closed;
+                    }
+                    dispatch(*sd, active);
+                }
+                else if (op == UringOpAccept)
+                {
+                    bool current = (sd != nullptr) && (gen == (us.gen & 0xffffff));
+                    if (current && !more)
+                    {
+                        us.armed &= ~Accepted;
+                    }
+                    if (cqe.res >= 0)
+                    {
+                        Socket client(cqe.res);
+                        if (current && (sd->flags & Accepted))
+                        {
+                            m_metrics.accepts.add();
+                            m_callback.onSocketAccepted(sd->socket, client);
+                        }
+                        else
+                        {
+                            client.close();
+                        }
+                    }
+                    else if (cqe.res != -ECANCELED)
+                    {
+                        LOG_WARN("Reactor: accept on fd=0x%x failed, error=%d", fd, -cqe.res);
+                    }
+                    if (!current || more || (cqe.res == -ECANCELED))
+                    {
+                        return;
+                    }
+                }
+                else if (op == UringOpReceive)
+                {
+                    bool current = (sd != nullptr) && (gen == (us.gen & 0xffffff));
+                    if (current && !more)
+                    {
+                        us.armed &= ~Received;
+                    }
+                    // Data of a receive cancelled by a change of flags is still delivered, unless
+                    // the socket was removed since
+                    bool added = (sd != nullptr) &&
+                        (((gen - us.baseGen) & 0xffffff) <= ((us.gen - us.baseGen) & 0xffffff));
+                    Socket socket = added ? sd->socket : Socket();
+                    bool deliver = current && (sd->flags & Received);
+                    if (cqe.flags & IORING_CQE_F_BUFFER)
+                    {
+                        unsigned short bid = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                        if ((deliver || (added && !current)) && (cqe.res > 0))
+                        {
+                            m_metrics.bytesRead.add(static_cast<uint64_t>(cqe.res));
+                            m_callback.onSocketReceived(
+                                socket, m_uringBuffers->data(bid), static_cast<size_t>(cqe.res));
+                        }
+                        m_uringBuffers->recycle(bid);
+                    }
+                    else if (deliver && (cqe.res != -ENOBUFS) && (cqe.res != -ECANCELED))
+                    {
+                        // End of stream or error
+                        m_callback.onSocketReceived(socket, nullptr, 0);
+                        return;
+                    }
+                    // Out of buffers ends multishot receive: re-armed below
+                    if (!current || more || ((cqe.res <= 0) && (cqe.res != -ENOBUFS)))
+                    {
+                        return;
+                    }
+                }
+
+                // Re-arm unless the callbacks removed the socket
+                sd = m_sockets.find(fd);
+                if (sd != nullptr)
+                {
+                    uringArm(fd, sd->flags);
+                }
             }
 
-            ~Reactor()
+            /// <summary>
+            /// Submit queued operations, wait for completions and handle them.
+            /// </summary>
+            void uringWait(int timeoutMs)
             {
-#ifdef __linux__
-                ::close(m_epollFd);
-#endif
-#ifdef TARGET_OS_MAC
-                ::close(kq);
-#endif
+                unsigned toSubmit;
+                {
+                    auto lock = lockSockets();
+                    if ((m_wakeFd >= 0) && !m_uringWakeArmed)
+                    {
+                        io_uring_sqe* sqe = uringSqe(IORING_OP_POLL_ADD, m_wakeFd, uringData(UringOpWake, 0, 0));
+                        if (sqe != nullptr)
+                        {
+                            sqe->poll32_events = POLLIN;
+                            m_uringWakeArmed = true;
+                        }
+                    }
+                    toSubmit = m_uring->publish();
+                }
+                m_uring->enter(toSubmit, 1, timeoutMs);
+                auto lock = lockSockets();
+                unsigned count = m_uring->forEachCompletion([this](io_uring_cqe const& cqe) { uringComplete(cqe); });
+                m_metrics.wakeups.add();
+                m_metrics.events.add(count);
             }
+#endif
 
             /// <summary>
-            /// Add Socket
+            /// Invoke callbacks for active events armed on the socket.
+            /// Must be called with m_sockets_mutex held.
             /// </summary>
-            /// <param name="socket"></param>
-            /// <param name="flags"></param>
-            void addSocket(const Socket& socket, int flags)
+            /// <param name="sd">Socket data entry, may be removed by callbacks</param>
+            /// <param name="active">State bits reported by the OS</param>
+            void dispatch(SocketData& sd, int active)
             {
-                if (flags == 0)
+                Socket socket = sd.socket;
+                int flags = sd.flags;
+                if (m_edgeTriggered && (m_backend == Default))
                 {
-                    removeSocket(socket);
-                    return;
+                    // Edges are not repeated: remember the ones we can't deliver now.
+                    active |= sd.ready;
+                    sd.ready = active & ~flags;
                 }
 
-                LOCKGUARD(m_sockets_mutex);
-                if ((flags == State::Readable) && (m_sockets.size() == 0))
+                if (sd.waiter != nullptr)
                 {
-                    // No listen/accept - readable UDP datagram
-                    m_streaming = false;
-                    LOG_TRACE("Reactor: Adding datagram socket 0x%x with flags 0x%x", static_cast<int>(socket),
-                        flags);
-                    m_sockets.push_back(SocketData());
-                    m_sockets.back().socket = socket;
-                    m_sockets.back().flags = 0;
+                    SocketWaiter* waiter = sd.waiter;
+                    int ready = active & flags & (Readable | Writable | Closed);
+                    if (ready != 0)
+                    {
+                        removeSocket(socket);
+                        waiter->onSocketReady(socket, ready);
+                    }
                     return;
                 }
 
-                if (m_streaming)
+                if ((flags & Readable) && (active & Readable))
+                {
+                    m_callback.onSocketReadable(socket);
+                }
+                if ((flags & Writable) && (active & Writable))
+                {
+                    m_callback.onSocketWritable(socket);
+                }
+                if ((flags & Acceptable) && (active & Acceptable))
+                {
+                    m_callback.onSocketAcceptable(socket);
+                }
+                if ((flags & Closed) && (active & Closed))
+                {
+                    LOG_TRACE("Reactor: handling socket 0x%x onSocketClosed", static_cast<int>(socket));
+                    m_callback.onSocketClosed(socket);
+                }
+                if ((m_backend == Default) && (flags & (Accepted | Received)) && (m_sockets.find(socket) != nullptr))
                 {
-                    auto it = std::find(m_sockets.begin(), m_sockets.end(), socket);
-                    if (it == m_sockets.end())
+                    // Completion events on top of readiness
+                    if ((flags & Accepted) && (active & Acceptable))
                     {
-                        LOG_TRACE("Reactor: Adding socket 0x%x with flags 0x%x", static_cast<int>(socket), flags);
-#ifdef _WIN32
-                        m_events.push_back(::WSACreateEvent());
-#endif
-#ifdef __linux__
-                        epoll_event event = {};
-                        event.data.fd = socket;
-                        event.events = 0;
-                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, socket, &event) != 0)
-                        {
-                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
-                        }
-#endif
-#ifdef TARGET_OS_MAC
-                        struct kevent event;
-                        bzero(&event, sizeof(event));
-                        event.ident = socket.m_sock;
-                        EV_SET(&event, event.ident, EVFILT_READ, EV_ADD, 0, 0, NULL);
-                        kevent(kq, &event, 1, NULL, 0, NULL);
-                        EV_SET(&event, event.ident, EVFILT_WRITE, EV_ADD, 0, 0, NULL);
-                        kevent(kq, &event, 1, NULL, 0, NULL);
-#endif
-                        m_sockets.push_back(SocketData());
-                        m_sockets.back().socket = socket;
-                        m_sockets.back().flags = 0;
-                        it = m_sockets.end() - 1;
+                        acceptAll(socket);
                     }
-                    else
+                    if ((flags & Received) && (active & (Readable | Closed)))
                     {
-                        LOG_TRACE("Reactor: Updating socket 0x%x with flags 0x%x", static_cast<int>(socket), flags);
+                        receiveAll(socket);
                     }
+                }
+            }
 
-                    if (it->flags != flags)
+            /// <summary>
+            /// Emulate Reactor::Accepted: accept until EAGAIN, at most the accept budget. In
+            /// edge-triggered mode the rest is replayed on the next iteration.
+            /// </summary>
+            void acceptAll(Socket socket)
+            {
+                Socket client;
+                SocketAddr addr;
+                for (size_t accepted = 0; accepted < m_acceptBudget;)
+                {
+                    if (!socket.acceptNonBlocking(client, addr))
                     {
-                        it->flags = flags;
-#ifdef _WIN32
-                        long lNetworkEvents = 0;
-                        if (it->flags & Readable)
-                        {
-                            lNetworkEvents |= FD_READ;
-                        }
-                        if (it->flags & Writable)
-                        {
-                            lNetworkEvents |= FD_WRITE;
-                        }
-                        if (it->flags & Acceptable)
-                        {
-                            lNetworkEvents |= FD_ACCEPT;
-                        }
-                        if (it->flags & Closed)
+                        int error = socket.error();
+#ifndef _WIN32
+                        // Connection reset while queued, the next one may be fine
+                        if ((error == ECONNABORTED) || (error == EINTR))
                         {
-                            lNetworkEvents |= FD_CLOSE;
+                            continue;
                         }
-                        auto eventIt = m_events.begin() + std::distance(m_sockets.begin(), it);
-                        ::WSAEventSelect(socket, *eventIt, lNetworkEvents);
 #endif
-#ifdef __linux__
-                        int events = 0;
-                        if (it->flags & Readable)
-                        {
-                            events |= EPOLLIN;
-                        };
-                        if (it->flags & Writable)
-                        {
-                            events |= EPOLLOUT;
-                        };
-                        if (it->flags & Acceptable)
-                        {
-                            events |= EPOLLIN;
-                        };
-                        // if (it->flags & Closed) - always handled (EPOLLERR | EPOLLHUP)
-                        epoll_event event = {};
-                        event.data.fd = socket;
-                        event.events = events;
-                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, socket, &event) != 0)
+                        if (error != Socket::ErrorWouldBlock)
                         {
-                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
+                            LOG_WARN("Reactor: accept failed! error=%d", error);
                         }
-#endif
-#ifdef TARGET_OS_MAC
-                        // TODO: [MG] - Mac OS X socket doesn't currently support updating flags
-#endif
+                        return;
+                    }
+                    accepted++;
+                    m_metrics.accepts.add();
+                    m_callback.onSocketAccepted(socket, client);
+                    if (m_sockets.find(socket) == nullptr)
+                    {
+                        return;
                     }
                 }
+#ifndef _WIN32
+                SocketData* sd = m_sockets.find(socket);
+                if (m_edgeTriggered && (sd != nullptr))
+                {
+                    sd->ready |= Acceptable;
+                    m_pending.push_back(socket);
+                }
+#endif
             }
 
             /// <summary>
-            /// Remove Socket
+            /// Emulate Reactor::Received: receive once, or until EAGAIN in edge-triggered mode.
             /// </summary>
-            /// <param name="socket"></param>
-            void removeSocket(const Socket& socket)
+            void receiveAll(Socket socket)
             {
-                LOCKGUARD(m_sockets_mutex);
-                LOG_TRACE("Reactor: Removing socket 0x%x", static_cast<int>(socket));
-                auto it = std::find(m_sockets.begin(), m_sockets.end(), socket);
-                if (it != m_sockets.end())
+                char buffer[4096];
+                for (;;)
                 {
-                    if (m_streaming)
+                    int received = socket.recv(buffer, sizeof(buffer));
+                    m_metrics.received(received, (received < 0) && (socket.error() == Socket::ErrorWouldBlock));
+                    if (received > 0)
                     {
-#ifdef _WIN32
-                        auto eventIt = m_events.begin() + std::distance(m_sockets.begin(), it);
-                        ::WSAEventSelect(it->socket, *eventIt, 0);
-                        ::WSACloseEvent(*eventIt);
-                        m_events.erase(eventIt);
-#endif
-#ifdef __linux__
-                        if (::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, socket, nullptr) != 0)
-                        {
-                            LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
-                        };
-#endif
-#ifdef TARGET_OS_MAC
-                        struct kevent event;
-                        bzero(&event, sizeof(event));
-                        event.ident = socket;
-                        EV_SET(&event, socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-                        if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
-                        {
-                            //// Already removed?
-                            LOG_ERROR("cannot delete fd=0x%x from kqueue!", event.ident);
-                        }
-                        EV_SET(&event, socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-                        if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
+                        m_callback.onSocketReceived(socket, buffer, static_cast<size_t>(received));
+                        if (m_edgeTriggered && (m_sockets.find(socket) != nullptr))
                         {
-                            //// Already removed?
-                            LOG_ERROR("cannot delete fd=0x%x from kqueue!", event.ident);
+                            continue;
                         }
-#endif
                     }
-                    m_sockets.erase(it);
+                    else if ((received == 0) || (socket.error() != Socket::ErrorWouldBlock))
+                    {
+                        m_callback.onSocketReceived(socket, nullptr, 0);
+                    }
+                    break;
                 }
             }
 
             /// <summary>
-            /// Start server
+            /// Edge-triggered mode: deliver readiness latched before the socket was re-armed.
+            /// Must be called with m_sockets_mutex held.
             /// </summary>
-            void start()
+            void dispatchPending()
             {
-                LOG_INFO("Reactor: Starting...");
-                startThread();
+                // Sockets that callbacks add meanwhile wait for the next iteration, after new events
+                std::vector<Socket> pending;
+                pending.swap(m_pending);
+                for (auto& socket : pending)
+                {
+                    SocketData* sd = m_sockets.find(socket);
+                    if (sd != nullptr)
+                    {
+                        dispatch(*sd, 0);
+                    }
+                }
             }
 
             /// <summary>
-            /// Stop server
+            /// Apply setCpu to the calling reactor thread.
             /// </summary>
-            void stop()
+            void pinThread()
             {
-                LOG_INFO("Reactor: Stopping...");
-                // If UDP server, then force-close it to stop.
-                if (!m_streaming)
+                if (m_cpu < 0)
                 {
-                    LOCKGUARD(m_sockets_mutex);
-                    if (m_sockets.size())
-                    {
-                        m_sockets[0].socket.close();
-                    }
+                    return;
                 }
-                joinThread();
-
-                // Only acquire the lock after the worker(s) have joined
-                LOCKGUARD(m_sockets_mutex);
-#ifdef _WIN32
-                for (auto& hEvent : m_events)
+#if defined(__linux__)
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(m_cpu, &cpus);
+                if (::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) != 0)
                 {
-                    ::WSACloseEvent(hEvent);
+                    LOG_WARN("Reactor: failed to pin thread to CPU %d", m_cpu);
                 }
-#else /* Linux and Mac */
-                for (auto& sd : m_sockets)
+#elif defined(_WIN32)
+                if ((m_cpu >= 64) || (::SetThreadAffinityMask(::GetCurrentThread(), 1ull << m_cpu) == 0))
                 {
-#  ifdef __linux__
-                    if (::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, sd.socket, nullptr) != 0)
-                    {
-                        LOG_ERROR("Reactor: epoll_ctl failed! errno=%d", errno);
-                    };
-#  endif
-#  ifdef TARGET_OS_MAC
-                    struct kevent event;
-                    bzero(&event, sizeof(event));
-                    event.ident = sd.socket;
-                    EV_SET(&event, sd.socket, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-                    if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
-                    {
-                        LOG_ERROR("Reactor: cannot delete fd=0x%x from kqueue!", event.ident);
-                    }
-                    EV_SET(&event, sd.socket, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-                    if (-1 == kevent(kq, &event, 1, NULL, 0, NULL))
-                    {
-                        LOG_ERROR("Reactor: cannot delete fd=0x%x from kqueue!", event.ident);
-                    }
-#  endif
+                    LOG_WARN("Reactor: failed to pin thread to CPU %d", m_cpu);
                 }
 #endif
-                // unbind
-                if (m_sockets.size())
-                {
-                    m_sockets[0].socket.close();
-                }
-                m_sockets.clear();
             }
 
             /// <summary>
@@ -1028,14 +3023,17 @@ namespace net
             virtual void onThread() override
             {
                 LOG_INFO("Reactor: Thread started");
+                current() = this;
+                pinThread();
+                runCommands();
 
                 if (!m_streaming)
                 {
                     // UDP Server implementation.
-                    // Process only one bound address at the moment, not many.
-                    // This single-threaded implementation passes UDP buffers
-                    // to onSocketReadable, that should decide what to do with
-                    // the socket. Callback may implement its own thread pool.
+                    // Every reactor receives from its own bound socket: several
+                    // reactors share a port with SO_REUSEPORT. The thread passes
+                    // the socket to onSocketReadable, that should decide what to
+                    // do with it. Callback may implement its own thread pool.
                     Socket socket = m_sockets[0].socket;
                     LOG_TRACE("Reactor: socket 0x%x receive loop started...", static_cast<int>(socket));
                     while (!shouldTerminate())
@@ -1049,6 +3047,8 @@ namespace net
 
                 while (!shouldTerminate())
                 {
+                    runCommands();
+                    runTimers();
                     // TCP and Unix Domain Server implementation.
                     //
                     // Use event-based notification with array of client
@@ -1059,9 +3059,11 @@ namespace net
                     // - Linux:   use epoll
                     // - Mac:     use kqueue
                     //
+                    // or io_uring on Linux, if selected with setBackend.
+                    //
 #ifdef _WIN32
                     DWORD dwResult = ::WSAWaitForMultipleEvents(static_cast<DWORD>(m_events.size()),
-                        m_events.data(), FALSE, 500, FALSE);
+                        m_events.data(), FALSE, static_cast<DWORD>(waitTimeout(500)), FALSE);
                     if (dwResult == WSA_WAIT_TIMEOUT)
                     {
                         continue;
@@ -1074,10 +3076,13 @@ namespace net
                     }
 
                     int index = dwResult - WSA_WAIT_EVENT_0;
+                    m_metrics.wakeups.add();
+                    m_metrics.events.add();
 
                     m_sockets_mutex.lock();
                     Socket socket = m_sockets[index].socket;
                     int flags = m_sockets[index].flags;
+                    SocketWaiter* waiter = m_sockets[index].waiter;
                     m_sockets_mutex.unlock();
 
                     WSANETWORKEVENTS ne;
@@ -1087,6 +3092,21 @@ namespace net
                         "(armed 0x%x)",
                         static_cast<int>(socket), index, ne.lNetworkEvents, flags);
 
+                    if (waiter != nullptr)
+                    {
+                        int ready = 0;
+                        ready |= (ne.lNetworkEvents & FD_READ) ? Readable : 0;
+                        ready |= (ne.lNetworkEvents & FD_WRITE) ? Writable : 0;
+                        ready |= (ne.lNetworkEvents & FD_CLOSE) ? Closed : 0;
+                        ready &= flags;
+                        if (ready != 0)
+                        {
+                            removeSocket(socket);
+                            waiter->onSocketReady(socket, ready);
+                        }
+                        continue;
+                    }
+
                     if ((flags & Readable) && (ne.lNetworkEvents & FD_READ))
                     {
                         m_callback.onSocketReadable(socket);
@@ -1099,97 +3119,147 @@ namespace net
                     {
                         m_callback.onSocketAcceptable(socket);
                     }
+                    if ((flags & Accepted) && (ne.lNetworkEvents & FD_ACCEPT))
+                    {
+                        // Reactor::Accepted on top of FD_ACCEPT, locked as dispatch() is on top of readiness
+                        auto lock = lockSockets();
+                        acceptAll(socket);
+                    }
                     if ((flags & Closed) && (ne.lNetworkEvents & FD_CLOSE))
                     {
                         m_callback.onSocketClosed(socket);
                     }
 #endif
 
+#ifdef HAVE_IO_URING
+                    if (m_backend == IoUring)
+                    {
+                        uringWait(waitTimeout(500));
+                        continue;
+                    }
+#endif
 #ifdef __linux__
                     {
-                        epoll_event events[4];
-                        int result = ::epoll_wait(m_epollFd, events, sizeof(events) / sizeof(events[0]), 500);
-                        if (result == 0)
-                            continue;
+                        int timeout = waitTimeout(500);
+                        {
+                            auto lock = lockSockets();
+                            if (!m_pending.empty())
+                            {
+                                timeout = 0;
+                            }
+                        }
+                        epoll_event* events = m_epollEvents.data();
+                        int result = ::epoll_wait(m_epollFd, events, static_cast<int>(m_epollEvents.size()), timeout);
                         if (result < 0)
                         {
-                            LOG_ERROR("Reactor: got errno=%d!", errno);
+                            if (errno != EINTR)
+                            {
+                                LOG_ERROR("Reactor: got errno=%d!", errno);
+                            }
                             continue;
                         };
-                        assert(result >= 1 && static_cast<size_t>(result) <= sizeof(events) / sizeof(events[0]));
+                        assert(static_cast<size_t>(result) <= m_epollEvents.size());
+                        m_metrics.wakeups.add();
+                        m_metrics.events.add(static_cast<uint64_t>(result));
+                        if (static_cast<size_t>(result) == m_epollEvents.size())
+                        {
+                            m_metrics.fullWakeups.add();
+                        }
 
-                        LOCKGUARD(m_sockets_mutex);
+                        auto lock = lockSockets();
+                        dispatchPending();
                         for (int i = 0; i < result; i++)
                         {
-                            auto it = std::find(m_sockets.begin(), m_sockets.end(), events[i].data.fd);
-                            assert(it != m_sockets.end());
-                            Socket socket = it->socket;
-                            int flags = it->flags;
+                            if (events[i].data.fd == m_wakeFd)
+                            {
+                                // Commands are applied before the next wait
+                                drainWake();
+                                continue;
+                            }
+                            SocketData* it = m_sockets.find(events[i].data.fd);
+                            if (it == nullptr)
+                            {
+                                // Removed by a callback earlier in this batch
+                                continue;
+                            }
 
                             LOG_TRACE("Reactor: Handling socket 0x%x active flags 0x%x (armed 0x%x)",
-                                static_cast<int>(socket), events[i].events, flags);
+                                static_cast<int>(it->socket), events[i].events, it->flags);
 
-                            if ((flags & Readable) && (events[i].events & EPOLLIN))
-                            {
-                                m_callback.onSocketReadable(socket);
-                            }
-                            if ((flags & Writable) && (events[i].events & EPOLLOUT))
+                            int active = 0;
+                            if (events[i].events & EPOLLIN)
                             {
-                                m_callback.onSocketWritable(socket);
+                                active |= Readable | Acceptable;
                             }
-                            if ((flags & Acceptable) && (events[i].events & EPOLLIN))
+                            if (events[i].events & EPOLLOUT)
                             {
-                                m_callback.onSocketAcceptable(socket);
+                                active |= Writable;
                             }
-                            if ((flags & Closed) && (events[i].events & (EPOLLHUP | EPOLLERR)))
+                            if (events[i].events & (EPOLLHUP | EPOLLERR))
                             {
-                                LOG_TRACE("Reactor: handling socket 0x%x onSocketClosed", static_cast<int>(socket));
-                                m_callback.onSocketClosed(socket);
+                                active |= Closed;
                             }
+                            dispatch(*it, active);
                         }
                     }
 #endif
 
 #if defined(TARGET_OS_MAC)
                     {
-                        LOCKGUARD(m_sockets_mutex);
-                        unsigned waitms = 500;  // never block for more than 500ms
+                        unsigned waitms = static_cast<unsigned>(waitTimeout(500));  // never block for more than 500ms
+                        {
+                            auto lock = lockSockets();
+                            if (!m_pending.empty())
+                            {
+                                waitms = 0;
+                            }
+                        }
                         struct timespec timeout;
                         timeout.tv_sec = waitms / 1000;
                         timeout.tv_nsec = (waitms % 1000) * 1000 * 1000;
 
-                        int nev = kevent(kq, NULL, 0, m_events, KQUEUE_SIZE, &timeout);
+                        int nev = kevent(kq, NULL, 0, m_events.data(), static_cast<int>(m_events.size()), &timeout);
+                        if (nev >= 0)
+                        {
+                            m_metrics.wakeups.add();
+                            m_metrics.events.add(static_cast<uint64_t>(nev));
+                            if (static_cast<size_t>(nev) == m_events.size())
+                            {
+                                m_metrics.fullWakeups.add();
+                            }
+                        }
+                        auto lock = lockSockets();
+                        dispatchPending();
                         for (int i = 0; i < nev; i++)
                         {
                             struct kevent& event = m_events[i];
                             int fd = (int)event.ident;
-                            auto it = std::find(m_sockets.begin(), m_sockets.end(), fd);
-                            assert(it != m_sockets.end());
+                            if (fd == m_wakeFd)
+                            {
+                                // Commands are applied before the next wait
+                                drainWake();
+                                continue;
+                            }
+                            SocketData* it = m_sockets.find(fd);
+                            if (it == nullptr)
+                            {
+                                // Removed by a callback earlier in this batch
+                                continue;
+                            }
                             Socket socket = it->socket;
-                            int flags = it->flags;
 
                             LOG_TRACE("Handling socket 0x%x active flags 0x%x (armed 0x%x)", static_cast<int>(socket),
                                 event.flags, event.fflags);
 
                             if (event.filter == EVFILT_READ)
                             {
-                                if (flags & Acceptable)
-                                {
-                                    m_callback.onSocketAcceptable(socket);
-                                }
-                                if (flags & Readable)
-                                {
-                                    m_callback.onSocketReadable(socket);
-                                }
+                                dispatch(*it, Readable | Acceptable);
                                 continue;
                             }
 
                             if (event.filter == EVFILT_WRITE)
                             {
-                                if (flags & Writable)
-                                {
-                                    m_callback.onSocketWritable(socket);
-                                }
+                                dispatch(*it, Writable);
                                 continue;
                             }
 
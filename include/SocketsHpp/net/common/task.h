@@ -0,0 +1,407 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+// Coroutines need C++20: this header is empty in earlier modes
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define SOCKETSHPP_HAVE_COROUTINES
+#endif
+#endif
+
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+#include "./connection_pool.h"
+#include "./socket_tools.h"
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        template <typename T>
+        class Task;
+
+        namespace detail
+        {
+            /// <summary>
+            /// State shared by promises of all Task types.
+            /// </summary>
+            struct TaskPromiseBase
+            {
+                std::coroutine_handle<> continuation;  // Coroutine awaiting the task
+                std::function<void()> onDone;          // Called once a started task completes, see Task::start
+                std::exception_ptr exception;
+
+                struct FinalAwaiter
+                {
+                    bool await_ready() noexcept { return false; }
+
+                    template <typename Promise>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                    {
+                        TaskPromiseBase& promise = handle.promise();
+                        if (promise.continuation)
+                        {
+                            return promise.continuation;
+                        }
+                        if (promise.onDone)
+                        {
+                            // The callback may destroy the task, nothing in the frame is used after it
+                            std::function<void()> onDone = std::move(promise.onDone);
+                            onDone();
+                        }
+                        return std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept {}
+                };
+
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                FinalAwaiter final_suspend() noexcept { return {}; }
+
+                void unhandled_exception() { exception = std::current_exception(); }
+
+                void rethrow()
+                {
+                    if (exception)
+                    {
+                        std::rethrow_exception(exception);
+                    }
+                }
+            };
+
+            template <typename T>
+            struct TaskPromise : TaskPromiseBase
+            {
+                std::optional<T> value;
+
+                Task<T> get_return_object();
+
+                template <typename U>
+                void return_value(U&& result)
+                {
+                    value.emplace(std::forward<U>(result));
+                }
+
+                T result()
+                {
+                    rethrow();
+                    return std::move(*value);
+                }
+            };
+
+            template <>
+            struct TaskPromise<void> : TaskPromiseBase
+            {
+                Task<void> get_return_object();
+
+                void return_void() {}
+
+                void result() { rethrow(); }
+            };
+        }
+
+        /// <summary>
+        /// Lazily started coroutine that produces a value. Awaiting the task runs it and
+        /// resumes the awaiting coroutine once it completes. Tasks of a reactor must only be
+        /// resumed by its thread, see readable(), writable() and sleepFor().
+        /// </summary>
+        template <typename T = void>
+        class Task
+        {
+        public:
+            using promise_type = detail::TaskPromise<T>;
+            using Handle = std::coroutine_handle<promise_type>;
+
+            Task() = default;
+
+            explicit Task(Handle handle) : m_handle(handle) {}
+
+            Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+            Task& operator=(Task&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset();
+                    m_handle = std::exchange(other.m_handle, nullptr);
+                }
+                return *this;
+            }
+
+            Task(const Task&) = delete;
+            Task& operator=(const Task&) = delete;
+
+            ~Task() { reset(); }
+
+            explicit operator bool() const { return static_cast<bool>(m_handle); }
+
+            bool done() const { return m_handle && m_handle.done(); }
+
+            /// <summary>
+            /// Run the task until it completes or suspends, without a coroutine awaiting it.
+            /// </summary>
+            /// <param name="onDone">Called by the thread that completes the task, unless it
+            /// completes before start() returns</param>
+            /// <returns>true if the task is done</returns>
+            bool start(std::function<void()> onDone)
+            {
+                assert(m_handle && !m_handle.done());
+                m_handle.resume();
+                if (m_handle.done())
+                {
+                    return true;
+                }
+                m_handle.promise().onDone = std::move(onDone);
+                return false;
+            }
+
+            /// <summary>
+            /// Result of the completed task. Rethrows the exception that escaped the coroutine.
+            /// </summary>
+            T result() { return m_handle.promise().result(); }
+
+            /// <summary>
+            /// Destroy the coroutine, suspended or completed.
+            /// </summary>
+            void reset()
+            {
+                if (m_handle)
+                {
+                    m_handle.destroy();
+                    m_handle = nullptr;
+                }
+            }
+
+            bool await_ready() const { return !m_handle || m_handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+            {
+                m_handle.promise().continuation = awaiting;
+                return m_handle;
+            }
+
+            T await_resume() { return m_handle.promise().result(); }
+
+        private:
+            Handle m_handle{ nullptr };
+        };
+
+        namespace detail
+        {
+            template <typename T>
+            Task<T> TaskPromise<T>::get_return_object()
+            {
+                return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+            }
+
+            inline Task<void> TaskPromise<void>::get_return_object()
+            {
+                return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+            }
+        }
+
+        /// <summary>
+        /// Awaitable socket state on a reactor. The socket must not be added to the reactor
+        /// otherwise, it is removed again once the coroutine resumes.
+        /// </summary>
+        class SocketAwaiter : private SocketWaiter
+        {
+        public:
+            SocketAwaiter(Reactor& reactor, Socket socket, int flags) :
+                m_reactor(reactor), m_socket(socket), m_flags(flags)
+            {
+            }
+
+            SocketAwaiter(const SocketAwaiter&) = delete;
+            SocketAwaiter& operator=(const SocketAwaiter&) = delete;
+
+            ~SocketAwaiter()
+            {
+                // Coroutine destroyed while suspended
+                if (m_handle)
+                {
+                    m_reactor.removeSocket(m_socket);
+                }
+            }
+
+            bool await_ready() const { return false; }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                m_handle = handle;
+                m_reactor.addWaiter(m_socket, m_flags, this);
+            }
+
+            /// <returns>Reactor::State bits that are active</returns>
+            int await_resume() const { return m_state; }
+
+        private:
+            void onSocketReady(Socket socket, int state) override
+            {
+                (void)socket;
+                m_state = state;
+                std::exchange(m_handle, nullptr).resume();
+            }
+
+            Reactor& m_reactor;
+            Socket m_socket;
+            int m_flags;
+            int m_state{ 0 };
+            std::coroutine_handle<> m_handle{ nullptr };
+        };
+
+        /// <summary>
+        /// Awaitable delay on a reactor.
+        /// </summary>
+        class SleepAwaiter
+        {
+        public:
+            SleepAwaiter(Reactor& reactor, std::chrono::milliseconds delay) : m_reactor(reactor), m_delay(delay) {}
+
+            SleepAwaiter(const SleepAwaiter&) = delete;
+            SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+
+            ~SleepAwaiter()
+            {
+                // Coroutine destroyed while suspended
+                if (m_handle)
+                {
+                    m_reactor.cancelTimer(m_timer);
+                }
+            }
+
+            bool await_ready() const { return m_delay.count() <= 0; }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                m_handle = handle;
+                m_timer = m_reactor.addTimer(m_delay, [this]() { std::exchange(m_handle, nullptr).resume(); });
+            }
+
+            void await_resume() const {}
+
+        private:
+            Reactor& m_reactor;
+            std::chrono::milliseconds m_delay;
+            Reactor::TimerId m_timer{ 0 };
+            std::coroutine_handle<> m_handle{ nullptr };
+        };
+
+        /// <summary>
+        /// Awaitable non-blocking connect on a reactor, see Connector.
+        /// </summary>
+        class ConnectAwaiter
+        {
+        public:
+            ConnectAwaiter(Reactor& reactor, SocketAddr const& addr, std::chrono::milliseconds timeout) :
+                m_connector(reactor), m_addr(addr), m_timeout(timeout)
+            {
+            }
+
+            ConnectAwaiter(const ConnectAwaiter&) = delete;
+            ConnectAwaiter& operator=(const ConnectAwaiter&) = delete;
+
+            bool await_ready()
+            {
+                // Failures right away complete the connect before the coroutine suspends
+                m_connector.connect(
+                    m_addr,
+                    [this](Socket socket, int error) {
+                        m_socket = socket;
+                        m_error = error;
+                        m_done = true;
+                        if (m_handle)
+                        {
+                            std::exchange(m_handle, nullptr).resume();
+                        }
+                    },
+                    m_timeout);
+                return m_done;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) { m_handle = handle; }
+
+            /// <returns>Connected non-blocking socket, invalid if the connect failed</returns>
+            Socket await_resume() const
+            {
+                if (m_error != 0)
+                {
+                    LOG_WARN("ConnectAwaiter: connect to %s failed, error=%d", m_addr.toString().c_str(), m_error);
+                }
+                return m_socket;
+            }
+
+        private:
+            // Cancels the connect if the coroutine is destroyed while suspended
+            Connector m_connector;
+            SocketAddr m_addr;
+            std::chrono::milliseconds m_timeout;
+            Socket m_socket;
+            int m_error{ 0 };
+            bool m_done{ false };
+            std::coroutine_handle<> m_handle{ nullptr };
+        };
+
+        /// <summary>
+        /// Suspend until the non-blocking socket has data, or the peer closes it.
+        /// Must be awaited on a reactor thread.
+        /// </summary>
+        /// <returns>Awaitable yielding Reactor::State bits that are active</returns>
+        inline SocketAwaiter readable(Socket socket)
+        {
+            assert(Reactor::current() != nullptr);
+            return SocketAwaiter(*Reactor::current(), socket, Reactor::Readable | Reactor::Closed);
+        }
+
+        /// <summary>
+        /// Suspend until the non-blocking socket can be written to, or the peer closes it.
+        /// Completes a non-blocking connect. Must be awaited on a reactor thread.
+        /// </summary>
+        /// <returns>Awaitable yielding Reactor::State bits that are active</returns>
+        inline SocketAwaiter writable(Socket socket)
+        {
+            assert(Reactor::current() != nullptr);
+            return SocketAwaiter(*Reactor::current(), socket, Reactor::Writable | Reactor::Closed);
+        }
+
+        /// <summary>
+        /// Connect a new stream socket to the address without blocking the reactor.
+        /// Must be awaited on a reactor thread.
+        /// </summary>
+        /// <param name="timeout">Deadline of the connect, 0 - none</param>
+        /// <returns>Awaitable yielding the connected non-blocking socket, invalid on failure</returns>
+        inline ConnectAwaiter connectTo(SocketAddr const& addr,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+        {
+            assert(Reactor::current() != nullptr);
+            return ConnectAwaiter(*Reactor::current(), addr, timeout);
+        }
+
+        /// <summary>
+        /// Suspend for the delay. Must be awaited on a reactor thread.
+        /// </summary>
+        inline SleepAwaiter sleepFor(std::chrono::milliseconds delay)
+        {
+            assert(Reactor::current() != nullptr);
+            return SleepAwaiter(*Reactor::current(), delay);
+        }
+
+    }
+}
+SOCKETSHPP_NS_END
+
+#endif
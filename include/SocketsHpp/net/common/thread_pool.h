@@ -0,0 +1,176 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Bounded pool of worker threads for blocking work that must not run on a reactor
+        /// thread. Every worker has its own queue: tasks are spread round-robin, a worker
+        /// takes tasks of its own queue in order and steals from the others when it runs out.
+        /// </summary>
+        class ThreadPool
+        {
+        public:
+            static constexpr size_t const DefaultCapacity = 1024;
+
+            /// <summary>
+            /// ThreadPool constructor
+            /// </summary>
+            /// <param name="numThreads">Number of worker threads, 0 - one per hardware thread</param>
+            /// <param name="capacity">Maximum number of queued tasks</param>
+            ThreadPool(size_t numThreads = 0, size_t capacity = DefaultCapacity) : m_capacity(capacity)
+            {
+                if (numThreads == 0)
+                {
+                    numThreads = std::thread::hardware_concurrency();
+                }
+                numThreads = (numThreads != 0) ? numThreads : 1;
+                for (size_t i = 0; i < numThreads; i++)
+                {
+                    m_queues.emplace_back(new Queue());
+                }
+            }
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            ~ThreadPool() { stop(); }
+
+            void start()
+            {
+                if (!m_threads.empty())
+                {
+                    return;
+                }
+                m_stop = false;
+                for (size_t i = 0; i < m_queues.size(); i++)
+                {
+                    m_threads.emplace_back([this, i]() { run(i); });
+                }
+            }
+
+            /// <summary>
+            /// Run queued tasks to completion and join the workers.
+            /// </summary>
+            void stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_idleMutex);
+                    m_stop = true;
+                }
+                m_idle.notify_all();
+                for (auto& thread : m_threads)
+                {
+                    thread.join();
+                }
+                m_threads.clear();
+            }
+
+            /// <summary>
+            /// Queue task. Safe to call from any thread.
+            /// </summary>
+            /// <returns>false if the pool is full, then the task is not run</returns>
+            bool submit(std::function<void()> task)
+            {
+                if (m_pending.fetch_add(1, std::memory_order_relaxed) >= m_capacity)
+                {
+                    m_pending.fetch_sub(1, std::memory_order_relaxed);
+                    return false;
+                }
+                Queue& queue = *m_queues[m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size()];
+                {
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    queue.tasks.push_back(std::move(task));
+                    // Counted under both locks: a worker can't take the task before it is counted,
+                    // nor miss it between its check and wait
+                    std::lock_guard<std::mutex> idleLock(m_idleMutex);
+                    m_queued++;
+                }
+                m_idle.notify_one();
+                return true;
+            }
+
+            size_t size() const { return m_queues.size(); }
+
+            /// <summary>
+            /// Number of tasks queued or running.
+            /// </summary>
+            size_t pending() const { return m_pending.load(std::memory_order_relaxed); }
+
+        private:
+            struct Queue
+            {
+                std::mutex mutex;
+                std::deque<std::function<void()>> tasks;
+            };
+
+            void run(size_t index)
+            {
+                std::function<void()> task;
+                for (;;)
+                {
+                    if (take(index, task))
+                    {
+                        task();
+                        task = nullptr;
+                        m_pending.fetch_sub(1, std::memory_order_release);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(m_idleMutex);
+                    m_idle.wait(lock, [this]() { return m_stop || (m_queued != 0); });
+                    if (m_stop && (m_queued == 0))
+                    {
+                        return;
+                    }
+                }
+            }
+
+            bool take(size_t index, std::function<void()>& task)
+            {
+                for (size_t i = 0; i < m_queues.size(); i++)
+                {
+                    Queue& queue = *m_queues[(index + i) % m_queues.size()];
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+                    if (queue.tasks.empty())
+                    {
+                        continue;
+                    }
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                    std::lock_guard<std::mutex> idleLock(m_idleMutex);
+                    m_queued--;
+                    return true;
+                }
+                return false;
+            }
+
+            std::vector<std::unique_ptr<Queue>> m_queues;
+            std::vector<std::thread> m_threads;
+            size_t m_capacity;
+            std::atomic<size_t> m_next{ 0 };
+            std::atomic<size_t> m_pending{ 0 };  // Queued or running, bounded by the capacity
+            std::mutex m_idleMutex;
+            std::condition_variable m_idle;
+            size_t m_queued{ 0 };  // Not taken by a worker yet, guarded by m_idleMutex
+            bool m_stop{ false };
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
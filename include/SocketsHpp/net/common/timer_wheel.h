@@ -0,0 +1,308 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+
+        /// <summary>
+        /// Hierarchical timer wheel with 1 ms ticks: 4 levels of 64 slots cover 2^24 ms (4.6 hours),
+        /// later timers wait in the last level and are placed again once it turns. Adding and
+        /// cancelling a timer is O(1): timers are linked into slots by index, their ids carry the
+        /// generation of the node, so that a stale id never cancels a reused node. A slot of a
+        /// higher level is spread over the lower levels when the wheel reaches it. Not thread-safe.
+        /// </summary>
+        class TimerWheel
+        {
+        public:
+            using Clock = std::chrono::steady_clock;
+            using TimerId = uint64_t;
+
+            static constexpr int const Levels = 4;
+            static constexpr int const SlotBits = 6;
+            static constexpr uint32_t const Slots = 1u << SlotBits;
+
+            TimerWheel() : m_start(Clock::now())
+            {
+                for (auto& level : m_slots)
+                {
+                    for (auto& slot : level)
+                    {
+                        slot = npos;
+                    }
+                }
+            }
+
+            TimerWheel(const TimerWheel&) = delete;
+            TimerWheel& operator=(const TimerWheel&) = delete;
+
+            size_t size() const { return m_size; }
+
+            bool empty() const { return m_size == 0; }
+
+            /// <summary>
+            /// Run callback once the delay expires, on the first advance() past it.
+            /// </summary>
+            /// <returns>Timer id for cancel, never 0</returns>
+            TimerId add(std::chrono::milliseconds delay, std::function<void()> callback)
+            {
+                // Round up to whole ticks, so that the timer never runs early. A tick that has
+                // been advanced to already is not revisited.
+                auto deadline = (Clock::now() - m_start) + std::max(delay, std::chrono::milliseconds(0));
+                uint64_t expiry = static_cast<uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(deadline).count());
+                expiry = std::max(expiry, m_now + 1);
+
+                uint32_t index;
+                if (m_free != npos)
+                {
+                    index = m_free;
+                    m_free = m_nodes[index].next;
+                }
+                else
+                {
+                    index = static_cast<uint32_t>(m_nodes.size());
+                    m_nodes.emplace_back();
+                }
+                Node& node = m_nodes[index];
+                node.expiry = expiry;
+                node.callback = std::move(callback);
+                node.active = true;
+                link(index);
+                m_size++;
+                return (static_cast<uint64_t>(node.generation) << 32) | (static_cast<uint64_t>(index) + 1);
+            }
+
+            /// <summary>
+            /// Cancel timer that has not expired yet, ids of expired timers are ignored.
+            /// </summary>
+            void cancel(TimerId id)
+            {
+                uint32_t index = static_cast<uint32_t>(id & 0xffffffffu) - 1;
+                if ((id == 0) || (index >= m_nodes.size()))
+                {
+                    return;
+                }
+                Node& node = m_nodes[index];
+                if (!node.active || (node.generation != static_cast<uint32_t>(id >> 32)))
+                {
+                    return;
+                }
+                unlink(index);
+                release(index);
+            }
+
+            /// <summary>
+            /// Run callbacks of timers expired by the time point. Callbacks may add and
+            /// cancel timers.
+            /// </summary>
+            void advance(Clock::time_point time)
+            {
+                uint64_t target = tickOf(time);
+                while (m_now < target)
+                {
+                    if (m_size == 0)
+                    {
+                        m_now = target;
+                        return;
+                    }
+                    // Nothing is due or moves down before the next occupied slot
+                    m_now = std::min(nextTick(), target);
+                    for (int level = Levels - 1; level > 0; level--)
+                    {
+                        if ((m_now & ((uint64_t(1) << (level * SlotBits)) - 1)) == 0)
+                        {
+                            cascade(level, static_cast<uint32_t>((m_now >> (level * SlotBits)) & (Slots - 1)));
+                        }
+                    }
+                    expire(static_cast<uint32_t>(m_now & (Slots - 1)));
+                }
+            }
+
+            /// <summary>
+            /// Time until the wheel has to advance next, no later than the next expiry.
+            /// </summary>
+            /// <param name="maxMs">Timeout if there are no timers</param>
+            /// <returns>Milliseconds, 0 if a timer is due</returns>
+            int timeout(int maxMs) const
+            {
+                if (m_size == 0)
+                {
+                    return maxMs;
+                }
+                uint64_t now = tickOf(Clock::now());
+                uint64_t next = nextTick();
+                if (next <= now)
+                {
+                    return 0;
+                }
+                return static_cast<int>(std::min<uint64_t>(next - now, static_cast<uint64_t>(maxMs)));
+            }
+
+        private:
+            static constexpr uint32_t const npos = static_cast<uint32_t>(-1);
+
+            struct Node
+            {
+                uint64_t expiry{ 0 };  // Tick
+                uint32_t prev{ npos };
+                uint32_t next{ npos };  // Next node of the slot, or of the free list
+                uint32_t generation{ 0 };
+                int level{ 0 };
+                uint32_t slot{ 0 };
+                bool active{ false };
+                std::function<void()> callback;
+            };
+
+            /// <summary>
+            /// Last tick reached by the time point.
+            /// </summary>
+            uint64_t tickOf(Clock::time_point time) const
+            {
+                auto elapsed = time - m_start;
+                if (elapsed <= Clock::duration::zero())
+                {
+                    return 0;
+                }
+                return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+            }
+
+            void link(uint32_t index)
+            {
+                Node& node = m_nodes[index];
+                uint64_t delta = node.expiry - m_now;
+                // Timers past the range of the wheel wait in the last level
+                uint64_t expiry = node.expiry;
+                int level = 0;
+                while ((level < Levels - 1) && (delta >= (uint64_t(1) << ((level + 1) * SlotBits))))
+                {
+                    level++;
+                }
+                if (delta >= (uint64_t(1) << (Levels * SlotBits)))
+                {
+                    expiry = m_now + (uint64_t(1) << (Levels * SlotBits)) - 1;
+                }
+                uint32_t slot = static_cast<uint32_t>((expiry >> (level * SlotBits)) & (Slots - 1));
+                node.level = level;
+                node.slot = slot;
+                node.prev = npos;
+                node.next = m_slots[level][slot];
+                if (node.next != npos)
+                {
+                    m_nodes[node.next].prev = index;
+                }
+                m_slots[level][slot] = index;
+                m_occupied[level] |= (uint64_t(1) << slot);
+            }
+
+            void unlink(uint32_t index)
+            {
+                Node& node = m_nodes[index];
+                if (node.prev != npos)
+                {
+                    m_nodes[node.prev].next = node.next;
+                }
+                else
+                {
+                    m_slots[node.level][node.slot] = node.next;
+                    if (node.next == npos)
+                    {
+                        m_occupied[node.level] &= ~(uint64_t(1) << node.slot);
+                    }
+                }
+                if (node.next != npos)
+                {
+                    m_nodes[node.next].prev = node.prev;
+                }
+            }
+
+            void release(uint32_t index)
+            {
+                Node& node = m_nodes[index];
+                node.active = false;
+                node.generation++;
+                node.callback = nullptr;
+                node.next = m_free;
+                m_free = index;
+                m_size--;
+            }
+
+            /// <summary>
+            /// Place timers of a higher level slot again, relative to the current tick.
+            /// </summary>
+            void cascade(int level, uint32_t slot)
+            {
+                uint32_t index = m_slots[level][slot];
+                m_slots[level][slot] = npos;
+                m_occupied[level] &= ~(uint64_t(1) << slot);
+                while (index != npos)
+                {
+                    uint32_t next = m_nodes[index].next;
+                    link(index);
+                    index = next;
+                }
+            }
+
+            void expire(uint32_t slot)
+            {
+                // Pop one at a time: the callback may cancel other timers of the slot
+                while (m_slots[0][slot] != npos)
+                {
+                    uint32_t index = m_slots[0][slot];
+                    unlink(index);
+                    std::function<void()> callback = std::move(m_nodes[index].callback);
+                    release(index);
+                    callback();
+                }
+            }
+
+            /// <summary>
+            /// Earliest tick after the current one with an occupied level 0 slot, or that
+            /// moves down an occupied slot of a higher level.
+            /// </summary>
+            uint64_t nextTick() const
+            {
+                uint64_t result = UINT64_MAX;
+                for (int level = 0; level < Levels; level++)
+                {
+                    if (m_occupied[level] == 0)
+                    {
+                        continue;
+                    }
+                    int shift = level * SlotBits;
+                    uint64_t position = m_now >> shift;
+                    // First occupied slot after the current position, the current one last
+                    uint32_t start = static_cast<uint32_t>((position + 1) & (Slots - 1));
+                    uint32_t distance = 0;
+                    while (!(m_occupied[level] & (uint64_t(1) << ((start + distance) & (Slots - 1)))))
+                    {
+                        distance++;
+                    }
+                    uint64_t tick = (position + 1 + distance) << shift;
+                    result = std::min(result, tick);
+                }
+                return result;
+            }
+
+            Clock::time_point m_start;
+            uint64_t m_now{ 0 };  // Last tick advanced to
+            std::vector<Node> m_nodes;
+            uint32_t m_free{ npos };  // Free list of nodes, linked by Node::next
+            size_t m_size{ 0 };
+            uint32_t m_slots[Levels][Slots];  // First node of every slot
+            uint64_t m_occupied[Levels]{};    // Bit of every slot that has nodes
+        };
+
+    }
+}
+SOCKETSHPP_NS_END
@@ -0,0 +1,676 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include <SocketsHpp/config.h>
+
+// TLS on top of OpenSSL 1.1.1+ or BoringSSL. The backend needs libssl, so it is opt-in:
+// define HAVE_OPENSSL and link OpenSSL::SSL. Without it contexts fail to load and
+// no session can be created, servers keep speaking plaintext only.
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "./socket_tools.h"
+
+#ifdef HAVE_OPENSSL
+#  include <openssl/bio.h>
+#  include <openssl/err.h>
+#  include <openssl/ssl.h>
+#  include <openssl/x509v3.h>
+#endif
+
+SOCKETSHPP_NS_BEGIN
+namespace net
+{
+    namespace utils
+    {
+        class TlsSession;
+
+        /// <summary>
+        /// TLS configuration shared by the connections of a listener or a client: certificate,
+        /// peer verification, kernel offload and session resumption. Thread-safe once configured,
+        /// sessions are created by any reactor thread. Must be owned by std::shared_ptr, every
+        /// session keeps its context alive.
+        /// </summary>
+        class TlsContext : public std::enable_shared_from_this<TlsContext>
+        {
+        public:
+            enum Role
+            {
+                Server,  // Accepts connections, needs a certificate
+                Client   // Connects to servers, caches their sessions for resumption
+            };
+
+            explicit TlsContext(Role role = Server) : m_role(role)
+            {
+#ifdef HAVE_OPENSSL
+                m_ctx = SSL_CTX_new((role == Server) ? TLS_server_method() : TLS_client_method());
+                if (m_ctx == nullptr)
+                {
+                    LOG_ERROR("TlsContext: failed to create context");
+                    return;
+                }
+                SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+                // Sends may be completed by a later call with a moved buffer, see TlsSession::write
+                SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#  ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+                // Peers that close without close_notify end the stream like plain TCP
+                SSL_CTX_set_options(m_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#  endif
+                setKernelOffload(true);
+                setSessionTickets(true);
+#else
+                LOG_ERROR("TlsContext: built without TLS support, define HAVE_OPENSSL");
+#endif
+            }
+
+            TlsContext(const TlsContext&) = delete;
+            TlsContext& operator=(const TlsContext&) = delete;
+
+            ~TlsContext()
+            {
+#ifdef HAVE_OPENSSL
+                for (auto& entry : m_sessions)
+                {
+                    SSL_SESSION_free(entry.second);
+                }
+                SSL_CTX_free(m_ctx);
+#endif
+            }
+
+            Role role() const { return m_role; }
+
+            /// <summary>
+            /// Whether the context was created, sessions can only be made by a valid one.
+            /// </summary>
+            bool valid() const { return m_ctx != nullptr; }
+
+            /// <summary>
+            /// Load the certificate chain and the private key, both PEM files. Required by servers.
+            /// </summary>
+            bool setCertificate(std::string const& certFile, std::string const& keyFile)
+            {
+#ifdef HAVE_OPENSSL
+                if ((m_ctx == nullptr) || (SSL_CTX_use_certificate_chain_file(m_ctx, certFile.c_str()) != 1) ||
+                    (SSL_CTX_use_PrivateKey_file(m_ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1) ||
+                    (SSL_CTX_check_private_key(m_ctx) != 1))
+                {
+                    LOG_ERROR("TlsContext: failed to load certificate %s", certFile.c_str());
+                    ERR_clear_error();
+                    return false;
+                }
+                return true;
+#else
+                (void)certFile;
+                (void)keyFile;
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Verify the certificate of the peer. Clients also check that it matches the server
+            /// name. Peers are not verified by default.
+            /// </summary>
+            /// <param name="caFile">PEM file of trusted certificates, empty - the system store</param>
+            bool setVerifyPeer(std::string const& caFile = std::string())
+            {
+#ifdef HAVE_OPENSSL
+                if ((m_ctx == nullptr) ||
+                    ((caFile.empty() ? SSL_CTX_set_default_verify_paths(m_ctx)
+                                     : SSL_CTX_load_verify_locations(m_ctx, caFile.c_str(), nullptr)) != 1))
+                {
+                    LOG_ERROR("TlsContext: failed to load trusted certificates %s", caFile.c_str());
+                    ERR_clear_error();
+                    return false;
+                }
+                int mode = SSL_VERIFY_PEER | ((m_role == Server) ? SSL_VERIFY_FAIL_IF_NO_PEER_CERT : 0);
+                SSL_CTX_set_verify(m_ctx, mode, nullptr);
+                m_verifyPeer = true;
+                return true;
+#else
+                (void)caFile;
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Hand the record layer over to kernel TLS once the handshake is done, on Linux with
+            /// the tls module loaded and a cipher the kernel supports. Sends then encrypt in the
+            /// kernel: gather writes and sendfile keep their zero-copy paths. Enabled by default,
+            /// sessions fall back to user space encryption where the kernel can't take over.
+            /// </summary>
+            void setKernelOffload(bool enable)
+            {
+#if defined(HAVE_OPENSSL) && defined(SSL_OP_ENABLE_KTLS)
+                if (m_ctx == nullptr)
+                {
+                    return;
+                }
+                if (enable)
+                {
+                    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+                }
+                else
+                {
+                    SSL_CTX_clear_options(m_ctx, SSL_OP_ENABLE_KTLS);
+                }
+#else
+                (void)enable;
+#endif
+            }
+
+            /// <summary>
+            /// Resume sessions with tickets, enabled by default. Servers issue tickets encrypted
+            /// with keys of this context, shared by all its listeners and reactors. Clients keep
+            /// the latest session of every server name and offer it on the next connect.
+            /// </summary>
+            void setSessionTickets(bool enable)
+            {
+#ifdef HAVE_OPENSSL
+                if (m_ctx == nullptr)
+                {
+                    return;
+                }
+                if (m_role == Server)
+                {
+                    static unsigned char const kSessionContext[] = "SocketsHpp";
+                    SSL_CTX_set_session_id_context(m_ctx, kSessionContext, sizeof(kSessionContext) - 1);
+                    SSL_CTX_set_session_cache_mode(m_ctx, enable ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+                    if (enable)
+                    {
+                        SSL_CTX_clear_options(m_ctx, SSL_OP_NO_TICKET);
+                    }
+                    else
+                    {
+                        SSL_CTX_set_options(m_ctx, SSL_OP_NO_TICKET);
+                    }
+#  ifndef OPENSSL_IS_BORINGSSL
+                    SSL_CTX_set_num_tickets(m_ctx, enable ? 2 : 0);
+#  endif
+                }
+                else
+                {
+                    SSL_CTX_set_session_cache_mode(
+                        m_ctx, enable ? (SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE) : SSL_SESS_CACHE_OFF);
+                    SSL_CTX_sess_set_new_cb(m_ctx, enable ? &TlsContext::onNewSession : nullptr);
+                }
+#endif
+                m_sessionTickets = enable;
+            }
+
+            /// <summary>
+            /// Start the server side of a connection accepted on a non-blocking socket.
+            /// </summary>
+            /// <returns>Session that has to complete its handshake, nullptr on failure</returns>
+            std::unique_ptr<TlsSession> accept(Socket socket);
+
+            /// <summary>
+            /// Start the client side of a connection. A cached session of the server is offered
+            /// for resumption.
+            /// </summary>
+            /// <param name="serverName">Sent as SNI and verified, unless it is an IP address</param>
+            /// <returns>Session that has to complete its handshake, nullptr on failure</returns>
+            std::unique_ptr<TlsSession> connect(Socket socket, std::string const& serverName);
+
+            /// <summary>
+            /// Server names with a session cached by the client.
+            /// </summary>
+            size_t cachedSessions() const
+            {
+                std::lock_guard<std::mutex> lock(m_sessionsMutex);
+                return m_sessions.size();
+            }
+
+        private:
+            friend class TlsSession;
+
+#ifdef HAVE_OPENSSL
+            static int onNewSession(SSL* ssl, SSL_SESSION* session);
+
+            /// <summary>
+            /// Take the cached session of the server, the caller owns the reference.
+            /// </summary>
+            SSL_SESSION* findSession(std::string const& serverName)
+            {
+                std::lock_guard<std::mutex> lock(m_sessionsMutex);
+                auto it = m_sessions.find(serverName);
+                if (it == m_sessions.end())
+                {
+                    return nullptr;
+                }
+                SSL_SESSION_up_ref(it->second);
+                return it->second;
+            }
+
+            void storeSession(std::string const& serverName, SSL_SESSION* session)
+            {
+                std::lock_guard<std::mutex> lock(m_sessionsMutex);
+                SSL_SESSION*& cached = m_sessions[serverName];
+                if (cached != nullptr)
+                {
+                    SSL_SESSION_free(cached);
+                }
+                cached = session;
+            }
+
+            SSL_CTX* m_ctx{ nullptr };
+            std::unordered_map<std::string, SSL_SESSION*> m_sessions;
+#else
+            void* m_ctx{ nullptr };
+            std::unordered_map<std::string, void*> m_sessions;
+#endif
+            Role m_role;
+            bool m_verifyPeer{ false };
+            bool m_sessionTickets{ true };
+            mutable std::mutex m_sessionsMutex;
+        };
+
+        /// <summary>
+        /// TLS connection on a non-blocking socket, driven by reactor events. The handshake and
+        /// every read or write return at once: wouldBlock() tells that the socket has to become
+        /// readable (wantsRead) or writable first. Only one thread may use a session.
+        /// </summary>
+        class TlsSession
+        {
+        public:
+            enum Status
+            {
+                Ok,         // Done
+                WantRead,   // Retry once the socket is readable
+                WantWrite,  // Retry once the socket is writable
+                Closed,     // Peer closed the connection
+                Failed      // Handshake or connection failed, the connection has to be closed
+            };
+
+            // Largest TLS record: the gather buffer collects small writes up to one record
+            static constexpr size_t const MaxRecordSize = 16 * 1024;
+
+            TlsSession(const TlsSession&) = delete;
+            TlsSession& operator=(const TlsSession&) = delete;
+
+            ~TlsSession()
+            {
+#ifdef HAVE_OPENSSL
+                SSL_free(m_ssl);
+#endif
+            }
+
+            Socket socket() const { return m_socket; }
+
+            TlsContext& context() const { return *m_context; }
+
+            /// <summary>
+            /// Continue the handshake. Data of the peer that arrives with its last flight stays
+            /// buffered for read().
+            /// </summary>
+            Status handshake()
+            {
+#ifdef HAVE_OPENSSL
+                ERR_clear_error();
+                int result = SSL_do_handshake(m_ssl);
+                m_status = (result == 1) ? Ok : status(result);
+                if (m_status == Ok)
+                {
+                    m_established = true;
+                    LOG_TRACE("TlsSession: [fd=0x%llx] %s %s%s%s", static_cast<unsigned long long>(m_socket.m_sock),
+                        SSL_get_version(m_ssl), SSL_get_cipher_name(m_ssl), resumed() ? ", resumed" : "",
+                        kernelSend() ? ", kernel TLS" : "");
+                }
+                else if (m_status == Failed)
+                {
+                    LOG_WARN("TlsSession: [fd=0x%llx] handshake failed", static_cast<unsigned long long>(m_socket.m_sock));
+                }
+                return m_status;
+#else
+                return Failed;
+#endif
+            }
+
+            /// <summary>
+            /// Whether the handshake is complete.
+            /// </summary>
+            bool established() const { return m_established; }
+
+            /// <summary>
+            /// Status of the last call, WantRead or WantWrite if it would block.
+            /// </summary>
+            Status status() const { return m_status; }
+
+            bool wouldBlock() const { return (m_status == WantRead) || (m_status == WantWrite); }
+
+            bool wantsWrite() const { return m_status == WantWrite; }
+
+            /// <summary>
+            /// Read decrypted data, like Socket::recv.
+            /// </summary>
+            /// <returns>Bytes read, 0 if the peer closed, -1 on error or if it would block</returns>
+            int read(void* buffer, size_t size)
+            {
+#ifdef HAVE_OPENSSL
+                ERR_clear_error();
+                int result = SSL_read(m_ssl, buffer, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+                if (result > 0)
+                {
+                    m_status = Ok;
+                    return result;
+                }
+                m_status = status(result);
+                return (m_status == Closed) ? 0 : -1;
+#else
+                (void)buffer;
+                (void)size;
+                return -1;
+#endif
+            }
+
+            /// <summary>
+            /// Encrypt and send data, like Socket::send. A write that would block has to be
+            /// retried with the same data, a longer buffer is allowed.
+            /// </summary>
+            /// <returns>Bytes sent, -1 on error or if it would block</returns>
+            int write(void const* data, size_t size)
+            {
+#ifdef HAVE_OPENSSL
+                if (size == 0)
+                {
+                    return 0;
+                }
+                ERR_clear_error();
+                int result = SSL_write(m_ssl, data, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+                if (result > 0)
+                {
+                    m_status = Ok;
+                    return result;
+                }
+                m_status = status(result);
+                return -1;
+#else
+                (void)data;
+                (void)size;
+                return -1;
+#endif
+            }
+
+            /// <summary>
+            /// Send all of the data unless the socket blocks, like Socket::writeall.
+            /// </summary>
+            size_t writeall(std::string_view data)
+            {
+                size_t total = 0;
+                while (total < data.size())
+                {
+                    int sent = write(data.data() + total, data.size() - total);
+                    if (sent <= 0)
+                    {
+                        break;
+                    }
+                    total += static_cast<size_t>(sent);
+                }
+                return total;
+            }
+
+            /// <summary>
+            /// Gather write, like Socket::sendv. With kernel TLS it is one system call, otherwise
+            /// small buffers are copied together, so that they go out as one record.
+            /// </summary>
+            /// <returns>Bytes sent, -1 on error or if it would block</returns>
+            int writev(Socket::IoVec const* vecs, size_t count)
+            {
+                if (kernelSend())
+                {
+                    int sent = m_socket.sendv(vecs, count);
+                    m_status = (sent >= 0) ? Ok : ((m_socket.error() == Socket::ErrorWouldBlock) ? WantWrite : Failed);
+                    return sent;
+                }
+                size_t total = 0;
+                size_t i = 0;
+                while (i < count)
+                {
+                    char const* data = vecData(vecs[i]);
+                    size_t size = vecSize(vecs[i]);
+                    if ((size < MaxRecordSize) && (i + 1 < count))
+                    {
+                        // Same data is gathered again if the write has to be retried
+                        m_gather.clear();
+                        while ((i < count) && (m_gather.size() + vecSize(vecs[i]) <= MaxRecordSize))
+                        {
+                            m_gather.append(vecData(vecs[i]), vecSize(vecs[i]));
+                            i++;
+                        }
+                        data = m_gather.data();
+                        size = m_gather.size();
+                    }
+                    else
+                    {
+                        i++;
+                    }
+                    int sent = write(data, size);
+                    if (sent < 0)
+                    {
+                        return (total > 0) ? static_cast<int>(total) : -1;
+                    }
+                    total += static_cast<size_t>(sent);
+                    if (static_cast<size_t>(sent) < size)
+                    {
+                        break;
+                    }
+                }
+                return static_cast<int>(total);
+            }
+
+            /// <summary>
+            /// Send part of a file, like Socket::sendfile. Only kernel TLS can send files
+            /// directly, other sessions read them into memory and write() them.
+            /// </summary>
+            int64_t sendfile(Socket::FileHandle file, uint64_t& offset, size_t count)
+            {
+                if (!kernelSend())
+                {
+                    m_status = Failed;
+                    return -1;
+                }
+                int64_t sent = m_socket.sendfile(file, offset, count);
+                m_status = (sent >= 0) ? Ok : ((m_socket.error() == Socket::ErrorWouldBlock) ? WantWrite : Failed);
+                return sent;
+            }
+
+            /// <summary>
+            /// Whether records are encrypted by the kernel, raw socket sends are then allowed.
+            /// </summary>
+            bool kernelSend() const
+            {
+#if defined(HAVE_OPENSSL) && defined(BIO_get_ktls_send)
+                return m_established && (BIO_get_ktls_send(SSL_get_wbio(m_ssl)) != 0);
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Whether records are decrypted by the kernel. Reads still go through read().
+            /// </summary>
+            bool kernelReceive() const
+            {
+#if defined(HAVE_OPENSSL) && defined(BIO_get_ktls_recv)
+                return m_established && (BIO_get_ktls_recv(SSL_get_rbio(m_ssl)) != 0);
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Whether the handshake resumed an earlier session.
+            /// </summary>
+            bool resumed() const
+            {
+#ifdef HAVE_OPENSSL
+                return m_established && (SSL_session_reused(m_ssl) == 1);
+#else
+                return false;
+#endif
+            }
+
+            /// <summary>
+            /// Send close_notify, without waiting for the one of the peer. Done before the socket
+            /// is shut down, so that the peer can tell the end of the stream from a truncation.
+            /// </summary>
+            void shutdown()
+            {
+#ifdef HAVE_OPENSSL
+                if (m_established)
+                {
+                    ERR_clear_error();
+                    SSL_shutdown(m_ssl);
+                    ERR_clear_error();
+                }
+#endif
+            }
+
+        private:
+            friend class TlsContext;
+
+#ifdef HAVE_OPENSSL
+            TlsSession(std::shared_ptr<TlsContext> context, Socket socket, SSL* ssl, std::string serverName) :
+                m_context(std::move(context)), m_socket(socket), m_ssl(ssl), m_serverName(std::move(serverName))
+            {
+                SSL_set_app_data(m_ssl, this);
+            }
+
+            Status status(int result)
+            {
+                int error = SSL_get_error(m_ssl, result);
+                switch (error)
+                {
+                case SSL_ERROR_WANT_READ:
+                    return WantRead;
+                case SSL_ERROR_WANT_WRITE:
+                    return WantWrite;
+                case SSL_ERROR_ZERO_RETURN:
+                    return Closed;
+                case SSL_ERROR_SYSCALL:
+                    // End of stream without close_notify, or a socket error
+                    ERR_clear_error();
+                    return ((result == 0) || (m_socket.error() == 0)) ? Closed : Failed;
+                default:
+                    ERR_clear_error();
+                    return Failed;
+                }
+            }
+#endif
+
+            static char const* vecData(Socket::IoVec const& vec)
+            {
+#ifdef _WIN32
+                return vec.buf;
+#else
+                return static_cast<char const*>(vec.iov_base);
+#endif
+            }
+
+            static size_t vecSize(Socket::IoVec const& vec)
+            {
+#ifdef _WIN32
+                return vec.len;
+#else
+                return vec.iov_len;
+#endif
+            }
+
+            std::shared_ptr<TlsContext> m_context;
+            Socket m_socket;
+#ifdef HAVE_OPENSSL
+            SSL* m_ssl{ nullptr };
+#endif
+            std::string m_serverName;  // Key of the session cache of clients
+            std::string m_gather;      // Small buffers of writev, copied into one record
+            Status m_status{ Ok };
+            bool m_established{ false };
+        };
+
+        inline std::unique_ptr<TlsSession> TlsContext::accept(Socket socket)
+        {
+#ifdef HAVE_OPENSSL
+            SSL* ssl = (m_ctx != nullptr) ? SSL_new(m_ctx) : nullptr;
+            if ((ssl == nullptr) || (SSL_set_fd(ssl, static_cast<int>(socket.m_sock)) != 1))
+            {
+                LOG_ERROR("TlsContext: failed to create server session");
+                SSL_free(ssl);
+                ERR_clear_error();
+                return nullptr;
+            }
+            SSL_set_accept_state(ssl);
+            return std::unique_ptr<TlsSession>(new TlsSession(shared_from_this(), socket, ssl, std::string()));
+#else
+            (void)socket;
+            return nullptr;
+#endif
+        }
+
+        inline std::unique_ptr<TlsSession> TlsContext::connect(Socket socket, std::string const& serverName)
+        {
+#ifdef HAVE_OPENSSL
+            SSL* ssl = (m_ctx != nullptr) ? SSL_new(m_ctx) : nullptr;
+            if ((ssl == nullptr) || (SSL_set_fd(ssl, static_cast<int>(socket.m_sock)) != 1))
+            {
+                LOG_ERROR("TlsContext: failed to create client session");
+                SSL_free(ssl);
+                ERR_clear_error();
+                return nullptr;
+            }
+            SSL_set_connect_state(ssl);
+            // IP addresses are neither sent as SNI nor matched against the certificate names
+            ASN1_OCTET_STRING* ip = a2i_IPADDRESS(serverName.c_str());
+            if (ip != nullptr)
+            {
+                ASN1_OCTET_STRING_free(ip);
+            }
+            else if (!serverName.empty())
+            {
+                SSL_set_tlsext_host_name(ssl, serverName.c_str());
+                if (m_verifyPeer)
+                {
+                    SSL_set1_host(ssl, serverName.c_str());
+                }
+            }
+            if (m_sessionTickets)
+            {
+                SSL_SESSION* session = findSession(serverName);
+                if (session != nullptr)
+                {
+                    SSL_set_session(ssl, session);
+                    SSL_SESSION_free(session);
+                }
+            }
+            return std::unique_ptr<TlsSession>(new TlsSession(shared_from_this(), socket, ssl, serverName));
+#else
+            (void)socket;
+            (void)serverName;
+            return nullptr;
+#endif
+        }
+
+#ifdef HAVE_OPENSSL
+        inline int TlsContext::onNewSession(SSL* ssl, SSL_SESSION* session)
+        {
+            TlsSession* owner = static_cast<TlsSession*>(SSL_get_app_data(ssl));
+            if (owner == nullptr)
+            {
+                return 0;
+            }
+            // Keeps the reference: TLS 1.3 servers send tickets after the handshake, the latest wins
+            owner->m_context->storeSession(owner->m_serverName, session);
+            return 1;
+        }
+#endif
+
+    }
+}
+SOCKETSHPP_NS_END
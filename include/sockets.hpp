@@ -6,8 +6,17 @@
 
 // Socket Tools and common Socket Server
 #include "SocketsHpp/net/common/socket_tools.h"
+#include "SocketsHpp/net/common/connection_pool.h"
+#include "SocketsHpp/net/common/datagram_batch.h"
+#include "SocketsHpp/net/common/reactor_pool.h"
+#include "SocketsHpp/net/common/thread_pool.h"
+#include "SocketsHpp/net/common/tls.h"
 #include "SocketsHpp/net/common/socket_server.h"
+#include "SocketsHpp/net/common/task.h"
 
 // HTTP base and HTTP file server
 #include "SocketsHpp/http/server/http_server.h"
 #include "SocketsHpp/http/server/http_file_server.h"
+
+// HTTP client
+#include "SocketsHpp/http/client/http_client.h"
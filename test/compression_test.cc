@@ -0,0 +1,455 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#  include <brotli/decode.h>
+#endif
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::http::server;
+using namespace std;
+
+namespace testing
+{
+    /**
+     * @brief Decode gzip or zlib data.
+     * @return Decoded data, "<error>" if it is malformed or truncated.
+     */
+    static std::string Inflate(std::string const& data)
+    {
+        z_stream stream{};
+        // 32: detect gzip or zlib header
+        if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        {
+            return "<error>";
+        }
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        std::string result;
+        char buffer[16384];
+        int status = Z_OK;
+        while (status == Z_OK)
+        {
+            stream.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream.avail_out = sizeof(buffer);
+            status = inflate(&stream, Z_NO_FLUSH);
+            result.append(buffer, sizeof(buffer) - stream.avail_out);
+            if ((status == Z_BUF_ERROR) && (stream.avail_in == 0))
+            {
+                break;
+            }
+        }
+        inflateEnd(&stream);
+        return (status == Z_STREAM_END) ? result : "<error>";
+    }
+
+    /**
+     * @brief Decode data of a content coding.
+     */
+    static std::string Decode(HttpEncoder::Coding coding, std::string const& data)
+    {
+#ifdef HAVE_BROTLI
+        if (coding == HttpEncoder::Brotli)
+        {
+            BrotliDecoderState* state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+            uint8_t const* nextIn = reinterpret_cast<uint8_t const*>(data.data());
+            size_t availIn = data.size();
+            std::string result;
+            BrotliDecoderResult status = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+            while (status == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+            {
+                uint8_t buffer[16384];
+                uint8_t* nextOut = buffer;
+                size_t availOut = sizeof(buffer);
+                status = BrotliDecoderDecompressStream(state, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+                result.append(reinterpret_cast<char*>(buffer), sizeof(buffer) - availOut);
+            }
+            BrotliDecoderDestroyInstance(state);
+            return (status == BROTLI_DECODER_RESULT_SUCCESS) ? result : "<error>";
+        }
+#endif
+        return (coding == HttpEncoder::Identity) ? data : Inflate(data);
+    }
+
+    /**
+     * @brief Codings the test is built with.
+     */
+    static std::vector<HttpEncoder::Coding> Codings()
+    {
+        std::vector<HttpEncoder::Coding> codings = { HttpEncoder::Gzip, HttpEncoder::Deflate };
+#ifdef HAVE_BROTLI
+        codings.push_back(HttpEncoder::Brotli);
+#endif
+        return codings;
+    }
+
+    /**
+     * @brief JSON-like text of the given size.
+     */
+    static std::string JsonText(size_t size)
+    {
+        std::string text = "[";
+        for (size_t i = 0; text.size() < size; i++)
+        {
+            text += "{\"id\":" + std::to_string(i) + ",\"name\":\"item " + std::to_string(i * 7 % 13) + "\"},";
+        }
+        text.resize(size - 1);
+        return text + "]";
+    }
+
+    struct HttpReply
+    {
+        std::string head;
+        std::string body;  // Chunked bodies are decoded
+
+        bool hasHeader(std::string const& line) const { return head.find("\r\n" + line + "\r\n") != std::string::npos; }
+    };
+
+    /**
+     * @brief Send one request and read the response until the server closes the connection.
+     */
+    static HttpReply Fetch(int port, std::string const& request)
+    {
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        EXPECT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string text = request;
+        client.writeall(text);
+        std::string response;
+        char chunk[16384];
+        int received;
+        while ((received = client.recv(chunk, sizeof(chunk))) > 0)
+        {
+            response.append(chunk, static_cast<size_t>(received));
+        }
+        client.close();
+
+        HttpReply reply;
+        size_t headEnd = response.find("\r\n\r\n");
+        EXPECT_NE(headEnd, std::string::npos);
+        if (headEnd == std::string::npos)
+        {
+            return reply;
+        }
+        reply.head = response.substr(0, headEnd + 2);
+        if (!reply.hasHeader("Transfer-Encoding: chunked"))
+        {
+            reply.body = response.substr(headEnd + 4);
+            return reply;
+        }
+        HttpChunkedDecoder decoder;
+        size_t consumed = 0;
+        auto result = decoder.decode(std::string_view(response).substr(headEnd + 4), consumed,
+            [&reply](std::string_view data) {
+                reply.body.append(data);
+                return true;
+            });
+        EXPECT_EQ(result, HttpChunkedDecoder::Done);
+        return reply;
+    }
+
+    static std::string Get(std::string const& uri, std::string const& acceptEncoding)
+    {
+        std::string request = "GET " + uri + " HTTP/1.1\r\nConnection: close\r\n";
+        if (!acceptEncoding.empty())
+        {
+            request += "Accept-Encoding: " + acceptEncoding + "\r\n";
+        }
+        return request + "\r\n";
+    }
+
+    TEST(CompressionTests, NegotiateTest)
+    {
+        unsigned all = HttpEncoder::Gzip | HttpEncoder::Deflate | HttpEncoder::Brotli;
+        EXPECT_EQ(HttpEncoder::negotiate("", all), HttpEncoder::Identity);
+        EXPECT_EQ(HttpEncoder::negotiate("gzip", all), HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("gzip, deflate, br", all), HttpEncoder::Brotli);
+        EXPECT_EQ(HttpEncoder::negotiate("gzip, deflate, br", HttpEncoder::Gzip | HttpEncoder::Deflate),
+            HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("br;q=0.5, GZIP;q=0.8", all), HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("deflate;q=1.0, gzip;q=0.999", all), HttpEncoder::Deflate);
+        EXPECT_EQ(HttpEncoder::negotiate("x-gzip", all), HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("identity", all), HttpEncoder::Identity);
+        // Refused codings are never picked, "*" covers the others
+        EXPECT_EQ(HttpEncoder::negotiate("gzip;q=0", all), HttpEncoder::Identity);
+        EXPECT_EQ(HttpEncoder::negotiate("*", all), HttpEncoder::Brotli);
+        EXPECT_EQ(HttpEncoder::negotiate("*;q=0.1, br;q=0", all), HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("br ; q=0.000, gzip ;q=0.001", all), HttpEncoder::Gzip);
+        EXPECT_EQ(HttpEncoder::negotiate("gzip;q=x", all), HttpEncoder::Identity);
+
+        EXPECT_TRUE(HttpEncoder::compressible("text/html; charset=utf-8"));
+        EXPECT_TRUE(HttpEncoder::compressible("application/json"));
+        EXPECT_TRUE(HttpEncoder::compressible("application/problem+json"));
+        EXPECT_TRUE(HttpEncoder::compressible("image/svg+xml"));
+        EXPECT_FALSE(HttpEncoder::compressible("image/png"));
+        EXPECT_FALSE(HttpEncoder::compressible("application/octet-stream"));
+    }
+
+    TEST(CompressionTests, StreamingEncoderTest)
+    {
+        std::string text = JsonText(200 * 1024);
+        for (auto coding : Codings())
+        {
+            EXPECT_NE(HttpEncoder::available() & coding, 0u);
+
+            // Every part decodes as soon as it is written
+            HttpEncoder encoder;
+            ASSERT_TRUE(encoder.start(coding));
+            EXPECT_EQ(encoder.coding(), coding);
+            std::string encoded;
+            ASSERT_TRUE(encoder.write(std::string_view(text).substr(0, 1000), encoded, false));
+            EXPECT_FALSE(encoded.empty());
+            for (size_t offset = 1000; offset < text.size(); offset += 7000)
+            {
+                ASSERT_TRUE(encoder.write(std::string_view(text).substr(offset, 7000), encoded, false));
+            }
+            ASSERT_TRUE(encoder.write(std::string_view(), encoded, true));
+            EXPECT_EQ(encoder.coding(), HttpEncoder::Identity);
+            EXPECT_LT(encoded.size(), text.size() / 4);
+            EXPECT_EQ(Decode(coding, encoded), text);
+
+            std::string compressed;
+            ASSERT_TRUE(HttpEncoder::compress(coding, text, compressed));
+            EXPECT_LE(compressed.size(), encoded.size());
+            EXPECT_EQ(Decode(coding, compressed), text);
+        }
+#ifndef HAVE_BROTLI
+        HttpEncoder encoder;
+        EXPECT_FALSE(encoder.start(HttpEncoder::Brotli));
+#endif
+    }
+
+    TEST(CompressionTests, ResponseBodyTest)
+    {
+        std::string text = JsonText(20000);
+        HttpServer server;
+        HttpRequestCallback json{ [&text](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = "application/json";
+            resp.body = text;
+            return 200;
+        } };
+        HttpRequestCallback small{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = "application/json";
+            resp.body = "[]";
+            return 200;
+        } };
+        HttpRequestCallback binary{ [&text](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_BIN;
+            resp.body = text;
+            return 200;
+        } };
+        HttpRequestCallback produced{ [&text](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = "text/plain";
+            auto offset = std::make_shared<size_t>(0);
+            resp.producer = [&text, offset](std::string& buffer) {
+                buffer.append(text, *offset, 1000);
+                *offset += 1000;
+                return *offset < text.size();
+            };
+            return 200;
+        } };
+        server["/json"] = json;
+        server["/small"] = small;
+        server["/binary"] = binary;
+        server["/produced"] = produced;
+        server.setCompression();
+        int port = server.addListeningPort(0);
+        server.start();
+
+        for (auto coding : Codings())
+        {
+            std::string name = HttpEncoder::name(coding);
+            HttpReply reply = Fetch(port, Get("/json", name));
+            EXPECT_TRUE(reply.hasHeader("Content-Encoding: " + name));
+            EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+            EXPECT_TRUE(reply.hasHeader("Content-Length: " + std::to_string(reply.body.size())));
+            EXPECT_LT(reply.body.size(), text.size() / 4);
+            EXPECT_EQ(Decode(coding, reply.body), text);
+
+            // Produced bodies are compressed part by part, for HTTP/1.1 and HTTP/1.0 clients
+            reply = Fetch(port, Get("/produced", name));
+            EXPECT_TRUE(reply.hasHeader("Content-Encoding: " + name));
+            EXPECT_TRUE(reply.hasHeader("Transfer-Encoding: chunked"));
+            EXPECT_EQ(Decode(coding, reply.body), text);
+            reply = Fetch(port, "GET /produced HTTP/1.0\r\nAccept-Encoding: " + name + "\r\n\r\n");
+            EXPECT_TRUE(reply.hasHeader("Content-Encoding: " + name));
+            EXPECT_EQ(Decode(coding, reply.body), text);
+        }
+
+        // Best accepted coding wins
+        HttpReply reply = Fetch(port, Get("/json", "deflate;q=0.5, gzip, br;q=0.1"));
+        EXPECT_TRUE(reply.hasHeader("Content-Encoding: gzip"));
+
+        // Not accepted: identity, but caches still learn that the body varies
+        reply = Fetch(port, Get("/json", ""));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+        EXPECT_EQ(reply.body, text);
+        reply = Fetch(port, Get("/json", "gzip;q=0, identity"));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_EQ(reply.body, text);
+
+        // Small and binary bodies are sent as they are
+        reply = Fetch(port, Get("/small", "gzip"));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_EQ(reply.head.find("Vary"), std::string::npos);
+        EXPECT_EQ(reply.body, "[]");
+        reply = Fetch(port, Get("/binary", "gzip"));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_EQ(reply.body, text);
+
+        server.stop();
+    }
+
+    /**
+     * @brief File server on an ephemeral port with compression, optionally with the file cache.
+     */
+    class CompressingFileServer : public HttpFileServer
+    {
+    public:
+        explicit CompressingFileServer(bool cached) : HttpFileServer("127.0.0.1", 0)
+        {
+            if (cached)
+            {
+                SetFileCache(1024 * 1024, 256 * 1024, 0);
+            }
+            setCompression();
+            InitializeFileEndpoint(*this);
+        }
+
+        int port()
+        {
+            SocketAddr addr;
+            m_listeningSockets.front().getsockname(addr);
+            return addr.port();
+        }
+    };
+
+    static void WriteFile(std::string const& path, std::string const& content)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        fwrite(content.data(), 1, content.size(), f);
+        fclose(f);
+    }
+
+    TEST(CompressionTests, PrecompressedFileTest)
+    {
+        // File server serves files relative to the working directory
+        std::string name = "compression_precompressed.json";
+        std::string text = JsonText(30000);
+        std::string gzipped;
+        ASSERT_TRUE(HttpEncoder::compress(HttpEncoder::Gzip, text, gzipped));
+        WriteFile(name, text);
+        WriteFile(name + ".gz", gzipped);
+
+        CompressingFileServer server(false);
+        int port = server.port();
+        server.start();
+
+        // The sibling is streamed as it is
+        HttpReply reply = Fetch(port, Get("/" + name, "gzip"));
+        EXPECT_TRUE(reply.hasHeader("Content-Type: application/json"));
+        EXPECT_TRUE(reply.hasHeader("Content-Encoding: gzip"));
+        EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+        EXPECT_EQ(reply.body, gzipped);
+
+        // No .br sibling: gzip is the next best
+        reply = Fetch(port, Get("/" + name, "br, gzip;q=0.5"));
+        EXPECT_TRUE(reply.hasHeader("Content-Encoding: gzip"));
+        reply = Fetch(port, Get("/" + name, "br"));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_EQ(reply.body, text);
+        reply = Fetch(port, Get("/" + name, ""));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+        EXPECT_EQ(reply.body, text);
+
+        server.stop();
+        std::remove(name.c_str());
+        std::remove((name + ".gz").c_str());
+    }
+
+    TEST(CompressionTests, CachedFileVariantsTest)
+    {
+        std::string name = "compression_cached.css";
+        std::string text;
+        for (int i = 0; text.size() < 40000; i++)
+        {
+            text += ".rule-" + std::to_string(i) + " { color: #" + std::to_string(100 + i % 800) + "; }\n";
+        }
+        WriteFile(name, text);
+        std::string image = "compression_cached.png";
+        WriteFile(image, text);
+
+        CompressingFileServer server(true);
+        int port = server.port();
+        server.start();
+
+        std::string etags;
+        for (auto coding : Codings())
+        {
+            std::string coded = HttpEncoder::name(coding);
+            HttpReply reply = Fetch(port, Get("/" + name, coded));
+            if (coding == HttpEncoder::Deflate)
+            {
+                // Cached in br and gzip only
+                EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+                EXPECT_EQ(reply.body, text);
+                continue;
+            }
+            EXPECT_TRUE(reply.hasHeader("Content-Type: text/css"));
+            EXPECT_TRUE(reply.hasHeader("Content-Encoding: " + coded));
+            EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+            EXPECT_EQ(Decode(coding, reply.body), text);
+
+            // Compressed once: the cached variant is served again
+            HttpReply again = Fetch(port, Get("/" + name, coded));
+            EXPECT_EQ(again.body, reply.body);
+            size_t ofs = reply.head.find("ETag: ");
+            ASSERT_NE(ofs, std::string::npos);
+            std::string etag = reply.head.substr(ofs + 6, reply.head.find("\r\n", ofs) - ofs - 6);
+            EXPECT_NE(etag.find("-" + coded), std::string::npos);
+            EXPECT_EQ(etags.find(etag), std::string::npos);
+            etags += etag;
+
+            reply = Fetch(port, "GET /" + name + " HTTP/1.1\r\nConnection: close\r\nAccept-Encoding: " + coded +
+                    "\r\nIf-None-Match: " + etag + "\r\n\r\n");
+            EXPECT_EQ(reply.head.find("HTTP/1.1 304 Not Modified\r\n"), 0u);
+            EXPECT_TRUE(reply.hasHeader("ETag: " + etag));
+            EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+            EXPECT_NE(reply.head.find("Last-Modified: "), std::string::npos);
+            EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+            EXPECT_EQ(reply.head.find("Content-Type"), std::string::npos);
+        }
+
+        HttpReply reply = Fetch(port, Get("/" + name, ""));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_TRUE(reply.hasHeader("Vary: Accept-Encoding"));
+        EXPECT_EQ(reply.body, text);
+
+        // Images are not compressed
+        reply = Fetch(port, Get("/" + image, "gzip"));
+        EXPECT_EQ(reply.head.find("Content-Encoding"), std::string::npos);
+        EXPECT_EQ(reply.head.find("Vary"), std::string::npos);
+        EXPECT_EQ(reply.body, text);
+
+        server.stop();
+        std::remove(name.c_str());
+        std::remove(image.c_str());
+    }
+}
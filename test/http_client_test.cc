@@ -0,0 +1,272 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::http::client;
+using namespace SOCKETSHPP_NS::http::server;
+using namespace std;
+
+namespace testing
+{
+    /**
+     * @brief Reactor callback of client sockets that are only awaited.
+     */
+    struct IdleCallback : public Reactor::SocketCallback
+    {
+        virtual void onSocketReadable(Socket) override {}
+        virtual void onSocketWritable(Socket) override {}
+        virtual void onSocketAcceptable(Socket) override {}
+        virtual void onSocketClosed(Socket) override {}
+    };
+
+    /**
+     * @brief Reactor thread running an HTTP client.
+     */
+    struct ClientReactor
+    {
+        IdleCallback callback;
+        Reactor reactor{ callback };
+        HttpClient client{ reactor };
+
+        ClientReactor() { reactor.start(); }
+
+        ~ClientReactor() { reactor.stop(); }
+
+        /**
+         * @brief Run function on the reactor thread and wait until it returns.
+         */
+        void run(std::function<void()> function)
+        {
+            std::promise<void> done;
+            reactor.execute([&]() {
+                function();
+                done.set_value();
+            });
+            done.get_future().wait();
+        }
+    };
+
+    /**
+     * @brief Wait until the condition holds, at most 5 seconds.
+     */
+    static bool WaitUntil(std::function<bool()> condition)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition())
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    TEST(HttpClientTests, KeepaliveReuseTest)
+    {
+        HttpServer server;
+        HttpRequestCallback hello{ [](HttpRequest const& req, HttpResponse& resp) {
+            resp.body = "Hello " + req.uri;
+            return 200;
+        } };
+        server["/hello"] = hello;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        ClientReactor client;
+        std::string url = "http://127.0.0.1:" + std::to_string(port) + "/hello";
+        std::atomic<int> completed{ 0 };
+        std::function<void()> next = [&]() {
+            client.client.get(url + std::to_string(completed.load()), [&](HttpClientResponse& response) {
+                EXPECT_EQ(response.result, HttpClient::Ok);
+                EXPECT_EQ(response.code, 200);
+                EXPECT_EQ(response.content, "Hello /hello" + std::to_string(completed.load()));
+                if (++completed < 20)
+                {
+                    next();
+                }
+            });
+        };
+        client.run(next);
+        ASSERT_TRUE(WaitUntil([&]() { return completed.load() == 20; }));
+        // Every request went over the same connection
+        client.run([&]() {
+            SocketAddr address(SocketAddr::Loopback, port);
+            EXPECT_EQ(client.client.pool().open(address), 1u);
+            EXPECT_EQ(client.client.pool().idle(address), 1u);
+            EXPECT_EQ(client.client.pending(), 0u);
+        });
+        server.stop();
+    }
+
+    TEST(HttpClientTests, ConcurrentPipelinedTest)
+    {
+        static const int kRequests = 64;
+        HttpServer server;
+        HttpRequestCallback echo{ [](HttpRequest const& req, HttpResponse& resp) {
+            resp.body = req.uri + ":" + req.content;
+            return 200;
+        } };
+        server["/echo"] = echo;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        ClientReactor client;
+        client.client.setMaxConnectionsPerHost(2);
+        client.client.setPipelineDepth(8);
+        std::mutex mutex;
+        std::vector<std::string> bodies(kRequests);
+        std::atomic<int> completed{ 0 };
+        client.run([&]() {
+            for (int i = 0; i < kRequests; i++)
+            {
+                HttpClientRequest request;
+                request.method = (i % 2) ? "POST" : "GET";
+                request.url = "http://127.0.0.1:" + std::to_string(port) + "/echo/" + std::to_string(i);
+                request.content = (i % 2) ? std::string(100 * i, 'x') : std::string();
+                EXPECT_TRUE(client.client.send(request, [&, i](HttpClientResponse& response) {
+                    EXPECT_EQ(response.result, HttpClient::Ok);
+                    EXPECT_EQ(response.code, 200);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bodies[i] = response.content;
+                    completed++;
+                }));
+            }
+            EXPECT_EQ(client.client.pending(), size_t(kRequests));
+        });
+        ASSERT_TRUE(WaitUntil([&]() { return completed.load() == kRequests; }));
+        for (int i = 0; i < kRequests; i++)
+        {
+            std::string content = (i % 2) ? std::string(100 * i, 'x') : std::string();
+            EXPECT_EQ(bodies[i], "/echo/" + std::to_string(i) + ":" + content);
+        }
+        client.run([&]() { EXPECT_LE(client.client.pool().open(SocketAddr(SocketAddr::Loopback, port)), 2u); });
+        server.stop();
+    }
+
+    TEST(HttpClientTests, ChunkedStreamingTest)
+    {
+        static const int kParts = 16;
+        HttpServer server;
+        HttpRequestCallback stream{ [](HttpRequest const&, HttpResponse& resp) {
+            auto part = std::make_shared<int>(0);
+            resp.producer = [part](std::string& buffer) {
+                buffer.append(10000, char('a' + *part));
+                return ++*part < kParts;
+            };
+            return 200;
+        } };
+        server["/stream"] = stream;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        ClientReactor client;
+        std::string streamed;
+        std::atomic<bool> done{ false };
+        client.run([&]() {
+            client.client.get(
+                "http://127.0.0.1:" + std::to_string(port) + "/stream",
+                [&](HttpClientResponse& response) {
+                    EXPECT_EQ(response.result, HttpClient::Ok);
+                    EXPECT_EQ(response.headers["Transfer-Encoding"], "chunked");
+                    EXPECT_TRUE(response.content.empty());
+                    done = true;
+                },
+                [&](HttpClientResponse const& response, std::string_view data) {
+                    EXPECT_EQ(response.code, 200);
+                    streamed.append(data);
+                    return true;
+                });
+        });
+        ASSERT_TRUE(WaitUntil([&]() { return done.load(); }));
+        std::string expected;
+        for (int i = 0; i < kParts; i++)
+        {
+            expected.append(10000, char('a' + i));
+        }
+        EXPECT_EQ(streamed, expected);
+        server.stop();
+    }
+
+    TEST(HttpClientTests, ConnectionClosedTest)
+    {
+        // Server that answers one request per connection, without Content-Length
+        Socket listener(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(listener.bind(SocketAddr("127.0.0.1:0")), 0);
+        ASSERT_TRUE(listener.listen(16));
+        SocketAddr address;
+        ASSERT_TRUE(listener.getsockname(address));
+        std::atomic<int> accepted{ 0 };
+        std::thread server([&]() {
+            for (int i = 0; i < 2; i++)
+            {
+                Socket conn;
+                SocketAddr peer;
+                if (!listener.accept(conn, peer))
+                {
+                    return;
+                }
+                accepted++;
+                std::string request(4096, 0);
+                int received = conn.recv(&request[0], request.size());
+                EXPECT_GT(received, 0);
+                std::string response = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nuntil close";
+                conn.writeall(response);
+                // Closed once the client has read the response, unread requests would reset it
+                conn.shutdown(Socket::ShutdownSend);
+                while (conn.recv(&request[0], request.size()) > 0)
+                {
+                }
+                conn.close();
+            }
+        });
+
+        ClientReactor client;
+        client.client.setPipelineDepth(2);
+        client.client.setMaxConnectionsPerHost(1);
+        std::string url = "http://" + address.toString() + "/";
+        std::atomic<int> completed{ 0 };
+        client.run([&]() {
+            for (int i = 0; i < 2; i++)
+            {
+                client.client.get(url, [&](HttpClientResponse& response) {
+                    EXPECT_EQ(response.result, HttpClient::Ok);
+                    EXPECT_EQ(response.content, "until close");
+                    completed++;
+                });
+            }
+        });
+        // The request that was sent behind the first one is sent again on a new connection
+        ASSERT_TRUE(WaitUntil([&]() { return completed.load() == 2; }));
+        EXPECT_EQ(accepted.load(), 2);
+        server.join();
+        listener.close();
+
+        // Nobody listens anymore
+        std::atomic<int> result{ -1 };
+        client.run([&]() {
+            client.client.get(url, [&](HttpClientResponse& response) { result = response.result; });
+        });
+        ASSERT_TRUE(WaitUntil([&]() { return result.load() != -1; }));
+        EXPECT_EQ(result.load(), HttpClient::ConnectFailed);
+    }
+
+}  // namespace testing
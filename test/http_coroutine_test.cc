@@ -0,0 +1,165 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::http::server;
+using SOCKETSHPP_NS::net::utils::connectTo;
+using SOCKETSHPP_NS::net::utils::readable;
+using SOCKETSHPP_NS::net::utils::sleepFor;
+using namespace std;
+
+#ifdef SOCKETSHPP_HAVE_COROUTINES
+
+namespace testing
+{
+    /**
+     * @brief Call upstream server from a coroutine, without blocking the reactor on the response.
+     */
+    static Task<std::string> Fetch(int port, std::string request_text)
+    {
+        Socket upstream = co_await connectTo(SocketAddr(SocketAddr::Loopback, port), std::chrono::seconds(5));
+        EXPECT_FALSE(upstream.invalid());
+        if (upstream.invalid())
+        {
+            co_return std::string();
+        }
+        upstream.writeall(request_text);
+
+        std::string response_text;
+        char buffer[4096];
+        for (;;)
+        {
+            int received = upstream.recv(buffer, sizeof(buffer));
+            if (received > 0)
+            {
+                response_text.append(buffer, received);
+                continue;
+            }
+            if ((received < 0) && (upstream.error() == Socket::ErrorWouldBlock))
+            {
+                co_await readable(upstream);
+                continue;
+            }
+            break;
+        }
+        upstream.close();
+        co_return response_text;
+    }
+
+    TEST(HttpCoroutineTests, UpstreamCallTest)
+    {
+        HttpServer upstream;
+        HttpRequestCallback slow{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.body = "upstream";
+            return 200;
+        } };
+        slow.setExecution(HttpRequestCallback::Offload);
+        upstream["/"] = slow;
+        int upstreamPort = upstream.addListeningPort(0);
+        upstream.start();
+
+        HttpServer server;
+        HttpRequestCallback proxy{ [upstreamPort](HttpRequest const&, HttpResponse& resp) -> Task<int> {
+            std::string response = co_await Fetch(upstreamPort, "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+            size_t ofs = response.find("\r\n\r\n");
+            resp.body = "proxied " + ((ofs != std::string::npos) ? response.substr(ofs + 4) : std::string());
+            co_return 200;
+        } };
+        server["/proxy"] = proxy;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        auto response = HttpRoundTrip(port, "GET /proxy HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\nproxied upstream"), std::string::npos);
+
+        server.stop();
+        upstream.stop();
+    }
+
+    TEST(HttpCoroutineTests, ConcurrentSleepTest)
+    {
+        HttpServer server;
+        HttpRequestCallback sleepy{ [](HttpRequest const&, HttpResponse& resp) -> Task<int> {
+            co_await sleepFor(std::chrono::milliseconds(200));
+            resp.body = "awake";
+            co_return 200;
+        } };
+        server["/sleep"] = sleepy;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // One reactor thread serves all sleeping requests at once
+        auto started = std::chrono::steady_clock::now();
+        std::vector<Socket> clients(8);
+        std::string request = "GET /sleep HTTP/1.1\r\nConnection: close\r\n\r\n";
+        for (auto& client : clients)
+        {
+            client = Socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+            client.writeall(request);
+        }
+        for (auto& client : clients)
+        {
+            std::string response;
+            response.resize(4096, 0);
+            client.readall(response);
+            client.close();
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("\r\n\r\nawake"), std::string::npos);
+        }
+        EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(1000));
+
+        server.stop();
+    }
+
+    TEST(HttpCoroutineTests, FallThroughTest)
+    {
+        HttpServer server;
+        HttpRequestCallback skip{ [](HttpRequest const& req, HttpResponse& resp) -> Task<int> {
+            co_await sleepFor(std::chrono::milliseconds(10));
+            resp.headers["X-Seen"] = "1";
+            co_return (req.uri == "/api/now") ? 200 : 0;
+        } };
+        HttpRequestCallback fallback{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.body = "fallback";
+            return 200;
+        } };
+        server["/api"] = skip;
+        server["/api"] = fallback;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Handler after the coroutine answers, keep-alive requests are served in order
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string requests = "GET /api/now HTTP/1.1\r\n\r\nGET /api/other HTTP/1.1\r\nConnection: close\r\n\r\n";
+        client.writeall(requests);
+        std::string response;
+        response.resize(4096, 0);
+        client.readall(response);
+        client.close();
+
+        size_t second = response.find("HTTP/1.1 200 OK\r\n", 1);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        ASSERT_NE(second, std::string::npos);
+        EXPECT_EQ(response.find("fallback"), response.find("\r\n\r\n", second) + 4);
+        EXPECT_NE(response.find("\r\nX-Seen: 1\r\n", second), std::string::npos);
+
+        server.stop();
+    }
+}
+
+#endif
@@ -0,0 +1,1147 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::net::common;
+using namespace SOCKETSHPP_NS::http::server;
+using namespace std;
+
+namespace testing
+{
+    /**
+     * @brief Extract one response from keep-alive connection, reading more data as needed.
+     * @param client Client socket.
+     * @param buffer Received bytes, the remainder after the response stays in the buffer.
+     */
+    static std::string ReadHttpResponse(Socket& client, std::string& buffer)
+    {
+        char chunk[4096];
+        for (;;)
+        {
+            size_t headersEnd = buffer.find("\r\n\r\n");
+            if (headersEnd != std::string::npos)
+            {
+                size_t contentLength = 0;
+                size_t ofs = buffer.find("Content-Length: ");
+                if (ofs != std::string::npos && ofs < headersEnd)
+                {
+                    contentLength = atoi(buffer.c_str() + ofs + 16);
+                }
+                size_t total = headersEnd + 4 + contentLength;
+                if (buffer.size() >= total)
+                {
+                    std::string response = buffer.substr(0, total);
+                    buffer.erase(0, total);
+                    return response;
+                }
+            }
+            int received = client.recv(chunk, sizeof(chunk));
+            if (received <= 0)
+            {
+                return {};
+            }
+            buffer.append(chunk, received);
+        }
+    }
+
+    /**
+     * @brief Wait until the server closes the connection, discarding what it sends.
+     * @param client Client socket, becomes non-blocking.
+     * @param timeout How long to wait.
+     * @return true if the connection was closed in time.
+     */
+    static bool WaitForClose(Socket& client, std::chrono::milliseconds timeout)
+    {
+        client.setNonBlocking();
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        char chunk[4096];
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            int received = client.recv(chunk, sizeof(chunk));
+            if ((received == 0) || ((received < 0) && (client.error() != Socket::ErrorWouldBlock)))
+            {
+                return true;
+            }
+            if (received < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        return false;
+    }
+
+    struct HelloServerTest
+    {
+        HttpServer server;
+        HttpRequestCallback hello{ [](HttpRequest const& req, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "Hello, " + req.uri;
+            return 200;
+        } };
+
+        HelloServerTest() { server["/hello"] = hello; }
+    };
+
+    TEST(HttpServerTests, BasicGetTest)
+    {
+        HelloServerTest test;
+        int port = test.server.addListeningPort(0);
+        test.server.start();
+
+        auto response = HttpRoundTrip(port, "GET /hello/world HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("Content-Length: 19\r\n"), std::string::npos);
+        EXPECT_NE(response.find("\r\n\r\nHello, /hello/world"), std::string::npos);
+
+        response = HttpRoundTrip(port, "GET /missing HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 404 Not Found\r\n"), 0u);
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, RequestHeadParseTest)
+    {
+        HttpRequestHead head;
+        std::string text = "POST /upload?x=1 HTTP/1.1\r\nhost: example\r\nX-Custom:  a b\r\n"
+                           "CONTENT-LENGTH: 5\r\nx-custom: c\r\n\r\n";
+        ASSERT_TRUE(head.parse(text));
+        EXPECT_EQ(head.method, "POST");
+        EXPECT_EQ(head.uri, "/upload?x=1");
+        EXPECT_EQ(head.protocol, "HTTP/1.1");
+        ASSERT_EQ(head.headers.size(), 4u);
+        EXPECT_EQ(head.headers[1].name, "X-Custom");
+        EXPECT_EQ(head.headers[1].value, "a b");
+        ASSERT_NE(head.find(HttpRequestHead::Host), nullptr);
+        EXPECT_EQ(head.find(HttpRequestHead::Host)->value, "example");
+        ASSERT_NE(head.find(HttpRequestHead::ContentLength), nullptr);
+        EXPECT_EQ(head.find(HttpRequestHead::ContentLength)->value, "5");
+        EXPECT_EQ(head.find(HttpRequestHead::Expect), nullptr);
+        ASSERT_NE(head.find("x-CUSTOM"), nullptr);
+        EXPECT_EQ(head.find("x-CUSTOM")->value, "c");
+        EXPECT_EQ(head.find("Missing"), nullptr);
+
+        EXPECT_TRUE(head.parse("GET / HTTP/1.0\n\n"));
+        EXPECT_TRUE(head.headers.empty());
+        EXPECT_EQ(head.find(HttpRequestHead::Host), nullptr);
+        EXPECT_FALSE(head.parse("GET /\r\n\r\n"));
+        EXPECT_FALSE(head.parse("GET / HTTP/1.1\r\nBad Header: x\r\n\r\n"));
+        EXPECT_FALSE(head.parse("GET / HTTP/1.1\r\nHost: x\r\n"));
+    }
+
+    TEST(HttpServerTests, HeadScannerTest)
+    {
+        // Feed one byte at a time, long lines cross the vectorized blocks
+        std::string text = "GET /" + std::string(100, 'a') + " HTTP/1.1\r\nX-Long: " + std::string(70, 'b') +
+            "\r\nHost: x\n\r\nbody";
+        HttpHeadScanner scanner;
+        size_t headLen = 0;
+        for (size_t i = 1; i <= text.size() && headLen == 0; i++)
+        {
+            headLen = scanner.scan(std::string_view(text.data(), i));
+        }
+        EXPECT_EQ(headLen, text.size() - 4);
+        ASSERT_EQ(scanner.lineEnds().size(), 4u);
+        EXPECT_EQ(text[scanner.lineEnds()[0]], '\n');
+
+        HttpRequestHead head;
+        ASSERT_TRUE(head.parse(std::string_view(text.data(), headLen), scanner.lineEnds()));
+        EXPECT_EQ(head.uri.size(), 101u);
+        ASSERT_EQ(head.headers.size(), 2u);
+        EXPECT_EQ(head.headers[1].value, "x");
+
+        // The whole buffer at once
+        scanner.reset();
+        EXPECT_EQ(scanner.scan(text), headLen);
+        scanner.reset();
+        EXPECT_EQ(scanner.scan(std::string(200, 'c')), 0u);
+        EXPECT_EQ(scanner.scanned(), 200u);
+        EXPECT_FALSE(head.parse("GET / HTTP/1.1\r\nA: b\rc\r\n\r\n"));
+    }
+
+    TEST(HttpServerTests, SlowHeadersTest)
+    {
+        HelloServerTest test;
+        test.server.setRequestLimits(256, 1024);
+        int port = test.server.addListeningPort(0);
+        test.server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string request = "GET /hello/slow HTTP/1.1\r\nUser-Agent: test\r\n\r\n";
+        for (size_t i = 0; i < request.size(); i += 5)
+        {
+            std::string piece = request.substr(i, 5);
+            client.writeall(piece);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::string buffer;
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\nHello, /hello/slow"), std::string::npos);
+        client.close();
+
+        response = HttpRoundTrip(port, "GET /hello HTTP/1.1\r\nX-Big: " + std::string(300, 'x') + "\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 431 Request Header Fields Too Large\r\n"), 0u);
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, ConnectionTimeoutTest)
+    {
+        HelloServerTest test;
+        test.server.setIdleTimeout(std::chrono::milliseconds(200));
+        test.server.setHeaderTimeout(std::chrono::milliseconds(300));
+        test.server.setBodyTimeout(std::chrono::milliseconds(200));
+        int port = test.server.addListeningPort(0);
+        test.server.start();
+
+        // Keep-alive connection is closed once idle
+        Socket idle(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(idle.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string request = "GET /hello/idle HTTP/1.1\r\n\r\n";
+        idle.writeall(request);
+        std::string buffer;
+        auto response = ReadHttpResponse(idle, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_TRUE(WaitForClose(idle, std::chrono::seconds(5)));
+        EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(150));
+        idle.close();
+
+        // Headers trickling in don't extend the header deadline
+        Socket slow(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(slow.connect(SocketAddr(SocketAddr::Loopback, port)));
+        start = std::chrono::steady_clock::now();
+        bool closed = false;
+        for (int i = 0; (i < 100) && !closed; i++)
+        {
+            std::string piece = (i == 0) ? "GET /hello/slow HTTP/1.1\r\n" : "X: y\r\n";
+            closed = (slow.send(piece.data(), piece.size()) < 0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            if (!closed)
+            {
+                char byte;
+                slow.setNonBlocking();
+                closed = (slow.recv(&byte, 1) == 0);
+            }
+        }
+        EXPECT_TRUE(closed);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(3));
+        slow.close();
+
+        // Body that stops arriving
+        Socket stalled(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(stalled.connect(SocketAddr(SocketAddr::Loopback, port)));
+        request = "POST /hello/body HTTP/1.1\r\nContent-Length: 100\r\n\r\npartial";
+        stalled.writeall(request);
+        EXPECT_TRUE(WaitForClose(stalled, std::chrono::seconds(5)));
+        stalled.close();
+
+        // Connections that keep up are served
+        response = HttpRoundTrip(port, "GET /hello/fast HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, RequestHeadWithoutMapTest)
+    {
+        HttpServer server;
+        server.setRequestHeadersMap(false);
+        HttpRequestCallback echo{ [](HttpRequest const& req, HttpResponse& resp) {
+            auto const agent = req.head.find("User-Agent");
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = std::string(req.head.method) + " " + std::string(req.head.uri) + " " +
+                ((agent != nullptr) ? std::string(agent->value) : std::string("-")) + " " +
+                std::to_string(req.headers.size()) + " " + req.content;
+            return 200;
+        } };
+        server["/echo"] = echo;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        auto response = HttpRoundTrip(port,
+            "POST /echo HTTP/1.1\r\nuser-agent: test\r\ncontent-length: 4\r\nConnection: close\r\n\r\nbody");
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\nPOST /echo test 0 body"), std::string::npos);
+
+        response = HttpRoundTrip(port, "POST /echo HTTP/1.1\r\nContent-Length: 4x\r\n\r\nbody");
+        EXPECT_EQ(response.find("HTTP/1.1 400 Bad Request\r\n"), 0u);
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, RouterTest)
+    {
+        int handlers[6] = {};
+        HttpRouter<int> router;
+        // Registration order decides, not prefix length; split edges keep their routes
+        router.build({ { "/api/users", &handlers[0] }, { "/api", &handlers[1] }, { "/", &handlers[2] },
+            { "/apx", &handlers[3] }, { "/api/users", nullptr }, { "/api/u", &handlers[4] },
+            { "/static/", &handlers[5] } });
+        EXPECT_EQ(router.size(), 6u);
+
+        auto matches = [&](std::string_view path) {
+            std::string result;
+            router.match(path, [&](HttpRouter<int>::Route const& route) {
+                result += std::to_string(route.handler - handlers);
+                return false;
+            });
+            return result;
+        };
+        EXPECT_EQ(matches("/api/users/42"), "0124");
+        EXPECT_EQ(matches("/api/us"), "124");
+        EXPECT_EQ(matches("/api"), "12");
+        EXPECT_EQ(matches("/ap"), "2");
+        EXPECT_EQ(matches("/apx?q=1"), "23");
+        EXPECT_EQ(matches("/static/app.js"), "25");
+        EXPECT_EQ(matches("/static"), "2");
+        EXPECT_EQ(matches("other"), "");
+
+        // The first route accepting the path stops the lookup
+        int calls = 0;
+        EXPECT_TRUE(router.match("/api/users", [&](HttpRouter<int>::Route const&) { return ++calls == 2; }));
+        EXPECT_EQ(calls, 2);
+    }
+
+    TEST(HttpServerTests, ManyRoutesTest)
+    {
+        HttpServer server;
+        HttpRequestCallback route{ [](HttpRequest const& req, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "Route " + req.uri;
+            return 200;
+        } };
+        HttpRequestCallback pass{ [](HttpRequest const&, HttpResponse&) { return 0; } };
+        for (int i = 0; i < 300; i++)
+        {
+            server["/route/" + std::to_string(i) + "/"] = route;
+        }
+        server["/route/1"] = pass;
+        server["/unset"];
+        int port = server.addListeningPort(0);
+        server.start();
+
+        auto response = HttpRoundTrip(port, "GET /route/123/x HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_NE(response.find("\r\n\r\nRoute /route/123/x"), std::string::npos);
+        response = HttpRoundTrip(port, "GET /route/1/ HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_NE(response.find("\r\n\r\nRoute /route/1/"), std::string::npos);
+        response = HttpRoundTrip(port, "GET /route/1000/ HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 404 Not Found\r\n"), 0u);
+        response = HttpRoundTrip(port, "GET /unset HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 404 Not Found\r\n"), 0u);
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, ServerHeadersTest)
+    {
+        HttpServer server;
+        server.setServerName("test-host");
+        HttpRequestCallback custom{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.headers["Content-Length"] = "999";
+            resp.headers["X-Custom"] = "1";
+            resp.body = "abc";
+            return 200;
+        } };
+        server["/custom"] = custom;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        auto response = HttpRoundTrip(port, "GET /custom HTTP/1.0\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.0 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\nHost: test-host\r\n"), std::string::npos);
+        EXPECT_NE(response.find("\r\nConnection: close\r\n"), std::string::npos);
+        EXPECT_NE(response.find("\r\nX-Custom: 1\r\n"), std::string::npos);
+        // Server computes Content-Length, the handler value is dropped
+        EXPECT_NE(response.find("\r\nContent-Length: 3\r\n"), std::string::npos);
+        EXPECT_EQ(response.find("999"), std::string::npos);
+        size_t ofs = response.find("\r\nDate: ");
+        ASSERT_NE(ofs, std::string::npos);
+        EXPECT_EQ(response.find(" GMT\r\n", ofs), ofs + 2 + 6 + 25);
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, BodylessResponseTest)
+    {
+        HttpServer server;
+        HttpRequestCallback text{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "abc";
+            return 200;
+        } };
+        HttpRequestCallback noContent{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.body = "ignored";
+            return 204;
+        } };
+        HttpRequestCallback produced{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.producer = [](std::string& buffer) {
+                buffer = "produced";
+                return false;
+            };
+            return 200;
+        } };
+        server["/text"] = text;
+        server["/empty"] = noContent;
+        server["/produced"] = produced;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Bodies of 204 and HEAD are not sent, the next response follows the headers
+        auto response = HttpRoundTrip(port,
+            "GET /empty HTTP/1.1\r\n\r\nHEAD /text HTTP/1.1\r\n\r\nHEAD /produced HTTP/1.1\r\n\r\n"
+            "GET /text HTTP/1.1\r\nConnection: close\r\n\r\n");
+        response.resize(strlen(response.c_str()));
+        std::vector<std::string> responses;
+        for (size_t begin = 0; begin < response.size();)
+        {
+            size_t next = response.find("HTTP/1.1 ", begin + 1);
+            next = (next == std::string::npos) ? response.size() : next;
+            responses.push_back(response.substr(begin, next - begin));
+            begin = next;
+        }
+        ASSERT_EQ(responses.size(), 4u);
+        EXPECT_EQ(responses[0].find("HTTP/1.1 204 No Content\r\n"), 0u);
+        EXPECT_EQ(responses[0].find("Content-Length"), std::string::npos);
+        EXPECT_EQ(responses[0].find("ignored"), std::string::npos);
+        EXPECT_NE(responses[1].find("\r\nContent-Length: 3\r\n"), std::string::npos);
+        EXPECT_EQ(responses[1].substr(responses[1].size() - 4), "\r\n\r\n");
+        EXPECT_NE(responses[2].find("\r\nTransfer-Encoding: chunked\r\n"), std::string::npos);
+        EXPECT_EQ(responses[2].substr(responses[2].size() - 4), "\r\n\r\n");
+        EXPECT_EQ(responses[3].substr(responses[3].size() - 7), "\r\n\r\nabc");
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, ChunkedDecoderTest)
+    {
+        std::string text = "4\r\nWiki\r\n5;ext=1\r\npedia\r\n0\r\nTrailer: x\r\n\r\nGET";
+        HttpChunkedDecoder decoder;
+        std::string body;
+        auto onData = [&body](std::string_view data) {
+            body.append(data.data(), data.size());
+            return true;
+        };
+        // Arbitrary splits of the input give the same body
+        HttpChunkedDecoder::Result result = HttpChunkedDecoder::NeedMore;
+        size_t pos = 0;
+        while (result == HttpChunkedDecoder::NeedMore)
+        {
+            size_t consumed = 0;
+            result = decoder.decode(std::string_view(text).substr(pos, 3), consumed, onData);
+            pos += consumed;
+        }
+        EXPECT_EQ(result, HttpChunkedDecoder::Done);
+        EXPECT_EQ(body, "Wikipedia");
+        EXPECT_EQ(text.substr(pos), "GET");
+
+        size_t consumed = 0;
+        decoder.reset();
+        EXPECT_EQ(decoder.decode("zz\r\n", consumed, onData), HttpChunkedDecoder::Error);
+        decoder.reset();
+        EXPECT_EQ(decoder.decode("fffffffffffffffff\r\n", consumed, onData), HttpChunkedDecoder::Error);
+        decoder.reset();
+        EXPECT_EQ(decoder.decode("3\r\nabcX", consumed, onData), HttpChunkedDecoder::Error);
+    }
+
+    TEST(HttpServerTests, ChunkedRequestTest)
+    {
+        HttpServer server;
+        HttpRequestCallback echo{ [](HttpRequest const& req, HttpResponse& resp) {
+            resp.body = "echo " + req.content;
+            return 200;
+        } };
+        server["/echo"] = echo;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Chunked body is collected, the pipelined request after it is served too
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string requests = "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                               "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+                               "GET /echo HTTP/1.1\r\n\r\n";
+        client.writeall(requests);
+        std::string buffer;
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\necho abcde"), std::string::npos);
+        response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\necho "), std::string::npos);
+        client.close();
+
+        response = HttpRoundTrip(port, "POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 501 Not Implemented\r\n"), 0u);
+        response = HttpRoundTrip(port,
+            "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n0\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 400 Bad Request\r\n"), 0u);
+        response = HttpRoundTrip(port, "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 400 Bad Request\r\n"), 0u);
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, StreamingRequestBodyTest)
+    {
+        HttpServer server;
+        size_t received = 0;
+        size_t pieces = 0;
+        HttpRequestCallback upload{ [&](HttpRequest const& req, HttpResponse& resp) {
+            EXPECT_TRUE(req.content.empty());
+            resp.body = std::to_string(received);
+            return 200;
+        } };
+        upload.setBodyCallback([&](HttpRequest const&, std::string_view data) {
+            received += data.size();
+            pieces++;
+            return (data.find('!') == std::string_view::npos) ? 0 : 422;
+        });
+        server["/upload"] = upload;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Larger than the content limit, never collected in memory
+        size_t size = 8 * 1024 * 1024;
+        std::string part(64 * 1024, 'x');
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string head = "POST /upload HTTP/1.1\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n";
+        client.writeall(head);
+        for (size_t sent = 0; sent < size; sent += part.size())
+        {
+            client.writeall(part);
+        }
+        std::string buffer;
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\n" + std::to_string(size)), std::string::npos);
+        EXPECT_GT(pieces, 1u);
+
+        // Body callback rejects the rest of a chunked body
+        std::string chunked = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nok\r\n1\r\n!\r\n";
+        client.writeall(chunked);
+        response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 422 "), 0u);
+        EXPECT_NE(response.find("\r\nConnection: close\r\n"), std::string::npos);
+        client.close();
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, ProducedResponseTest)
+    {
+        HttpServer server;
+        std::string part(32 * 1024, 'p');
+        size_t parts = 64;
+        HttpRequestCallback download{ [&](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_BIN;
+            auto produced = std::make_shared<size_t>(0);
+            resp.producer = [&part, parts, produced](std::string& out) {
+                out.append(part);
+                return ++*produced < parts;
+            };
+            return 200;
+        } };
+        server["/download"] = download;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Chunked for HTTP/1.1, the next keep-alive request is answered after the body
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string requests = "GET /download HTTP/1.1\r\n\r\nGET /download HTTP/1.1\r\nConnection: close\r\n\r\n";
+        client.writeall(requests);
+        std::string response;
+        char chunk[16 * 1024];
+        int received;
+        while ((received = client.recv(chunk, sizeof(chunk))) > 0)
+        {
+            response.append(chunk, received);
+        }
+        client.close();
+
+        size_t pos = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            EXPECT_EQ(response.compare(pos, 17, "HTTP/1.1 200 OK\r\n"), 0);
+            size_t headEnd = response.find("\r\n\r\n", pos);
+            ASSERT_NE(headEnd, std::string::npos);
+            std::string head = response.substr(pos, headEnd - pos);
+            EXPECT_NE(head.find("\r\nTransfer-Encoding: chunked"), std::string::npos);
+            EXPECT_EQ(head.find("Content-Length"), std::string::npos);
+
+            HttpChunkedDecoder decoder;
+            size_t bodySize = 0;
+            size_t consumed = 0;
+            auto result = decoder.decode(std::string_view(response).substr(headEnd + 4), consumed,
+                [&bodySize](std::string_view data) {
+                    bodySize += data.size();
+                    return true;
+                });
+            EXPECT_EQ(result, HttpChunkedDecoder::Done);
+            EXPECT_EQ(bodySize, part.size() * parts);
+            pos = headEnd + 4 + consumed;
+        }
+        EXPECT_EQ(pos, response.size());
+
+        // HTTP/1.0 client reads the body until the connection is closed
+        client = Socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        requests = "GET /download HTTP/1.0\r\n\r\n";
+        client.writeall(requests);
+        response.clear();
+        while ((received = client.recv(chunk, sizeof(chunk))) > 0)
+        {
+            response.append(chunk, received);
+        }
+        client.close();
+        size_t headEnd = response.find("\r\n\r\n");
+        ASSERT_NE(headEnd, std::string::npos);
+        EXPECT_EQ(response.find("Transfer-Encoding"), std::string::npos);
+        EXPECT_NE(response.find("\r\nConnection: close\r\n"), std::string::npos);
+        EXPECT_EQ(response.size(), headEnd + 4 + part.size() * parts);
+        EXPECT_EQ(response.find_first_not_of('p', headEnd + 4), std::string::npos);
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, OffloadedHandlerTest)
+    {
+        HttpServer server;
+        server.setWorkerThreads(2);
+        HttpRequestCallback slow{ [](HttpRequest const& req, HttpResponse& resp) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "slow " + req.content;
+            return 200;
+        } };
+        slow.setExecution(HttpRequestCallback::Offload);
+        HttpRequestCallback fast{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = "fast";
+            return 200;
+        } };
+        server["/slow"] = slow;
+        server["/fast"] = fast;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Pipelined requests around the offloaded one are answered in order
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string requests = "GET /fast HTTP/1.1\r\n\r\nPOST /slow HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+                               "GET /fast HTTP/1.1\r\n\r\n";
+        client.writeall(requests);
+
+        // The reactor serves other connections while the handler blocks
+        auto started = std::chrono::steady_clock::now();
+        auto response = HttpRoundTrip(port, "GET /fast HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_NE(response.find("\r\n\r\nfast"), std::string::npos);
+        EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::milliseconds(200));
+
+        std::string buffer;
+        char const* expected[] = { "fast", "slow body", "fast" };
+        for (auto body : expected)
+        {
+            response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find(std::string("\r\n\r\n") + body), std::string::npos);
+        }
+        client.close();
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, OffloadQueueFullTest)
+    {
+        HttpServer server;
+        server.setWorkerThreads(1, 1);
+        HttpRequestCallback slow{ [](HttpRequest const&, HttpResponse& resp) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            resp.body = "slow";
+            return 200;
+        } };
+        slow.setExecution(HttpRequestCallback::Offload);
+        server["/slow"] = slow;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string request = "GET /slow HTTP/1.1\r\n\r\n";
+        client.writeall(request);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto response = HttpRoundTrip(port, "GET /slow HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 503 Service Unavailable\r\n"), 0u);
+
+        std::string buffer;
+        response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        client.close();
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, ReactorPoolGetTest)
+    {
+        HelloServerTest test;
+        int port = test.server.addListeningPort(0, 4);
+        test.server.start();
+
+        for (int i = 0; i < 16; i++)
+        {
+            auto response = HttpRoundTrip(port, "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n");
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("\r\n\r\nHello, /hello"), std::string::npos);
+        }
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, LargeBodyKeepaliveTest)
+    {
+        HttpServer server;
+        std::string body(4 * 1024 * 1024, 'x');
+        HttpRequestCallback large{ [&](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_TEXT;
+            resp.body = body;
+            return 200;
+        } };
+        server["/large"] = large;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Headers and body go out in one gather write, partial writes resume at the offset
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string request = "GET /large HTTP/1.1\r\n\r\nGET /large HTTP/1.1\r\n\r\n";
+        client.writeall(request);
+        std::string buffer;
+        for (int i = 0; i < 2; i++)
+        {
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            size_t ofs = response.find("\r\n\r\n");
+            ASSERT_NE(ofs, std::string::npos);
+            EXPECT_TRUE(response.compare(ofs + 4, std::string::npos, body) == 0);
+        }
+        client.close();
+
+        server.stop();
+    }
+
+    TEST(HttpServerTests, FileBodyTest)
+    {
+        std::string path = GetTempDirectory() + "http_file_body.bin";
+        std::string content;
+        for (size_t i = 0; i < 3 * 1024 * 1024; i++)
+        {
+            content += char('a' + i % 26);
+        }
+        FILE* f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        fwrite(content.data(), 1, content.size(), f);
+        fclose(f);
+        EXPECT_EQ(HttpFile::open(path + ".missing"), nullptr);
+
+        HttpServer server;
+        HttpRequestCallback file{ [&](HttpRequest const&, HttpResponse& resp) {
+            resp.headers[CONTENT_TYPE] = CONTENT_TYPE_BIN;
+            resp.file = HttpFile::open(path);
+            return (resp.file != nullptr) ? 200 : 404;
+        } };
+        server["/file"] = file;
+        int port = server.addListeningPort(0);
+        server.start();
+
+        // Content-Length comes from the file size, the body is sent with sendfile
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string request = "GET /file HTTP/1.1\r\n\r\nGET /file HTTP/1.1\r\n\r\n";
+        client.writeall(request);
+        std::string buffer;
+        for (int i = 0; i < 2; i++)
+        {
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("Content-Length: " + std::to_string(content.size()) + "\r\n"), std::string::npos);
+            size_t ofs = response.find("\r\n\r\n");
+            ASSERT_NE(ofs, std::string::npos);
+            EXPECT_TRUE(response.compare(ofs + 4, std::string::npos, content) == 0);
+        }
+        client.close();
+
+        server.stop();
+        std::remove(path.c_str());
+    }
+
+    /**
+     * @brief File server on an ephemeral port, with the file cache enabled.
+     */
+    class CachingFileServer : public HttpFileServer
+    {
+    public:
+        CachingFileServer() : HttpFileServer("127.0.0.1", 0)
+        {
+            SetFileCache(1024 * 1024, 64 * 1024, 0);
+            InitializeFileEndpoint(*this);
+        }
+
+        int port()
+        {
+            SocketAddr addr;
+            m_listeningSockets.front().getsockname(addr);
+            return addr.port();
+        }
+    };
+
+    static void WriteTextFile(std::string const& path, std::string const& content)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        fwrite(content.data(), 1, content.size(), f);
+        fclose(f);
+    }
+
+    TEST(HttpServerTests, FileCacheTest)
+    {
+        // File server serves files relative to the working directory
+        std::string name = "http_file_cache.css";
+        WriteTextFile(name, "body { color: red; }");
+
+        CachingFileServer server;
+        int port = server.port();
+        server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string buffer;
+        std::string request = "GET /" + name + " HTTP/1.1\r\n\r\n";
+        client.writeall(request);
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("Content-Type: text/css\r\n"), std::string::npos);
+        EXPECT_NE(response.find("Last-Modified: "), std::string::npos);
+        EXPECT_NE(response.find("\r\n\r\nbody { color: red; }"), std::string::npos);
+        size_t ofs = response.find("ETag: ");
+        ASSERT_NE(ofs, std::string::npos);
+        std::string etag = response.substr(ofs + 6, response.find("\r\n", ofs) - ofs - 6);
+
+        // Served from the cache
+        client.writeall(request);
+        EXPECT_EQ(ReadHttpResponse(client, buffer), response);
+
+        request = "GET /" + name + " HTTP/1.1\r\nIf-None-Match: " + etag + "\r\n\r\n";
+        client.writeall(request);
+        response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 304 Not Modified\r\n"), 0u);
+        EXPECT_EQ(response.find("Content-Length"), std::string::npos);
+
+        // Size changed, the entry is dropped on revalidation
+        WriteTextFile(name, "body { color: green; }");
+        client.writeall(request);
+        response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\nbody { color: green; }"), std::string::npos);
+        client.close();
+
+        server.stop();
+        std::remove(name.c_str());
+    }
+
+    TEST(HttpServerTests, PipelinedRequestsTest)
+    {
+        HelloServerTest test;
+        test.server.setPipelineDepth(4);
+        int port = test.server.addListeningPort(0);
+        test.server.start();
+
+        // Responses to requests received together are batched, in request order
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string pipelined;
+        for (int i = 0; i < 30; i++)
+        {
+            pipelined += "GET /hello/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+        }
+        // Body with "100 Continue" behind batched responses
+        pipelined += "POST /hello/post HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 4\r\n\r\n";
+        client.writeall(pipelined);
+        std::string buffer;
+        for (int i = 0; i < 30; i++)
+        {
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("\r\n\r\nHello, /hello/" + std::to_string(i)), std::string::npos);
+        }
+        EXPECT_EQ(ReadHttpResponse(client, buffer), "HTTP/1.1 100 Continue\r\n\r\n");
+        std::string body = "data";
+        client.writeall(body);
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_NE(response.find("\r\n\r\nHello, /hello/post"), std::string::npos);
+        client.close();
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, SendBudgetTest)
+    {
+        for (auto backend : { Reactor::Default, Reactor::IoUring })
+        {
+            HttpServer server;
+            HttpRequestCallback big{ [](HttpRequest const& req, HttpResponse& resp) {
+                resp.body.assign(256 * 1024, req.uri.back());
+                return 200;
+            } };
+            server["/big"] = big;
+            // Falls back to epoll if the kernel doesn't support io_uring
+            server.setBackend(backend);
+            server.setSendWatermarks(64 * 1024, 16 * 1024);
+            server.setGlobalSendWatermarks(1024 * 1024, 256 * 1024);
+            int port = server.addListeningPort(0);
+            server.start();
+
+            // Client that doesn't read holds back the answers to its pipelined requests
+            Socket client(AF_INET, SOCK_STREAM, 0);
+            ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+            std::string pipelined;
+            for (int i = 0; i < 32; i++)
+            {
+                pipelined += "GET /big/" + std::string(1, char('a' + i % 26)) + " HTTP/1.1\r\n\r\n";
+            }
+            client.writeall(pipelined);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            EXPECT_LT(server.pendingSendBytes(), 2u * 1024 * 1024);
+
+            std::string buffer;
+            for (int i = 0; i < 32; i++)
+            {
+                auto response = ReadHttpResponse(client, buffer);
+                EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+                EXPECT_NE(response.find("\r\n\r\n" + std::string(256 * 1024, char('a' + i % 26))),
+                    std::string::npos);
+            }
+            client.close();
+            server.stop();
+            EXPECT_EQ(server.pendingSendBytes(), 0u);
+        }
+    }
+
+    TEST(HttpServerTests, EdgeTriggeredKeepaliveTest)
+    {
+        HelloServerTest test;
+        test.server.setEdgeTriggered(true);
+        test.server.setEventBatchSize(512);
+        int port = test.server.addListeningPort(0);
+        test.server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string buffer;
+        for (int i = 0; i < 4; i++)
+        {
+            std::string request = "GET /hello/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+            client.writeall(request);
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("Connection: keep-alive\r\n"), std::string::npos);
+            EXPECT_NE(response.find("\r\n\r\nHello, /hello/" + std::to_string(i)), std::string::npos);
+        }
+
+        // Several requests in one segment
+        std::string pipelined;
+        for (int i = 0; i < 8; i++)
+        {
+            pipelined += "GET /hello/p" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+        }
+        client.writeall(pipelined);
+        for (int i = 0; i < 8; i++)
+        {
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_NE(response.find("\r\n\r\nHello, /hello/p" + std::to_string(i)), std::string::npos);
+        }
+        client.close();
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, IoUringKeepaliveTest)
+    {
+        HelloServerTest test;
+        // Falls back to epoll if the kernel doesn't support io_uring
+        test.server.setBackend(Reactor::IoUring);
+        int port = test.server.addListeningPort(0, 2);
+        test.server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string buffer;
+        std::string pipelined;
+        for (int i = 0; i < 8; i++)
+        {
+            pipelined += "GET /hello/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+        }
+        client.writeall(pipelined);
+        for (int i = 0; i < 8; i++)
+        {
+            auto response = ReadHttpResponse(client, buffer);
+            EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+            EXPECT_NE(response.find("\r\n\r\nHello, /hello/" + std::to_string(i)), std::string::npos);
+        }
+        client.close();
+
+        // Shutdown is linked to the body of the last response
+        auto response = HttpRoundTrip(port, "GET /hello/close HTTP/1.1\r\nConnection: close\r\n\r\n");
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("\r\n\r\nHello, /hello/close"), std::string::npos);
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, ThreadOwnedKeepaliveTest)
+    {
+        HelloServerTest test;
+        // Listeners are posted to reactors and added when they start
+        EXPECT_TRUE(test.server.setThreadOwned(true));
+        int port = test.server.addListeningPort(0, 4);
+        test.server.start();
+
+        for (int i = 0; i < 8; i++)
+        {
+            Socket client(AF_INET, SOCK_STREAM, 0);
+            ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+            std::string buffer;
+            for (int j = 0; j < 4; j++)
+            {
+                std::string request = "GET /hello/" + std::to_string(j) + " HTTP/1.1\r\n\r\n";
+                client.writeall(request);
+                auto response = ReadHttpResponse(client, buffer);
+                EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+                EXPECT_NE(response.find("\r\n\r\nHello, /hello/" + std::to_string(j)), std::string::npos);
+            }
+            client.close();
+        }
+
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, MetricsTest)
+    {
+        HelloServerTest test;
+        test.server.enableMetrics();
+        int port = test.server.addListeningPort(0, 2);
+        test.server.start();
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+        std::string buffer;
+        for (int i = 0; i < 5; i++)
+        {
+            std::string request = "GET /hello/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+            client.writeall(request);
+            EXPECT_EQ(ReadHttpResponse(client, buffer).find("HTTP/1.1 200 OK\r\n"), 0u);
+        }
+
+        // The connection waits for the next request, counters are written before the response is sent
+        HttpServerMetrics metrics = test.server.metrics();
+        EXPECT_EQ(metrics.reactors.accepts, 1u);
+        EXPECT_EQ(metrics.reactors.bytesRead, 5 * 25u);
+        EXPECT_GT(metrics.reactors.wakeups, 0u);
+        EXPECT_EQ(metrics.connectionsOpened, 1u);
+        EXPECT_EQ(metrics.activeConnections(), 1u);
+        EXPECT_EQ(metrics.requests, 5u);
+        EXPECT_EQ(metrics.processing.count(), 5u);
+        uint64_t open = 0;
+        for (uint64_t connections : metrics.connections)
+        {
+            open += connections;
+        }
+        EXPECT_EQ(open, 1u);
+
+        std::string request = "GET /metrics HTTP/1.1\r\n\r\n";
+        client.writeall(request);
+        auto response = ReadHttpResponse(client, buffer);
+        EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+        EXPECT_NE(response.find("Content-Type: text/plain; version=0.0.4\r\n"), std::string::npos);
+        EXPECT_NE(response.find("\nsocketshpp_http_requests_total 6\n"), std::string::npos);
+        EXPECT_NE(response.find("\nsocketshpp_http_connections{state=\"processing\"} 1\n"), std::string::npos);
+        EXPECT_NE(response.find("\nsocketshpp_http_request_processing_seconds_count 5\n"), std::string::npos);
+        EXPECT_NE(response.find("\n# TYPE socketshpp_http_request_processing_seconds summary\n"), std::string::npos);
+        // Earlier responses were sent by the reactor before it processed this request
+        EXPECT_GT(test.server.metrics().reactors.bytesWritten, 5 * 100u);
+        client.close();
+
+        // Closed by the reactor thread, after the client
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while ((test.server.metrics().connectionsClosed != 1) && (std::chrono::steady_clock::now() < deadline))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        metrics = test.server.metrics();
+        EXPECT_EQ(metrics.connectionsClosed, 1u);
+        EXPECT_EQ(metrics.activeConnections(), 0u);
+        for (uint64_t connections : metrics.connections)
+        {
+            EXPECT_EQ(connections, 0u);
+        }
+        test.server.stop();
+    }
+
+    TEST(HttpServerTests, AcceptStormTest)
+    {
+        static const size_t kClients = 200;
+        for (bool edgeTriggered : { false, true })
+        {
+            HelloServerTest test;
+            test.server.setEdgeTriggered(edgeTriggered);
+            // Connections queue in the backlog, the reactor takes a few of them per wakeup
+            test.server.setAcceptBudget(4);
+            test.server.setListenBacklog(kClients);
+            test.server.setDeferAccept(1);
+            test.server.setFastOpen(16);
+            int port = test.server.addListeningPort(0, 2);
+            test.server.start();
+
+            std::vector<Socket> clients;
+            for (size_t i = 0; i < kClients; i++)
+            {
+                clients.emplace_back(AF_INET, SOCK_STREAM, 0);
+                ASSERT_TRUE(clients.back().connect(SocketAddr(SocketAddr::Loopback, port)));
+            }
+            for (size_t i = 0; i < kClients; i++)
+            {
+                std::string request = "GET /hello/" + std::to_string(i) + " HTTP/1.1\r\n\r\n";
+                clients[i].writeall(request);
+            }
+            for (size_t i = 0; i < kClients; i++)
+            {
+                std::string buffer;
+                auto response = ReadHttpResponse(clients[i], buffer);
+                EXPECT_EQ(response.find("HTTP/1.1 200 OK\r\n"), 0u);
+                EXPECT_NE(response.find("\r\n\r\nHello, /hello/" + std::to_string(i)), std::string::npos);
+                clients[i].close();
+            }
+            EXPECT_EQ(test.server.metrics().reactors.accepts, kClients);
+            test.server.stop();
+        }
+    }
+
+}  // namespace testing
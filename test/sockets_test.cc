@@ -4,13 +4,18 @@
 // Uncomment this line for additional debugging:
 // #define HAVE_CONSOLE_LOG
 
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <future>
 #include <list>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -19,6 +24,7 @@
 #include "./utils.h"
 
 using namespace SOCKETSHPP_NS::net::common;
+using SOCKETSHPP_NS::net::utils::ConnectionPool;
 using namespace std;
 
 namespace testing
@@ -45,8 +51,7 @@ namespace testing
         EchoServerTest(SocketServer& server) : server(server)
         {
             server.onRequest = [&](SocketServer::Connection& conn) {
-                conn.response_buffer.clear();
-                conn.request_buffer.swap(conn.response_buffer);
+                conn.response_buffer.assign(conn.request_data.data(), conn.request_data.size());
                 // Signal to Reactor that it's time to respond
                 conn.state.insert(SocketServer::Connection::Responding);
             };
@@ -94,6 +99,300 @@ namespace testing
         EXPECT_TRUE(host_port_ipv6 == destination.toString());
     }
 
+    TEST(SocketTests, BufferPoolTest)
+    {
+        BufferPool pool(1024, 1);
+        char* data;
+        {
+            BufferPool::Chunk chunk = pool.acquire();
+            ASSERT_TRUE(static_cast<bool>(chunk));
+            EXPECT_EQ(chunk.size(), 1024u);
+            data = chunk.data();
+        }
+        // Returned on destruction and handed out again
+        EXPECT_EQ(pool.available(), 1u);
+        BufferPool::Chunk first = pool.acquire();
+        EXPECT_EQ(first.data(), data);
+        EXPECT_EQ(pool.available(), 0u);
+
+        // Only one free buffer is kept
+        BufferPool::Chunk second = pool.acquire();
+        EXPECT_NE(second.data(), data);
+        first.reset();
+        second.reset();
+        EXPECT_FALSE(static_cast<bool>(first));
+        EXPECT_EQ(pool.available(), 1u);
+    }
+
+    TEST(SocketTests, ConnectionTableTest)
+    {
+        ConnectionTable<SocketServer::Connection> table;
+        SocketServer::Connection& first = table.insert(Socket(5));
+        first.state = { SocketServer::Connection::Idle, SocketServer::Connection::Responding };
+        first.response_buffer = "pending";
+        EXPECT_EQ(&table.insert(Socket(5)), &first);
+        SocketServer::Connection& second = table.insert(Socket(1000));
+        EXPECT_EQ(table.size(), 2u);
+        EXPECT_EQ(table.find(Socket(5)), &first);
+        EXPECT_EQ(table.find(Socket(1000)), &second);
+        EXPECT_EQ(table.find(Socket(6)), nullptr);
+
+        // Entries don't move, erased slots are reset and reused
+        for (int fd = 10; fd < 600; fd++)
+        {
+            table.insert(Socket(fd));
+        }
+        EXPECT_EQ(table.find(Socket(5)), &first);
+        EXPECT_TRUE(first.state.count(SocketServer::Connection::Responding));
+        EXPECT_TRUE(table.erase(Socket(5)));
+        EXPECT_FALSE(table.erase(Socket(5)));
+        EXPECT_EQ(table.find(Socket(5)), nullptr);
+        size_t capacity = table.capacity();
+        SocketServer::Connection& reused = table.insert(Socket(7));
+        EXPECT_EQ(&reused, &first);
+        EXPECT_TRUE(reused.state.empty());
+        EXPECT_TRUE(reused.response_buffer.empty());
+        EXPECT_EQ(table.capacity(), capacity);
+        EXPECT_EQ(table.size(), 592u);
+
+        size_t visited = 0;
+        table.forEach([&table, &visited](Socket socket, SocketServer::Connection& conn) {
+            EXPECT_EQ(table.find(socket), &conn);
+            visited++;
+        });
+        EXPECT_EQ(visited, table.size());
+    }
+
+    TEST(SocketTests, TimerWheelTest)
+    {
+        using SOCKETSHPP_NS::net::utils::TimerWheel;
+        using std::chrono::milliseconds;
+        TimerWheel wheel;
+        auto start = TimerWheel::Clock::now();
+        std::vector<int> fired;
+        EXPECT_EQ(wheel.timeout(500), 500);
+        wheel.add(milliseconds(30), [&fired]() { fired.push_back(30); });
+        wheel.add(milliseconds(10), [&fired]() { fired.push_back(10); });
+        TimerWheel::TimerId cancelled = wheel.add(milliseconds(20), [&fired]() { fired.push_back(20); });
+        // Past the first level, past the last level
+        wheel.add(milliseconds(600000), [&fired]() { fired.push_back(600000); });
+        wheel.add(std::chrono::hours(5), [&fired]() { fired.push_back(-1); });
+        EXPECT_EQ(wheel.size(), 5u);
+        EXPECT_LE(wheel.timeout(500), 11);  // Rounded up to whole ticks
+        wheel.cancel(cancelled);
+        EXPECT_EQ(wheel.size(), 4u);
+
+        wheel.advance(start + milliseconds(5));
+        EXPECT_TRUE(fired.empty());
+        wheel.advance(start + milliseconds(40));
+        EXPECT_EQ(fired, (std::vector<int>{ 10, 30 }));
+
+        // Id of an expired timer doesn't cancel the timer reusing its node
+        TimerWheel::TimerId reused = wheel.add(milliseconds(10), [&fired, &wheel]() {
+            fired.push_back(11);
+            wheel.add(milliseconds(1), [&fired]() { fired.push_back(12); });
+        });
+        EXPECT_NE(reused, cancelled);
+        wheel.cancel(cancelled);
+        wheel.cancel(0);
+        EXPECT_EQ(wheel.size(), 3u);
+        // Timers added by callbacks expire in the same advance
+        wheel.advance(start + milliseconds(60));
+        EXPECT_EQ(fired, (std::vector<int>{ 10, 30, 11, 12 }));
+
+        wheel.advance(start + milliseconds(599000));
+        EXPECT_EQ(fired.size(), 4u);
+        wheel.advance(start + milliseconds(601000));
+        EXPECT_EQ(fired.back(), 600000);
+        wheel.advance(start + std::chrono::hours(5) - milliseconds(1000));
+        EXPECT_EQ(fired.size(), 5u);
+        EXPECT_GT(wheel.timeout(500), 0);
+        wheel.advance(start + std::chrono::hours(5) + milliseconds(1000));
+        EXPECT_EQ(fired.back(), -1);
+        EXPECT_TRUE(wheel.empty());
+    }
+
+    TEST(SocketTests, SendBudgetTest)
+    {
+        SOCKETSHPP_NS::net::utils::SendBudget budget;
+        EXPECT_FALSE(budget.enabled());
+        budget.setConnectionWatermarks(1000, 200);
+        budget.setGlobalWatermarks(1500, 500);
+        EXPECT_TRUE(budget.enabled());
+
+        size_t first = 0;
+        size_t second = 0;
+        EXPECT_FALSE(budget.update(first, 900, false));
+        EXPECT_TRUE(budget.update(first, 1000, false));
+        // Resumes at the low watermark, not below the high one
+        EXPECT_TRUE(budget.update(first, 600, true));
+        EXPECT_FALSE(budget.update(first, 200, true));
+        EXPECT_EQ(budget.pending(), 200u);
+
+        // Every connection with bytes queued pauses for the total
+        EXPECT_FALSE(budget.update(second, 800, false));
+        EXPECT_TRUE(budget.update(first, 700, false));
+        EXPECT_EQ(budget.pending(), 1500u);
+        EXPECT_TRUE(budget.update(second, 100, true));
+        EXPECT_FALSE(budget.update(second, 0, true));
+        EXPECT_TRUE(budget.update(first, 400, true));
+        EXPECT_FALSE(budget.update(first, 200, true));
+        EXPECT_FALSE(budget.update(first, 0, false));
+        EXPECT_EQ(budget.pending(), 0u);
+    }
+
+    TEST(SocketTests, LatencyHistogramTest)
+    {
+        using SOCKETSHPP_NS::net::utils::LatencyHistogram;
+        LatencyHistogram histogram;
+        EXPECT_EQ(histogram.percentile(0.5), 0u);
+        for (uint64_t value = 1; value <= 1000; value++)
+        {
+            histogram.record(value);
+        }
+        EXPECT_EQ(histogram.count(), 1000u);
+        EXPECT_EQ(histogram.sum(), 500500u);
+        EXPECT_EQ(histogram.max(), 1000u);
+        EXPECT_EQ(histogram.percentile(0), 1u);
+        // Within the bucket width of about 3%
+        EXPECT_GE(histogram.percentile(0.5), 500u);
+        EXPECT_LE(histogram.percentile(0.5), 516u);
+        EXPECT_GE(histogram.percentile(0.99), 990u);
+        EXPECT_LE(histogram.percentile(0.99), 1000u);
+        EXPECT_EQ(histogram.percentile(1), 1000u);
+
+        // Every value falls into the bucket it bounds
+        for (uint64_t value : std::vector<uint64_t>{ 0, 31, 64, 65, 1000000, LatencyHistogram::MaxValue })
+        {
+            size_t bucket = LatencyHistogram::bucketOf(value);
+            EXPECT_LT(bucket, LatencyHistogram::Buckets);
+            EXPECT_GE(LatencyHistogram::upperBound(bucket), value);
+            EXPECT_EQ(LatencyHistogram::bucketOf(LatencyHistogram::upperBound(bucket)), bucket);
+        }
+
+        // Snapshots merge, larger values than the maximum are clamped
+        LatencyHistogram other;
+        other.record(uint64_t(1) << 60);
+        LatencyHistogram merged(histogram);
+        merged.add(other);
+        EXPECT_EQ(merged.count(), 1001u);
+        EXPECT_EQ(merged.max(), LatencyHistogram::MaxValue);
+        EXPECT_EQ(merged.percentile(0.5), histogram.percentile(0.5));
+        histogram.reset();
+        EXPECT_EQ(histogram.count(), 0u);
+        EXPECT_EQ(merged.count(), 1001u);
+    }
+
+    TEST(SocketTests, ThreadPoolTest)
+    {
+        SOCKETSHPP_NS::net::utils::ThreadPool pool(4, 64);
+        EXPECT_EQ(pool.size(), 4u);
+        std::atomic<int> done{ 0 };
+        pool.start();
+        for (int i = 0; i < 64; i++)
+        {
+            EXPECT_TRUE(pool.submit([&done]() { done++; }));
+        }
+        // Queued tasks run before the workers exit
+        pool.stop();
+        EXPECT_EQ(done.load(), 64);
+        EXPECT_EQ(pool.pending(), 0u);
+
+        // Tasks over the capacity are refused
+        SOCKETSHPP_NS::net::utils::ThreadPool bounded(1, 2);
+        EXPECT_TRUE(bounded.submit([]() {}));
+        EXPECT_TRUE(bounded.submit([]() {}));
+        EXPECT_FALSE(bounded.submit([]() {}));
+        bounded.start();
+        bounded.stop();
+        EXPECT_TRUE(bounded.submit([]() {}));
+    }
+
+    TEST(SocketTests, AcceptNonBlockingTest)
+    {
+        Socket listener(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(listener.bind(SocketAddr("127.0.0.1:0")), 0);
+        // Longer backlogs are capped
+        ASSERT_TRUE(listener.listen(size_t(1) << 20));
+        listener.setNonBlocking();
+        SocketAddr address;
+        ASSERT_TRUE(listener.getsockname(address));
+        Socket accepted;
+        SocketAddr peer;
+        EXPECT_FALSE(listener.acceptNonBlocking(accepted, peer));
+        EXPECT_EQ(listener.error(), Socket::ErrorWouldBlock);
+
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(address));
+        ASSERT_TRUE(listener.acceptNonBlocking(accepted, peer));
+        char buffer[16];
+        EXPECT_LT(accepted.recv(buffer, sizeof(buffer)), 0);
+        EXPECT_EQ(accepted.error(), Socket::ErrorWouldBlock);
+#ifdef __linux__
+        EXPECT_NE(::fcntl(accepted.m_sock, F_GETFD) & FD_CLOEXEC, 0);
+        EXPECT_TRUE(listener.setDeferAccept(1));
+        EXPECT_TRUE(listener.setFastOpen(16));
+#endif
+        accepted.close();
+        client.close();
+        listener.close();
+    }
+
+    TEST(SocketTests, SendToResetPeerTest)
+    {
+        Socket listener(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(listener.bind(SocketAddr("127.0.0.1:0")), 0);
+        ASSERT_TRUE(listener.listen(1));
+        SocketAddr address;
+        ASSERT_TRUE(listener.getsockname(address));
+        Socket client(AF_INET, SOCK_STREAM, 0);
+        ASSERT_TRUE(client.connect(address));
+        Socket accepted;
+        SocketAddr peer;
+        ASSERT_TRUE(listener.accept(accepted, peer));
+
+        // Linger 0: close sends RST instead of FIN
+        struct linger reset = { 1, 0 };
+        setsockopt(client.m_sock, SOL_SOCKET, SO_LINGER, reinterpret_cast<char const*>(&reset), sizeof(reset));
+        client.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        // The first write reports the reset, the next ones would raise SIGPIPE and end the process
+        char data[] = "data";
+        Socket::IoVec vec;
+#ifdef _WIN32
+        vec.buf = data;
+        vec.len = sizeof(data);
+#else
+        vec.iov_base = data;
+        vec.iov_len = sizeof(data);
+#endif
+        for (int i = 0; i < 3; i++)
+        {
+            EXPECT_LT(accepted.send(data, sizeof(data)), 0);
+            EXPECT_LT(accepted.sendv(&vec, 1), 0);
+        }
+#ifndef _WIN32
+        std::string path = GetTempDirectory() + "send_to_reset_peer.bin";
+        FILE* f = fopen(path.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        fwrite(data, 1, sizeof(data), f);
+        fclose(f);
+        int file = ::open(path.c_str(), O_RDONLY);
+        ASSERT_GE(file, 0);
+        for (int i = 0; i < 3; i++)
+        {
+            uint64_t offset = 0;
+            EXPECT_LT(accepted.sendfile(file, offset, sizeof(data)), 0);
+            EXPECT_EQ(offset, 0u);
+        }
+        ::close(file);
+        std::remove(path.c_str());
+#endif
+        accepted.close();
+        listener.close();
+    }
+
     TEST(SocketTests, BasicTcpEchoTest)
     {
         SocketParams params{ AF_INET, SOCK_STREAM, 0 };
@@ -118,6 +417,305 @@ namespace testing
         test.Stop();
     }
 
+    TEST(SocketTests, ReactorPoolTcpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        SocketAddr destination("127.0.0.1:0");
+        SocketServer server(destination, params, 10, 4);
+        EXPECT_EQ(server.reactors.size(), 4u);
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!", kMaxConnections);
+        test.Stop();
+    }
+
+    TEST(SocketTests, IdleTimeoutTcpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        // Closed by the server, so that the port lingers in TIME_WAIT: any available port
+        SocketAddr destination("127.0.0.1:0");
+        SocketServer server(destination, params, 10, 2);
+        server.idle_timeout = std::chrono::milliseconds(200);
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!");
+
+        // Connection kept open by the client is closed by the server once idle
+        Socket client(server.server_socket_params);
+        ASSERT_TRUE(client.connect(server.address()));
+        std::string request_text = "ping";
+        client.writeall(request_text);
+        std::string response_text(request_text.size(), 0);
+        EXPECT_EQ(client.readall(response_text), request_text.size());
+        client.setNonBlocking();
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        int received = -1;
+        char byte;
+        while ((received != 0) && (std::chrono::steady_clock::now() < deadline))
+        {
+            received = client.recv(&byte, 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        EXPECT_EQ(received, 0);
+        client.close();
+        test.Stop();
+    }
+
+    TEST(SocketTests, SendBudgetTcpTest)
+    {
+        static const size_t kResponseSize = 1024 * 1024;
+        for (auto backend : { Reactor::Default, Reactor::IoUring })
+        {
+            SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+            SocketServer server(SocketAddr("127.0.0.1:0"), params);
+            // Falls back to epoll if the kernel doesn't support io_uring
+            server.reactors.setBackend(backend);
+            server.send_budget.setConnectionWatermarks(64 * 1024, 16 * 1024);
+            std::atomic<int> paused{ 0 };
+            std::atomic<int> resumed{ 0 };
+            // Every request byte is answered with a megabyte of it, appended behind what is still unsent
+            server.onRequest = [](SocketServer::Connection& conn) {
+                for (char c : conn.request_data)
+                {
+                    conn.response_buffer.append(kResponseSize, c);
+                }
+                conn.state.insert(SocketServer::Connection::Responding);
+            };
+            server.onWritePaused = [&paused](SocketServer::Connection&) { paused++; };
+            server.onWriteResumed = [&resumed](SocketServer::Connection&) { resumed++; };
+            server.Start();
+
+            Socket client(server.server_socket_params);
+            ASSERT_TRUE(client.connect(server.address()));
+            std::string requests = "0123";
+            client.writeall(requests);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            EXPECT_GE(paused.load(), 1);
+            std::string more = "4567";
+            client.writeall(more);
+
+            std::string response_text(8 * kResponseSize, 0);
+            EXPECT_EQ(client.readall(response_text), response_text.size());
+            for (size_t i = 0; i < 8; i++)
+            {
+                EXPECT_EQ(
+                    response_text.compare(i * kResponseSize, kResponseSize, std::string(kResponseSize, char('0' + i))),
+                    0);
+            }
+            client.close();
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while ((server.send_budget.pending() != 0) && (std::chrono::steady_clock::now() < deadline))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            EXPECT_EQ(server.send_budget.pending(), 0u);
+            EXPECT_GE(resumed.load(), 1);
+            server.Stop();
+        }
+    }
+
+    /**
+     * @brief Reactor callback of client sockets that are only awaited.
+     */
+    struct IdleCallback : public Reactor::SocketCallback
+    {
+        virtual void onSocketReadable(Socket) override {}
+        virtual void onSocketWritable(Socket) override {}
+        virtual void onSocketAcceptable(Socket) override {}
+        virtual void onSocketClosed(Socket) override {}
+    };
+
+    /**
+     * @brief Run function on the reactor thread and wait until it returns.
+     */
+    static void RunOnReactor(Reactor& reactor, std::function<void()> function)
+    {
+        std::promise<void> done;
+        reactor.execute([&]() {
+            function();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+
+    TEST(SocketTests, ConnectionPoolTest)
+    {
+        using Result = std::pair<Socket, int>;
+        for (auto backend : { Reactor::Default, Reactor::IoUring })
+        {
+            // Connections complete in the backlog, they are accepted when the test needs the peer
+            Socket listener(AF_INET, SOCK_STREAM, 0);
+            ASSERT_EQ(listener.bind(SocketAddr("127.0.0.1:0")), 0);
+            ASSERT_TRUE(listener.listen(16));
+            SocketAddr address;
+            ASSERT_TRUE(listener.getsockname(address));
+
+            IdleCallback callback;
+            Reactor reactor(callback);
+            // Falls back to epoll if the kernel doesn't support io_uring
+            reactor.setBackend(backend);
+            reactor.start();
+            ConnectionPool pool(reactor);
+            pool.setMaxPerHost(1);
+
+            std::mutex mutex;
+            std::vector<Result> results;
+            auto acquire = [&]() {
+                pool.acquire(address, [&](Socket socket, int error) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results.push_back({ socket, error });
+                });
+            };
+            auto waitFor = [&](size_t count) {
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                for (;;)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if ((results.size() >= count) || (std::chrono::steady_clock::now() >= deadline))
+                        {
+                            return results.size() >= count;
+                        }
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            };
+
+            // New connection, the next acquire waits for it above the limit
+            RunOnReactor(reactor, acquire);
+            ASSERT_TRUE(waitFor(1));
+            Socket first = results[0].first;
+            EXPECT_EQ(results[0].second, 0);
+            ASSERT_FALSE(first.invalid());
+            RunOnReactor(reactor, [&]() {
+                acquire();
+                EXPECT_EQ(pool.open(address), 1u);
+                EXPECT_EQ(pool.waiting(address), 1u);
+                pool.release(address, first);
+            });
+            ASSERT_TRUE(waitFor(2));
+            EXPECT_EQ(results[1].first, first);
+
+            // Idle connection is reused
+            RunOnReactor(reactor, [&]() {
+                pool.release(address, first);
+                EXPECT_EQ(pool.idle(address), 1u);
+                acquire();
+            });
+            ASSERT_TRUE(waitFor(3));
+            EXPECT_EQ(results[2].first, first);
+
+            // Connection closed by the peer fails the health check
+            Socket peer;
+            SocketAddr peerAddress;
+            ASSERT_TRUE(listener.accept(peer, peerAddress));
+            peer.close();
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            RunOnReactor(reactor, [&]() {
+                pool.release(address, first);
+                EXPECT_EQ(pool.idle(address), 0u);
+                EXPECT_EQ(pool.open(address), 0u);
+            });
+
+            // Idle connection expires
+            RunOnReactor(reactor, [&]() {
+                pool.setIdleTimeout(std::chrono::milliseconds(20));
+                acquire();
+            });
+            ASSERT_TRUE(waitFor(4));
+            EXPECT_EQ(results[3].second, 0);
+            RunOnReactor(reactor, [&]() { pool.release(address, results[3].first); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            RunOnReactor(reactor, [&]() {
+                EXPECT_EQ(pool.idle(address), 0u);
+                EXPECT_EQ(pool.open(address), 0u);
+            });
+
+            // Connect refused once nobody listens
+            listener.close();
+            RunOnReactor(reactor, acquire);
+            ASSERT_TRUE(waitFor(5));
+            EXPECT_TRUE(results[4].first.invalid());
+            EXPECT_NE(results[4].second, 0);
+            RunOnReactor(reactor, [&]() { EXPECT_EQ(pool.open(address), 0u); });
+            reactor.stop();
+        }
+    }
+
+    TEST(SocketTests, GatherWriteTcpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        SocketAddr destination("127.0.0.1:3000");
+        SocketServer server(destination, params);
+        EchoServerTest test(server);
+        test.Start();
+
+        std::string header = "Hello, ";
+        std::string body = GenerateBigString(20000);
+        std::string trailer = "!";
+        Socket client(server.server_socket_params);
+        ASSERT_TRUE(client.connect(server.address()));
+        Socket::IoVec vecs[3] = { Socket::ioVec(header.data(), header.size()),
+            Socket::ioVec(body.data(), body.size()), Socket::ioVec(trailer.data(), trailer.size()) };
+        size_t total = header.size() + body.size() + trailer.size();
+        EXPECT_EQ(client.writeallv(vecs, 3), total);
+
+        std::string response_text;
+        response_text.resize(total, 0);
+        EXPECT_EQ(client.readall(response_text), total);
+        EXPECT_EQ(response_text, header + body + trailer);
+        client.close();
+        test.Stop();
+    }
+
+    TEST(SocketTests, EdgeTriggeredTcpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        SocketAddr destination("127.0.0.1:3000");
+        SocketServer server(destination, params);
+        server.reactors.setEdgeTriggered(true);
+        server.reactors.setEventBatchSize(256);
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!", kMaxConnections);
+        // Larger than a single 4K read chunk
+        test.PingPong(GenerateBigString(20000));
+        test.Stop();
+    }
+
+    TEST(SocketTests, IoUringTcpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        SocketAddr destination("127.0.0.1:0");
+        SocketServer server(destination, params, 10, 4);
+        // Falls back to epoll if the kernel doesn't support io_uring
+        bool completion = server.reactors.setBackend(Reactor::IoUring);
+        EXPECT_EQ(server.reactors[0].isCompletionBased(), completion);
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!", kMaxConnections);
+        // More than one provided buffer
+        test.PingPong(GenerateBigString(20000));
+        test.Stop();
+    }
+
+    TEST(SocketTests, ThreadOwnedUnixDomainEchoTest)
+    {
+        auto socket_name = GetTempDirectory();
+        SocketParams params{ AF_UNIX, SOCK_STREAM, 0 };
+        socket_name += "messenger.sock";
+        std::remove(socket_name.c_str());
+        SocketAddr destination(socket_name.c_str(), true);
+        // Accepting reactor posts connections to the other reactors
+        SocketServer server(destination, params, 10, 4);
+        EXPECT_TRUE(server.reactors.setThreadOwned(true));
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!", kMaxConnections);
+        test.PingPong(GenerateBigString(20000));
+        test.Stop();
+    }
+
     TEST(SocketTests, BasicUdpEchoTest)
     {
         SocketParams params{ AF_INET, SOCK_DGRAM, 0 };
@@ -163,4 +761,19 @@ namespace testing
         test.Stop();
     }
 
+    TEST(SocketTests, ReactorPoolUnixDomainEchoTest)
+    {
+        auto socket_name = GetTempDirectory();
+        SocketParams params{ AF_UNIX, SOCK_STREAM, 0 };
+        socket_name += "messenger.sock";
+        std::remove(socket_name.c_str());
+        SocketAddr destination(socket_name.c_str(), true);
+        // Unix domain listener is shared, accepted connections are spread round-robin
+        SocketServer server(destination, params, 10, 4);
+        EchoServerTest test(server);
+        test.Start();
+        test.PingPong("Hello, world!", kMaxConnections);
+        test.Stop();
+    }
+
 }  // namespace testing
\ No newline at end of file
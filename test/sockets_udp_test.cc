@@ -8,9 +8,11 @@
 #include <cstdlib>
 #include <list>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -38,4 +40,188 @@ namespace testing
         client.close();
     }
 
+    /**
+     * @brief Bind UDP socket to an ephemeral loopback port.
+     */
+    static Socket BindUdp(SocketAddr& address)
+    {
+        Socket socket(AF_INET, SOCK_DGRAM, 0);
+        EXPECT_EQ(socket.bind(SocketAddr(SocketAddr::Loopback, 0)), 0);
+        socket.getsockname(address);
+        return socket;
+    }
+
+    /**
+     * @brief Receive batches until the expected number of datagrams arrived.
+     */
+    static std::vector<std::string> ReceiveDatagrams(Socket socket, DatagramBatch& batch, size_t count,
+        int port = 0)
+    {
+        std::vector<std::string> received;
+        while ((received.size() < count) && (batch.receive(socket) > 0))
+        {
+            for (auto const& datagram : batch)
+            {
+                if (port != 0)
+                {
+                    EXPECT_EQ(datagram.address->port(), port);
+                }
+                received.emplace_back(datagram.data);
+            }
+        }
+        return received;
+    }
+
+    TEST(SocketTests, DatagramBatchTest)
+    {
+        SocketAddr senderAddress, receiverAddress;
+        Socket sender = BindUdp(senderAddress);
+        Socket receiver = BindUdp(receiverAddress);
+
+        // Equal-sized datagrams to one address may go out as one segmented write
+        DatagramBatch batch(16, 1024);
+        batch.setGso(true);
+        for (int i = 0; i < 10; i++)
+        {
+            EXPECT_TRUE(batch.queue(receiverAddress, std::string(100, static_cast<char>('a' + i))));
+        }
+        EXPECT_TRUE(batch.queue(receiverAddress, "tail"));
+        EXPECT_FALSE(batch.queue(receiverAddress, std::string(DatagramBatch::MaxDatagramSize + 1, 'x')));
+        EXPECT_EQ(batch.pending(), 11u);
+        EXPECT_EQ(batch.send(sender), 11);
+        EXPECT_EQ(batch.pending(), 0u);
+
+        DatagramBatch incoming(16, 1024);
+        auto received = ReceiveDatagrams(receiver, incoming, 11, senderAddress.port());
+        ASSERT_EQ(received.size(), 11u);
+        EXPECT_EQ(received[0], std::string(100, 'a'));
+        EXPECT_EQ(received[9], std::string(100, 'j'));
+        EXPECT_EQ(received[10], "tail");
+
+        // Replies go back to the sender
+        incoming.reply(incoming[incoming.size() - 1], "pong");
+        EXPECT_EQ(incoming.send(receiver), 1);
+        received = ReceiveDatagrams(sender, batch, 1, receiverAddress.port());
+        ASSERT_EQ(received.size(), 1u);
+        EXPECT_EQ(received[0], "pong");
+
+        // Longer than the receive buffer
+        std::string big(2000, 'b');
+        sender.sendto(big.data(), big.size(), 0, receiverAddress);
+        sender.sendto("ok", 2, 0, receiverAddress);
+        received = ReceiveDatagrams(receiver, incoming, 1);
+        ASSERT_EQ(received.size(), 1u);
+        EXPECT_EQ(received[0], "ok");
+
+        sender.close();
+        receiver.close();
+    }
+
+    TEST(SocketTests, DatagramGroTest)
+    {
+        SocketAddr senderAddress, receiverAddress;
+        Socket sender = BindUdp(senderAddress);
+        Socket receiver = BindUdp(receiverAddress);
+        // Not supported by every kernel, the datagrams are split the same otherwise
+        receiver.setUdpGro();
+
+        DatagramBatch batch;
+        batch.setGso(true);
+        for (int i = 0; i < 20; i++)
+        {
+            batch.queue(receiverAddress, std::string(1000, static_cast<char>('a' + i)));
+        }
+        EXPECT_EQ(batch.send(sender), 20);
+
+        DatagramBatch incoming;
+        auto received = ReceiveDatagrams(receiver, incoming, 20);
+        ASSERT_EQ(received.size(), 20u);
+        for (int i = 0; i < 20; i++)
+        {
+            EXPECT_EQ(received[i], std::string(1000, static_cast<char>('a' + i)));
+        }
+
+        sender.close();
+        receiver.close();
+    }
+
+    TEST(SocketTests, BatchedUdpEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_DGRAM, 0 };
+        SocketServer server(SocketAddr(SocketAddr::Loopback, 0), params);
+        size_t batches = 0;
+        server.datagram_gso = true;
+        server.onDatagrams = [&batches](DatagramBatch& batch) {
+            batches++;
+            for (auto const& datagram : batch)
+            {
+                batch.reply(datagram, datagram.data);
+            }
+        };
+        server.Start();
+
+        SocketAddr clientAddress;
+        Socket client = BindUdp(clientAddress);
+        SocketAddr serverAddress = server.address();
+        for (int i = 0; i < 32; i++)
+        {
+            std::string ping = "ping " + std::to_string(i);
+            client.sendto(ping.data(), ping.size(), 0, serverAddress);
+        }
+        DatagramBatch incoming;
+        auto received = ReceiveDatagrams(client, incoming, 32, serverAddress.port());
+        ASSERT_EQ(received.size(), 32u);
+        EXPECT_EQ(received[0], "ping 0");
+        EXPECT_EQ(received[31], "ping 31");
+        client.close();
+
+        server.Stop();
+        EXPECT_GE(batches, 1u);
+    }
+
+    TEST(SocketTests, MultiThreadedUdpTest)
+    {
+        SocketParams params{ AF_INET, SOCK_DGRAM, 0 };
+        SocketServer server(SocketAddr(SocketAddr::Loopback, 0), params, 10, 4);
+        EXPECT_EQ(server.reactors.size(), ReactorPool::HasReusePort ? 4u : 1u);
+        server.cpu_affinity = true;
+        std::mutex mutex;
+        std::set<std::thread::id> threads;
+        server.onDatagrams = [&](DatagramBatch& batch) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }
+            for (auto const& datagram : batch)
+            {
+                batch.reply(datagram, datagram.data);
+            }
+        };
+        server.Start();
+
+        // Datagrams are spread across receiver sockets by their source address
+        std::vector<Socket> clients;
+        SocketAddr serverAddress = server.address();
+        for (int i = 0; i < 32; i++)
+        {
+            SocketAddr clientAddress;
+            clients.push_back(BindUdp(clientAddress));
+            std::string ping = "ping " + std::to_string(i);
+            clients.back().sendto(ping.data(), ping.size(), 0, serverAddress);
+        }
+        DatagramBatch incoming(1, 1024);
+        for (int i = 0; i < 32; i++)
+        {
+            auto received = ReceiveDatagrams(clients[i], incoming, 1, serverAddress.port());
+            ASSERT_EQ(received.size(), 1u);
+            EXPECT_EQ(received[0], "ping " + std::to_string(i));
+            clients[i].close();
+        }
+        server.Stop();
+        if (ReactorPool::HasReusePort)
+        {
+            EXPECT_GT(threads.size(), 1u);
+        }
+    }
+
 }  // namespace testing
\ No newline at end of file
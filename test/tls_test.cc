@@ -0,0 +1,292 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::http::server;
+using SOCKETSHPP_NS::net::common::SocketServer;
+using namespace std;
+
+namespace testing
+{
+    /**
+     * @brief Self-signed certificate for localhost, written to the temporary directory once.
+     */
+    static std::shared_ptr<TlsContext> ServerContext()
+    {
+        static std::string const certFile = GetTempDirectory() + "sockets_tls_cert.pem";
+        static std::string const keyFile = GetTempDirectory() + "sockets_tls_key.pem";
+        static bool const written = []() {
+            EVP_PKEY* key = EVP_EC_gen("P-256");
+            X509* cert = X509_new();
+            ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+            X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+            X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+            X509_set_pubkey(cert, key);
+            X509_NAME* name = X509_get_subject_name(cert);
+            X509_NAME_add_entry_by_txt(
+                name, "CN", MBSTRING_ASC, reinterpret_cast<unsigned char const*>("localhost"), -1, -1, 0);
+            X509_set_issuer_name(cert, name);
+            bool signed_ = X509_sign(cert, key, EVP_sha256()) > 0;
+            FILE* file = fopen(certFile.c_str(), "w");
+            bool ok = signed_ && (file != nullptr) && PEM_write_X509(file, cert);
+            if (file != nullptr)
+            {
+                fclose(file);
+            }
+            file = fopen(keyFile.c_str(), "w");
+            ok = ok && (file != nullptr) && PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr);
+            if (file != nullptr)
+            {
+                fclose(file);
+            }
+            X509_free(cert);
+            EVP_PKEY_free(key);
+            return ok;
+        }();
+        EXPECT_TRUE(written);
+        auto context = std::make_shared<TlsContext>(TlsContext::Server);
+        EXPECT_TRUE(context->setCertificate(certFile, keyFile));
+        return context;
+    }
+
+    /**
+     * @brief Blocking TLS client of the servers under test.
+     */
+    struct TlsClient
+    {
+        Socket socket{ AF_INET, SOCK_STREAM, 0 };
+        std::unique_ptr<TlsSession> tls;
+        std::string buffered;  // Read past the last response
+
+        bool connect(std::shared_ptr<TlsContext> const& context, int port)
+        {
+            if (!socket.connect(SocketAddr(SocketAddr::Loopback, port)))
+            {
+                return false;
+            }
+            tls = context->connect(socket, "localhost");
+            return tls && (tls->handshake() == TlsSession::Ok);
+        }
+
+        ~TlsClient()
+        {
+            if (tls)
+            {
+                tls->shutdown();
+            }
+            socket.close();
+        }
+
+        /**
+         * @brief Send HTTP requests and read the next response with Content-Length.
+         * @return Response body, "<closed>" if the stream ended first.
+         */
+        std::string fetch(std::string const& request)
+        {
+            if (tls->writeall(request) != request.size())
+            {
+                return "<failed>";
+            }
+            std::string response;
+            response.swap(buffered);
+            size_t headEnd = std::string::npos;
+            size_t total = std::string::npos;
+            char buffer[16384];
+            for (;;)
+            {
+                if (headEnd == std::string::npos)
+                {
+                    headEnd = response.find("\r\n\r\n");
+                    if (headEnd != std::string::npos)
+                    {
+                        size_t length = response.find("Content-Length: ");
+                        EXPECT_NE(length, std::string::npos);
+                        total = headEnd + 4 + std::strtoull(response.c_str() + length + 16, nullptr, 10);
+                    }
+                }
+                if (response.size() >= total)
+                {
+                    break;
+                }
+                int received = tls->read(buffer, sizeof(buffer));
+                if (received <= 0)
+                {
+                    return "<closed>";
+                }
+                response.append(buffer, static_cast<size_t>(received));
+            }
+            buffered = response.substr(total);
+            return response.substr(headEnd + 4, total - headEnd - 4);
+        }
+    };
+
+    static std::string Get(std::string const& uri)
+    {
+        return "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    }
+
+    TEST(TlsTests, HttpsKeepaliveTest)
+    {
+        for (auto backend : { Reactor::Default, Reactor::IoUring })
+        {
+            HttpServer server;
+            // Falls back to epoll if the kernel doesn't support io_uring, TLS uses readiness on both
+            server.setBackend(backend);
+            HttpRequestCallback hello{ [](HttpRequest const& req, HttpResponse& resp) {
+                resp.body = "Hello " + req.uri;
+                return 200;
+            } };
+            server["/hello"] = hello;
+            int port = server.addTlsListeningPort(0, ServerContext());
+            ASSERT_GT(port, 0);
+            server.start();
+
+            auto context = std::make_shared<TlsContext>(TlsContext::Client);
+            TlsClient client;
+            ASSERT_TRUE(client.connect(context, port));
+            for (int i = 0; i < 10; i++)
+            {
+                EXPECT_EQ(client.fetch(Get("/hello/" + std::to_string(i))), "Hello /hello/" + std::to_string(i));
+            }
+            // Pipelined requests are answered in order
+            EXPECT_EQ(client.fetch(Get("/hello/a") + Get("/hello/b")), "Hello /hello/a");
+            EXPECT_EQ(client.fetch(std::string()), "Hello /hello/b");
+
+            // Plaintext clients fail the handshake and are closed, at most with an alert
+            Socket plain(AF_INET, SOCK_STREAM, 0);
+            ASSERT_TRUE(plain.connect(SocketAddr(SocketAddr::Loopback, port)));
+            std::string request = Get("/hello");
+            plain.writeall(request);
+            std::string answer;
+            char buffer[256];
+            for (int received; (received = plain.recv(buffer, sizeof(buffer))) > 0;)
+            {
+                answer.append(buffer, static_cast<size_t>(received));
+            }
+            EXPECT_EQ(answer.find("HTTP/1.1"), std::string::npos);
+            plain.close();
+            server.stop();
+        }
+    }
+
+    TEST(TlsTests, HttpsFileBodyTest)
+    {
+        std::string path = GetTempDirectory() + "tls_file_body.bin";
+        std::string contents(3 * 1024 * 1024 + 77, 0);
+        for (size_t i = 0; i < contents.size(); i++)
+        {
+            contents[i] = static_cast<char>((i * 7) % 251);
+        }
+        FILE* file = fopen(path.c_str(), "wb");
+        ASSERT_NE(file, nullptr);
+        ASSERT_EQ(fwrite(contents.data(), 1, contents.size(), file), contents.size());
+        fclose(file);
+
+        HttpServer server;
+        HttpRequestCallback download{ [&](HttpRequest const&, HttpResponse& resp) {
+            resp.file = HttpFile::open(path);
+            return (resp.file != nullptr) ? 200 : 404;
+        } };
+        server["/file"] = download;
+        int port = server.addTlsListeningPort(0, ServerContext());
+        server.start();
+
+        auto context = std::make_shared<TlsContext>(TlsContext::Client);
+        TlsClient client;
+        ASSERT_TRUE(client.connect(context, port));
+        // Sent with sendfile by kernel TLS, otherwise read part by part and encrypted in user space
+        EXPECT_TRUE(client.fetch(Get("/file")) == contents);
+        EXPECT_TRUE(client.fetch(Get("/file")) == contents);
+        server.stop();
+        std::remove(path.c_str());
+    }
+
+    TEST(TlsTests, SessionResumptionTest)
+    {
+        HttpServer server;
+        HttpRequestCallback hello{ [](HttpRequest const&, HttpResponse& resp) {
+            resp.body = "Hello";
+            return 200;
+        } };
+        server["/"] = hello;
+        server.setEdgeTriggered(true);
+        int port = server.addTlsListeningPort(0, ServerContext(), 2);
+        server.start();
+
+        auto context = std::make_shared<TlsContext>(TlsContext::Client);
+        for (int i = 0; i < 3; i++)
+        {
+            TlsClient client;
+            ASSERT_TRUE(client.connect(context, port));
+            // Only the first connection does the full handshake
+            EXPECT_EQ(client.tls->resumed(), i != 0);
+            // TLS 1.3 tickets arrive after the handshake, with the response
+            EXPECT_EQ(client.fetch(Get("/")), "Hello");
+            EXPECT_EQ(context->cachedSessions(), 1u);
+        }
+
+        // Without tickets every connection does the full handshake
+        auto fresh = std::make_shared<TlsContext>(TlsContext::Client);
+        fresh->setSessionTickets(false);
+        for (int i = 0; i < 2; i++)
+        {
+            TlsClient client;
+            ASSERT_TRUE(client.connect(fresh, port));
+            EXPECT_FALSE(client.tls->resumed());
+            EXPECT_EQ(client.fetch(Get("/")), "Hello");
+        }
+        EXPECT_EQ(fresh->cachedSessions(), 0u);
+        server.stop();
+    }
+
+    TEST(TlsTests, SocketServerEchoTest)
+    {
+        SocketParams params{ AF_INET, SOCK_STREAM, 0 };
+        SocketServer server(SocketAddr("127.0.0.1:0"), params);
+        server.tls_context = ServerContext();
+        server.onRequest = [](SocketServer::Connection& conn) {
+            conn.response_buffer.append(conn.request_data.data(), conn.request_data.size());
+            conn.state.insert(SocketServer::Connection::Responding);
+        };
+        server.onResponse = [](SocketServer::Connection&) {};
+        server.Start();
+
+        auto context = std::make_shared<TlsContext>(TlsContext::Client);
+        TlsClient client;
+        ASSERT_TRUE(client.connect(context, server.address().port()));
+        std::string request(60000, 'x');
+        for (size_t i = 0; i < request.size(); i++)
+        {
+            request[i] = static_cast<char>('a' + i % 26);
+        }
+        ASSERT_EQ(client.tls->writeall(request), request.size());
+        std::string response;
+        char buffer[16384];
+        while (response.size() < request.size())
+        {
+            int received = client.tls->read(buffer, sizeof(buffer));
+            ASSERT_GT(received, 0);
+            response.append(buffer, static_cast<size_t>(received));
+        }
+        EXPECT_TRUE(response == request);
+        server.Stop();
+    }
+
+}  // namespace testing
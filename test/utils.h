@@ -10,6 +10,10 @@
 
 #include <cstdlib>
 
+#include <gtest/gtest.h>
+
+#include "sockets.hpp"
+
 /**
  * @brief Obtain path to temporary directory
  * @return Temporary Directory
@@ -48,4 +52,22 @@ static inline std::string GetTempDirectory()
     result += "/";
 #endif
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Send raw request text and read the response until server closes the connection.
+ */
+static inline std::string HttpRoundTrip(int port, std::string const& request_text)
+{
+    using SOCKETSHPP_NS::net::common::Socket;
+    using SOCKETSHPP_NS::net::common::SocketAddr;
+    Socket client(AF_INET, SOCK_STREAM, 0);
+    EXPECT_TRUE(client.connect(SocketAddr(SocketAddr::Loopback, port)));
+    client.writeall(request_text);
+
+    std::string response_text;
+    response_text.resize(64 * 1024, 0);
+    client.readall(response_text);
+    client.close();
+    return response_text;
+}
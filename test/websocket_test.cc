@@ -0,0 +1,665 @@
+// Copyright Max Golovanov.
+// SPDX-License-Identifier: Apache-2.0
+
+// Uncomment this line for additional debugging:
+// #define HAVE_CONSOLE_LOG
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "sockets.hpp"
+
+#include "./utils.h"
+
+using namespace SOCKETSHPP_NS::http::server;
+using namespace std;
+
+namespace testing
+{
+    static constexpr char const* const kKey = "dGhlIHNhbXBsZSBub25jZQ==";
+
+    /**
+     * @brief Wait until the condition holds, for up to 5 seconds.
+     */
+    template <typename Condition>
+    static bool WaitFor(Condition condition)
+    {
+        for (int i = 0; (i < 500) && !condition(); i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    }
+
+    /**
+     * @brief Client frame as the reader gets it: masked, with a fixed mask key.
+     */
+    static std::string ClientFrame(uint8_t opcode, std::string_view payload, bool fin = true, bool rsv1 = false)
+    {
+        static uint8_t const mask[4] = { 0x37, 0xFA, 0x21, 0x3D };
+        std::string frame(WebSocketFrame::MaxHeaderSize + payload.size(), '\0');
+        size_t headerSize = WebSocketFrame::writeHeader(&frame[0], opcode, payload.size(), fin, rsv1, mask);
+        std::memcpy(&frame[headerSize], payload.data(), payload.size());
+        WebSocketFrame::unmask(&frame[headerSize], payload.size(), mask);
+        frame.resize(headerSize + payload.size());
+        return frame;
+    }
+
+    struct WsMessage
+    {
+        uint8_t opcode;
+        std::string payload;
+    };
+
+    /**
+     * @brief Read all the complete frames of the data with a reader.
+     */
+    static std::vector<WsMessage> ReadAll(WebSocketReader& reader, std::string& data, size_t* consumed = nullptr)
+    {
+        std::vector<WsMessage> messages;
+        size_t read = reader.read(&data[0], data.size(), [&messages](uint8_t opcode, std::string_view payload) {
+            messages.push_back({ opcode, std::string(payload) });
+            return true;
+        });
+        if (consumed != nullptr)
+        {
+            *consumed = read;
+        }
+        return messages;
+    }
+
+    /**
+     * @brief Blocking WebSocket client on a loopback port.
+     */
+    class WsClient
+    {
+    public:
+        Socket socket{ AF_INET, SOCK_STREAM, 0 };
+        std::string head;    // Response to the upgrade request
+        std::string buffer;  // Received past what is read
+
+        ~WsClient() { socket.close(); }
+
+        /**
+         * @brief Send the upgrade request and read the response head.
+         * @return Status code of the response
+         */
+        int connect(int port, std::string const& headers = std::string(), std::string const& after = std::string())
+        {
+            EXPECT_TRUE(socket.connect(SocketAddr(SocketAddr::Loopback, port)));
+            std::string request = "GET /ws HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                                  "Connection: keep-alive, Upgrade\r\nSec-WebSocket-Key: " +
+                std::string(kKey) + "\r\nSec-WebSocket-Version: 13\r\n" + headers + "\r\n" + after;
+            socket.writeall(request);
+            size_t end;
+            while ((end = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (!receive())
+                {
+                    return 0;
+                }
+            }
+            head = buffer.substr(0, end + 2);
+            buffer.erase(0, end + 4);
+            return std::atoi(head.c_str() + 9);
+        }
+
+        bool hasHeader(std::string const& line) const { return head.find("\r\n" + line + "\r\n") != std::string::npos; }
+
+        void send(uint8_t opcode, std::string_view payload, bool fin = true, bool rsv1 = false)
+        {
+            std::string frame = ClientFrame(opcode, payload, fin, rsv1);
+            socket.writeall(frame);
+        }
+
+        /**
+         * @brief Read the next frame of the server.
+         * @return false if the connection closed first
+         */
+        bool read(WebSocketFrame& frame, std::string& payload)
+        {
+            for (;;)
+            {
+                if ((frame.parse(buffer.data(), buffer.size()) == WebSocketFrame::Ok) &&
+                    (buffer.size() - frame.headerSize >= frame.length))
+                {
+                    EXPECT_FALSE(frame.masked);
+                    payload = buffer.substr(frame.headerSize, static_cast<size_t>(frame.length));
+                    buffer.erase(0, frame.headerSize + static_cast<size_t>(frame.length));
+                    return true;
+                }
+                if (!receive())
+                {
+                    return false;
+                }
+            }
+        }
+
+        /**
+         * @brief Read the next frame, decompressed if it has RSV1 set.
+         */
+        WsMessage read()
+        {
+            WebSocketFrame frame;
+            WsMessage message{ 0xFF, std::string() };
+            if (read(frame, message.payload))
+            {
+                message.opcode = frame.opcode;
+            }
+            if (frame.rsv1)
+            {
+                std::string inflated;
+                EXPECT_TRUE(WebSocketDeflate::decompress(message.payload, inflated, 0));
+                message.payload = inflated;
+            }
+            return message;
+        }
+
+        /**
+         * @brief Whether the server closes the connection without sending more.
+         */
+        bool closedByServer()
+        {
+            return buffer.empty() && !receive();
+        }
+
+    private:
+        bool receive()
+        {
+            char chunk[65536];
+            int received = socket.recv(chunk, sizeof(chunk));
+            if (received <= 0)
+            {
+                return false;
+            }
+            buffer.append(chunk, static_cast<size_t>(received));
+            return true;
+        }
+    };
+
+    /**
+     * @brief Echo endpoint on /ws that records the codes of closed connections.
+     */
+    class EchoServer
+    {
+    public:
+        HttpServer server;
+        WebSocketHandler handler;
+        std::mutex mutex;
+        std::vector<uint16_t> closed;
+        std::atomic<int> opened{ 0 };
+        int port;
+
+        explicit EchoServer(size_t numWorkers = 1)
+        {
+            handler.protocols = { "chat", "superchat" };
+            handler.onOpen = [this](WebSocket&) { opened++; };
+            handler.onMessage = [this](WebSocket& ws, std::string_view message, bool binary) {
+                if (message == "close")
+                {
+                    ws.close(WebSocketFrame::GoingAway, "bye");
+                    return;
+                }
+                if (message == "flood")
+                {
+                    std::string block(1024 * 1024, 'f');
+                    for (int i = 0; (i < 64) && ws.send(block, true); i++)
+                    {
+                    }
+                    return;
+                }
+                ws.send(message, binary);
+            };
+            handler.onClose = [this](WebSocket&, uint16_t code) {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed.push_back(code);
+            };
+            server["/ws"] = handler;
+            port = server.addListeningPort(0, numWorkers);
+            server.start();
+        }
+
+        ~EchoServer() { server.stop(); }
+
+        std::vector<uint16_t> closedCodes()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return closed;
+        }
+    };
+
+    TEST(WebSocketTests, FrameTest)
+    {
+        for (uint64_t length : { 0ull, 125ull, 126ull, 65535ull, 65536ull, 1ull << 40 })
+        {
+            char header[WebSocketFrame::MaxHeaderSize];
+            uint8_t const mask[4] = { 1, 2, 3, 4 };
+            size_t size = WebSocketFrame::writeHeader(header, WebSocketFrame::Binary, length, false, true, mask);
+            EXPECT_EQ(size, ((length < 126) ? 2u : ((length <= 65535) ? 4u : 10u)) + 4u);
+
+            WebSocketFrame frame;
+            EXPECT_EQ(frame.parse(header, size - 1), WebSocketFrame::NeedMore);
+            ASSERT_EQ(frame.parse(header, size), WebSocketFrame::Ok);
+            EXPECT_FALSE(frame.fin);
+            EXPECT_TRUE(frame.rsv1);
+            EXPECT_TRUE(frame.masked);
+            EXPECT_EQ(frame.opcode, WebSocketFrame::Binary);
+            EXPECT_EQ(frame.length, length);
+            EXPECT_EQ(frame.headerSize, size);
+            EXPECT_EQ(std::memcmp(frame.mask, mask, 4), 0);
+        }
+
+        // RSV2 and RSV3 are not negotiated
+        char reserved[2] = { static_cast<char>(0x81 | 0x20), 0 };
+        WebSocketFrame frame;
+        EXPECT_EQ(frame.parse(reserved, 2), WebSocketFrame::Error);
+
+        std::string out;
+        WebSocketFrame::serialize(out, WebSocketFrame::Text, "Hello");
+        EXPECT_EQ(out, std::string("\x81\x05Hello", 7));
+
+        // SIMD and word steps match the byte-wise definition at every length and alignment
+        uint8_t const mask[4] = { 0x9A, 0x01, 0xFF, 0x5C };
+        std::string data(300, '\0');
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            data[i] = static_cast<char>(i * 31 + 7);
+        }
+        for (size_t offset = 0; offset < 5; offset++)
+        {
+            for (size_t size = 0; offset + size <= data.size(); size += 13)
+            {
+                std::string masked = data;
+                WebSocketFrame::unmask(&masked[offset], size, mask);
+                for (size_t i = 0; i < data.size(); i++)
+                {
+                    bool inside = (i >= offset) && (i < offset + size);
+                    char expected = inside ? static_cast<char>(data[i] ^ mask[(i - offset) & 3]) : data[i];
+                    ASSERT_EQ(masked[i], expected) << "offset " << offset << ", size " << size << ", byte " << i;
+                }
+            }
+        }
+
+        EXPECT_TRUE(WebSocketFrame::validUtf8("plain ASCII text, longer than a word"));
+        EXPECT_TRUE(WebSocketFrame::validUtf8("\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5 \xf0\x9f\x98\x80"));
+        EXPECT_FALSE(WebSocketFrame::validUtf8("\xc0\xaf"));          // Overlong
+        EXPECT_FALSE(WebSocketFrame::validUtf8("\xed\xa0\x80"));      // Surrogate
+        EXPECT_FALSE(WebSocketFrame::validUtf8("\xf4\x90\x80\x80"));  // Past U+10FFFF
+        EXPECT_FALSE(WebSocketFrame::validUtf8("abc\xe2\x82"));       // Truncated
+    }
+
+    TEST(WebSocketTests, HandshakeTest)
+    {
+        // Example of RFC 6455
+        EXPECT_EQ(WebSocketHandshake::acceptKey(kKey), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+        EXPECT_TRUE(WebSocketHandshake::validKey(kKey));
+        EXPECT_FALSE(WebSocketHandshake::validKey("dGhlIHNhbXBsZSBub25jZQ"));
+        EXPECT_FALSE(WebSocketHandshake::validKey("dGhlIHNhbXBsZSBub25j%Q=="));
+
+        EXPECT_TRUE(WebSocketHandshake::hasToken("keep-alive, Upgrade", "upgrade"));
+        EXPECT_FALSE(WebSocketHandshake::hasToken("keep-alive, Upgraded", "upgrade"));
+
+        EXPECT_TRUE(WebSocketHandshake::acceptsDeflate("permessage-deflate"));
+        EXPECT_TRUE(WebSocketHandshake::acceptsDeflate("permessage-deflate; client_max_window_bits"));
+        EXPECT_TRUE(WebSocketHandshake::acceptsDeflate(
+            "permessage-deflate; server_no_context_takeover; client_max_window_bits=10"));
+        EXPECT_TRUE(WebSocketHandshake::acceptsDeflate("x-webkit-deflate-frame, permessage-deflate"));
+        // A smaller server window is declined, the fallback offer is taken
+        EXPECT_FALSE(WebSocketHandshake::acceptsDeflate("permessage-deflate; server_max_window_bits=10"));
+        EXPECT_TRUE(WebSocketHandshake::acceptsDeflate(
+            "permessage-deflate; server_max_window_bits=10, permessage-deflate"));
+        EXPECT_FALSE(WebSocketHandshake::acceptsDeflate("permessage-deflate; client_max_window_bits=16"));
+        EXPECT_FALSE(WebSocketHandshake::acceptsDeflate("permessage-deflate; unknown"));
+        EXPECT_FALSE(WebSocketHandshake::acceptsDeflate(
+            "permessage-deflate; server_no_context_takeover; server_no_context_takeover"));
+    }
+
+    TEST(WebSocketTests, ReaderTest)
+    {
+        WebSocketReader reader;
+        reader.reset(false, 1024);
+
+        // A single frame is handed over in place, unmasked
+        std::string data = ClientFrame(WebSocketFrame::Text, "Hello");
+        char const* payload = nullptr;
+        size_t consumed = reader.read(&data[0], data.size(), [&payload](uint8_t, std::string_view message) {
+            payload = message.data();
+            return true;
+        });
+        EXPECT_EQ(consumed, data.size());
+        EXPECT_EQ(payload, data.data() + 6);
+        EXPECT_EQ(std::string(payload, 5), "Hello");
+
+        // Fragments are assembled, control frames between them come first
+        data = ClientFrame(WebSocketFrame::Text, "Hel", false) + ClientFrame(WebSocketFrame::Ping, "p") +
+            ClientFrame(WebSocketFrame::Continuation, "lo ", false) +
+            ClientFrame(WebSocketFrame::Continuation, "world");
+        // Incomplete frames wait for more data
+        std::string partial = data.substr(0, data.size() - 2);
+        auto messages = ReadAll(reader, partial, &consumed);
+        ASSERT_EQ(messages.size(), 1u);
+        EXPECT_EQ(messages[0].opcode, WebSocketFrame::Ping);
+        std::string rest = data.substr(consumed);
+        messages = ReadAll(reader, rest, &consumed);
+        EXPECT_EQ(consumed, rest.size());
+        ASSERT_EQ(messages.size(), 1u);
+        EXPECT_EQ(messages[0].opcode, WebSocketFrame::Text);
+        EXPECT_EQ(messages[0].payload, "Hello world");
+        EXPECT_EQ(reader.error(), 0);
+
+        struct Case
+        {
+            std::string data;
+            uint16_t error;
+        };
+        std::string unmasked;
+        WebSocketFrame::serialize(unmasked, WebSocketFrame::Text, "x");
+        Case cases[] = {
+            { unmasked, WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Continuation, "x"), WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Text, "a", false) + ClientFrame(WebSocketFrame::Text, "b"),
+                WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Ping, "x", false), WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Ping, std::string(126, 'x')), WebSocketFrame::ProtocolError },
+            { ClientFrame(3, "x"), WebSocketFrame::ProtocolError },
+            // RSV1 without permessage-deflate
+            { ClientFrame(WebSocketFrame::Text, "x", true, true), WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Close, "\x03\xed"), WebSocketFrame::ProtocolError },
+            { ClientFrame(WebSocketFrame::Text, "\xc0\xaf"), WebSocketFrame::InvalidPayload },
+            { ClientFrame(WebSocketFrame::Binary, std::string(1025, 'x')), WebSocketFrame::MessageTooBig },
+            { ClientFrame(WebSocketFrame::Binary, std::string(1000, 'x'), false) +
+                    ClientFrame(WebSocketFrame::Continuation, std::string(100, 'x')),
+                WebSocketFrame::MessageTooBig },
+        };
+        for (auto& test : cases)
+        {
+            reader.reset(false, 1024);
+            ReadAll(reader, test.data);
+            EXPECT_EQ(reader.error(), test.error);
+        }
+
+        // Oversized messages are rejected as soon as the header arrives
+        reader.reset(false, 1024);
+        std::string header = ClientFrame(WebSocketFrame::Binary, std::string(2000, 'x')).substr(0, 8);
+        ReadAll(reader, header);
+        EXPECT_EQ(reader.error(), WebSocketFrame::MessageTooBig);
+    }
+
+#ifdef HAVE_ZLIB
+    TEST(WebSocketTests, DeflateTest)
+    {
+        std::string text;
+        for (int i = 0; text.size() < 100000; i++)
+        {
+            text += "{\"sample\":" + std::to_string(i % 97) + ",\"value\":\"reading\"}\n";
+        }
+        std::string compressed;
+        ASSERT_TRUE(WebSocketDeflate::compress(text, compressed));
+        EXPECT_LT(compressed.size(), text.size() / 10);
+        std::string inflated;
+        ASSERT_TRUE(WebSocketDeflate::decompress(compressed, inflated, 0));
+        EXPECT_EQ(inflated, text);
+        inflated.clear();
+        EXPECT_FALSE(WebSocketDeflate::decompress(compressed, inflated, text.size() - 1));
+
+        // Compressed messages may be fragmented, only the first frame has RSV1
+        WebSocketReader reader;
+        reader.reset(true, 1024 * 1024);
+        std::string data = ClientFrame(WebSocketFrame::Text, compressed.substr(0, 100), false, true) +
+            ClientFrame(WebSocketFrame::Continuation, compressed.substr(100));
+        auto messages = ReadAll(reader, data);
+        ASSERT_EQ(messages.size(), 1u);
+        EXPECT_EQ(messages[0].payload, text);
+
+        reader.reset(true, 1000);
+        data = ClientFrame(WebSocketFrame::Text, compressed, true, true);
+        ReadAll(reader, data);
+        EXPECT_EQ(reader.error(), WebSocketFrame::MessageTooBig);
+        reader.reset(true, 0);
+        data = ClientFrame(WebSocketFrame::Text, "garbage", true, true);
+        ReadAll(reader, data);
+        EXPECT_EQ(reader.error(), WebSocketFrame::InvalidPayload);
+    }
+#endif
+
+    TEST(WebSocketTests, EchoTest)
+    {
+        EchoServer echo;
+        WsClient client;
+        ASSERT_EQ(client.connect(echo.port, "Sec-WebSocket-Protocol: other, superchat\r\n"), 101);
+        EXPECT_TRUE(client.hasHeader("Upgrade: websocket"));
+        EXPECT_TRUE(client.hasHeader("Connection: Upgrade"));
+        EXPECT_TRUE(client.hasHeader("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+        EXPECT_TRUE(client.hasHeader("Sec-WebSocket-Protocol: superchat"));
+        EXPECT_EQ(client.head.find("Content-Length"), std::string::npos);
+        EXPECT_EQ(client.head.find("Sec-WebSocket-Extensions"), std::string::npos);
+
+        client.send(WebSocketFrame::Text, "Hello");
+        WsMessage message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Text);
+        EXPECT_EQ(message.payload, "Hello");
+
+        // Large messages take partial writes
+        std::string large(4 * 1024 * 1024, '\0');
+        for (size_t i = 0; i < large.size(); i++)
+        {
+            large[i] = static_cast<char>(i * 7);
+        }
+        client.send(WebSocketFrame::Binary, large);
+        message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Binary);
+        EXPECT_TRUE(message.payload == large);
+
+        client.send(WebSocketFrame::Text, "frag", false);
+        client.send(WebSocketFrame::Ping, "are you there?");
+        client.send(WebSocketFrame::Continuation, "mented");
+        message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Pong);
+        EXPECT_EQ(message.payload, "are you there?");
+        message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Text);
+        EXPECT_EQ(message.payload, "fragmented");
+
+        // Close handshake: the server echoes the code and shuts the connection down
+        client.send(WebSocketFrame::Close, std::string("\x03\xe8" "done", 6));
+        message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Close);
+        EXPECT_EQ(message.payload, std::string("\x03\xe8", 2));
+        EXPECT_TRUE(client.closedByServer());
+        client.socket.close();
+        ASSERT_TRUE(WaitFor([&echo]() { return !echo.closedCodes().empty(); }));
+        EXPECT_EQ(echo.closedCodes()[0], WebSocketFrame::NormalClosure);
+        EXPECT_EQ(echo.opened, 1);
+    }
+
+    TEST(WebSocketTests, ServerCloseTest)
+    {
+        EchoServer echo;
+        WsClient client;
+        ASSERT_EQ(client.connect(echo.port), 101);
+        // Frames right behind the upgrade request are read with it
+        ASSERT_EQ(client.head.find("Sec-WebSocket-Protocol"), std::string::npos);
+        client.send(WebSocketFrame::Text, "close");
+        WsMessage message = client.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Close);
+        EXPECT_EQ(message.payload, std::string("\x03\xe9" "bye", 5));
+        client.send(WebSocketFrame::Close, std::string("\x03\xe9", 2));
+        EXPECT_TRUE(client.closedByServer());
+        client.socket.close();
+        ASSERT_TRUE(WaitFor([&echo]() { return !echo.closedCodes().empty(); }));
+        EXPECT_EQ(echo.closedCodes()[0], WebSocketFrame::GoingAway);
+
+        WsClient pipelined;
+        ASSERT_EQ(pipelined.connect(echo.port, "", ClientFrame(WebSocketFrame::Text, "early")), 101);
+        message = pipelined.read();
+        EXPECT_EQ(message.payload, "early");
+
+        // Protocol errors close with their code
+        std::string unmasked;
+        WebSocketFrame::serialize(unmasked, WebSocketFrame::Text, "x");
+        pipelined.socket.writeall(unmasked);
+        message = pipelined.read();
+        EXPECT_EQ(message.opcode, WebSocketFrame::Close);
+        EXPECT_EQ(message.payload, std::string("\x03\xea", 2));
+        EXPECT_TRUE(pipelined.closedByServer());
+        pipelined.socket.close();
+        ASSERT_TRUE(WaitFor([&echo]() { return echo.closedCodes().size() == 2; }));
+        EXPECT_EQ(echo.closedCodes()[1], WebSocketFrame::ProtocolError);
+    }
+
+    TEST(WebSocketTests, RejectTest)
+    {
+        EchoServer echo;
+        auto status = [&echo](std::string const& request, std::string const& header) {
+            Socket socket(AF_INET, SOCK_STREAM, 0);
+            EXPECT_TRUE(socket.connect(SocketAddr(SocketAddr::Loopback, echo.port)));
+            std::string text = request;
+            socket.writeall(text);
+            std::string response;
+            char chunk[4096];
+            int received;
+            while ((response.find("\r\n\r\n") == std::string::npos) &&
+                ((received = socket.recv(chunk, sizeof(chunk))) > 0))
+            {
+                response.append(chunk, static_cast<size_t>(received));
+            }
+            socket.close();
+            EXPECT_NE(response.find("\r\n" + header + "\r\n"), std::string::npos) << response;
+            return std::atoi(response.c_str() + 9);
+        };
+        std::string key = "Sec-WebSocket-Key: " + std::string(kKey) + "\r\n";
+        EXPECT_EQ(status("GET /ws HTTP/1.1\r\n\r\n", "Upgrade: websocket"), 426);
+        EXPECT_EQ(status("GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" + key +
+                             "Sec-WebSocket-Version: 8\r\n\r\n",
+                      "Sec-WebSocket-Version: 13"),
+            426);
+        EXPECT_EQ(status("GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                         "Sec-WebSocket-Key: short\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                      "Content-Length: 0"),
+            400);
+        EXPECT_EQ(status("POST /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" + key +
+                             "Sec-WebSocket-Version: 13\r\nContent-Length: 0\r\n\r\n",
+                      "Allow: GET"),
+            405);
+        EXPECT_EQ(echo.opened, 0);
+    }
+
+    TEST(WebSocketTests, BroadcastTest)
+    {
+        EchoServer echo(2);
+        std::vector<std::unique_ptr<WsClient>> clients;
+        for (int i = 0; i < 4; i++)
+        {
+            clients.emplace_back(new WsClient());
+            ASSERT_EQ(clients.back()->connect(echo.port), 101);
+        }
+        ASSERT_TRUE(WaitFor([&echo]() { return echo.opened == 4; }));
+
+        // Other handlers don't get it, nor does a client that is closing
+        WebSocketHandler other;
+        echo.server.broadcast(other, "not for you");
+        clients[3]->send(WebSocketFrame::Text, "close");
+        EXPECT_EQ(clients[3]->read().opcode, WebSocketFrame::Close);
+        echo.server.broadcast(echo.handler, "news");
+        echo.server.broadcast(echo.handler, std::string(100000, 'b'), true);
+        for (int i = 0; i < 3; i++)
+        {
+            WsMessage message = clients[i]->read();
+            EXPECT_EQ(message.opcode, WebSocketFrame::Text);
+            EXPECT_EQ(message.payload, "news");
+            message = clients[i]->read();
+            EXPECT_EQ(message.opcode, WebSocketFrame::Binary);
+            EXPECT_EQ(message.payload, std::string(100000, 'b'));
+        }
+
+        // Messages of the handler go to all the clients, on the reactors of each
+        echo.handler.onMessage = [&echo](WebSocket&, std::string_view message, bool) {
+            echo.server.broadcast(echo.handler, message);
+        };
+        clients[0]->send(WebSocketFrame::Text, "relay");
+        for (int i = 0; i < 3; i++)
+        {
+            EXPECT_EQ(clients[i]->read().payload, "relay");
+        }
+
+        // A closing connection stays upgraded until the client answers
+        clients[3]->send(WebSocketFrame::Close, std::string("\x03\xe9", 2));
+        EXPECT_TRUE(clients[3]->closedByServer());
+        clients[3]->socket.close();
+        ASSERT_TRUE(WaitFor([&echo]() { return echo.closedCodes().size() == 1; }));
+        HttpServerMetrics metrics = echo.server.metrics();
+        EXPECT_EQ(metrics.connections[HttpServerMetrics::States - 1], 3u);
+        EXPECT_NE(metrics.toPrometheus().find("socketshpp_http_connections{state=\"websocket\"} 3"),
+            std::string::npos);
+    }
+
+    TEST(WebSocketTests, SlowClientTest)
+    {
+        EchoServer echo;
+        echo.handler.maxQueuedBytes = 1024 * 1024;
+        WsClient client;
+        ASSERT_EQ(client.connect(echo.port), 101);
+        // The client doesn't read while the server floods it
+        client.send(WebSocketFrame::Text, "flood");
+        ASSERT_TRUE(WaitFor([&echo]() { return !echo.closedCodes().empty(); }));
+        EXPECT_EQ(echo.closedCodes()[0], WebSocketFrame::AbnormalClosure);
+    }
+
+#ifdef HAVE_ZLIB
+    TEST(WebSocketTests, DeflateEchoTest)
+    {
+        EchoServer echo;
+        WsClient client;
+        ASSERT_EQ(client.connect(echo.port, "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"),
+            101);
+        EXPECT_TRUE(client.hasHeader(
+            "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover"));
+
+        std::string text;
+        for (int i = 0; text.size() < 20000; i++)
+        {
+            text += "sensor " + std::to_string(i % 10) + " reads " + std::to_string(i % 7) + "\n";
+        }
+        std::string compressed;
+        ASSERT_TRUE(WebSocketDeflate::compress(text, compressed));
+        client.send(WebSocketFrame::Text, compressed, true, true);
+        WebSocketFrame frame;
+        std::string payload;
+        ASSERT_TRUE(client.read(frame, payload));
+        EXPECT_TRUE(frame.rsv1);
+        EXPECT_LT(payload.size(), text.size() / 4);
+        std::string inflated;
+        EXPECT_TRUE(WebSocketDeflate::decompress(payload, inflated, 0));
+        EXPECT_EQ(inflated, text);
+
+        // Small messages go uncompressed, both kinds mix on the connection
+        client.send(WebSocketFrame::Text, "tiny");
+        ASSERT_TRUE(client.read(frame, payload));
+        EXPECT_FALSE(frame.rsv1);
+        EXPECT_EQ(payload, "tiny");
+
+        // Compressed once, for every client that negotiated the extension
+        WsClient plain;
+        ASSERT_EQ(plain.connect(echo.port), 101);
+        ASSERT_TRUE(WaitFor([&echo]() { return echo.opened == 2; }));
+        echo.server.broadcast(echo.handler, text);
+        ASSERT_TRUE(client.read(frame, payload));
+        EXPECT_TRUE(frame.rsv1);
+        WsMessage message = plain.read();
+        EXPECT_EQ(message.payload, text);
+
+        echo.handler.deflate = false;
+        WsClient declined;
+        ASSERT_EQ(declined.connect(echo.port, "Sec-WebSocket-Extensions: permessage-deflate\r\n"), 101);
+        EXPECT_EQ(declined.head.find("Sec-WebSocket-Extensions"), std::string::npos);
+    }
+#endif
+
+}  // namespace testing